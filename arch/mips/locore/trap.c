@@ -159,6 +159,8 @@ mips_trap(struct trapframe *tf)
 
 		old_in = curthread->t_in_interrupt;
 		curthread->t_in_interrupt = 1;
+		/* for hardclock's user/system time accounting */
+		curthread->t_intruser = !iskern;
 
 		/*
 		 * The processor has turned interrupts off; if the
@@ -39,6 +39,8 @@
 #include <vm.h>
 #include <vfs.h>
 #include <addrspace.h>
+#include <copyinout.h>
+#include <systrace.h>
 
 /*
  * System call dispatcher.
@@ -84,12 +86,22 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#if OPT_A2
+	off_t pos;
+	size_t len;
+#endif
+#if OPT_SYSTRACE
+	uint64_t tracestart;
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+#if OPT_SYSTRACE
+	tracestart = systrace_enter();
+#endif
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -111,6 +123,11 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
         break;
+
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
         
 #if OPT_A2
         case SYS_write:
@@ -121,6 +138,70 @@ syscall(struct trapframe *tf)
 
 		break;
             
+        case SYS_readv:
+            err = readv(tf->tf_a0, (const struct iovec *)tf->tf_a1, tf->tf_a2, &retval);
+            if(err){
+                err = retval;
+            }
+            break;
+
+        case SYS_writev:
+            err = writev(tf->tf_a0, (const struct iovec *)tf->tf_a1, tf->tf_a2, &retval);
+            if(err){
+                err = retval;
+            }
+            break;
+
+        case SYS_pread:
+        case SYS_pwrite:
+            /* 64-bit offset doesn't fit in a0-a3; it's on the stack. */
+            err = copyin((const_userptr_t)(tf->tf_sp + 16), &pos, sizeof(pos));
+            if(err){
+                break;
+            }
+            if(callno == SYS_pread){
+                err = pread(tf->tf_a0, (void*)tf->tf_a1, tf->tf_a2, pos, &retval);
+            } else {
+                err = pwrite(tf->tf_a0, (const void*)tf->tf_a1, tf->tf_a2, pos, &retval);
+            }
+            if(err){
+                err = retval;
+            }
+            break;
+            
+        case SYS_copy_file_range:
+            /* len is the fifth argument, on the stack. */
+            err = copyin((const_userptr_t)(tf->tf_sp + 16), &len, sizeof(len));
+            if(err){
+                break;
+            }
+            err = copy_file_range(tf->tf_a0, (off_t*)tf->tf_a1, tf->tf_a2, (off_t*)tf->tf_a3, len, &retval);
+            if(err){
+                err = retval;
+            }
+            break;
+            
+        case SYS_ioring_enter:
+            err = ioring_enter((struct ioring*)tf->tf_a0, tf->tf_a1, &retval);
+            if(err){
+                err = retval;
+            }
+            break;
+            
+        case SYS_getrusage:
+            err = getrusage(tf->tf_a0, (struct rusage*)tf->tf_a1, &retval);
+            if(err){
+                err = retval;
+            }
+            break;
+            
+        case SYS_pipe:
+            err = pipe((int*)tf->tf_a0, &retval);
+            if(err){
+                err = retval;
+            }
+            break;
+            
         case SYS_open:
             err = open((char*)tf->tf_a0,tf->tf_a1,&retval);
             if(err){
@@ -149,6 +230,13 @@ syscall(struct trapframe *tf)
 	        }
             break;
             
+        case SYS_vfork:
+	        err = vfork(tf, &retval);
+	        if(err) {
+		        err = retval;
+	        }
+            break;
+            
         case SYS_waitpid:
 		    err = waitpid(tf->tf_a0, (int*)tf->tf_a1, tf->tf_a2, &retval);
 		    if(err) {
@@ -183,6 +271,9 @@ syscall(struct trapframe *tf)
 		break;
 	}
 
+#if OPT_SYSTRACE
+	systrace_exit(callno, tf, err, retval, tracestart);
+#endif
 
 	if (err) {
 		/*
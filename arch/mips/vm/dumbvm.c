@@ -46,9 +46,6 @@
  * assignment, this file is not included in your kernel!
  */
 
-/* under dumbvm, always have 48k of user stack */
-#define DUMBVM_STACKPAGES    12
-
 /*
  * Wrap rma_stealmem in a spinlock.
  */
@@ -50,6 +50,7 @@
 #include <synch.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
+#include <mainbus.h>
 #include <vfs.h>
 #include <emufs.h>
 #include "autoconf.h"
@@ -394,6 +395,409 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 //
 ////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////
+//
+// Client-side cache (see emufs.h)
+//
+// Everything here is called with ef_cachelock held. Lock order is
+// ef_vnlock, then ef_cachelock, then e_lock.
+//
+// ef_cachelock is not held across emu_read/emu_write: the page being
+// filled or written back is marked ep_busy for the duration, and
+// nobody else touches a busy page (its contents, its file, or its
+// slot) until it is no longer busy. Anything that finds one waits on
+// ef_cachecv.
+
+/*
+ * Wait until PG is not busy.
+ */
+static
+void
+emufs_pg_wait(struct emufs_fs *ef, struct emufs_page *pg)
+{
+	while (pg->ep_busy) {
+		cv_wait(ef->ef_cachecv, ef->ef_cachelock);
+	}
+}
+
+/*
+ * Wait until no page of EV is busy. Once this returns, nothing else
+ * can get at EV's pages until the caller next lets go of the lock.
+ */
+static
+void
+emufs_pg_waitfile(struct emufs_fs *ef, struct emufs_vnode *ev)
+{
+	struct emufs_page *pg;
+	unsigned i;
+	bool waited;
+
+	do {
+		waited = false;
+		for (i=0; i<ef->ef_npages; i++) {
+			pg = &ef->ef_pages[i];
+			if (pg->ep_ev == ev && pg->ep_busy) {
+				emufs_pg_wait(ef, pg);
+				waited = true;
+			}
+		}
+	} while (waited);
+}
+
+/*
+ * Write a dirty page back to the host.
+ */
+static
+int
+emufs_pg_writeback(struct emufs_fs *ef, struct emufs_page *pg)
+{
+	struct emufs_vnode *ev = pg->ep_ev;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(lock_do_i_hold(ef->ef_cachelock));
+	KASSERT(pg->ep_dirty);
+	KASSERT(!pg->ep_busy);
+
+	result = 0;
+	if (pg->ep_len > 0) {
+		pg->ep_busy = true;
+		lock_release(ef->ef_cachelock);
+
+		uio_kinit(&iov, &ku, pg->ep_data, pg->ep_len,
+			  (off_t)pg->ep_pageno * EMUFS_PAGESIZE, UIO_WRITE);
+		result = emu_write(ev->ev_emu, ev->ev_handle, pg->ep_len, &ku);
+
+		lock_acquire(ef->ef_cachelock);
+		pg->ep_busy = false;
+		cv_broadcast(ef->ef_cachecv, ef->ef_cachelock);
+	}
+	if (result == 0) {
+		pg->ep_dirty = false;
+		ef->ef_writebacks++;
+	}
+	return result;
+}
+
+/*
+ * Write back the dirty pages of one file, or of all files if EV is
+ * NULL. If DROP is set, forget them as well.
+ */
+static
+int
+emufs_pg_flush(struct emufs_fs *ef, struct emufs_vnode *ev, bool drop)
+{
+	struct emufs_page *pg;
+	unsigned i;
+	int result;
+
+	KASSERT(lock_do_i_hold(ef->ef_cachelock));
+
+	for (i=0; i<ef->ef_npages; i++) {
+		pg = &ef->ef_pages[i];
+		if (pg->ep_busy && (ev == NULL || pg->ep_ev == ev)) {
+			emufs_pg_wait(ef, pg);
+		}
+		if (pg->ep_ev == NULL || (ev != NULL && pg->ep_ev != ev)) {
+			continue;
+		}
+		if (pg->ep_dirty) {
+			result = emufs_pg_writeback(ef, pg);
+			if (result) {
+				return result;
+			}
+		}
+		if (drop) {
+			pg->ep_ev = NULL;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Forget the pages of one file without writing them. Used when the
+ * host copy changed under us; any dirty page would be ours and would
+ * have kept it from getting here. The caller has already waited for
+ * the file's busy pages with emufs_pg_waitfile.
+ */
+static
+void
+emufs_pg_drop(struct emufs_fs *ef, struct emufs_vnode *ev)
+{
+	unsigned i;
+
+	for (i=0; i<ef->ef_npages; i++) {
+		if (ef->ef_pages[i].ep_ev == ev) {
+			KASSERT(!ef->ef_pages[i].ep_dirty);
+			KASSERT(!ef->ef_pages[i].ep_busy);
+			ef->ef_pages[i].ep_ev = NULL;
+		}
+	}
+}
+
+/*
+ * Get the size of a file, from the cache if we know it.
+ */
+static
+int
+emufs_getattr(struct emufs_fs *ef, struct emufs_vnode *ev, off_t *size)
+{
+	int result;
+
+	KASSERT(lock_do_i_hold(ef->ef_cachelock));
+
+	if (ev->ev_sizevalid) {
+		ef->ef_ahits++;
+	}
+	else {
+		ef->ef_amisses++;
+		result = emu_getsize(ev->ev_emu, ev->ev_handle, &ev->ev_size);
+		if (result) {
+			return result;
+		}
+		ev->ev_sizevalid = true;
+	}
+	*size = ev->ev_size;
+	return 0;
+}
+
+/*
+ * Find page PAGENO of a file in the cache, or bring it in, evicting
+ * the least recently used page if need be. If FILL is false the
+ * caller is about to overwrite all of it, so don't read it from the
+ * host.
+ */
+static
+int
+emufs_pg_get(struct emufs_fs *ef, struct emufs_vnode *ev, uint32_t pageno,
+	     bool fill, struct emufs_page **ret)
+{
+	struct emufs_page *pg, *found, *victim;
+	struct iovec iov;
+	struct uio ku;
+	off_t start;
+	uint32_t len;
+	unsigned i;
+	int result;
+
+	KASSERT(lock_do_i_hold(ef->ef_cachelock));
+
+	/*
+	 * Anything that drops the lock (waiting for a busy page, or
+	 * writing back the victim) means starting the search over.
+	 */
+	while (1) {
+		found = victim = NULL;
+		for (i=0; i<ef->ef_npages; i++) {
+			pg = &ef->ef_pages[i];
+			if (pg->ep_ev == ev && pg->ep_pageno == pageno) {
+				found = pg;
+				break;
+			}
+			if (pg->ep_busy) {
+				continue;
+			}
+
+			/* Take a free page if there is one, else the oldest */
+			if (victim == NULL) {
+				victim = pg;
+			}
+			else if (victim->ep_ev == NULL) {
+				/* keep it */
+			}
+			else if (pg->ep_ev == NULL ||
+				 pg->ep_lastuse < victim->ep_lastuse) {
+				victim = pg;
+			}
+		}
+
+		if (found != NULL && found->ep_busy) {
+			emufs_pg_wait(ef, found);
+			continue;
+		}
+		if (found != NULL) {
+			ef->ef_hits++;
+			found->ep_lastuse = ++ef->ef_clock;
+			*ret = found;
+			return 0;
+		}
+		if (victim == NULL) {
+			/* Every page is busy; wait for one */
+			cv_wait(ef->ef_cachecv, ef->ef_cachelock);
+			continue;
+		}
+		if (victim->ep_ev != NULL && victim->ep_dirty) {
+			result = emufs_pg_writeback(ef, victim);
+			if (result) {
+				return result;
+			}
+			continue;
+		}
+		break;
+	}
+	ef->ef_misses++;
+
+	pg = victim;
+	pg->ep_ev = NULL;
+	if (pg->ep_data == NULL) {
+		pg->ep_data = kmalloc(EMUFS_PAGESIZE);
+		if (pg->ep_data == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	pg->ep_ev = ev;
+	pg->ep_pageno = pageno;
+	pg->ep_len = 0;
+	pg->ep_dirty = false;
+	pg->ep_lastuse = ++ef->ef_clock;
+
+	/*
+	 * Nothing on the host at or past the size we know of; our own
+	 * dirty pages are the only way it can be bigger than the host's.
+	 */
+	start = (off_t)pageno * EMUFS_PAGESIZE;
+	if (fill && start < ev->ev_size) {
+		pg->ep_busy = true;
+		lock_release(ef->ef_cachelock);
+
+		uio_kinit(&iov, &ku, pg->ep_data, EMUFS_PAGESIZE, start,
+			  UIO_READ);
+		result = emu_read(ev->ev_emu, ev->ev_handle, EMUFS_PAGESIZE,
+				  &ku);
+
+		lock_acquire(ef->ef_cachelock);
+		pg->ep_busy = false;
+		cv_broadcast(ef->ef_cachecv, ef->ef_cachelock);
+		if (result) {
+			pg->ep_ev = NULL;
+			return result;
+		}
+		len = EMUFS_PAGESIZE - ku.uio_resid;
+
+		/* A hole we extended past but haven't written back */
+		if (start + len < ev->ev_size && len < EMUFS_PAGESIZE) {
+			if (ev->ev_size - start < EMUFS_PAGESIZE) {
+				bzero(pg->ep_data + len,
+				      ev->ev_size - start - len);
+				len = ev->ev_size - start;
+			}
+			else {
+				bzero(pg->ep_data + len, EMUFS_PAGESIZE - len);
+				len = EMUFS_PAGESIZE;
+			}
+		}
+		pg->ep_len = len;
+	}
+
+	*ret = pg;
+	return 0;
+}
+
+/*
+ * Read through the cache.
+ */
+static
+int
+emufs_cache_read(struct emufs_fs *ef, struct emufs_vnode *ev,
+		 struct uio *uio)
+{
+	struct emufs_page *pg;
+	uint32_t off, amt;
+	off_t size;
+	int result;
+
+	result = emufs_getattr(ef, ev, &size);
+	if (result) {
+		return result;
+	}
+
+	while (uio->uio_resid > 0 && uio->uio_offset < size) {
+		result = emufs_pg_get(ef, ev,
+				      uio->uio_offset / EMUFS_PAGESIZE,
+				      true, &pg);
+		if (result) {
+			return result;
+		}
+
+		off = uio->uio_offset % EMUFS_PAGESIZE;
+		if (off >= pg->ep_len) {
+			/* Someone else shrank the file on the host */
+			break;
+		}
+		amt = pg->ep_len - off;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		result = uiomove(pg->ep_data + off, amt, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write into the cache.
+ */
+static
+int
+emufs_cache_write(struct emufs_fs *ef, struct emufs_vnode *ev,
+		  struct uio *uio)
+{
+	struct emufs_page *pg;
+	uint32_t off, amt;
+	size_t resid;
+	off_t size;
+	int result;
+
+	/* Make sure ev_size is known, so it can be kept up to date */
+	result = emufs_getattr(ef, ev, &size);
+	if (result) {
+		return result;
+	}
+
+	while (uio->uio_resid > 0) {
+		off = uio->uio_offset % EMUFS_PAGESIZE;
+		amt = EMUFS_PAGESIZE - off;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+
+		result = emufs_pg_get(ef, ev,
+				      uio->uio_offset / EMUFS_PAGESIZE,
+				      amt < EMUFS_PAGESIZE, &pg);
+		if (result) {
+			return result;
+		}
+
+		/* Writing past what's there leaves zeros in between */
+		if (off > pg->ep_len) {
+			bzero(pg->ep_data + pg->ep_len, off - pg->ep_len);
+			pg->ep_len = off;
+		}
+
+		resid = uio->uio_resid;
+		result = uiomove(pg->ep_data + off, amt, uio);
+		amt = resid - uio->uio_resid;
+		pg->ep_dirty = true;
+		if (off + amt > pg->ep_len) {
+			pg->ep_len = off + amt;
+		}
+		if (uio->uio_offset > ev->ev_size) {
+			ev->ev_size = uio->uio_offset;
+		}
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+//
+////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////
 //
 // vnode functions 
@@ -411,6 +815,12 @@ static
 int
 emufs_open(struct vnode *v, int openflags)
 {
+	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	off_t size;
+	unsigned i;
+	int result;
+
 	/*
 	 * At this level we do not need to handle O_CREAT, O_EXCL, or O_TRUNC.
 	 * We *would* need to handle O_APPEND, but we don't support it.
@@ -423,7 +833,33 @@ emufs_open(struct vnode *v, int openflags)
 		return EUNIMP;
 	}
 
-	(void)v;
+	/*
+	 * Check whether the host copy changed since we cached it. If
+	 * we have unwritten changes, the file is ours and can't have.
+	 */
+	lock_acquire(ef->ef_cachelock);
+	if (ef->ef_cacheon) {
+		emufs_pg_waitfile(ef, ev);
+		for (i=0; i<ef->ef_npages; i++) {
+			if (ef->ef_pages[i].ep_ev == ev &&
+			    ef->ef_pages[i].ep_dirty) {
+				break;
+			}
+		}
+		if (i == ef->ef_npages) {
+			result = emu_getsize(ev->ev_emu, ev->ev_handle, &size);
+			if (result) {
+				lock_release(ef->ef_cachelock);
+				return result;
+			}
+			if (!ev->ev_sizevalid || size != ev->ev_size) {
+				emufs_pg_drop(ef, ev);
+			}
+			ev->ev_size = size;
+			ev->ev_sizevalid = true;
+		}
+	}
+	lock_release(ef->ef_cachelock);
 
 	return 0;
 }
@@ -452,11 +888,31 @@ emufs_opendir(struct vnode *v, int openflags)
 }
 
 /*
- * VOP_CLOSE
+ * VOP_CLOSE on files
+ *
+ * Write back anything cached, so the next open (ours or the host's)
+ * sees it.
  */
 static
 int
 emufs_close(struct vnode *v)
+{
+	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	int result;
+
+	lock_acquire(ef->ef_cachelock);
+	result = emufs_pg_flush(ef, ev, false);
+	lock_release(ef->ef_cachelock);
+	return result;
+}
+
+/*
+ * VOP_CLOSE on directories
+ */
+static
+int
+emufs_closedir(struct vnode *v)
 {
 	(void)v;
 	return 0;
@@ -477,24 +933,34 @@ emufs_reclaim(struct vnode *v)
 	int result;
 
 	/*
-	 * Need both of these locks, e_lock to protect the device
-	 * and vfs_biglock to protect the fs-related material.
+	 * Need both of these locks, ef_vnlock to protect the vnode
+	 * table and e_lock to protect the device, plus ef_cachelock in
+	 * between for a moment. Take them in that order.
 	 */
 
-	vfs_biglock_acquire();
-	lock_acquire(ef->ef_emu->e_lock);
+	lock_acquire(ef->ef_vnlock);
 
-	if (ev->ev_v.vn_refcount != 1) {
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+	if (!vnode_reclaimable(&ev->ev_v)) {
+		lock_release(ef->ef_vnlock);
 		return EBUSY;
 	}
 
+	/* The cache must not hold on to pages of a vnode that's going */
+	lock_acquire(ef->ef_cachelock);
+	result = emufs_pg_flush(ef, ev, true);
+	lock_release(ef->ef_cachelock);
+	if (result) {
+		lock_release(ef->ef_vnlock);
+		return result;
+	}
+
+	lock_acquire(ef->ef_emu->e_lock);
+
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+		lock_release(ef->ef_vnlock);
 		return result;
 	}
 
@@ -518,7 +984,7 @@ emufs_reclaim(struct vnode *v)
 	VOP_CLEANUP(&ev->ev_v);
 
 	lock_release(ef->ef_emu->e_lock);
-	vfs_biglock_release();
+	lock_release(ef->ef_vnlock);
 
 	kfree(ev);
 	return 0;
@@ -532,12 +998,21 @@ int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
 	uint32_t amt;
 	size_t oldresid;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	lock_acquire(ef->ef_cachelock);
+	if (ef->ef_cacheon) {
+		result = emufs_cache_read(ef, ev, uio);
+		lock_release(ef->ef_cachelock);
+		return result;
+	}
+	lock_release(ef->ef_cachelock);
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -588,12 +1063,21 @@ int
 emufs_write(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
 	uint32_t amt;
 	size_t oldresid;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	lock_acquire(ef->ef_cachelock);
+	if (ef->ef_cacheon) {
+		result = emufs_cache_write(ef, ev, uio);
+		lock_release(ef->ef_cachelock);
+		return result;
+	}
+	lock_release(ef->ef_cachelock);
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -642,16 +1126,26 @@ int
 emufs_stat(struct vnode *v, struct stat *statbuf)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
 	int result;
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
+	result = VOP_GETTYPE(v, &statbuf->st_mode);
 	if (result) {
 		return result;
 	}
 
-	result = VOP_GETTYPE(v, &statbuf->st_mode);
+	/* Directory sizes aren't cached; files come and go on the host */
+	lock_acquire(ef->ef_cachelock);
+	if (ef->ef_cacheon && statbuf->st_mode == S_IFREG) {
+		result = emufs_getattr(ef, ev, &statbuf->st_size);
+	}
+	else {
+		result = emu_getsize(ev->ev_emu, ev->ev_handle,
+				     &statbuf->st_size);
+	}
+	lock_release(ef->ef_cachelock);
 	if (result) {
 		return result;
 	}
@@ -710,8 +1204,14 @@ static
 int
 emufs_fsync(struct vnode *v)
 {
-	(void)v;
-	return 0;
+	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	int result;
+
+	lock_acquire(ef->ef_cachelock);
+	result = emufs_pg_flush(ef, ev, false);
+	lock_release(ef->ef_cachelock);
+	return result;
 }
 
 /*
@@ -722,7 +1222,36 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	struct emufs_page *pg;
+	off_t start;
+	unsigned i;
+	int result;
+
+	lock_acquire(ef->ef_cachelock);
+	/* A write-back finishing after the truncate would undo it */
+	emufs_pg_waitfile(ef, ev);
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	if (result == 0 && ef->ef_cacheon) {
+		/* Cut cached pages down to match, dirty or not */
+		for (i=0; i<ef->ef_npages; i++) {
+			pg = &ef->ef_pages[i];
+			if (pg->ep_ev != ev) {
+				continue;
+			}
+			start = (off_t)pg->ep_pageno * EMUFS_PAGESIZE;
+			if (start >= len) {
+				pg->ep_ev = NULL;
+			}
+			else if (start + pg->ep_len > len) {
+				pg->ep_len = len - start;
+			}
+		}
+		ev->ev_size = len;
+		ev->ev_sizevalid = true;
+	}
+	lock_release(ef->ef_cachelock);
+	return result;
 }
 
 /*
@@ -1117,7 +1646,7 @@ static const struct vnode_ops emufs_dirops = {
 	VOP_MAGIC,	/* mark this a valid vnode ops table */
 
 	emufs_opendir,
-	emufs_close,
+	emufs_closedir,
 	emufs_reclaim,
 
 	emufs_uio_op_isdir,   /* read */
@@ -1158,8 +1687,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	unsigned i, num;
 	int result;
 
-	vfs_biglock_acquire();
-	lock_acquire(ef->ef_emu->e_lock);
+	lock_acquire(ef->ef_vnlock);
 
 	num = vnodearray_num(ef->ef_vnodes);
 	for (i=0; i<num; i++) {
@@ -1170,8 +1698,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 			VOP_INCREF(&ev->ev_v);
 
-			lock_release(ef->ef_emu->e_lock);
-			vfs_biglock_release();
+			lock_release(ef->ef_vnlock);
 			*ret = ev;
 			return 0;
 		}
@@ -1181,18 +1708,19 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev = kmalloc(sizeof(struct emufs_vnode));
 	if (ev==NULL) {
-		lock_release(ef->ef_emu->e_lock);
+		lock_release(ef->ef_vnlock);
 		return ENOMEM;
 	}
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_size = 0;
+	ev->ev_sizevalid = false;
 
 	result = VOP_INIT(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			   &ef->ef_fs, ev);
 	if (result) {
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+		lock_release(ef->ef_vnlock);
 		kfree(ev);
 		return result;
 	}
@@ -1201,14 +1729,12 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	if (result) {
 		/* note: VOP_CLEANUP undoes VOP_INIT - it does not kfree */
 		VOP_CLEANUP(&ev->ev_v);
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+		lock_release(ef->ef_vnlock);
 		kfree(ev);
 		return result;
 	}
 
-	lock_release(ef->ef_emu->e_lock);
-	vfs_biglock_release();
+	lock_release(ef->ef_vnlock);
 
 	*ret = ev;
 	return 0;
@@ -1229,8 +1755,13 @@ static
 int
 emufs_sync(struct fs *fs)
 {
-	(void)fs;
-	return 0;
+	struct emufs_fs *ef = fs->fs_data;
+	int result;
+
+	lock_acquire(ef->ef_cachelock);
+	result = emufs_pg_flush(ef, NULL, false);
+	lock_release(ef->ef_cachelock);
+	return result;
 }
 
 /*
@@ -1277,6 +1808,106 @@ emufs_unmount(struct fs *fs)
 	return EBUSY;
 }
 
+/*
+ * Hit rate as a percentage, for the report below.
+ */
+static
+unsigned
+emufs_pct(unsigned hits, unsigned misses)
+{
+	if (hits + misses == 0) {
+		return 0;
+	}
+	return (uint64_t)hits * 100 / (hits + misses);
+}
+
+/*
+ * Cache control and statistics, for the kernel menu. Turning the
+ * cache off writes back and frees all the pages and forgets the file
+ * sizes, as nothing keeps them current while it's off.
+ */
+int
+emufs_cachectl(const char *devname, int enable)
+{
+	struct vnode *root, *v;
+	struct emufs_fs *ef;
+	struct emufs_page *pg;
+	unsigned i, num, npages, ndirty;
+	int result;
+
+	result = vfs_getroot(devname, &root);
+	if (result) {
+		return result;
+	}
+	if (root->vn_ops != &emufs_dirops) {
+		VOP_DECREF(root);
+		return EINVAL;
+	}
+	ef = root->vn_fs->fs_data;
+
+	lock_acquire(ef->ef_vnlock);
+	lock_acquire(ef->ef_cachelock);
+
+	result = 0;
+	if (enable == 0 && ef->ef_cacheon) {
+		/*
+		 * Turn it off first so nothing new comes in while the
+		 * flush has the lock dropped. A read or write already in
+		 * progress may still bring a page in; that page keeps
+		 * its buffer and goes out with the file's next flush.
+		 */
+		ef->ef_cacheon = false;
+		result = emufs_pg_flush(ef, NULL, true);
+		if (result == 0) {
+			for (i=0; i<ef->ef_npages; i++) {
+				pg = &ef->ef_pages[i];
+				if (pg->ep_ev == NULL && !pg->ep_busy &&
+				    pg->ep_data != NULL) {
+					kfree(pg->ep_data);
+					pg->ep_data = NULL;
+				}
+			}
+			num = vnodearray_num(ef->ef_vnodes);
+			for (i=0; i<num; i++) {
+				v = vnodearray_get(ef->ef_vnodes, i);
+				((struct emufs_vnode *)v->vn_data)->ev_sizevalid
+					= false;
+			}
+		}
+		else {
+			ef->ef_cacheon = true;
+		}
+	}
+	else if (enable > 0) {
+		ef->ef_cacheon = true;
+	}
+
+	npages = ndirty = 0;
+	for (i=0; i<ef->ef_npages; i++) {
+		pg = &ef->ef_pages[i];
+		if (pg->ep_ev != NULL) {
+			npages++;
+			if (pg->ep_dirty) {
+				ndirty++;
+			}
+		}
+	}
+
+	kprintf("%s: cache %s, %u/%u pages in use (%u dirty)\n", devname,
+		ef->ef_cacheon ? "on" : "off", npages, ef->ef_npages, ndirty);
+	kprintf("  pages: %u hits, %u misses (%u%%), %u written back\n",
+		ef->ef_hits, ef->ef_misses,
+		emufs_pct(ef->ef_hits, ef->ef_misses), ef->ef_writebacks);
+	kprintf("  sizes: %u hits, %u misses (%u%%)\n",
+		ef->ef_ahits, ef->ef_amisses,
+		emufs_pct(ef->ef_ahits, ef->ef_amisses));
+
+	lock_release(ef->ef_cachelock);
+	lock_release(ef->ef_vnlock);
+	VOP_DECREF(root);
+	return result;
+}
+
 /*
  * Routine for "mounting" an emufs - we're not really mounted in the
  * sense that the VFS understands that term, because we're not
@@ -1309,9 +1940,61 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 		kfree(ef);
 		return ENOMEM;
 	}
+	ef->ef_vnlock = lock_create("emufs-vnodes");
+	if (ef->ef_vnlock == NULL) {
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
+	ef->ef_cachelock = lock_create("emufs-cache");
+	if (ef->ef_cachelock == NULL) {
+		lock_destroy(ef->ef_vnlock);
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
+	ef->ef_cachecv = cv_create("emufs-cache");
+	if (ef->ef_cachecv == NULL) {
+		lock_destroy(ef->ef_cachelock);
+		lock_destroy(ef->ef_vnlock);
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
+
+	/* Size the cache from how much memory the machine has */
+	ef->ef_npages = mainbus_ramsize() / EMUFS_PAGESIZE / EMUFS_RAMSHARE;
+	if (ef->ef_npages < EMUFS_MINPAGES) {
+		ef->ef_npages = EMUFS_MINPAGES;
+	}
+	if (ef->ef_npages > EMUFS_MAXPAGES) {
+		ef->ef_npages = EMUFS_MAXPAGES;
+	}
+	ef->ef_pages = kmalloc(ef->ef_npages * sizeof(struct emufs_page));
+	if (ef->ef_pages == NULL) {
+		cv_destroy(ef->ef_cachecv);
+		lock_destroy(ef->ef_cachelock);
+		lock_destroy(ef->ef_vnlock);
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
+
+	/* Cache starts out on and empty; pages are allocated as used */
+	ef->ef_cacheon = true;
+	ef->ef_clock = 0;
+	bzero(ef->ef_pages, ef->ef_npages * sizeof(struct emufs_page));
+	ef->ef_hits = ef->ef_misses = 0;
+	ef->ef_ahits = ef->ef_amisses = 0;
+	ef->ef_writebacks = 0;
 
 	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, &ef->ef_root);
 	if (result) {
+		kfree(ef->ef_pages);
+		cv_destroy(ef->ef_cachecv);
+		lock_destroy(ef->ef_cachelock);
+		lock_destroy(ef->ef_vnlock);
+		vnodearray_destroy(ef->ef_vnodes);
 		kfree(ef);
 		return result;
 	}
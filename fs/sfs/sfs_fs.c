@@ -39,6 +39,7 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
@@ -47,10 +48,13 @@
 #define SFS_FS_BITMAPSIZE(sfs)  SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks)
 #define SFS_FS_BITBLOCKS(sfs)   SFS_BITBLOCKS((sfs)->sfs_super.sp_nblocks)
 
+/* Number of power-of-two size classes in the free run histogram */
+#define SFS_FRAGBUCKETS 8
+
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * This does the whole bitmap at once, which mount needs; sync uses
+ * sfs_mapflush below to write only the parts that changed.
  *
  * The free block bitmap consists of SFS_BITBLOCKS 512-byte sectors of
  * bits, one bit for each sector on the filesystem. The number of
@@ -101,9 +105,109 @@ sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 	return 0;
 }
 
+/*
+ * Write out the freemap blocks that have changed since the last sync
+ * (as recorded in sfs_mapdirty), a run of adjacent ones per request.
+ * Call with sfs_freemaplock held.
+ */
+static
+int
+sfs_mapflush(struct sfs_fs *sfs)
+{
+	uint32_t j, n, mapsize;
+	char *bitdata;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	mapsize = SFS_FS_BITBLOCKS(sfs);
+	bitdata = bitmap_getdata(sfs->sfs_freemap);
+
+	j = 0;
+	while (j < mapsize) {
+		if (!bitmap_isset(sfs->sfs_mapdirty, j)) {
+			j++;
+			continue;
+		}
+		for (n = 1; j+n < mapsize &&
+			     bitmap_isset(sfs->sfs_mapdirty, j+n); n++) {
+			/* nothing */
+		}
+
+		uio_kinit(&iov, &ku, bitdata + j*SFS_BLOCKSIZE,
+			  n*SFS_BLOCKSIZE,
+			  (off_t)(SFS_MAP_LOCATION+j)*SFS_BLOCKSIZE, UIO_WRITE);
+		result = sfs_rwblock(sfs, &ku);
+		if (result) {
+			return result;
+		}
+
+		for (; n > 0; n--, j++) {
+			bitmap_unmark(sfs->sfs_mapdirty, j);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write out the changed parts of the freemap, unless the journal is
+ * taking care of them. Used by sync and fsync, ahead of any inodes.
+ */
+int
+sfs_mapsync(struct sfs_fs *sfs)
+{
+	int result = 0;
+
+	if (sfs->sfs_journal != NULL) {
+		return 0;
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs->sfs_freemapdirty) {
+		result = sfs_mapflush(sfs);
+		if (result == 0) {
+			sfs->sfs_freemapdirty = false;
+		}
+	}
+	lock_release(sfs->sfs_freemaplock);
+	return result;
+}
+
+/*
+ * Order for writing back inodes: by block number, so the disk sweeps
+ * across once.
+ */
+static
+void
+sfs_sortvnodes(struct sfs_vnode **svs, unsigned num)
+{
+	struct sfs_vnode *tmp;
+	unsigned i, j;
+
+	/* Insertion sort; usually only a handful are dirty */
+	for (i=1; i<num; i++) {
+		tmp = svs[i];
+		for (j=i; j>0 && svs[j-1]->sv_ino > tmp->sv_ino; j--) {
+			svs[j] = svs[j-1];
+		}
+		svs[j] = tmp;
+	}
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
+ *
+ * Only the inodes on the dirty list (which also has the files with
+ * delayed writes) and the freemap blocks marked in sfs_mapdirty are
+ * written, so the cost goes with how much changed
+ * rather than with the size of the volume. The freemap goes first,
+ * so an inode on disk never points at a block the map on disk still
+ * shows as free.
+ *
+ * With a journal, the freemap and inodes are already in it (the
+ * dirty list only has inodes that couldn't be put there), and all
+ * this comes down to committing it.
  */
 
 static
@@ -111,11 +215,10 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs; 
+	struct sfs_vnode **svs, *sv;
 	unsigned i, num;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -148,35 +251,86 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	/*
+	 * Collect the dirty inodes. Syncing takes each vnode's lock,
+	 * and whoever holds that may be waiting for the table lock, so
+	 * take references to them all and let go of the locks first.
+	 * Holding the table lock keeps sfs_reclaim away meanwhile.
+	 * Anything dirtied after the count is taken waits for next time.
+	 */
+	spinlock_acquire(&sfs->sfs_dirtylock);
+	num = 0;
+	for (sv = sfs->sfs_dirtyinodes; sv != NULL; sv = sv->sv_dnext) {
+		num++;
 	}
+	spinlock_release(&sfs->sfs_dirtylock);
 
-	/* If the free block map needs to be written, write it. */
-	if (sfs->sfs_freemapdirty) {
-		result = sfs_mapio(sfs, UIO_WRITE);
-		if (result) {
-			vfs_biglock_release();
-			return result;
+	svs = NULL;
+	if (num > 0) {
+		svs = kmalloc(num * sizeof(struct sfs_vnode *));
+		if (svs == NULL) {
+			return ENOMEM;
+		}
+
+		rwlock_acquire_read(sfs->sfs_vnlock);
+		spinlock_acquire(&sfs->sfs_dirtylock);
+		i = 0;
+		for (sv = sfs->sfs_dirtyinodes; sv != NULL && i < num;
+		     sv = sv->sv_dnext) {
+			VOP_INCREF(&sv->sv_v);
+			svs[i++] = sv;
+		}
+		num = i;
+		spinlock_release(&sfs->sfs_dirtylock);
+		rwlock_release_read(sfs->sfs_vnlock);
+
+		sfs_sortvnodes(svs, num);
+	}
+
+	/* If the free block map needs writing, write what changed. */
+	result = sfs_mapsync(sfs);
+	if (result) {
+		goto out;
+	}
+
+	/*
+	 * Then the inodes, in disk order. Flushing a file also gives
+	 * its delayed writes disk blocks, and writes the freemap again
+	 * first if that changed it. With a journal this only adds to
+	 * the running transaction, so it's committed once below rather
+	 * than once per file.
+	 */
+	for (i=0; i<num; i++) {
+		if (result == 0) {
+			result = sfs_flushvnode(svs[i]);
 		}
-		sfs->sfs_freemapdirty = false;
 	}
 
+	/* Commit the journal, if any */
+	if (result == 0) {
+		result = sfs_jsync(sfs);
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+
 	/* If the superblock needs to be written, write it. */
-	if (sfs->sfs_superdirty) {
+	if (result == 0 && sfs->sfs_superdirty) {
 		result = sfs_wblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
-		if (result) {
-			vfs_biglock_release();
-			return result;
+		if (result == 0) {
+			sfs->sfs_superdirty = false;
 		}
-		sfs->sfs_superdirty = false;
 	}
 
-	vfs_biglock_release();
-	return 0;
+	lock_release(sfs->sfs_freemaplock);
+
+ out:
+	for (i=0; i<num; i++) {
+		VOP_DECREF(&svs[i]->sv_v);
+	}
+	if (svs != NULL) {
+		kfree(svs);
+	}
+	return result;
 }
 
 /*
@@ -189,13 +343,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_super.sp_volname;
-	vfs_biglock_release();
-
-	return ret;
+	/* Set at mount time and never changed */
+	return sfs->sfs_super.sp_volname;
 }
 
 /*
@@ -208,22 +358,36 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
-	vfs_biglock_acquire();
-	
 	/* Do we have any files open? If so, can't unmount. */
+	rwlock_acquire_read(sfs->sfs_vnlock);
 	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+		rwlock_release_read(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	rwlock_release_read(sfs->sfs_vnlock);
+
+	/* Get everything in the journal home, and the log empty. */
+	result = sfs_jflush(sfs);
+	if (result) {
+		return result;
+	}
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
+	KASSERT(sfs->sfs_dirtyinodes == NULL);
 
 	/* Once we start nuking stuff we can't fail. */
+	sfs_jstop(sfs);
 	vnodearray_destroy(sfs->sfs_vnodes);
+	rwlock_destroy(sfs->sfs_vnlock);
+	bitmap_destroy(sfs->sfs_resvmap);
+	bitmap_destroy(sfs->sfs_mapdirty);
 	bitmap_destroy(sfs->sfs_freemap);
+	lock_destroy(sfs->sfs_freemaplock);
+	spinlock_cleanup(&sfs->sfs_dirtylock);
 	
 	/* The vfs layer takes care of the device for us */
 	(void)sfs->sfs_device;
@@ -232,7 +396,6 @@ sfs_unmount(struct fs *fs)
 	kfree(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -255,10 +418,9 @@ int
 sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
+	uint32_t i;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
-
 	/* We don't pass any options through mount */
 	(void)options;
 
@@ -268,6 +430,8 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	KASSERT(sizeof(struct sfs_super)==SFS_BLOCKSIZE);
 	KASSERT(sizeof(struct sfs_inode)==SFS_BLOCKSIZE);
 	KASSERT(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
+	KASSERT(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	KASSERT(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
 
 	/*
 	 * We can't mount on devices with the wrong sector size.
@@ -278,14 +442,12 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		return ENXIO;
 	}
 
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
 	if (sfs==NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -293,19 +455,38 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	sfs->sfs_vnodes = vnodearray_create();
 	if (sfs->sfs_vnodes == NULL) {
 		kfree(sfs);
-		vfs_biglock_release();
+		return ENOMEM;
+	}
+	sfs->sfs_vnlock = rwlock_create("sfs_vnodes");
+	if (sfs->sfs_vnlock == NULL) {
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_freemaplock = lock_create("sfs_freemap");
+	if (sfs->sfs_freemaplock == NULL) {
+		rwlock_destroy(sfs->sfs_vnlock);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
 		return ENOMEM;
 	}
 
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
 
+	/* No journal until it's been replayed and started */
+	sfs->sfs_journal = NULL;
+	sfs->sfs_frozen = false;
+	sfs->sfs_heldmap = NULL;
+	sfs->sfs_nheld = 0;
+
 	/* Load superblock */
 	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 	if (result) {
+		lock_destroy(sfs->sfs_freemaplock);
+		rwlock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -316,9 +497,10 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
 			SFS_MAGIC);
+		lock_destroy(sfs->sfs_freemaplock);
+		rwlock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 	
@@ -330,23 +512,81 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_super.sp_volname[sizeof(sfs->sfs_super.sp_volname)-1] = 0;
 
+	/* Replay the journal before reading anything it may cover */
+	result = sfs_jrecover(sfs);
+	if (result) {
+		lock_destroy(sfs->sfs_freemaplock);
+		rwlock_destroy(sfs->sfs_vnlock);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return result;
+	}
+
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
+		lock_destroy(sfs->sfs_freemaplock);
+		rwlock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
 		bitmap_destroy(sfs->sfs_freemap);
+		lock_destroy(sfs->sfs_freemaplock);
+		rwlock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
+	/* Nothing is modified yet */
+	sfs->sfs_mapdirty = bitmap_create(SFS_FS_BITBLOCKS(sfs));
+	if (sfs->sfs_mapdirty == NULL) {
+		bitmap_destroy(sfs->sfs_freemap);
+		lock_destroy(sfs->sfs_freemaplock);
+		rwlock_destroy(sfs->sfs_vnlock);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return ENOMEM;
+	}
+
+	/* Nothing is reserved yet */
+	sfs->sfs_resvmap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
+	if (sfs->sfs_resvmap == NULL) {
+		bitmap_destroy(sfs->sfs_mapdirty);
+		bitmap_destroy(sfs->sfs_freemap);
+		lock_destroy(sfs->sfs_freemaplock);
+		rwlock_destroy(sfs->sfs_vnlock);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return ENOMEM;
+	}
+
+	/* Start the journal, putting one on the volume if need be */
+	result = sfs_jstart(sfs);
+	if (result) {
+		bitmap_destroy(sfs->sfs_resvmap);
+		bitmap_destroy(sfs->sfs_mapdirty);
+		bitmap_destroy(sfs->sfs_freemap);
+		lock_destroy(sfs->sfs_freemaplock);
+		rwlock_destroy(sfs->sfs_vnlock);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return result;
+	}
+
+	/* Count free blocks, now the journal has taken its own */
+	sfs->sfs_nfree = 0;
+	sfs->sfs_nresv = 0;
+	sfs->sfs_ndelayed = 0;
+	for (i=0; i<sfs->sfs_super.sp_nblocks; i++) {
+		if (!bitmap_isset(sfs->sfs_freemap, i)) {
+			sfs->sfs_nfree++;
+		}
+	}
+
 	/* Set up abstract fs calls */
 	sfs->sfs_absfs.fs_sync = sfs_sync;
 	sfs->sfs_absfs.fs_getvolname = sfs_getvolname;
@@ -357,11 +597,13 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* the other fields */
 	sfs->sfs_superdirty = false;
 	sfs->sfs_freemapdirty = false;
+	spinlock_init(&sfs->sfs_dirtylock);
+	spinlock_setname(&sfs->sfs_dirtylock, "sfs dirty list");
+	sfs->sfs_dirtyinodes = NULL;
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -374,3 +616,191 @@ sfs_mount(const char *device)
 {
 	return vfs_mount(device, NULL, sfs_domount);
 }
+
+/*
+ * Find the sfs mounted on DEVNAME. Hands back its root vnode too, to
+ * hold it mounted; the caller lets go of that when done.
+ */
+static
+int
+sfs_byname(const char *devname, struct vnode **root, struct sfs_fs **ret)
+{
+	int result;
+
+	result = vfs_getroot(devname, root);
+	if (result) {
+		return result;
+	}
+	if ((*root)->vn_fs == NULL ||
+	    (*root)->vn_fs->fs_getroot != sfs_getroot) {
+		VOP_DECREF(*root);
+		return EINVAL;
+	}
+	*ret = (*root)->vn_fs->fs_data;
+	return 0;
+}
+
+/*
+ * Print a report on how fragmented the free space and the files on
+ * the sfs mounted on DEVNAME are.
+ */
+int
+sfs_fragreport(const char *devname)
+{
+	struct vnode *root;
+	struct sfs_fs *sfs;
+	uint32_t hist[SFS_FRAGBUCKETS];
+	uint32_t nblocks, block, run, nfree, nruns, maxrun;
+	uint32_t nfiles, nfblocks, nextents, nfragfiles;
+	unsigned bucket;
+	int result;
+
+	result = sfs_byname(devname, &root, &sfs);
+	if (result) {
+		return result;
+	}
+
+	/* Free space: count the runs of free blocks, by size */
+	bzero(hist, sizeof(hist));
+	nfree = nruns = maxrun = 0;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	nblocks = sfs->sfs_super.sp_nblocks;
+	block = 0;
+	while (block < nblocks) {
+		if (bitmap_isset(sfs->sfs_freemap, block)) {
+			block++;
+			continue;
+		}
+		run = 0;
+		while (block < nblocks &&
+		       !bitmap_isset(sfs->sfs_freemap, block)) {
+			run++;
+			block++;
+		}
+		nfree += run;
+		nruns++;
+		if (run > maxrun) {
+			maxrun = run;
+		}
+		for (bucket = 0; bucket < SFS_FRAGBUCKETS-1 &&
+			     run >= (2U << bucket); bucket++) {
+			/* nothing */
+		}
+		hist[bucket]++;
+	}
+	lock_release(sfs->sfs_freemaplock);
+
+	/* Files: count how many pieces each is in */
+	result = sfs_filefrag(sfs, &nfiles, &nfblocks, &nextents, &nfragfiles);
+	VOP_DECREF(root);
+	if (result) {
+		return result;
+	}
+
+	kprintf("sfs: %s: %u blocks, %u free in %u runs (largest %u)\n",
+		sfs->sfs_super.sp_volname, nblocks, nfree, nruns, maxrun);
+	for (bucket = 0; bucket < SFS_FRAGBUCKETS; bucket++) {
+		if (bucket == SFS_FRAGBUCKETS-1) {
+			kprintf("  free runs %4u+     : %u\n",
+				1U << bucket, hist[bucket]);
+		}
+		else {
+			kprintf("  free runs %4u-%-4u : %u\n",
+				1U << bucket, (2U << bucket) - 1,
+				hist[bucket]);
+		}
+	}
+	kprintf("  %u files, %u data blocks in %u extents "
+		"(%u.%02u blocks/extent), %u fragmented\n",
+		nfiles, nfblocks, nextents,
+		nextents ? nfblocks / nextents : 0,
+		nextents ? (nfblocks * 100 / nextents) % 100 : 0,
+		nfragfiles);
+
+	return 0;
+}
+
+/*
+ * For testing journal replay: report how many transactions the
+ * journal of the sfs mounted on DEVNAME has committed since mount,
+ * and how many of those are in the log, not yet checkpointed. Fewer
+ * in the log than committed means the log has been started over.
+ * Also report whether the volume has been frozen.
+ */
+int
+sfs_logstat(const char *devname, uint32_t *ncommits, uint32_t *nlogged,
+	    bool *frozen)
+{
+	struct vnode *root;
+	struct sfs_fs *sfs;
+	int result;
+
+	result = sfs_byname(devname, &root, &sfs);
+	if (result) {
+		return result;
+	}
+	if (sfs->sfs_journal == NULL) {
+		VOP_DECREF(root);
+		return ENOSYS;
+	}
+	sfs_jcounts(sfs, ncommits, nlogged);
+	lock_acquire(sfs->sfs_freemaplock);
+	*frozen = sfs->sfs_frozen;
+	lock_release(sfs->sfs_freemaplock);
+	VOP_DECREF(root);
+	return 0;
+}
+
+/*
+ * Also for testing journal replay: sync the sfs mounted on DEVNAME,
+ * then stop writing to its disk, as if the machine went down just
+ * after. Everything carries on in memory, including unmount, but the
+ * volume stays as the last commit left it, with whatever is in the
+ * log not yet home, for the next mount to replay.
+ */
+int
+sfs_freeze(const char *devname)
+{
+	struct vnode *root;
+	struct sfs_fs *sfs;
+	int result;
+
+	result = sfs_byname(devname, &root, &sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_sync(&sfs->sfs_absfs);
+	if (result == 0) {
+		lock_acquire(sfs->sfs_freemaplock);
+		sfs->sfs_frozen = true;
+		lock_release(sfs->sfs_freemaplock);
+	}
+	VOP_DECREF(root);
+	return result;
+}
+
+/*
+ * Freeze the sfs mounted on DEVNAME, but not yet: only once its log
+ * fills up and a commit has to checkpoint to make room, just after
+ * that checkpoint. See sfs_jfreezeroom.
+ */
+int
+sfs_freezeroom(const char *devname)
+{
+	struct vnode *root;
+	struct sfs_fs *sfs;
+	int result;
+
+	result = sfs_byname(devname, &root, &sfs);
+	if (result) {
+		return result;
+	}
+	if (sfs->sfs_journal == NULL) {
+		VOP_DECREF(root);
+		return ENOSYS;
+	}
+	sfs_jfreezeroom(sfs);
+	VOP_DECREF(root);
+	return 0;
+}
@@ -42,15 +42,30 @@
 // Note: sfs_rblock is used to read the superblock
 // early in mount, before sfs is fully (or even mostly)
 // initialized, and so may not use anything from sfs
-// except sfs_device.
+// except sfs_device, sfs_frozen, and sfs_journal, which
+// is NULL until the journal is started.
 
 int
 sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 {
 	int result;
 	int tries=0;
+	bool found;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	/* Metadata not yet checkpointed is newer in the journal */
+	if (uio->uio_rw == UIO_READ && sfs->sfs_journal != NULL) {
+		result = sfs_jread(sfs, uio, &found);
+		if (result || found) {
+			return result;
+		}
+	}
+
+	/* Once frozen, the disk stays as it is; see sfs_freeze */
+	if (uio->uio_rw == UIO_WRITE && sfs->sfs_frozen) {
+		uio->uio_offset += uio->uio_resid;
+		uio->uio_resid = 0;
+		return 0;
+	}
 
 	DEBUG(DB_SFS, "sfs: %s %llu\n", 
 	      uio->uio_rw == UIO_READ ? "read" : "write",
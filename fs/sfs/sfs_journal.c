@@ -0,0 +1,1182 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS metadata journal.
+ *
+ * Changes to metadata (inodes, indirect blocks, directory blocks, and
+ * the freemap) don't go straight to their home locations. sfs_jwrite
+ * keeps the new contents in a table in memory instead, and reads
+ * (sfs_rwblock) look there first. Each operation brackets its changes
+ * with sfs_jbegin and sfs_jend, and everything changed since the last
+ * commit makes up the running transaction.
+ *
+ * A commit waits for the operations in progress to finish, holding
+ * off new ones, and then appends the running transaction to the log
+ * on disk in a few large sequential writes. However many operations
+ * have piled up, from however many threads, they share the one
+ * commit. Commits happen on sync (so every few seconds, from the
+ * syncer), on fsync, and whenever the running transaction gets big.
+ *
+ * Blocks in the table only go home at a checkpoint, which happens
+ * once the log is half full, when a commit doesn't fit in what's left
+ * of it, and at unmount. A checkpoint writes the committed contents
+ * of the whole table out in disk order and starts the log over. After
+ * a crash, sfs_jrecover replays the committed transactions in the log
+ * before anything else looks at the volume.
+ *
+ * Only committed contents may go home, but a committed block can be
+ * changed again before the checkpoint. So the first change to it
+ * after a commit saves a copy of what was committed (je_committed),
+ * and that copy is what a checkpoint writes.
+ *
+ * File data is not journaled. It is written in place, as before, and
+ * so is always on disk before the transaction that makes it reachable
+ * commits. So that replay never writes old metadata over a block that
+ * has been reused since, freed blocks are held back (sfs_heldmap)
+ * until the transaction that freed them has committed and, if they
+ * are in the table, until they have been checkpointed as well.
+ *
+ * An operation that changes more blocks than fit in the log is split
+ * across transactions and is not atomic. None comes close: even
+ * rehashing a big directory writes the new copy outside the journal
+ * and logs only the inode, indirect blocks, and freemap that switch
+ * to it (see sfs_dir_rehash).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <synch.h>
+#include <vfs.h>
+#include <device.h>
+#include <sfs.h>
+
+/* Number of hash chains in the table */
+#define SFS_JHASHSIZE   64
+
+/* Smallest journal we'll use */
+#define SFS_JMINBLOCKS  16
+
+/*
+ * A block in the table: the latest contents of metadata block
+ * je_block, committed or not.
+ */
+struct sfs_jentry {
+	uint32_t je_block;              /* home location */
+	bool je_running;                /* changed since the last commit */
+	struct sfs_jentry *je_hnext;    /* next on hash chain */
+	struct sfs_jentry *je_rnext;    /* next in running transaction */
+	char *je_data;                  /* contents, SFS_BLOCKSIZE bytes */
+	char *je_committed;             /* committed contents, if changed */
+};
+
+/*
+ * In-memory journal state. j_lock covers the handle count, the table,
+ * and the running transaction. The rest belongs to whoever holds
+ * j_commitlock. Entries only change inside handles and commits only
+ * run with no handles open, so the committer can write them out
+ * without holding j_lock.
+ */
+struct sfs_journal {
+	struct lock *j_lock;
+	struct cv *j_cv;                /* j_active or j_committing changed */
+	struct lock *j_commitlock;      /* one commit at a time */
+	unsigned j_active;              /* handles open */
+	bool j_committing;              /* commit waiting; hold off handles */
+	bool j_freezeroom;              /* testing; see sfs_jfreezeroom */
+
+	struct sfs_jentry *j_hash[SFS_JHASHSIZE];
+	unsigned j_nentries;            /* entries in the table */
+	struct sfs_jentry *j_run;       /* the running transaction */
+	unsigned j_nrun;                /* entries in it */
+
+	uint32_t j_start;               /* first block of the journal */
+	uint32_t j_nblocks;             /* size of the journal */
+	uint32_t j_seq;                 /* sequence number of next commit */
+	uint32_t j_hseq;                /* the one the header names */
+	uint32_t j_mountseq;            /* the one it named at mount */
+	uint32_t j_head;                /* next log block to write */
+	struct sfs_jdesc *j_desc;       /* descriptor block buffer */
+	struct iovec j_iov[SFS_JTAGS+1];/* for gathering writes */
+};
+
+////////////////////////////////////////////////////////////
+//
+// Disk I/O
+
+/*
+ * Write the N blocks described by IOV to disk, starting at BLOCK, as
+ * one request.
+ */
+static
+int
+sfs_jgather(struct sfs_fs *sfs, struct iovec *iov, unsigned n,
+	    uint32_t block)
+{
+	struct uio ku;
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)block * SFS_BLOCKSIZE;
+	ku.uio_resid = n * SFS_BLOCKSIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+	return sfs_rwblock(sfs, &ku);
+}
+
+/*
+ * Write the journal header for the journal at JSTART, saying replay
+ * should start with transaction SEQ.
+ */
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs, uint32_t jstart, uint32_t seq)
+{
+	struct sfs_jheader *jh;
+	int result;
+
+	jh = kmalloc(sizeof(struct sfs_jheader));
+	if (jh == NULL) {
+		return ENOMEM;
+	}
+	bzero(jh, sizeof(struct sfs_jheader));
+	jh->jh_magic = SFS_JMAGIC_HEADER;
+	jh->jh_seq = seq;
+	result = sfs_wblock(sfs, jh, jstart);
+	kfree(jh);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// The table
+
+/* Find the entry for BLOCK, if any. Call with j_lock held. */
+static
+struct sfs_jentry *
+sfs_jlookup(struct sfs_journal *j, uint32_t block)
+{
+	struct sfs_jentry *e;
+
+	for (e = j->j_hash[block % SFS_JHASHSIZE]; e != NULL; e = e->je_hnext) {
+		if (e->je_block == block) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find or make the entry for BLOCK and put it in the running
+ * transaction. On success it's handed back with j_lock held, for the
+ * caller to fill in.
+ */
+static
+int
+sfs_jgetentry(struct sfs_journal *j, uint32_t block, struct sfs_jentry **ret)
+{
+	struct sfs_jentry *e;
+
+	lock_acquire(j->j_lock);
+
+	/* Changes are only allowed inside a handle */
+	KASSERT(j->j_active > 0);
+
+	e = sfs_jlookup(j, block);
+	if (e == NULL) {
+		e = kmalloc(sizeof(struct sfs_jentry));
+		if (e == NULL) {
+			lock_release(j->j_lock);
+			return ENOMEM;
+		}
+		e->je_data = kmalloc(SFS_BLOCKSIZE);
+		if (e->je_data == NULL) {
+			kfree(e);
+			lock_release(j->j_lock);
+			return ENOMEM;
+		}
+		e->je_block = block;
+		e->je_committed = NULL;
+		e->je_running = false;
+		e->je_rnext = NULL;
+		e->je_hnext = j->j_hash[block % SFS_JHASHSIZE];
+		j->j_hash[block % SFS_JHASHSIZE] = e;
+		j->j_nentries++;
+	}
+	else if (!e->je_running) {
+		/* Committed, and about to change; keep what was committed */
+		e->je_committed = kmalloc(SFS_BLOCKSIZE);
+		if (e->je_committed == NULL) {
+			lock_release(j->j_lock);
+			return ENOMEM;
+		}
+		memcpy(e->je_committed, e->je_data, SFS_BLOCKSIZE);
+	}
+
+	if (!e->je_running) {
+		e->je_running = true;
+		e->je_rnext = j->j_run;
+		j->j_run = e;
+		j->j_nrun++;
+	}
+
+	*ret = e;
+	return 0;
+}
+
+/*
+ * Write metadata block BLOCK: into the running transaction if there's
+ * a journal, or straight to disk if not.
+ */
+int
+sfs_jwrite(struct sfs_fs *sfs, void *data, uint32_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jentry *e;
+	int result;
+
+	if (j == NULL) {
+		return sfs_wblock(sfs, data, block);
+	}
+
+	result = sfs_jgetentry(j, block, &e);
+	if (result) {
+		return result;
+	}
+	memcpy(e->je_data, data, SFS_BLOCKSIZE);
+	lock_release(j->j_lock);
+	return 0;
+}
+
+/*
+ * The same, for a write of one whole block described by UIO, as
+ * sfs_blockio does for directories.
+ */
+int
+sfs_jwriteuio(struct sfs_fs *sfs, struct uio *uio)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jentry *e;
+	int result;
+
+	if (j == NULL) {
+		return sfs_rwblock(sfs, uio);
+	}
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+	KASSERT(uio->uio_resid == SFS_BLOCKSIZE);
+	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
+
+	result = sfs_jgetentry(j, uio->uio_offset / SFS_BLOCKSIZE, &e);
+	if (result) {
+		return result;
+	}
+	result = uiomove(e->je_data, SFS_BLOCKSIZE, uio);
+	lock_release(j->j_lock);
+	return result;
+}
+
+/*
+ * Satisfy a read from the table, if the block is there; sets *FOUND
+ * if so. Metadata is only ever read a block at a time, so longer
+ * reads needn't look.
+ */
+int
+sfs_jread(struct sfs_fs *sfs, struct uio *uio, bool *found)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jentry *e;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	*found = false;
+	if (j == NULL || uio->uio_resid != SFS_BLOCKSIZE) {
+		return 0;
+	}
+
+	lock_acquire(j->j_lock);
+	e = sfs_jlookup(j, uio->uio_offset / SFS_BLOCKSIZE);
+	if (e != NULL) {
+		result = uiomove(e->je_data, SFS_BLOCKSIZE, uio);
+		*found = true;
+	}
+	lock_release(j->j_lock);
+	return result;
+}
+
+/*
+ * Put the changed freemap blocks in the running transaction. Call
+ * with sfs_freemaplock held, inside a handle. A block that can't be
+ * added stays marked in sfs_mapdirty for next time.
+ */
+static
+void
+sfs_jmappull(struct sfs_fs *sfs)
+{
+	uint32_t i, mapsize;
+	char *bitdata;
+	bool alldone = true;
+
+	mapsize = SFS_BITBLOCKS(sfs->sfs_super.sp_nblocks);
+	bitdata = bitmap_getdata(sfs->sfs_freemap);
+
+	for (i=0; i<mapsize; i++) {
+		if (!bitmap_isset(sfs->sfs_mapdirty, i)) {
+			continue;
+		}
+		if (sfs_jwrite(sfs, bitdata + i*SFS_BLOCKSIZE,
+			       SFS_MAP_LOCATION+i)) {
+			alldone = false;
+			continue;
+		}
+		bitmap_unmark(sfs->sfs_mapdirty, i);
+	}
+	if (alldone) {
+		sfs->sfs_freemapdirty = false;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Handles
+
+/*
+ * Start an operation that changes metadata. Must come before taking
+ * any of the filesystem's other locks, since a commit waiting for
+ * the handles already open holds this up.
+ */
+void
+sfs_jbegin(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	if (j == NULL) {
+		return;
+	}
+
+	lock_acquire(j->j_lock);
+	while (j->j_committing) {
+		cv_wait(j->j_cv, j->j_lock);
+	}
+	j->j_active++;
+	lock_release(j->j_lock);
+}
+
+/*
+ * Finish an operation. Call with none of the filesystem's other locks
+ * held. If the running transaction has got big, commit it.
+ */
+void
+sfs_jend(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	bool big;
+
+	if (j == NULL) {
+		return;
+	}
+
+	/*
+	 * The freemap changes go in the same transaction as whatever
+	 * they were for. Any we made ourselves we'd see in
+	 * sfs_freemapdirty, so there's no need to lock to look.
+	 */
+	if (sfs->sfs_freemapdirty) {
+		lock_acquire(sfs->sfs_freemaplock);
+		sfs_jmappull(sfs);
+		lock_release(sfs->sfs_freemaplock);
+	}
+
+	lock_acquire(j->j_lock);
+	KASSERT(j->j_active > 0);
+	j->j_active--;
+	if (j->j_active == 0 && j->j_committing) {
+		cv_broadcast(j->j_cv, j->j_lock);
+	}
+	big = !j->j_committing && j->j_nrun >= (j->j_nblocks - 1) / 4;
+	lock_release(j->j_lock);
+
+	if (big) {
+		/* If this fails, the next sync will fail the same way */
+		(void)sfs_jcommit(sfs);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Commit and checkpoint
+
+/*
+ * Number of table entries that fit in a transaction of at most SPACE
+ * log blocks, counting descriptors and the commit block.
+ */
+static
+unsigned
+sfs_jfit(uint32_t space)
+{
+	unsigned n;
+
+	if (space < 3) {
+		return 0;
+	}
+	n = (space - 1) * SFS_JTAGS / (SFS_JTAGS + 1);
+	while (n > 0 && DIVROUNDUP(n, SFS_JTAGS) + n + 1 > space) {
+		n--;
+	}
+	return n;
+}
+
+/*
+ * Append the first N entries of the running transaction to the log
+ * as one transaction. Each descriptor goes out together with the
+ * blocks it lists, and the commit block after all of them.
+ */
+static
+int
+sfs_jappend(struct sfs_fs *sfs, unsigned n)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *jd = j->j_desc;
+	struct sfs_jentry *e;
+	uint32_t pos;
+	unsigned done, ntags, i;
+	int result;
+
+	pos = j->j_head;
+	e = j->j_run;
+	for (done = 0; done < n; done += ntags) {
+		ntags = n - done;
+		if (ntags > SFS_JTAGS) {
+			ntags = SFS_JTAGS;
+		}
+
+		bzero(jd, sizeof(struct sfs_jdesc));
+		jd->jd_magic = SFS_JMAGIC_DESC;
+		jd->jd_seq = j->j_seq;
+		jd->jd_ntags = ntags;
+		j->j_iov[0].iov_kbase = jd;
+		j->j_iov[0].iov_len = SFS_BLOCKSIZE;
+		for (i=0; i<ntags; i++) {
+			KASSERT(e != NULL);
+			jd->jd_tags[i] = e->je_block;
+			j->j_iov[i+1].iov_kbase = e->je_data;
+			j->j_iov[i+1].iov_len = SFS_BLOCKSIZE;
+			e = e->je_rnext;
+		}
+
+		result = sfs_jgather(sfs, j->j_iov, ntags+1, j->j_start + pos);
+		if (result) {
+			return result;
+		}
+		pos += ntags+1;
+	}
+
+	bzero(jd, sizeof(struct sfs_jdesc));
+	jd->jd_magic = SFS_JMAGIC_COMMIT;
+	jd->jd_seq = j->j_seq;
+	jd->jd_ntags = n;
+	result = sfs_wblock(sfs, jd, j->j_start + pos);
+	if (result) {
+		return result;
+	}
+	pos++;
+
+	/* Those entries are committed now */
+	lock_acquire(j->j_lock);
+	for (i=0; i<n; i++) {
+		e = j->j_run;
+		j->j_run = e->je_rnext;
+		e->je_rnext = NULL;
+		e->je_running = false;
+		if (e->je_committed != NULL) {
+			kfree(e->je_committed);
+			e->je_committed = NULL;
+		}
+	}
+	j->j_nrun -= n;
+	lock_release(j->j_lock);
+
+	j->j_head = pos;
+	j->j_seq++;
+	return 0;
+}
+
+/*
+ * Sort table entries by home location.
+ */
+static
+void
+sfs_jsort(struct sfs_jentry **ents, unsigned num)
+{
+	struct sfs_jentry *tmp;
+	unsigned i, k;
+
+	for (i=1; i<num; i++) {
+		tmp = ents[i];
+		for (k=i; k>0 && ents[k-1]->je_block > tmp->je_block; k--) {
+			ents[k] = ents[k-1];
+		}
+		ents[k] = tmp;
+	}
+}
+
+/*
+ * Contents of table entry E to write home at a checkpoint: what was
+ * last committed, or NULL if nothing has been (so home is current).
+ */
+static
+char *
+sfs_jhomedata(struct sfs_jentry *e)
+{
+	if (!e->je_running) {
+		return e->je_data;
+	}
+	return e->je_committed;
+}
+
+/*
+ * Write everything committed in the table home, in disk order and a
+ * run of adjacent blocks at a time, then start the log over and drop
+ * the entries that aren't in the running transaction. Call holding
+ * j_commitlock with no handles open.
+ */
+static
+int
+sfs_jcheckpoint(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jentry **ents, *e, **pe;
+	unsigned num, i, k, n;
+	int result;
+
+	lock_acquire(j->j_lock);
+	num = j->j_nentries;
+	lock_release(j->j_lock);
+
+	ents = NULL;
+	if (num > 0) {
+		ents = kmalloc(num * sizeof(struct sfs_jentry *));
+		if (ents == NULL) {
+			return ENOMEM;
+		}
+
+		lock_acquire(j->j_lock);
+		k = 0;
+		for (i=0; i<SFS_JHASHSIZE; i++) {
+			for (e = j->j_hash[i]; e != NULL; e = e->je_hnext) {
+				KASSERT(k < num);
+				if (sfs_jhomedata(e) != NULL) {
+					ents[k++] = e;
+				}
+			}
+		}
+		lock_release(j->j_lock);
+		num = k;
+
+		sfs_jsort(ents, num);
+	}
+
+	for (i=0; i<num; i += n) {
+		for (n=0; i+n < num && n < SFS_JTAGS+1; n++) {
+			if (ents[i+n]->je_block != ents[i]->je_block + n) {
+				break;
+			}
+			j->j_iov[n].iov_kbase = sfs_jhomedata(ents[i+n]);
+			j->j_iov[n].iov_len = SFS_BLOCKSIZE;
+		}
+		result = sfs_jgather(sfs, j->j_iov, n, ents[i]->je_block);
+		if (result) {
+			kfree(ents);
+			return result;
+		}
+	}
+	if (ents != NULL) {
+		kfree(ents);
+	}
+
+	/* Nothing in the log is needed any more */
+	result = sfs_jwriteheader(sfs, j->j_start, j->j_seq);
+	if (result) {
+		return result;
+	}
+	j->j_hseq = j->j_seq;
+	j->j_head = 1;
+
+	/*
+	 * Drop what's home now. Anything in the running transaction
+	 * (there if the checkpoint is making room for it; see
+	 * sfs_jcommit) stays until it's committed, but what it last
+	 * committed is home, so its copy of that can go.
+	 */
+	lock_acquire(j->j_lock);
+	for (i=0; i<SFS_JHASHSIZE; i++) {
+		pe = &j->j_hash[i];
+		while ((e = *pe) != NULL) {
+			if (e->je_running) {
+				if (e->je_committed != NULL) {
+					kfree(e->je_committed);
+					e->je_committed = NULL;
+				}
+				pe = &e->je_hnext;
+				continue;
+			}
+			*pe = e->je_hnext;
+			j->j_nentries--;
+			kfree(e->je_data);
+			kfree(e);
+		}
+	}
+	lock_release(j->j_lock);
+
+	return 0;
+}
+
+/*
+ * Let go of the held blocks that are now safe to reuse: all but those
+ * still in the table. Call after a commit, holding j_commitlock with
+ * no handles open, so that every block held has had its freeing
+ * committed.
+ */
+static
+void
+sfs_jrelease(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	uint32_t block, nblocks;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs->sfs_nheld > 0) {
+		nblocks = sfs->sfs_super.sp_nblocks;
+		lock_acquire(j->j_lock);
+		for (block=0; block<nblocks && sfs->sfs_nheld > 0; block++) {
+			if (bitmap_isset(sfs->sfs_heldmap, block) &&
+			    sfs_jlookup(j, block) == NULL) {
+				bitmap_unmark(sfs->sfs_heldmap, block);
+				sfs->sfs_nheld--;
+			}
+		}
+		lock_release(j->j_lock);
+	}
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Commit the running transaction, along with whatever the operations
+ * open right now add to it before they finish. Call with none of the
+ * filesystem's locks held and outside any handle.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	unsigned n;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+
+	lock_acquire(j->j_commitlock);
+
+	lock_acquire(j->j_lock);
+	if (j->j_nrun == 0) {
+		/* Nothing to do; perhaps someone just committed for us */
+		lock_release(j->j_lock);
+		lock_release(j->j_commitlock);
+		return 0;
+	}
+	j->j_committing = true;
+	while (j->j_active > 0) {
+		cv_wait(j->j_cv, j->j_lock);
+	}
+	lock_release(j->j_lock);
+
+	result = 0;
+	while (result == 0 && j->j_nrun > 0) {
+		n = sfs_jfit(j->j_nblocks - j->j_head);
+		if (n < j->j_nrun && j->j_head > 1) {
+			/* Doesn't fit after what's there; make room */
+			result = sfs_jcheckpoint(sfs);
+			if (result == 0 && j->j_freezeroom) {
+				lock_acquire(sfs->sfs_freemaplock);
+				sfs->sfs_frozen = true;
+				lock_release(sfs->sfs_freemaplock);
+			}
+		}
+		else {
+			/* Split it if it doesn't fit even in an empty log */
+			if (n > j->j_nrun) {
+				n = j->j_nrun;
+			}
+			KASSERT(n > 0);
+			result = sfs_jappend(sfs, n);
+		}
+	}
+
+	/* Checkpoint lazily, once the log is half full */
+	if (result == 0 && !j->j_freezeroom &&
+	    j->j_head > j->j_nblocks / 2) {
+		result = sfs_jcheckpoint(sfs);
+	}
+	if (result == 0) {
+		sfs_jrelease(sfs);
+	}
+
+	lock_acquire(j->j_lock);
+	j->j_committing = false;
+	cv_broadcast(j->j_cv, j->j_lock);
+	lock_release(j->j_lock);
+
+	lock_release(j->j_commitlock);
+	return result;
+}
+
+/*
+ * Commit everything, including freemap changes not yet picked up.
+ */
+int
+sfs_jsync(struct sfs_fs *sfs)
+{
+	/* An empty handle picks up the freemap; see sfs_jend */
+	sfs_jbegin(sfs);
+	sfs_jend(sfs);
+	return sfs_jcommit(sfs);
+}
+
+/*
+ * Count the transactions committed since mount and the ones of those
+ * still in the log, for testing; see sfs_logstat.
+ */
+void
+sfs_jcounts(struct sfs_fs *sfs, uint32_t *ncommits, uint32_t *nlogged)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	lock_acquire(j->j_commitlock);
+	*ncommits = j->j_seq - j->j_mountseq;
+	*nlogged = j->j_seq - j->j_hseq;
+	lock_release(j->j_commitlock);
+}
+
+/*
+ * Also for testing: stop checkpointing lazily, so the log fills up
+ * and a commit has to make room in it, and freeze the volume (see
+ * sfs_freeze) as soon as that checkpoint is done. Lasts until
+ * unmount.
+ */
+void
+sfs_jfreezeroom(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	lock_acquire(j->j_commitlock);
+	j->j_freezeroom = true;
+	lock_release(j->j_commitlock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Mount and unmount
+
+/*
+ * Replay the journal, if the volume has one. Called from mount after
+ * the superblock is loaded and before anything else is read, so uses
+ * nothing but the superblock and the device.
+ *
+ * Transactions are replayed in sequence from the one the header
+ * names, for as long as the next one in the log is complete; one
+ * without its commit block was cut short by the crash, and none of it
+ * is used.
+ */
+int
+sfs_jrecover(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct sfs_jheader *jh;
+	struct sfs_jdesc *jd;
+	char *buf;
+	uint32_t seq, pos, txstart, p, total, ntx;
+	unsigned i;
+	bool complete;
+	int result;
+
+	if (sp->sp_jblocks == 0) {
+		return 0;
+	}
+
+	if (sp->sp_jblocks < SFS_JMINBLOCKS ||
+	    sp->sp_jstart <= SFS_MAP_LOCATION ||
+	    sp->sp_jstart >= sp->sp_nblocks ||
+	    sp->sp_jblocks > sp->sp_nblocks - sp->sp_jstart) {
+		kprintf("sfs: %s: bad journal location %u (%u blocks)\n",
+			sp->sp_volname, sp->sp_jstart, sp->sp_jblocks);
+		return EINVAL;
+	}
+
+	jh = kmalloc(sizeof(struct sfs_jheader));
+	jd = kmalloc(sizeof(struct sfs_jdesc));
+	buf = kmalloc(SFS_BLOCKSIZE);
+	if (jh == NULL || jd == NULL || buf == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	result = sfs_rblock(sfs, jh, sp->sp_jstart);
+	if (result) {
+		goto out;
+	}
+	if (jh->jh_magic != SFS_JMAGIC_HEADER) {
+		kprintf("sfs: %s: bad journal header (magic 0x%x)\n",
+			sp->sp_volname, jh->jh_magic);
+		result = EINVAL;
+		goto out;
+	}
+
+	seq = jh->jh_seq;
+	pos = 1;
+	ntx = 0;
+	while (1) {
+		/* See if the next transaction is all there */
+		txstart = pos;
+		total = 0;
+		complete = false;
+		while (pos < sp->sp_jblocks) {
+			result = sfs_rblock(sfs, jd, sp->sp_jstart + pos);
+			if (result) {
+				goto out;
+			}
+			if (jd->jd_seq != seq) {
+				break;
+			}
+			if (jd->jd_magic == SFS_JMAGIC_COMMIT) {
+				complete = (jd->jd_ntags == total);
+				break;
+			}
+			if (jd->jd_magic != SFS_JMAGIC_DESC ||
+			    jd->jd_ntags == 0 || jd->jd_ntags > SFS_JTAGS ||
+			    pos + 1 + jd->jd_ntags >= sp->sp_jblocks) {
+				break;
+			}
+			total += jd->jd_ntags;
+			pos += 1 + jd->jd_ntags;
+		}
+		if (!complete) {
+			break;
+		}
+
+		/* It is; copy its blocks home */
+		for (p = txstart; p < pos; p += 1 + jd->jd_ntags) {
+			result = sfs_rblock(sfs, jd, sp->sp_jstart + p);
+			if (result) {
+				goto out;
+			}
+			for (i=0; i<jd->jd_ntags; i++) {
+				if (jd->jd_tags[i] >= sp->sp_nblocks) {
+					kprintf("sfs: %s: journal: bad block "
+						"%u in transaction %u\n",
+						sp->sp_volname,
+						jd->jd_tags[i], seq);
+					result = EINVAL;
+					goto out;
+				}
+				result = sfs_rblock(sfs, buf,
+						    sp->sp_jstart + p + 1 + i);
+				if (result) {
+					goto out;
+				}
+				result = sfs_wblock(sfs, buf, jd->jd_tags[i]);
+				if (result) {
+					goto out;
+				}
+			}
+		}
+		pos++;
+		seq++;
+		ntx++;
+	}
+
+	if (ntx > 0) {
+		kprintf("sfs: %s: replayed %u journal transaction%s\n",
+			sp->sp_volname, ntx, ntx == 1 ? "" : "s");
+		result = sfs_jwriteheader(sfs, sp->sp_jstart, seq);
+	}
+
+ out:
+	if (buf != NULL) {
+		kfree(buf);
+	}
+	if (jd != NULL) {
+		kfree(jd);
+	}
+	if (jh != NULL) {
+		kfree(jh);
+	}
+	return result;
+}
+
+/*
+ * Put a journal on a volume that doesn't have one yet: SFS_JBLOCKS
+ * free blocks in a row, looking from the middle of the volume so it's
+ * never too far from anything. Volumes that are too small or too
+ * full are left without.
+ */
+static
+int
+sfs_jcreate(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	uint32_t nblocks = sp->sp_nblocks;
+	uint32_t block, len, seen, start, i;
+	char *bitdata;
+	void *zeros;
+	int result;
+
+	if (nblocks < SFS_JMINVOLUME) {
+		return 0;
+	}
+
+	block = nblocks / 2;
+	len = 0;
+	for (seen = 0; seen < nblocks && len < SFS_JBLOCKS; seen++) {
+		if (block == nblocks) {
+			/* Runs don't wrap */
+			block = 0;
+			len = 0;
+		}
+		if (bitmap_isset(sfs->sfs_freemap, block)) {
+			len = 0;
+		}
+		else {
+			len++;
+		}
+		block++;
+	}
+	if (len < SFS_JBLOCKS) {
+		kprintf("sfs: %s: no room for a journal\n", sp->sp_volname);
+		return 0;
+	}
+	start = block - SFS_JBLOCKS;
+
+	/* Claim the blocks, on disk before anything points at them */
+	for (i=0; i<SFS_JBLOCKS; i++) {
+		bitmap_mark(sfs->sfs_freemap, start+i);
+	}
+	bitdata = bitmap_getdata(sfs->sfs_freemap);
+	for (i = start / SFS_BLOCKBITS;
+	     i <= (start + SFS_JBLOCKS - 1) / SFS_BLOCKBITS; i++) {
+		result = sfs_wblock(sfs, bitdata + i*SFS_BLOCKSIZE,
+				    SFS_MAP_LOCATION+i);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* An empty log: the header, then nothing valid */
+	result = sfs_jwriteheader(sfs, start, 1);
+	if (result) {
+		return result;
+	}
+	zeros = kmalloc(SFS_BLOCKSIZE);
+	if (zeros == NULL) {
+		return ENOMEM;
+	}
+	bzero(zeros, SFS_BLOCKSIZE);
+	result = sfs_wblock(sfs, zeros, start+1);
+	kfree(zeros);
+	if (result) {
+		return result;
+	}
+
+	sp->sp_jstart = start;
+	sp->sp_jblocks = SFS_JBLOCKS;
+	result = sfs_wblock(sfs, sp, SFS_SB_LOCATION);
+	if (result) {
+		sp->sp_jstart = sp->sp_jblocks = 0;
+		return result;
+	}
+
+	kprintf("sfs: %s: created %u-block journal at block %u\n",
+		sp->sp_volname, SFS_JBLOCKS, start);
+	return 0;
+}
+
+/*
+ * Set up the journal for use; called from mount once the freemap is
+ * loaded (and so after sfs_jrecover). Creates one first if need be.
+ * Leaves sfs_journal NULL if the volume can't have one.
+ */
+int
+sfs_jstart(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct sfs_journal *j;
+	struct sfs_jheader *jh;
+	unsigned i;
+	int result;
+
+	if (sp->sp_jblocks == 0) {
+		result = sfs_jcreate(sfs);
+		if (result) {
+			return result;
+		}
+		if (sp->sp_jblocks == 0) {
+			return 0;
+		}
+	}
+
+	j = kmalloc(sizeof(struct sfs_journal));
+	if (j == NULL) {
+		return ENOMEM;
+	}
+	j->j_desc = kmalloc(sizeof(struct sfs_jdesc));
+	if (j->j_desc == NULL) {
+		kfree(j);
+		return ENOMEM;
+	}
+
+	/* The header says where the log's sequence numbers are up to */
+	jh = (struct sfs_jheader *)j->j_desc;
+	result = sfs_rblock(sfs, jh, sp->sp_jstart);
+	if (result) {
+		kfree(j->j_desc);
+		kfree(j);
+		return result;
+	}
+	KASSERT(jh->jh_magic == SFS_JMAGIC_HEADER);
+	j->j_seq = jh->jh_seq;
+	j->j_hseq = j->j_mountseq = jh->jh_seq;
+
+	j->j_lock = lock_create("sfs_journal");
+	if (j->j_lock == NULL) {
+		goto nomem;
+	}
+	j->j_cv = cv_create("sfs_journal");
+	if (j->j_cv == NULL) {
+		lock_destroy(j->j_lock);
+		goto nomem;
+	}
+	j->j_commitlock = lock_create("sfs_jcommit");
+	if (j->j_commitlock == NULL) {
+		cv_destroy(j->j_cv);
+		lock_destroy(j->j_lock);
+		goto nomem;
+	}
+	sfs->sfs_heldmap = bitmap_create(SFS_BITMAPSIZE(sp->sp_nblocks));
+	if (sfs->sfs_heldmap == NULL) {
+		lock_destroy(j->j_commitlock);
+		cv_destroy(j->j_cv);
+		lock_destroy(j->j_lock);
+		goto nomem;
+	}
+	sfs->sfs_nheld = 0;
+
+	j->j_active = 0;
+	j->j_committing = false;
+	j->j_freezeroom = false;
+	for (i=0; i<SFS_JHASHSIZE; i++) {
+		j->j_hash[i] = NULL;
+	}
+	j->j_nentries = 0;
+	j->j_run = NULL;
+	j->j_nrun = 0;
+	j->j_start = sp->sp_jstart;
+	j->j_nblocks = sp->sp_jblocks;
+	j->j_head = 1;
+
+	sfs->sfs_journal = j;
+	return 0;
+
+ nomem:
+	kfree(j->j_desc);
+	kfree(j);
+	return ENOMEM;
+}
+
+/*
+ * Commit and checkpoint everything, leaving the log empty, so the
+ * volume is consistent on disk without it. Called from unmount once
+ * no vnodes are left, so there are no handles open.
+ */
+int
+sfs_jflush(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+
+	result = sfs_jsync(sfs);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(j->j_commitlock);
+	KASSERT(j->j_active == 0);
+	if (j->j_nentries > 0 || j->j_head > 1) {
+		result = sfs_jcheckpoint(sfs);
+	}
+	if (result == 0) {
+		sfs_jrelease(sfs);
+	}
+	lock_release(j->j_commitlock);
+
+	return result;
+}
+
+/*
+ * Free the journal state. Call after a successful sfs_jflush.
+ */
+void
+sfs_jstop(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	if (j == NULL) {
+		return;
+	}
+
+	KASSERT(j->j_nentries == 0);
+	KASSERT(sfs->sfs_nheld == 0);
+
+	bitmap_destroy(sfs->sfs_heldmap);
+	sfs->sfs_heldmap = NULL;
+	lock_destroy(j->j_commitlock);
+	cv_destroy(j->j_cv);
+	lock_destroy(j->j_lock);
+	kfree(j->j_desc);
+	kfree(j);
+	sfs->sfs_journal = NULL;
+}
@@ -49,6 +49,10 @@
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
 			 struct sfs_vnode **ret);
 
+/* With the vnode ops */
+static int sfs_dotruncate(struct sfs_vnode *sv, off_t len);
+static int sfs_wbuf_flush(struct sfs_vnode *sv);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -63,19 +67,82 @@ sfs_clearblock(struct sfs_fs *sfs, uint32_t block)
 	return sfs_wblock(sfs, zeros, block);
 }
 
-/* Write an on-disk inode structure back out to disk. */
+/*
+ * Put a vnode on the filesystem's list of dirty inodes so sfs_sync
+ * can find it without looking at every loaded vnode.
+ */
+static
+void
+sfs_dlist_add(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	spinlock_acquire(&sfs->sfs_dirtylock);
+	if (sv->sv_dpprev == NULL) {
+		sv->sv_dnext = sfs->sfs_dirtyinodes;
+		if (sv->sv_dnext != NULL) {
+			sv->sv_dnext->sv_dpprev = &sv->sv_dnext;
+		}
+		sv->sv_dpprev = &sfs->sfs_dirtyinodes;
+		sfs->sfs_dirtyinodes = sv;
+	}
+	spinlock_release(&sfs->sfs_dirtylock);
+}
+
+/*
+ * Mark an inode modified, and put it on the dirty list.
+ *
+ * With a journal the inode goes straight into the running
+ * transaction instead, so it commits along with the rest of the
+ * operation; only if that fails does it wait on the dirty list.
+ */
+static
+void
+sfs_dirty_inode(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	if (sfs->sfs_journal != NULL &&
+	    sfs_jwrite(sfs, &sv->sv_i, sv->sv_ino) == 0) {
+		sv->sv_dirty = false;
+		return;
+	}
+
+	sv->sv_dirty = true;
+	sfs_dlist_add(sv);
+}
+
+/*
+ * Write an on-disk inode structure back out to disk. Delayed writes
+ * should be flushed first, as they change the inode.
+ */
 static
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	int result;
+
 	if (sv->sv_dirty) {
-		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		result = sfs_jwrite(sfs, &sv->sv_i, sv->sv_ino);
 		if (result) {
 			return result;
 		}
 		sv->sv_dirty = false;
 	}
+
+	/* Clean now, unless data is still held back; off the dirty list */
+	spinlock_acquire(&sfs->sfs_dirtylock);
+	if (sv->sv_dpprev != NULL && sv->sv_wcount == 0) {
+		*sv->sv_dpprev = sv->sv_dnext;
+		if (sv->sv_dnext != NULL) {
+			sv->sv_dnext->sv_dpprev = sv->sv_dpprev;
+		}
+		sv->sv_dnext = NULL;
+		sv->sv_dpprev = NULL;
+	}
+	spinlock_release(&sfs->sfs_dirtylock);
+
 	return 0;
 }
 
@@ -84,37 +151,275 @@ sfs_sync_inode(struct sfs_vnode *sv)
 // Space allocation
 
 /*
- * Allocate a block.
+ * Check if a block is free for a new allocation: not in use, not
+ * set aside in some file's reservation window, and not recently freed
+ * and held back by the journal. Call with sfs_freemaplock held, as
+ * for the rest of the bitmap scanning below.
  */
 static
-int
-sfs_balloc(struct sfs_fs *sfs, uint32_t *diskblock)
+bool
+sfs_bavail(struct sfs_fs *sfs, uint32_t diskblock)
 {
-	int result;
+	return !bitmap_isset(sfs->sfs_freemap, diskblock) &&
+		!bitmap_isset(sfs->sfs_resvmap, diskblock) &&
+		(sfs->sfs_heldmap == NULL ||
+		 !bitmap_isset(sfs->sfs_heldmap, diskblock));
+}
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
-	if (result) {
-		return result;
+/*
+ * Find a run of free blocks, looking forward from GOAL and wrapping
+ * around at the end of the volume. The first run of at least WANT
+ * blocks wins; if there isn't one, settle for the longest run seen.
+ * Hands back the start of the run (0 if the disk is full, since block
+ * 0 is the superblock and never free) and its length, capped at WANT.
+ */
+static
+uint32_t
+sfs_bfindrun(struct sfs_fs *sfs, uint32_t goal, uint32_t want,
+	     uint32_t *runlen)
+{
+	uint32_t nblocks = sfs->sfs_super.sp_nblocks;
+	uint32_t block, len, seen;
+	uint32_t best = 0, bestlen = 0;
+
+	KASSERT(want > 0);
+
+	if (goal >= nblocks) {
+		goal = 0;
+	}
+
+	block = goal;
+	seen = 0;
+	while (seen < nblocks) {
+		if (!sfs_bavail(sfs, block)) {
+			len = 1;
+		}
+		else {
+			/* Runs don't wrap; the end of the disk ends them */
+			len = 0;
+			while (block+len < nblocks && len < want &&
+			       sfs_bavail(sfs, block+len)) {
+				len++;
+			}
+			if (len > bestlen) {
+				best = block;
+				bestlen = len;
+			}
+			if (len >= want) {
+				break;
+			}
+		}
+		block += len;
+		seen += len;
+		if (block >= nblocks) {
+			block = 0;
+		}
+	}
+
+	*runlen = bestlen;
+	return best;
+}
+
+/*
+ * Note that the freemap block holding DISKBLOCK's bit needs writing
+ * out. Call with sfs_freemaplock held.
+ */
+static
+void
+sfs_bdirty(struct sfs_fs *sfs, uint32_t diskblock)
+{
+	uint32_t mapblock = diskblock / SFS_BLOCKBITS;
+
+	if (!bitmap_isset(sfs->sfs_mapdirty, mapblock)) {
+		bitmap_mark(sfs->sfs_mapdirty, mapblock);
 	}
 	sfs->sfs_freemapdirty = true;
+}
+
+/*
+ * Number of blocks that can still be handed out: those free in the
+ * bitmap, less the ones the journal is holding back, the ones in
+ * reservation windows, and the ones promised to delayed writes. Call
+ * with sfs_freemaplock held.
+ */
+static
+uint32_t
+sfs_bspare(struct sfs_fs *sfs)
+{
+	uint32_t taken;
+
+	taken = sfs->sfs_nheld + sfs->sfs_nresv + sfs->sfs_ndelayed;
+	return sfs->sfs_nfree > taken ? sfs->sfs_nfree - taken : 0;
+}
+
+/*
+ * Same, for a particular file, which can also use what's left of its
+ * own reservation window.
+ */
+static
+uint32_t
+sfs_bspare_file(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	return sfs_bspare(sfs) + (sv->sv_resvend - sv->sv_resvnext);
+}
+
+/*
+ * Take a block that was found free and mark it in use. Call with
+ * sfs_freemaplock held. The caller clears the block, after letting go
+ * of the lock so other allocations needn't wait for the disk.
+ */
+static
+void
+sfs_bclaim(struct sfs_fs *sfs, uint32_t diskblock)
+{
+	if (diskblock >= sfs->sfs_super.sp_nblocks) {
+		panic("sfs: balloc: invalid block %u\n", diskblock);
+	}
 
-	if (*diskblock >= sfs->sfs_super.sp_nblocks) {
-		panic("sfs: balloc: invalid block %u\n", *diskblock);
+	bitmap_mark(sfs->sfs_freemap, diskblock);
+	sfs->sfs_nfree--;
+	sfs_bdirty(sfs, diskblock);
+}
+
+/*
+ * Allocate a block, as close after GOAL as possible.
+ */
+static
+int
+sfs_balloc(struct sfs_fs *sfs, uint32_t goal, uint32_t *diskblock)
+{
+	uint32_t len;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs_bspare(sfs) == 0) {
+		lock_release(sfs->sfs_freemaplock);
+		return ENOSPC;
 	}
+	*diskblock = sfs_bfindrun(sfs, goal, 1, &len);
+	if (len == 0) {
+		lock_release(sfs->sfs_freemaplock);
+		return ENOSPC;
+	}
+	sfs_bclaim(sfs, *diskblock);
+	lock_release(sfs->sfs_freemaplock);
 
 	/* Clear block before returning it */
 	return sfs_clearblock(sfs, *diskblock);
 }
 
 /*
- * Free a block.
+ * Give back whatever is left of a file's reservation window.
+ */
+static
+void
+sfs_resv_release(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	if (sv->sv_resvnext >= sv->sv_resvend) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+	while (sv->sv_resvnext < sv->sv_resvend) {
+		bitmap_unmark(sfs->sfs_resvmap, sv->sv_resvnext);
+		sfs->sfs_nresv--;
+		sv->sv_resvnext++;
+	}
+	lock_release(sfs->sfs_freemaplock);
+	sv->sv_resvnext = sv->sv_resvend = 0;
+}
+
+/*
+ * Allocate a block (data or indirect) for a file.
+ *
+ * Each file being written gets a reservation window: a run of up to
+ * SFS_RESVBLOCKS free blocks, placed right after the last block the
+ * file allocated (or right after its inode, for a new file), that
+ * other allocations steer around. Blocks then come out of the window
+ * in order, so a file written sequentially is laid out contiguously
+ * even with other files growing at the same time. Reservations live
+ * only in memory (sfs_resvmap); they never reach the disk and are
+ * dropped on last close and on truncate.
+ */
+static
+int
+sfs_balloc_file(struct sfs_vnode *sv, uint32_t *diskblock, bool clear)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t goal, start, len, i;
+	bool promised;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	lock_acquire(sfs->sfs_freemaplock);
+
+	/* Blocks for held-back data were set aside at write time */
+	promised = sv->sv_wresv > 0;
+	if (promised) {
+		sv->sv_wresv--;
+		sfs->sfs_ndelayed--;
+	}
+	else if (sfs_bspare_file(sv) == 0) {
+		lock_release(sfs->sfs_freemaplock);
+		return ENOSPC;
+	}
+
+	if (sv->sv_resvnext >= sv->sv_resvend) {
+		goal = sv->sv_lastalloc != 0 ? sv->sv_lastalloc+1 :
+			sv->sv_ino+1;
+		start = sfs_bfindrun(sfs, goal, SFS_RESVBLOCKS, &len);
+		if (len == 0) {
+			if (promised) {
+				sv->sv_wresv++;
+				sfs->sfs_ndelayed++;
+			}
+			lock_release(sfs->sfs_freemaplock);
+			return ENOSPC;
+		}
+		for (i=0; i<len; i++) {
+			bitmap_mark(sfs->sfs_resvmap, start+i);
+		}
+		sfs->sfs_nresv += len;
+		sv->sv_resvnext = start;
+		sv->sv_resvend = start + len;
+	}
+
+	*diskblock = sv->sv_resvnext++;
+	bitmap_unmark(sfs->sfs_resvmap, *diskblock);
+	sfs->sfs_nresv--;
+	sfs_bclaim(sfs, *diskblock);
+	lock_release(sfs->sfs_freemaplock);
+
+	sv->sv_lastalloc = *diskblock;
+
+	/* Clear block before returning it, unless it's about to be written */
+	if (!clear) {
+		return 0;
+	}
+	return sfs_clearblock(sfs, *diskblock);
+}
+
+/*
+ * Free a block. With a journal, it can't be handed out again until
+ * the journal says so; see sfs_journal.c.
  */
 static
 void
 sfs_bfree(struct sfs_fs *sfs, uint32_t diskblock)
 {
+	lock_acquire(sfs->sfs_freemaplock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	sfs->sfs_nfree++;
+	sfs_bdirty(sfs, diskblock);
+	if (sfs->sfs_heldmap != NULL &&
+	    !bitmap_isset(sfs->sfs_heldmap, diskblock)) {
+		bitmap_mark(sfs->sfs_heldmap, diskblock);
+		sfs->sfs_nheld++;
+	}
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -124,45 +429,145 @@ static
 int
 sfs_bused(struct sfs_fs *sfs, uint32_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: sfs_bused called on out of range block %u\n", 
 		      diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////
 //
 // Block mapping/inode maintenance
 
+/*
+ * Number of file blocks reachable through one pointer at each depth
+ * of indirection: a single indirect block maps SFS_DBPERIDB blocks, a
+ * double indirect block SFS_DBPERIDB^2, and a triple indirect block
+ * SFS_DBPERIDB^3.
+ */
+static const uint32_t sfs_idspan[SFS_NINDLEVELS+1] = {
+	1,
+	SFS_DBPERIDB,
+	SFS_DBPERIDB*SFS_DBPERIDB,
+	SFS_DBPERIDB*SFS_DBPERIDB*SFS_DBPERIDB,
+};
+
+/*
+ * Return the inode field holding the top of the indirect tree with
+ * LEVELS levels.
+ */
+static
+uint32_t *
+sfs_idroot(struct sfs_vnode *sv, int levels)
+{
+	switch (levels) {
+	    case 1: return &sv->sv_i.sfi_indirect;
+	    case 2: return &sv->sv_i.sfi_dindirect;
+	    case 3: return &sv->sv_i.sfi_tindirect;
+	}
+	panic("sfs: idroot: bad indirect level %d\n", levels);
+	return NULL;
+}
+
+/*
+ * Get the contents of indirect block IDBLOCK, which sits LEVEL levels
+ * above the data blocks, through the vnode's indirect block cache. If
+ * FRESH is set the block was just allocated (and cleared), so there's
+ * no need to read it.
+ */
+static
+int
+sfs_idload(struct sfs_vnode *sv, int level, uint32_t idblock, bool fresh,
+	   uint32_t **ret)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_idcache *ic;
+	int result;
+
+	KASSERT(level >= 1 && level <= SFS_NINDLEVELS);
+
+	if (sv->sv_idcache == NULL) {
+		sv->sv_idcache = kmalloc(SFS_NINDLEVELS *
+					 sizeof(struct sfs_idcache));
+		if (sv->sv_idcache == NULL) {
+			return ENOMEM;
+		}
+		bzero(sv->sv_idcache,
+		      SFS_NINDLEVELS * sizeof(struct sfs_idcache));
+	}
+	ic = &sv->sv_idcache[level-1];
+
+	if (ic->ic_block != idblock) {
+		if (fresh) {
+			bzero(ic->ic_data, sizeof(ic->ic_data));
+		}
+		else {
+			ic->ic_block = 0;
+			result = sfs_rblock(sfs, ic->ic_data, idblock);
+			if (result) {
+				return result;
+			}
+		}
+		ic->ic_block = idblock;
+	}
+	*ret = ic->ic_data;
+	return 0;
+}
+
+/*
+ * Forget everything in the indirect block cache. Used when blocks
+ * are being freed, since a freed block number can come back later
+ * holding something else.
+ */
+static
+void
+sfs_idflush(struct sfs_vnode *sv)
+{
+	unsigned i;
+
+	if (sv->sv_idcache != NULL) {
+		for (i=0; i<SFS_NINDLEVELS; i++) {
+			sv->sv_idcache[i].ic_block = 0;
+		}
+	}
+}
+
+/*
+ * Value for sfs_bmap's DOALLOC when the caller is about to write the
+ * whole block anyway, so a newly allocated data block need not be
+ * cleared first.
+ */
+#define SFS_BMAP_NOCLEAR 2
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
  * allocated.
+ *
+ * Past the direct blocks, a file's blocks are reached through the
+ * single, then the double, then the triple indirect block.
  */
 static
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	 uint32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-	uint32_t block;
+	uint32_t block, origblock;
 	uint32_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t *idroot, *idbuf;
+	uint32_t idoff;
+	int levels, level;
+	bool fresh;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
 	/*
 	 * If the block we want is one of the direct blocks...
 	 */
@@ -176,14 +581,15 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_balloc_file(sv, &block,
+						 doalloc != SFS_BMAP_NOCLEAR);
 			if (result) {
 				return result;
 			}
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
-			sv->sv_dirty = true;
+			sfs_dirty_inode(sv);
 		}
 
 		/*
@@ -198,94 +604,354 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * It's not a direct block. Work out which indirect tree it's
+	 * in and its offset within that tree.
 	 */
-
+	origblock = fileblock;
 	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum > 0) {
+	for (levels = 1; levels <= SFS_NINDLEVELS; levels++) {
+		if (fileblock < sfs_idspan[levels]) {
+			break;
+		}
+		fileblock -= sfs_idspan[levels];
+	}
+	if (levels > SFS_NINDLEVELS) {
+		/* Past the end of the triple indirect block */
 		return EFBIG;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	idroot = sfs_idroot(sv, levels);
+	idblock = *idroot;
+	fresh = false;
 
 	if (idblock==0 && !doalloc) {
 		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
+		 * Nothing allocated there, and we weren't asked to
+		 * allocate anything, so pretend the whole tree is zeros.
 		 */
 		*diskblock = 0;
 		return 0;
 	}
 	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_balloc_file(sv, &idblock, true);
 		if (result) {
 			return result;
 		}
 
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+		/* Remember the block we just allocated; mark inode dirty */
+		*idroot = idblock;
+		sfs_dirty_inode(sv);
+		fresh = true;
+	}
 
-		/* Mark the inode dirty */
-		sv->sv_dirty = true;
+	/*
+	 * Walk down the tree one indirect block at a time, allocating
+	 * missing blocks along the way if requested.
+	 */
+	for (level = levels; level >= 1; level--) {
+		result = sfs_idload(sv, level, idblock, fresh, &idbuf);
+		if (result) {
+			return result;
+		}
+
+		idoff = (fileblock / sfs_idspan[level-1]) % SFS_DBPERIDB;
+		block = idbuf[idoff];
+		fresh = false;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		if (block==0 && !doalloc) {
+			*diskblock = 0;
+			return 0;
+		}
+		else if (block==0) {
+			/* Only the last level down is a data block */
+			result = sfs_balloc_file(sv, &block, level > 1 ||
+						 doalloc != SFS_BMAP_NOCLEAR);
+			if (result) {
+				return result;
+			}
+
+			/* Remember the block we allocated */
+			idbuf[idoff] = block;
+
+			/* The indirect block is now dirty; write it back */
+			result = sfs_jwrite(sfs, idbuf, idblock);
+			if (result) {
+				return result;
+			}
+			fresh = true;
+		}
+
+		if (!sfs_bused(sfs, block)) {
+			panic("sfs: Block %u (level %d for block %u of "
+			      "file %u) marked free\n",
+			      block, level-1, origblock, sv->sv_ino);
+		}
+		idblock = block;
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
+
+	/* Hand back the result and return. */
+	*diskblock = idblock;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Inline data
+//
+// New files and directories start out with SFS_IF_INLINE set and
+// their contents in the inode itself, so a small one costs a single
+// block and a single read. Once one grows past SFS_INLINESIZE, its
+// contents move out to an ordinary first block and it stays that way.
+
+/*
+ * Move a file's inline contents out to a data block. Call with
+ * sv_lock held, inside a journal handle.
+ */
+static
+int
+sfs_inline_promote(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t diskblock;
+	char *iobuf;
+	int result;
+
+	KASSERT(sv->sv_i.sfi_flags & SFS_IF_INLINE);
+
+	if (sv->sv_i.sfi_size > 0) {
+		iobuf = kmalloc(SFS_BLOCKSIZE);
+		if (iobuf == NULL) {
+			return ENOMEM;
+		}
+		bzero(iobuf, SFS_BLOCKSIZE);
+		memcpy(iobuf, sv->sv_i.sfi_inline, sv->sv_i.sfi_size);
+
+		result = sfs_bmap(sv, 0, SFS_BMAP_NOCLEAR, &diskblock);
 		if (result) {
+			kfree(iobuf);
 			return result;
 		}
+
+		/* Directory blocks are metadata and go through the journal */
+		if (sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+			result = sfs_jwrite(sfs, iobuf, diskblock);
+		}
+		else {
+			result = sfs_wblock(sfs, iobuf, diskblock);
+		}
+		kfree(iobuf);
+		if (result) {
+			/* Still inline; forget the block */
+			sv->sv_i.sfi_direct[0] = 0;
+			sfs_bfree(sfs, diskblock);
+			sfs_dirty_inode(sv);
+			return result;
+		}
+	}
+
+	sv->sv_i.sfi_flags &= ~SFS_IF_INLINE;
+	bzero(sv->sv_i.sfi_inline, sizeof(sv->sv_i.sfi_inline));
+	sfs_dirty_inode(sv);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Delayed writes
+//
+// Blocks written past the allocated part of a regular file are held
+// back in sv_wbuf, up to SFS_CLUSTERBLOCKS consecutive ones, and only
+// given disk blocks when they're flushed. The whole run is then
+// allocated from the reservation window at once and written with as
+// few device requests as the allocation allows, and since each block
+// is written in full it needn't be cleared first.
+//
+// The space is promised when a block is taken in (sv_wresv, counted
+// in sfs_ndelayed), so a full disk fails the write() rather than the
+// later flush, which may have nobody to report to.
+
+/*
+ * Set aside N blocks for SV's held-back data.
+ */
+static
+int
+sfs_wresv_get(struct sfs_vnode *sv, uint32_t n)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs_bspare_file(sv) < n) {
+		lock_release(sfs->sfs_freemaplock);
+		return ENOSPC;
+	}
+	sfs->sfs_ndelayed += n;
+	sv->sv_wresv += n;
+	lock_release(sfs->sfs_freemaplock);
+	return 0;
+}
+
+/*
+ * Give back up to N of the blocks set aside for SV.
+ */
+static
+void
+sfs_wresv_put(struct sfs_vnode *sv, uint32_t n)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	if (n > sv->sv_wresv) {
+		n = sv->sv_wresv;
+	}
+	if (n == 0) {
+		return;
+	}
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs->sfs_ndelayed -= n;
+	sv->sv_wresv -= n;
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Give the held blocks disk blocks and write them out. Call with
+ * sv_lock held, inside a journal handle.
+ */
+static
+int
+sfs_wbuf_flush(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t disk[SFS_CLUSTERBLOCKS];
+	struct iovec iov;
+	struct uio ku;
+	uint32_t n, i, run;
+	int result, result2;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	result = 0;
+	for (n=0; n<sv->sv_wcount; n++) {
+		result = sfs_bmap(sv, sv->sv_wstart + n, SFS_BMAP_NOCLEAR,
+				  &disk[n]);
+		if (result) {
+			break;
+		}
+	}
+
+	/*
+	 * Write each run of consecutive disk blocks in one go. If we
+	 * ran out of space partway, the blocks that did get allocated
+	 * still have to be written, or they'd show garbage.
+	 */
+	for (i=0; i<n; i += run) {
+		for (run=1; i+run < n && disk[i+run] == disk[i]+run; run++) {
+			/* nothing */
+		}
+		uio_kinit(&iov, &ku, sv->sv_wbuf + i*SFS_BLOCKSIZE,
+			  run*SFS_BLOCKSIZE, disk[i]*(off_t)SFS_BLOCKSIZE,
+			  UIO_WRITE);
+		result2 = sfs_rwblock(sfs, &ku);
+		if (result2) {
+			return result2;
+		}
+	}
+
+	/* Keep whatever is left over */
+	if (n > 0 && n < sv->sv_wcount) {
+		memmove(sv->sv_wbuf, sv->sv_wbuf + n*SFS_BLOCKSIZE,
+			(sv->sv_wcount - n) * SFS_BLOCKSIZE);
+	}
+	sv->sv_wstart += n;
+	sv->sv_wcount -= n;
+
+	/* Whatever wasn't needed for indirect blocks goes back */
+	if (sv->sv_wcount == 0) {
+		sfs_wresv_put(sv, sv->sv_wresv);
+	}
+	return result;
+}
+
+/*
+ * Try to do a write to one block of a regular file by holding it in
+ * sv_wbuf. Sets *DONE if so; otherwise the caller writes to disk as
+ * usual. Blocks that already have disk blocks aren't held back.
+ */
+static
+int
+sfs_wbuf_write(struct sfs_vnode *sv, struct uio *uio,
+	       uint32_t skipstart, uint32_t len, bool *done)
+{
+	uint32_t fileblock, diskblock, need;
+	char *slot;
+	int result;
+
+	*done = false;
+	if (uio->uio_rw != UIO_WRITE || sv->sv_i.sfi_type != SFS_TYPE_FILE) {
+		return 0;
+	}
+
+	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+
+	/* Already held? Then just update it. */
+	if (sv->sv_wcount > 0 && fileblock >= sv->sv_wstart &&
+	    fileblock < sv->sv_wstart + sv->sv_wcount) {
+		slot = sv->sv_wbuf + (fileblock - sv->sv_wstart)*SFS_BLOCKSIZE;
+		result = uiomove(slot + skipstart, len, uio);
+		if (result) {
+			return result;
+		}
+		*done = true;
+		return 0;
+	}
+
+	result = sfs_bmap(sv, fileblock, 0, &diskblock);
+	if (result) {
+		return result;
+	}
+	if (diskblock != 0) {
+		return 0;
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
-
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+	/* Only a run of consecutive blocks is held; start a new one */
+	if (sv->sv_wcount > 0 &&
+	    (fileblock != sv->sv_wstart + sv->sv_wcount ||
+	     sv->sv_wcount == SFS_CLUSTERBLOCKS)) {
+		result = sfs_wbuf_flush(sv);
 		if (result) {
 			return result;
 		}
+	}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
-
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
+	if (sv->sv_wbuf == NULL) {
+		sv->sv_wbuf = kmalloc(SFS_CLUSTERBLOCKS * SFS_BLOCKSIZE);
+		if (sv->sv_wbuf == NULL) {
+			/* Fall back to writing it directly */
+			return 0;
 		}
 	}
 
-	/* Hand back the result and return. */
-	if (block != 0 && !sfs_bused(sfs, block)) {
-		panic("sfs: Data block %u (block %u of file %u) marked free\n",
-		      block, fileblock, sv->sv_ino);
+	need = sv->sv_wcount == 0 ? 1 + SFS_WRESVMETA : 1;
+	result = sfs_wresv_get(sv, need);
+	if (result) {
+		return result;
+	}
+
+	if (sv->sv_wcount == 0) {
+		sv->sv_wstart = fileblock;
+	}
+	slot = sv->sv_wbuf + sv->sv_wcount * SFS_BLOCKSIZE;
+	bzero(slot, SFS_BLOCKSIZE);
+	result = uiomove(slot + skipstart, len, uio);
+	if (result) {
+		sfs_wresv_put(sv, need);
+		return result;
 	}
-	*diskblock = block;
+	sv->sv_wcount++;
+
+	/* So sfs_sync gets to it */
+	sfs_dlist_add(sv);
+
+	*done = true;
 	return 0;
 }
 
@@ -312,14 +978,16 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 * I/O buffer for handling partial sectors.
 	 *
 	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
+	 * you would get space from the disk buffer cache for this.
+	 * It can't be a static area, since I/O on different files
+	 * runs in parallel.
 	 */
-	static char iobuf[SFS_BLOCKSIZE];
+	char *iobuf;
 
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	uint32_t diskblock;
 	uint32_t fileblock;
+	bool done;
 	int result;
 	
 	/* Allocate missing blocks if and only if we're writing */
@@ -327,6 +995,12 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
+	/* New file data can wait */
+	result = sfs_wbuf_write(sv, uio, skipstart, len, &done);
+	if (result || done) {
+		return result;
+	}
+
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -336,13 +1010,18 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		return result;
 	}
 
+	iobuf = kmalloc(SFS_BLOCKSIZE);
+	if (iobuf == NULL) {
+		return ENOMEM;
+	}
+
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
 		 * Zero the buffer.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		bzero(iobuf, SFS_BLOCKSIZE);
 	}
 	else {
 		/*
@@ -350,7 +1029,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		 */
 		result = sfs_rblock(sfs, iobuf, diskblock);
 		if (result) {
-			return result;
+			goto out;
 		}
 	}
 
@@ -359,20 +1038,25 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 */
 	result = uiomove(iobuf+skipstart, len, uio);
 	if (result) {
-		return result;
+		goto out;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, write back the modified block. Directory
+	 * blocks are metadata and go through the journal.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
+		if (sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+			result = sfs_jwrite(sfs, iobuf, diskblock);
+		}
+		else {
+			result = sfs_wblock(sfs, iobuf, diskblock);
 		}
 	}
 
-	return 0;
+ out:
+	kfree(iobuf);
+	return result;
 }
 
 /*
@@ -385,13 +1069,25 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	uint32_t diskblock;
 	uint32_t fileblock;
+	bool done;
 	int result;
-	int doalloc = (uio->uio_rw==UIO_WRITE);
 	off_t saveoff;
 	off_t diskoff;
 	off_t saveres;
 	off_t diskres;
 
+	/*
+	 * Allocate missing blocks if and only if we're writing; we
+	 * write the whole block, so there's no need to clear it.
+	 */
+	int doalloc = (uio->uio_rw==UIO_WRITE) ? SFS_BMAP_NOCLEAR : 0;
+
+	/* New file data can wait */
+	result = sfs_wbuf_write(sv, uio, 0, SFS_BLOCKSIZE, &done);
+	if (result || done) {
+		return result;
+	}
+
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -428,7 +1124,13 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	diskres = SFS_BLOCKSIZE;
 	uio->uio_resid = diskres;
 	
-	result = sfs_rwblock(sfs, uio);
+	if (uio->uio_rw == UIO_WRITE && sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+		/* Directory blocks are metadata; journal them */
+		result = sfs_jwriteuio(sfs, uio);
+	}
+	else {
+		result = sfs_rwblock(sfs, uio);
+	}
 
 	/*
 	 * Now, restore the original uio_offset and uio_resid and update 
@@ -473,6 +1175,26 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		}
 	}
 
+	/*
+	 * Inline contents are right here in the inode, unless this
+	 * write makes them too big.
+	 */
+	if (sv->sv_i.sfi_flags & SFS_IF_INLINE) {
+		if (uio->uio_rw == UIO_READ ||
+		    uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE) {
+			result = uiomove(sv->sv_i.sfi_inline + uio->uio_offset,
+					 uio->uio_resid, uio);
+			if (uio->uio_rw == UIO_WRITE) {
+				sfs_dirty_inode(sv);
+			}
+			goto out;
+		}
+		result = sfs_inline_promote(sv);
+		if (result) {
+			goto out;
+		}
+	}
+
 	/*
 	 * First, do any leading partial block.
 	 */
@@ -513,209 +1235,634 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		}
 	}
 
-	/*
-	 * Now do any remaining partial block at the end.
-	 */
-	KASSERT(uio->uio_resid < SFS_BLOCKSIZE);
+	/*
+	 * Now do any remaining partial block at the end.
+	 */
+	KASSERT(uio->uio_resid < SFS_BLOCKSIZE);
+
+	if (uio->uio_resid > 0) {
+		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
+		if (result) {
+			goto out;
+		}
+	}
+
+ out:
+
+	/* If writing, adjust file length */
+	if (uio->uio_rw == UIO_WRITE && 
+	    uio->uio_offset > (off_t)sv->sv_i.sfi_size) {
+		sv->sv_i.sfi_size = uio->uio_offset;
+		sfs_dirty_inode(sv);
+	}
+
+	/* Add in any extra amount we couldn't read because of EOF */
+	uio->uio_resid += extraresid;
+
+	/* Done */
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Directory I/O
+
+/*
+ * Read the directory entry out of slot SLOT of a directory vnode.
+ * The "slot" is the index of the directory entry, starting at 0.
+ */
+static
+int
+sfs_readdir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t actualpos;
+	int result;
+
+	/* Compute the actual position in the directory to read. */
+	actualpos = slot * sizeof(struct sfs_dir);
+
+	/* Set up a uio to do the read */ 
+	uio_kinit(&iov, &ku, sd, sizeof(struct sfs_dir), actualpos, UIO_READ);
+
+	/* do it */
+	result = sfs_io(sv, &ku);
+	if (result) {
+		return result;
+	}
+
+	/* We should not hit EOF in the middle of a directory entry */
+	if (ku.uio_resid > 0) {
+		panic("sfs: readdir: Short entry (inode %u)\n", sv->sv_ino);
+	}
+
+	/* Done */
+	return 0;
+}
+
+/*
+ * Write (overwrite) the directory entry in slot SLOT of a directory
+ * vnode.
+ */
+static
+int
+sfs_writedir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t actualpos;
+	int result;
+
+	/* Compute the actual position in the directory. */
+	KASSERT(slot>=0);
+	actualpos = slot * sizeof(struct sfs_dir);
+
+	/* Set up a uio to do the write */ 
+	uio_kinit(&iov, &ku, sd, sizeof(struct sfs_dir), actualpos, UIO_WRITE);
+
+	/* do it */
+	result = sfs_io(sv, &ku);
+	if (result) {
+		return result;
+	}
+
+	/* Should not end up with a partial entry! */
+	if (ku.uio_resid > 0) {
+		panic("sfs: writedir: Short write (ino %u)\n", sv->sv_ino);
+	}
+
+	/* Done */
+	return 0;
+}
+
+/*
+ * Compute the number of entries in a directory.
+ * This actually computes the number of existing slots, and does not
+ * account for empty slots.
+ */
+static
+int
+sfs_dir_nentries(struct sfs_vnode *sv)
+{
+	off_t size;
+
+	KASSERT(sv->sv_i.sfi_type == SFS_TYPE_DIR);
+
+	size = sv->sv_i.sfi_size;
+	if (size % sizeof(struct sfs_dir) != 0) {
+		panic("sfs: directory %u: Invalid size %llu\n",
+		      sv->sv_ino, size);
+	}
+
+	return size / sizeof(struct sfs_dir);
+}
+
+/*
+ * Directory layout.
+ *
+ * A directory is an array of struct sfs_dir slots, SFS_DIRPERBLK to a
+ * block. Older volumes keep the entries in no particular order and
+ * searching means reading the whole directory. Once a directory has
+ * SFS_IF_HASHDIR set in its inode, each block is instead a hash
+ * bucket: a name lives in the block its hash picks or, if that one
+ * was full, in one of the blocks after it (wrapping around). The
+ * number of blocks is always a power of two.
+ *
+ * Empty slots come in two kinds. A slot that has never been used is
+ * all zeros; one whose entry was removed keeps SFS_NOINO with
+ * SFS_DIR_TOMBSTONE in the name. A search can stop at the first block
+ * with a never-used slot, since nothing could have spilled past it;
+ * inserts may reuse either kind.
+ *
+ * A linear directory is converted to the hashed layout the first time
+ * something is linked into it, and a hashed one is doubled whenever
+ * an insert would land more than SFS_DIRMAXPROBE blocks away from
+ * home. Either way a lookup usually costs one block read.
+ */
+#define SFS_DIRPERBLK   (SFS_BLOCKSIZE / sizeof(struct sfs_dir))
+#define SFS_DIRMAXPROBE 2
+
+/*
+ * A directory with its entries inline (see above) stays linear until
+ * it outgrows the inode, as a single inode can hold only this many.
+ */
+#define SFS_INLINEDIRS  (SFS_INLINESIZE / sizeof(struct sfs_dir))
+
+static
+bool
+sfs_dir_neverused(const struct sfs_dir *sd)
+{
+	return sd->sfd_ino == SFS_NOINO && sd->sfd_name[0] == 0;
+}
+
+/*
+ * Hash a filename (32-bit FNV-1a).
+ */
+static
+uint32_t
+sfs_dir_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Read or write NENTS directory slots starting at the first slot of
+ * directory block BLOCK.
+ */
+static
+int
+sfs_dir_rwblock(struct sfs_vnode *sv, uint32_t block, struct sfs_dir *ents,
+		unsigned nents, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, ents, nents * sizeof(struct sfs_dir),
+		  (off_t)block * SFS_BLOCKSIZE, rw);
+	result = sfs_io(sv, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid > 0) {
+		panic("sfs: dir %u: short %s of block %u\n", sv->sv_ino,
+		      rw == UIO_READ ? "read" : "write", block);
+	}
+	return 0;
+}
+
+/*
+ * Check whether directory entry SD is the one called NAME.
+ */
+static
+bool
+sfs_dir_match(struct sfs_dir *sd, const char *name)
+{
+	if (sd->sfd_ino == SFS_NOINO) {
+		return false;
+	}
+	/* Ensure null termination, just in case */
+	sd->sfd_name[sizeof(sd->sfd_name)-1] = 0;
+	return !strcmp(sd->sfd_name, name);
+}
+
+/*
+ * findname for linear directories: look at every slot, a block at a
+ * time.
+ */
+static
+int
+sfs_dir_linearfind(struct sfs_vnode *sv, const char *name,
+		   uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dir ents[SFS_DIRPERBLK];
+	int found = 0;
+	int nentries = sfs_dir_nentries(sv);
+	int base, i, n, result;
+
+	/* For each block... */
+	for (base=0; base<nentries; base+=SFS_DIRPERBLK) {
+		n = nentries - base;
+		if (n > (int)SFS_DIRPERBLK) {
+			n = SFS_DIRPERBLK;
+		}
+
+		result = sfs_dir_rwblock(sv, base / SFS_DIRPERBLK, ents, n,
+					 UIO_READ);
+		if (result) {
+			return result;
+		}
+
+		/* ...look at each slot */
+		for (i=0; i<n; i++) {
+			if (ents[i].sfd_ino == SFS_NOINO) {
+				/* Free slot - report it back if requested */
+				if (emptyslot != NULL) {
+					*emptyslot = base+i;
+				}
+			}
+			else if (sfs_dir_match(&ents[i], name)) {
+				/* Each name may legally appear only once... */
+				KASSERT(found==0);
+
+				found = 1;
+				if (slot != NULL) {
+					*slot = base+i;
+				}
+				if (ino != NULL) {
+					*ino = ents[i].sfd_ino;
+				}
+			}
+		}
+	}
+
+	return found ? 0 : ENOENT;
+}
+
+/*
+ * findname for hashed directories: walk the probe sequence for NAME.
+ * If EMPTYPROBE is not NULL, it gets how many blocks past the home
+ * block *EMPTYSLOT is.
+ */
+static
+int
+sfs_dir_hashfind(struct sfs_vnode *sv, const char *name,
+		 uint32_t *ino, int *slot, int *emptyslot,
+		 uint32_t *emptyprobe)
+{
+	struct sfs_dir ents[SFS_DIRPERBLK];
+	uint32_t nbuckets, home, block, probe;
+	bool sawneverused;
+	unsigned i;
+	int result;
+
+	nbuckets = sv->sv_i.sfi_size / SFS_BLOCKSIZE;
+	KASSERT(nbuckets > 0 && (nbuckets & (nbuckets-1)) == 0);
+	KASSERT(sv->sv_i.sfi_size % SFS_BLOCKSIZE == 0);
 
-	if (uio->uio_resid > 0) {
-		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
+	home = sfs_dir_hash(name) & (nbuckets-1);
+	for (probe=0; probe<nbuckets; probe++) {
+		block = (home + probe) & (nbuckets-1);
+		result = sfs_dir_rwblock(sv, block, ents, SFS_DIRPERBLK,
+					 UIO_READ);
 		if (result) {
-			goto out;
+			return result;
 		}
-	}
 
- out:
+		sawneverused = false;
+		for (i=0; i<SFS_DIRPERBLK; i++) {
+			if (sfs_dir_match(&ents[i], name)) {
+				if (slot != NULL) {
+					*slot = block*SFS_DIRPERBLK + i;
+				}
+				if (ino != NULL) {
+					*ino = ents[i].sfd_ino;
+				}
+				return 0;
+			}
+			if (ents[i].sfd_ino != SFS_NOINO) {
+				continue;
+			}
+			if (sfs_dir_neverused(&ents[i])) {
+				sawneverused = true;
+			}
+			/* Report the first free slot on the way */
+			if (emptyslot != NULL && *emptyslot < 0) {
+				*emptyslot = block*SFS_DIRPERBLK + i;
+				if (emptyprobe != NULL) {
+					*emptyprobe = probe;
+				}
+			}
+		}
 
-	/* If writing, adjust file length */
-	if (uio->uio_rw == UIO_WRITE && 
-	    uio->uio_offset > (off_t)sv->sv_i.sfi_size) {
-		sv->sv_i.sfi_size = uio->uio_offset;
-		sv->sv_dirty = true;
+		if (sawneverused) {
+			/* Nothing with this hash went any further */
+			break;
+		}
 	}
 
-	/* Add in any extra amount we couldn't read because of EOF */
-	uio->uio_resid += extraresid;
-
-	/* Done */
-	return result;
+	return ENOENT;
 }
 
-////////////////////////////////////////////////////////////
-//
-// Directory I/O
+/*
+ * Search a directory for a particular filename in a directory, and
+ * return its inode number, its slot, and/or the slot number of an
+ * empty directory slot if one is found.
+ */
+
+static
+int
+sfs_dir_findname(struct sfs_vnode *sv, const char *name,
+		    uint32_t *ino, int *slot, int *emptyslot)
+{
+	if (sv->sv_i.sfi_flags & SFS_IF_HASHDIR) {
+		return sfs_dir_hashfind(sv, name, ino, slot, emptyslot, NULL);
+	}
+	return sfs_dir_linearfind(sv, name, ino, slot, emptyslot);
+}
 
 /*
- * Read the directory entry out of slot SLOT of a directory vnode.
- * The "slot" is the index of the directory entry, starting at 0.
+ * Write the NBUCKETS blocks of directory contents NEW to blocks of
+ * their own, leaving SV's inode pointing at them. The old blocks are
+ * untouched, and the inode is saved in *OLDI. Call with sv_lock held,
+ * inside a journal handle.
+ *
+ * The new blocks aren't reachable from anything on disk until the
+ * inode is, so like file data they're written in place rather than
+ * through the journal, and are on disk before the transaction that
+ * switches the inode over commits. That leaves only the inode, the
+ * new indirect blocks, and the freemap for the journal, however big
+ * the directory is.
  */
 static
 int
-sfs_readdir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
+sfs_dir_shadow(struct sfs_vnode *sv, struct sfs_dir *new, uint32_t nbuckets,
+	       struct sfs_inode *oldi)
 {
-	struct iovec iov;
-	struct uio ku;
-	off_t actualpos;
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t block, diskblock;
+	unsigned i;
 	int result;
 
-	/* Compute the actual position in the directory to read. */
-	actualpos = slot * sizeof(struct sfs_dir);
-
-	/* Set up a uio to do the read */ 
-	uio_kinit(&iov, &ku, sd, sizeof(struct sfs_dir), actualpos, UIO_READ);
-
-	/* do it */
-	result = sfs_io(sv, &ku);
-	if (result) {
-		return result;
-	}
+	*oldi = sv->sv_i;
 
-	/* We should not hit EOF in the middle of a directory entry */
-	if (ku.uio_resid > 0) {
-		panic("sfs: readdir: Short entry (inode %u)\n", sv->sv_ino);
+	/* Start the new copy with no blocks at all */
+	for (i=0; i<SFS_NDIRECT; i++) {
+		sv->sv_i.sfi_direct[i] = 0;
+	}
+	sv->sv_i.sfi_indirect = 0;
+	sv->sv_i.sfi_dindirect = 0;
+	sv->sv_i.sfi_tindirect = 0;
+	sv->sv_i.sfi_flags &= ~SFS_IF_INLINE;
+	bzero(sv->sv_i.sfi_inline, sizeof(sv->sv_i.sfi_inline));
+	sfs_idflush(sv);
+
+	for (block=0; block<nbuckets; block++) {
+		result = sfs_bmap(sv, block, SFS_BMAP_NOCLEAR, &diskblock);
+		if (result == 0) {
+			result = sfs_wblock(sfs, &new[block*SFS_DIRPERBLK],
+					    diskblock);
+		}
+		if (result) {
+			/* Give back what we got and put the old one back */
+			(void)sfs_dotruncate(sv, 0);
+			sv->sv_i = *oldi;
+			sfs_idflush(sv);
+			sfs_dirty_inode(sv);
+			return result;
+		}
 	}
 
-	/* Done */
+	sv->sv_i.sfi_size = nbuckets*SFS_BLOCKSIZE;
+	sv->sv_i.sfi_flags |= SFS_IF_HASHDIR;
 	return 0;
 }
 
 /*
- * Write (overwrite) the directory entry in slot SLOT of a directory
- * vnode.
+ * Rebuild a directory in the hashed layout with NBUCKETS blocks. If
+ * NBUCKETS is 0, pick a size that leaves the directory at most half
+ * full. This is also how a linear directory gets converted.
+ *
+ * The new layout goes in new blocks (see sfs_dir_shadow) and the
+ * inode is switched over to them in one step, after which the old
+ * blocks are freed; a crash leaves either the old directory or the
+ * new one, never a mix.
  */
 static
 int
-sfs_writedir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
+sfs_dir_rehash(struct sfs_vnode *sv, uint32_t nbuckets)
 {
+	struct sfs_dir *old, *new;
+	struct sfs_inode *oldi, *newi;
 	struct iovec iov;
 	struct uio ku;
-	off_t actualpos;
+	uint32_t oldsize = sv->sv_i.sfi_size;
+	uint32_t home, block, probe;
+	int nold = sfs_dir_nentries(sv);
+	int live, i;
+	unsigned j;
 	int result;
 
-	/* Compute the actual position in the directory. */
-	KASSERT(slot>=0);
-	actualpos = slot * sizeof(struct sfs_dir);
+	/* Read the whole old directory */
+	old = NULL;
+	if (nold > 0) {
+		old = kmalloc(oldsize);
+		if (old == NULL) {
+			return ENOMEM;
+		}
+		uio_kinit(&iov, &ku, old, oldsize, 0, UIO_READ);
+		result = sfs_io(sv, &ku);
+		if (result) {
+			kfree(old);
+			return result;
+		}
+		KASSERT(ku.uio_resid == 0);
+	}
 
-	/* Set up a uio to do the write */ 
-	uio_kinit(&iov, &ku, sd, sizeof(struct sfs_dir), actualpos, UIO_WRITE);
+	live = 0;
+	for (i=0; i<nold; i++) {
+		if (old[i].sfd_ino != SFS_NOINO) {
+			live++;
+		}
+	}
 
-	/* do it */
-	result = sfs_io(sv, &ku);
-	if (result) {
-		return result;
+	if (nbuckets == 0) {
+		nbuckets = 1;
+		while (nbuckets*SFS_DIRPERBLK < (uint32_t)live*2 ||
+		       nbuckets*SFS_BLOCKSIZE < oldsize) {
+			nbuckets *= 2;
+		}
 	}
+	KASSERT((nbuckets & (nbuckets-1)) == 0);
+	KASSERT(nbuckets*SFS_DIRPERBLK > (uint32_t)live);
+	KASSERT(nbuckets*SFS_BLOCKSIZE >= oldsize);
 
-	/* Should not end up with a partial entry! */
-	if (ku.uio_resid > 0) {
-		panic("sfs: writedir: Short write (ino %u)\n", sv->sv_ino);
+	new = kmalloc(nbuckets*SFS_BLOCKSIZE);
+	if (new == NULL) {
+		if (old != NULL) {
+			kfree(old);
+		}
+		return ENOMEM;
 	}
+	bzero(new, nbuckets*SFS_BLOCKSIZE);
 
-	/* Done */
-	return 0;
-}
+	/* Put each live entry in the first never-used slot of its chain */
+	for (i=0; i<nold; i++) {
+		if (old[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		old[i].sfd_name[sizeof(old[i].sfd_name)-1] = 0;
+		home = sfs_dir_hash(old[i].sfd_name) & (nbuckets-1);
+		for (probe=0; probe<nbuckets; probe++) {
+			block = (home + probe) & (nbuckets-1);
+			for (j=0; j<SFS_DIRPERBLK; j++) {
+				if (sfs_dir_neverused(
+					    &new[block*SFS_DIRPERBLK + j])) {
+					break;
+				}
+			}
+			if (j < SFS_DIRPERBLK) {
+				new[block*SFS_DIRPERBLK + j] = old[i];
+				break;
+			}
+		}
+		KASSERT(probe < nbuckets);
+	}
 
-/*
- * Compute the number of entries in a directory.
- * This actually computes the number of existing slots, and does not
- * account for empty slots.
- */
-static
-int
-sfs_dir_nentries(struct sfs_vnode *sv)
-{
-	off_t size;
+	if (old != NULL) {
+		kfree(old);
+	}
 
-	KASSERT(sv->sv_i.sfi_type == SFS_TYPE_DIR);
+	oldi = kmalloc(2 * sizeof(struct sfs_inode));
+	if (oldi == NULL) {
+		kfree(new);
+		return ENOMEM;
+	}
+	newi = oldi + 1;
 
-	size = sv->sv_i.sfi_size;
-	if (size % sizeof(struct sfs_dir) != 0) {
-		panic("sfs: directory %u: Invalid size %llu\n",
-		      sv->sv_ino, size);
+	/* Write it out to new blocks */
+	result = sfs_dir_shadow(sv, new, nbuckets, oldi);
+	kfree(new);
+	if (result) {
+		kfree(oldi);
+		return result;
 	}
+	*newi = sv->sv_i;
 
-	return size / sizeof(struct sfs_dir);
+	/*
+	 * Free the old blocks. If that fails partway, the rest stay
+	 * allocated; the new directory is complete either way, so
+	 * switch to it regardless.
+	 */
+	sv->sv_i = *oldi;
+	sfs_idflush(sv);
+	result = sfs_dotruncate(sv, 0);
+	if (result) {
+		kprintf("sfs: dir %u: old blocks not all freed after "
+			"rehash: %s\n", sv->sv_ino, strerror(result));
+	}
+
+	/* Switch over */
+	sv->sv_i = *newi;
+	sfs_idflush(sv);
+	sfs_dirty_inode(sv);
+
+	kfree(oldi);
+	return 0;
 }
 
 /*
- * Search a directory for a particular filename in a directory, and
- * return its inode number, its slot, and/or the slot number of an
- * empty directory slot if one is found.
+ * Find the slot for a new name in a hashed directory, doubling the
+ * directory if its chain is too crowded.
  */
-
 static
 int
-sfs_dir_findname(struct sfs_vnode *sv, const char *name,
-		    uint32_t *ino, int *slot, int *emptyslot)
+sfs_dir_hashslot(struct sfs_vnode *sv, const char *name, int *emptyslot)
 {
-	struct sfs_dir tsd;
-	int found = 0;
-	int nentries = sfs_dir_nentries(sv);
-	int i, result;
-
-	/* For each slot... */
-	for (i=0; i<nentries; i++) {
+	uint32_t emptyprobe;
+	int result;
 
-		/* Read the entry from that slot */
-		result = sfs_readdir(sv, &tsd, i);
-		if (result) {
+	while (1) {
+		/* Look up the name. We want to make sure it *doesn't* exist. */
+		*emptyslot = -1;
+		emptyprobe = 0;
+		result = sfs_dir_hashfind(sv, name, NULL, NULL,
+					  emptyslot, &emptyprobe);
+		if (result!=0 && result!=ENOENT) {
 			return result;
 		}
-		if (tsd.sfd_ino == SFS_NOINO) {
-			/* Free slot - report it back if one was requested */
-			if (emptyslot != NULL) {
-				*emptyslot = i;
-			}
+		if (result==0) {
+			return EEXIST;
 		}
-		else {
-			/* Ensure null termination, just in case */
-			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
-			if (!strcmp(tsd.sfd_name, name)) {
 
-				/* Each name may legally appear only once... */
-				KASSERT(found==0);
+		if (*emptyslot >= 0 && emptyprobe < SFS_DIRMAXPROBE) {
+			return 0;
+		}
 
-				found = 1;
-				if (slot != NULL) {
-					*slot = i;
-				}
-				if (ino != NULL) {
-					*ino = tsd.sfd_ino;
-				}
-			}
+		/* Too crowded around here; double the directory */
+		result = sfs_dir_rehash(sv,
+				2 * (sv->sv_i.sfi_size / SFS_BLOCKSIZE));
+		if (result) {
+			return result;
 		}
 	}
-
-	return found ? 0 : ENOENT;
 }
 
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
+ *
+ * This may rehash the directory, which moves entries around; any
+ * slot numbers the caller had from before are stale afterwards.
  */
 static
 int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 {
-	int emptyslot = -1;
+	int emptyslot;
 	int result;
 	struct sfs_dir sd;
 
-	/* Look up the name. We want to make sure it *doesn't* exist. */
-	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
-	if (result!=0 && result!=ENOENT) {
-		return result;
-	}
-	if (result==0) {
-		return EEXIST;
-	}
-
 	if (strlen(name)+1 > sizeof(sd.sfd_name)) {
 		return ENAMETOOLONG;
 	}
 
-	/* If we didn't get an empty slot, add the entry at the end. */
+	/* An inline directory stays linear while the entry fits */
+	emptyslot = -1;
+	if (sv->sv_i.sfi_flags & SFS_IF_INLINE) {
+		result = sfs_dir_linearfind(sv, name, NULL, NULL, &emptyslot);
+		if (result!=0 && result!=ENOENT) {
+			return result;
+		}
+		if (result==0) {
+			return EEXIST;
+		}
+		if (emptyslot < 0 &&
+		    sfs_dir_nentries(sv) < (int)SFS_INLINEDIRS) {
+			emptyslot = sfs_dir_nentries(sv);
+		}
+	}
+
 	if (emptyslot < 0) {
-		emptyslot = sfs_dir_nentries(sv);
+		/* Convert other linear directories on first modification */
+		if ((sv->sv_i.sfi_flags & SFS_IF_HASHDIR) == 0) {
+			result = sfs_dir_rehash(sv, 0);
+			if (result) {
+				return result;
+			}
+		}
+
+		result = sfs_dir_hashslot(sv, name, &emptyslot);
+		if (result) {
+			return result;
+		}
 	}
 
 	/* Set up the entry. */
@@ -746,6 +1893,11 @@ sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
+	/* ...leaving a tombstone so hash chains aren't cut short... */
+	if (sv->sv_i.sfi_flags & SFS_IF_HASHDIR) {
+		sd.sfd_name[0] = SFS_DIR_TOMBSTONE;
+	}
+
 	/* ... and write it */
 	return sfs_writedir(sv, &sd, slot);
 }
@@ -787,11 +1939,14 @@ sfs_lookonce(struct sfs_vnode *sv, const char *name,
 // Object creation
 
 /*
- * Create a new filesystem object and hand back its vnode.
+ * Create a new filesystem object and hand back its vnode. The inode
+ * is placed as close after GOAL (normally the parent directory's
+ * inode) as possible.
  */
 static
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, int type, uint32_t goal,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
@@ -801,7 +1956,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, goal, &ino);
 	if (result) {
 		return result;
 	}
@@ -875,8 +2030,31 @@ static
 int
 sfs_close(struct vnode *v)
 {
-	/* Sync it. */
-	return VOP_FSYNC(v);
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+
+	/* Nobody is writing any more; write out what was held back... */
+	result = sfs_wbuf_flush(sv);
+	if (result == 0 && sv->sv_wbuf != NULL) {
+		kfree(sv->sv_wbuf);
+		sv->sv_wbuf = NULL;
+	}
+
+	/* ...and give back the reservation. */
+	sfs_resv_release(sv);
+
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+
+	/*
+	 * The inode is left for the syncer, or for sfs_reclaim if this
+	 * was the last reference too.
+	 */
+	return result;
 }
 
 /*
@@ -893,28 +2071,61 @@ sfs_reclaim(struct vnode *v)
 	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	/* Erasing the file changes metadata */
+	sfs_jbegin(sfs);
 
 	/*
-	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * Write out any data still held back, unless the file is going
+	 * away anyway. Nobody else can be using the vnode unless they
+	 * picked it up just now, in which case we'll find out below.
 	 */
-	if (v->vn_refcount != 1) {
+	lock_acquire(sv->sv_lock);
+	if (sv->sv_i.sfi_linkcount == 0) {
+		sv->sv_wcount = 0;
+	}
+	result = sfs_wbuf_flush(sv);
+	if (result) {
+		/*
+		 * Space was set aside at write time, so this means the
+		 * disk failed. There's nobody left to tell, and failing
+		 * here would only leave the vnode stuck, so let it go.
+		 */
+		kprintf("sfs: %s: inode %u: lost %u delayed blocks: %s\n",
+			sfs->sfs_super.sp_volname, sv->sv_ino,
+			sv->sv_wcount, strerror(result));
+		sv->sv_wcount = 0;
+	}
+	sfs_wresv_put(sv, sv->sv_wresv);
+	lock_release(sv->sv_lock);
 
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
+	/*
+	 * Hold the vnode table exclusively for the whole reclaim so
+	 * sfs_loadvnode can't find and hand out this vnode while we
+	 * are tearing it down.
+	 */
+	rwlock_acquire_write(sfs->sfs_vnlock);
 
-		vfs_biglock_release();
+	/*
+	 * Make sure someone else hasn't picked up the vnode since the
+	 * decision was made to reclaim it.
+	 */
+	if (!vnode_reclaimable(v)) {
+		rwlock_release_write(sfs->sfs_vnlock);
+		sfs_jend(sfs);
 		return EBUSY;
 	}
 
+	/*
+	 * Ours was the last reference and no new ones can be made, so
+	 * nobody else can be holding or waiting for sv_lock.
+	 */
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount==0) {
-		result = VOP_TRUNCATE(&sv->sv_v, 0);
+		result = sfs_dotruncate(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			rwlock_release_write(sfs->sfs_vnlock);
+			sfs_jend(sfs);
 			return result;
 		}
 	}
@@ -922,10 +2133,14 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(sfs->sfs_vnlock);
+		sfs_jend(sfs);
 		return result;
 	}
 
+	/* Drop any reservation window left over */
+	sfs_resv_release(sv);
+
 	/* If there are no on-disk references, discard the inode */
 	if (sv->sv_i.sfi_linkcount==0) {
 		sfs_bfree(sfs, sv->sv_ino);
@@ -946,36 +2161,127 @@ sfs_reclaim(struct vnode *v)
 		panic("sfs: reclaim vnode %u not in vnode pool\n",
 		      sv->sv_ino);
 	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
-
-	VOP_CLEANUP(&sv->sv_v);
-
-	vfs_biglock_release();
+	vnodearray_remove(sfs->sfs_vnodes, ix);
+	rwlock_release_write(sfs->sfs_vnlock);
+	sfs_jend(sfs);
+
+	VOP_CLEANUP(&sv->sv_v);
+
+	/* Release the storage for the vnode structure itself. */
+	lock_destroy(sv->sv_lock);
+	if (sv->sv_idcache != NULL) {
+		kfree(sv->sv_idcache);
+	}
+	if (sv->sv_wbuf != NULL) {
+		kfree(sv->sv_wbuf);
+	}
+	kfree(sv);
+
+	/* Done */
+	return 0;
+}
+
+/*
+ * Called for read(). sfs_io() does the work.
+ */
+static
+int
+sfs_read(struct vnode *v, struct uio *uio)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	lock_acquire(sv->sv_lock);
+
+	/*
+	 * Held-back blocks aren't on disk yet, so write them out
+	 * first. That allocates, so it needs a journal handle, which
+	 * has to be taken before sv_lock.
+	 */
+	if (sv->sv_wcount > 0) {
+		lock_release(sv->sv_lock);
+		sfs_jbegin(sfs);
+		lock_acquire(sv->sv_lock);
+		result = sfs_wbuf_flush(sv);
+		if (result == 0) {
+			result = sfs_io(sv, uio);
+		}
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
+		return result;
+	}
 
-	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	result = sfs_io(sv, uio);
+	lock_release(sv->sv_lock);
 
-	/* Done */
-	return 0;
+	return result;
 }
 
 /*
- * Called for read(). sfs_io() does the work.
+ * Called for getdirentry(). The offset is a slot number: hand back the
+ * name in the first slot in use at or after it, and leave the offset
+ * just past that slot. Rehashing moves entries to other slots, so if
+ * the directory grows in between calls, names may be missed or seen
+ * twice.
  */
 static
 int
-sfs_read(struct vnode *v, struct uio *uio)
+sfs_getdirentry(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
-	int result;
+	struct sfs_dir ents[SFS_DIRPERBLK];
+	off_t slot;
+	int nentries, n, result;
+	unsigned i;
+	bool found;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	if (uio->uio_offset < 0) {
+		return EINVAL;
+	}
 
-	return result;
+	lock_acquire(sv->sv_lock);
+	nentries = sfs_dir_nentries(sv);
+	slot = uio->uio_offset;
+	found = false;
+	while (!found && slot < nentries) {
+		n = nentries - (slot - slot % SFS_DIRPERBLK);
+		if (n > (int)SFS_DIRPERBLK) {
+			n = SFS_DIRPERBLK;
+		}
+		result = sfs_dir_rwblock(sv, slot / SFS_DIRPERBLK, ents, n,
+					 UIO_READ);
+		if (result) {
+			lock_release(sv->sv_lock);
+			return result;
+		}
+		for (i = slot % SFS_DIRPERBLK; i < (unsigned)n; i++) {
+			slot++;
+			if (ents[i].sfd_ino != SFS_NOINO) {
+				found = true;
+				break;
+			}
+		}
+	}
+
+	if (found) {
+		/* Ensure null termination, just in case */
+		ents[i].sfd_name[sizeof(ents[i].sfd_name)-1] = 0;
+		result = uiomove(ents[i].sfd_name, strlen(ents[i].sfd_name),
+				 uio);
+		if (result) {
+			lock_release(sv->sv_lock);
+			return result;
+		}
+	}
+	uio->uio_offset = slot;
+	lock_release(sv->sv_lock);
+
+	return 0;
 }
 
 /*
@@ -985,14 +2291,17 @@ static
 int
 sfs_write(struct vnode *v, struct uio *uio)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
 
 	return result;
 }
@@ -1033,7 +2342,9 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
+	lock_release(sv->sv_lock);
 
 	/* We don't support these yet; you get to implement them */
 	statbuf->st_nlink = 0;
@@ -1053,16 +2364,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* The type never changes once the vnode is loaded; no lock needed */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -1092,19 +2400,50 @@ sfs_tryseek(struct vnode *v, off_t pos)
 }
 
 /*
- * Called for fsync(), and also on filesystem unmount, global sync(),
- * and some other cases.
+ * Flush a file's held-back data and write its inode, joining the
+ * running transaction but not committing it; sfs_sync does that once
+ * for all the files it flushes.
+ */
+int
+sfs_flushvnode(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+
+	/* Data held back first, then the blocks that allocated, then us */
+	result = sfs_wbuf_flush(sv);
+	if (result == 0) {
+		result = sfs_mapsync(sfs);
+	}
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+
+	return result;
+}
+
+/*
+ * Called for fsync(), and also on filesystem unmount and some other
+ * cases.
  */
 static
 int
 sfs_fsync(struct vnode *v)
 {
-	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
-	vfs_biglock_acquire();
-	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	result = sfs_flushvnode(v->vn_data);
+
+	/* With a journal, the inode isn't on disk until it's committed */
+	if (result == 0) {
+		result = sfs_jcommit(sfs);
+	}
 
 	return result;
 }
@@ -1121,35 +2460,136 @@ sfs_mmap(struct vnode *v   /* add stuff as needed */)
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Free the parts of the indirect tree rooted at *IDBLOCKP that lie at
+ * or past file block BLOCKLEN. The tree has LEVEL levels and its first
+ * entry maps file block BASEBLOCK. If the whole tree ends up empty the
+ * indirect block itself is freed and *IDBLOCKP is zeroed; in that
+ * case *CHANGED is set so the caller knows to write back whatever
+ * *IDBLOCKP lives in.
  */
 static
 int
-sfs_truncate(struct vnode *v, off_t len)
+sfs_truncate_indirect(struct sfs_vnode *sv, uint32_t *idblockp, int level,
+		      uint32_t baseblock, uint32_t blocklen, bool *changed)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t idblock = *idblockp;
+	uint32_t span = sfs_idspan[level-1];
+	uint32_t *idbuf;
+	uint32_t j, entrybase;
+	bool hasnonzero, iddirty, subchanged;
+	int result;
 
-	struct sfs_vnode *sv = v->vn_data;
+	*changed = false;
+
+	if (idblock == 0 || blocklen >= baseblock + span*SFS_DBPERIDB) {
+		/* Nothing here, or everything here is below the new EOF */
+		return 0;
+	}
+
+	idbuf = kmalloc(SFS_BLOCKSIZE);
+	if (idbuf == NULL) {
+		return ENOMEM;
+	}
+
+	result = sfs_rblock(sfs, idbuf, idblock);
+	if (result) {
+		kfree(idbuf);
+		return result;
+	}
+
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		entrybase = baseblock + j*span;
+		if (idbuf[j] == 0) {
+			continue;
+		}
+		if (level == 1) {
+			/* Discard any data blocks past the new EOF */
+			if (entrybase >= blocklen) {
+				sfs_bfree(sfs, idbuf[j]);
+				idbuf[j] = 0;
+				iddirty = true;
+			}
+		}
+		else {
+			result = sfs_truncate_indirect(sv, &idbuf[j], level-1,
+						       entrybase, blocklen,
+						       &subchanged);
+			if (subchanged) {
+				iddirty = true;
+			}
+			if (result) {
+				break;
+			}
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j] != 0) {
+			hasnonzero = true;
+		}
+	}
+
+	if (result == 0 && !hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, idblock);
+		*idblockp = 0;
+		*changed = true;
+	}
+	else if (iddirty) {
+		/* The indirect block is dirty; write it back */
+		int result2 = sfs_jwrite(sfs, idbuf, idblock);
+		if (result == 0) {
+			result = result2;
+		}
+	}
+
+	kfree(idbuf);
+	return result;
+}
+
+/*
+ * Truncate a file. Call with sv_lock held, or from sfs_reclaim.
+ */
+static
+int
+sfs_dotruncate(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j, block;
-	uint32_t idblock, baseblock, highblock;
+	uint32_t i, block, baseblock;
+	int levels;
+	bool changed;
 	int result;
-	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	/* Inline contents just need the end cleared */
+	if (sv->sv_i.sfi_flags & SFS_IF_INLINE) {
+		if (len <= SFS_INLINESIZE) {
+			if (len < sv->sv_i.sfi_size) {
+				bzero(sv->sv_i.sfi_inline + len,
+				      SFS_INLINESIZE - len);
+			}
+			sv->sv_i.sfi_size = len;
+			sfs_dirty_inode(sv);
+			return 0;
+		}
+		result = sfs_inline_promote(sv);
+		if (result) {
+			return result;
+		}
+	}
 
-	vfs_biglock_acquire();
+	/* Drop held-back blocks past the new end */
+	if (sv->sv_wcount > 0 && sv->sv_wstart + sv->sv_wcount > blocklen) {
+		i = sv->sv_wcount;
+		sv->sv_wcount = blocklen > sv->sv_wstart ?
+			blocklen - sv->sv_wstart : 0;
+		sfs_wresv_put(sv, sv->sv_wcount == 0 ?
+			      sv->sv_wresv : i - sv->sv_wcount);
+	}
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -1160,70 +2600,64 @@ sfs_truncate(struct vnode *v, off_t len)
 		if (i >= blocklen && block != 0) {
 			sfs_bfree(sfs, block);
 			sv->sv_i.sfi_direct[i] = 0;
-			sv->sv_dirty = true;
+			sfs_dirty_inode(sv);
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
+	/*
+	 * The cached indirect blocks are about to be rewritten or freed
+	 * behind the cache's back.
+	 */
+	sfs_idflush(sv);
 
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
+	/* Start allocating afresh when the file grows again */
+	sfs_resv_release(sv);
+	sv->sv_lastalloc = 0;
 
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
+	/* Then the single, double, and triple indirect trees */
+	baseblock = SFS_NDIRECT;
+	for (levels = 1; levels <= SFS_NINDLEVELS; levels++) {
+		result = sfs_truncate_indirect(sv, sfs_idroot(sv, levels),
+					       levels, baseblock, blocklen,
+					       &changed);
+		if (changed) {
+			sfs_dirty_inode(sv);
+		}
 		if (result) {
-			vfs_biglock_release();
 			return result;
 		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
+		baseblock += sfs_idspan[levels];
 	}
 
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
 
 	/* Mark the inode dirty */
-	sv->sv_dirty = true;
+	sfs_dirty_inode(sv);
 
-	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * Called for ftruncate().
+ */
+static
+int
+sfs_truncate(struct vnode *v, off_t len)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+	result = sfs_dotruncate(sv, len);
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -1259,37 +2693,41 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return EEXIST;
 	}
 
 	if (result==0) {
 		/* We got a file; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		if (result) {
-			vfs_biglock_release();
 			return result;
 		}
 		*ret = &newguy->sv_v;
-		vfs_biglock_release();
 		return 0;
 	}
 
 	/* Didn't exist - create it */
-	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
+	result = sfs_makeobj(sfs, SFS_TYPE_FILE, sv->sv_ino, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
@@ -1299,20 +2737,25 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	/* Link it into the directory */
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
+		lock_release(sv->sv_lock);
+		/* Close the handle first; reclaiming needs one of its own */
+		sfs_jend(sfs);
 		VOP_DECREF(&newguy->sv_v);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
-	newguy->sv_dirty = true;
+	sfs_dirty_inode(newguy);
+	lock_release(newguy->sv_lock);
+
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
 
 	*ret = &newguy->sv_v;
-	
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -1325,26 +2768,37 @@ static
 int
 sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
 	int result;
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
+	/* Hard links to the directory would need its lock twice */
+	if (f == sv) {
+		return EINVAL;
+	}
+
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
 
 	/* Just create a link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	lock_acquire(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
-	f->sv_dirty = true;
+	sfs_dirty_inode(f);
+	lock_release(f->sv_lock);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
 	return 0;
 }
 
@@ -1355,33 +2809,51 @@ static
 int
 sfs_remove(struct vnode *dir, const char *name)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *victim;
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
+	if (victim == sv) {
+		/* An entry for the directory itself; leave it alone */
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
+		VOP_DECREF(&victim->sv_v);
+		return EINVAL;
+	}
 
 	/* Erase its directory entry. */
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
-		victim->sv_dirty = true;
+		sfs_dirty_inode(victim);
+		lock_release(victim->sv_lock);
 	}
 
-	/* Discard the reference that sfs_lookonce got us */
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+
+	/*
+	 * Discard the reference that sfs_lookonce got us. This may
+	 * reclaim the file, which opens a journal handle of its own,
+	 * so it has to come after ours is closed.
+	 */
 	VOP_DECREF(&victim->sv_v);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -1396,20 +2868,23 @@ int
 sfs_rename(struct vnode *d1, const char *n1, 
 	   struct vnode *d2, const char *n2)
 {
+	struct sfs_fs *sfs = d1->vn_fs->fs_data;
 	struct sfs_vnode *sv = d1->vn_data;
 	struct sfs_vnode *g1;
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOT_LOCATION);
 
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
@@ -1430,8 +2905,16 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 	
 	/* Increment the link count, and mark inode dirty */
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
-	g1->sv_dirty = true;
+	sfs_dirty_inode(g1);
+	lock_release(g1->sv_lock);
+
+	/* Linking may have rehashed the directory; find the old name again */
+	result = sfs_dir_findname(sv, n1, NULL, &slot1, NULL);
+	if (result) {
+		goto puke_harder;
+	}
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -1443,14 +2926,18 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	lock_acquire(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
-	g1->sv_dirty = true;
+	sfs_dirty_inode(g1);
+	lock_release(g1->sv_lock);
+
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
 
-	vfs_biglock_release();
 	return 0;
 
  puke_harder:
@@ -1464,11 +2951,15 @@ sfs_rename(struct vnode *d1, const char *n1,
 			strerror(result2));
 		panic("sfs: rename: Cannot recover\n");
 	}
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	sfs_dirty_inode(g1);
+	lock_release(g1->sv_lock);
  puke:
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
-	vfs_biglock_release();
 	return result;
 }
 
@@ -1486,15 +2977,11 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -1502,7 +2989,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_v);
 	*ret = &sv->sv_v;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -1520,22 +3006,19 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 	
+	lock_acquire(sv->sv_lock);
 	result = sfs_lookonce(sv, path, &final, NULL);
+	lock_release(sv->sv_lock);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	*ret = &final->sv_v;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -1619,7 +3102,7 @@ static const struct vnode_ops sfs_dirops = {
 	
 	ISDIR,   /* read */
 	ISDIR,   /* readlink */
-	UNIMP,   /* getdirentry */
+	sfs_getdirentry,
 	ISDIR,   /* write */
 	sfs_ioctl,
 	sfs_stat,
@@ -1643,21 +3126,17 @@ static const struct vnode_ops sfs_dirops = {
 };
 
 /*
- * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * Look for an inode in the table of loaded vnodes. Call with
+ * sfs_vnlock held (for reading or writing).
  */
 static
-int
-sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
-		 struct sfs_vnode **ret)
+struct sfs_vnode *
+sfs_findvnode(struct sfs_fs *sfs, uint32_t ino)
 {
 	struct vnode *v;
 	struct sfs_vnode *sv;
-	const struct vnode_ops *ops = NULL;
 	unsigned i, num;
-	int result;
 
-	/* Look in the vnodes table */
 	num = vnodearray_num(sfs->sfs_vnodes);
 
 	/* Linear search. Is this too slow? You decide. */
@@ -1672,16 +3151,38 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		}
 
 		if (sv->sv_ino==ino) {
-			/* Found */
+			return sv;
+		}
+	}
+	return NULL;
+}
 
-			/* May only be set when creating new objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+/*
+ * Function to load a inode into memory as a vnode, or dig up one
+ * that's already resident.
+ */
+static
+int
+sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
+		 struct sfs_vnode **ret)
+{
+	struct sfs_vnode *sv, *other;
+	const struct vnode_ops *ops = NULL;
+	int result;
 
-			VOP_INCREF(&sv->sv_v);
-			*ret = sv;
-			return 0;
-		}
+	/* Look in the vnodes table */
+	rwlock_acquire_read(sfs->sfs_vnlock);
+	sv = sfs_findvnode(sfs, ino);
+	if (sv != NULL) {
+		/* May only be set when creating new objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
+
+		VOP_INCREF(&sv->sv_v);
+		rwlock_release_read(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
+	rwlock_release_read(sfs->sfs_vnlock);
 
 	/* Didn't have it loaded; load it */
 
@@ -1703,9 +3204,31 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		return result;
 	}
 
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		return ENOMEM;
+	}
+
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* No indirect blocks cached until someone needs one */
+	sv->sv_idcache = NULL;
+
+	/* No allocation history or reservation yet */
+	sv->sv_lastalloc = 0;
+	sv->sv_resvnext = sv->sv_resvend = 0;
+
+	/* Not on the dirty list */
+	sv->sv_dnext = NULL;
+	sv->sv_dpprev = NULL;
+
+	/* No delayed writes */
+	sv->sv_wbuf = NULL;
+	sv->sv_wstart = sv->sv_wcount = 0;
+	sv->sv_wresv = 0;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out and thus the type
@@ -1714,6 +3237,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	if (forcetype != SFS_TYPE_INVAL) {
 		KASSERT(sv->sv_i.sfi_type == SFS_TYPE_INVAL);
 		sv->sv_i.sfi_type = forcetype;
+		sv->sv_i.sfi_flags |= SFS_IF_INLINE;
 		sv->sv_dirty = true;
 	}
 
@@ -1736,6 +3260,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
 		return result;
 	}
@@ -1743,14 +3268,37 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
 
-	/* Add it to our table */
+	/*
+	 * Add it to our table. We dropped the table lock while reading
+	 * the inode, so someone else may have loaded it meanwhile; if
+	 * so, use theirs and throw ours away.
+	 */
+	rwlock_acquire_write(sfs->sfs_vnlock);
+	other = sfs_findvnode(sfs, ino);
+	if (other != NULL) {
+		KASSERT(forcetype==SFS_TYPE_INVAL);
+		VOP_INCREF(&other->sv_v);
+		rwlock_release_write(sfs->sfs_vnlock);
+		VOP_CLEANUP(&sv->sv_v);
+		lock_destroy(sv->sv_lock);
+		kfree(sv);
+		*ret = other;
+		return 0;
+	}
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
+	rwlock_release_write(sfs->sfs_vnlock);
 	if (result) {
 		VOP_CLEANUP(&sv->sv_v);
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
 		return result;
 	}
 
+	/* A new object needs its type written out */
+	if (sv->sv_dirty) {
+		sfs_dirty_inode(sv);
+	}
+
 	/* Hand it back */
 	*ret = sv;
 	return 0;
@@ -1767,14 +3315,120 @@ sfs_getroot(struct fs *fs)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOT_LOCATION, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		panic("sfs: getroot: Cannot load root vnode\n");
 	}
 
-	vfs_biglock_release();
-
 	return &sv->sv_v;
 }
+
+/*
+ * Walk the files in the root directory and count how many pieces
+ * their data is in. Used by sfs_fragreport().
+ */
+int
+sfs_filefrag(struct sfs_fs *sfs, uint32_t *nfiles, uint32_t *nblocks,
+	     uint32_t *nextents, uint32_t *nfragfiles)
+{
+	struct sfs_vnode *dir, *sv;
+	struct sfs_dir sd;
+	uint32_t fileblock, fblocks, diskblock, prev, extents;
+	int i;
+	int result;
+
+	*nfiles = *nblocks = *nextents = *nfragfiles = 0;
+
+	result = sfs_loadvnode(sfs, SFS_ROOT_LOCATION, SFS_TYPE_INVAL, &dir);
+	if (result) {
+		return result;
+	}
+	lock_acquire(dir->sv_lock);
+
+	/* The directory can change while it's unlocked; see below */
+	for (i=0; i<sfs_dir_nentries(dir); i++) {
+		result = sfs_readdir(dir, &sd, i);
+		if (result) {
+			break;
+		}
+		if (sd.sfd_ino == SFS_NOINO || sd.sfd_ino == dir->sv_ino) {
+			continue;
+		}
+		result = sfs_loadvnode(sfs, sd.sfd_ino, SFS_TYPE_INVAL, &sv);
+		if (result) {
+			break;
+		}
+		lock_acquire(sv->sv_lock);
+
+		/* A new extent starts wherever a block doesn't follow on */
+		fblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+		prev = 0;
+		extents = 0;
+		for (fileblock=0; fileblock<fblocks; fileblock++) {
+			result = sfs_bmap(sv, fileblock, 0, &diskblock);
+			if (result) {
+				break;
+			}
+			if (diskblock == 0) {
+				continue;
+			}
+			if (diskblock != prev+1) {
+				extents++;
+			}
+			prev = diskblock;
+			(*nblocks)++;
+		}
+		lock_release(sv->sv_lock);
+
+		/*
+		 * Letting go of the file may reclaim it, which opens a
+		 * journal handle, so it can't be done holding a lock.
+		 */
+		lock_release(dir->sv_lock);
+		VOP_DECREF(&sv->sv_v);
+		lock_acquire(dir->sv_lock);
+		if (result) {
+			break;
+		}
+
+		(*nfiles)++;
+		*nextents += extents;
+		if (extents > 1) {
+			(*nfragfiles)++;
+		}
+	}
+
+	lock_release(dir->sv_lock);
+	VOP_DECREF(&dir->sv_v);
+	return result;
+}
+
+/*
+ * Make a directory that isn't linked in anywhere, on the same volume
+ * as DIR (and near it), and hand back its vnode. Like a removed file
+ * that's still open, it goes away once let go of; remove anything
+ * linked into it first. For fstest, there being no mkdir yet.
+ */
+int
+sfs_scratchdir(struct vnode *dir, struct vnode **ret)
+{
+	struct sfs_fs *sfs;
+	struct sfs_vnode *sv;
+	int result;
+
+	if (dir->vn_fs == NULL || dir->vn_fs->fs_getroot != sfs_getroot) {
+		return EINVAL;
+	}
+	sfs = dir->vn_fs->fs_data;
+	sv = dir->vn_data;
+
+	sfs_jbegin(sfs);
+	result = sfs_makeobj(sfs, SFS_TYPE_DIR, sv->sv_ino, &sv);
+	sfs_jend(sfs);
+	if (result) {
+		return result;
+	}
+
+	*ret = &sv->sv_v;
+	return 0;
+}
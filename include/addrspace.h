@@ -44,6 +44,9 @@
 struct vnode;
 extern struct addrspace* last_as;
 
+/* always have 48k of user stack */
+#define DUMBVM_STACKPAGES    12
+
 /* 
  * Address space - data structure associated with the virtual memory
  * space of a process.
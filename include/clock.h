@@ -39,7 +39,9 @@
  * when the CPU is not idle, for scheduling.
  *
  * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timed operations. (This is a fairly simpleminded interface.) Finer
+ * grained timed operations should use the timeouts in <timeout.h>,
+ * which are driven from hardclock().
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
@@ -70,8 +72,19 @@ void getinterval(time_t secs1, uint32_t nsecs,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ *
+ * clocksleep_nsecs() is the same but takes seconds and nanoseconds,
+ * like nanosleep(2). The sleep is rounded up to whole hardclock
+ * ticks, so the resolution is 1/HZ seconds.
+ *
+ * clocksleep_ticks() sleeps for a given number of hardclock ticks.
+ *
+ * Each sleeper arms its own timeout and is woken individually when it
+ * expires.
  */
 void clocksleep(int seconds);
+void clocksleep_nsecs(time_t seconds, uint32_t nanoseconds);
+void clocksleep_ticks(uint64_t ticks);
 
 
 #endif /* _CLOCK_H_ */
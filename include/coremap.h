@@ -21,6 +21,9 @@ struct coremap_entry ** get_global_coremap(void);
 bool coremap_exists(void);
 void set_coremap_proc(unsigned int index, int seg_type);
 void printCoremap(void);
+void coremap_getstats(unsigned *used, unsigned *total);
+paddr_t coremap_paddr(unsigned int index);
+void coremap_release(unsigned int index, unsigned int npages);
 
 extern paddr_t lo_paddr, hi_paddr;
 
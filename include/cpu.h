@@ -33,10 +33,14 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <timeout.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 #include "opt-A3.h"
+#include "opt-systrace.h"
 #include <addrspace.h>
 
+struct systrace_cpu;
+
 
 /*
  * Per-cpu structure
@@ -89,6 +93,20 @@ struct cpu {
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
 	struct spinlock c_ipi_lock;
+
+	/*
+	 * Timeouts armed on this cpu; run from its hardclock.
+	 * Protected by the wheel's own lock.
+	 */
+	struct timerwheel c_timers;
+
+#if OPT_SYSTRACE
+	/*
+	 * Syscall counters. Accessed only by this cpu, with interrupts
+	 * off, except when a report adds them up.
+	 */
+	struct systrace_cpu *c_systrace;
+#endif
 };
 
 #define TLBSHOOTDOWN_ALL  (-1)
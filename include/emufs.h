@@ -45,6 +45,38 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	off_t ev_size;			/* cached file size */
+	bool ev_sizevalid;		/* true if ev_size can be used */
+};
+
+/*
+ * Client-side cache.
+ *
+ * While caching is on, each emufs keeps up to ef_npages pages of file
+ * data, replaced least recently used first, and each file vnode
+ * remembers the file's size. Writes stay in the cache until fsync,
+ * sync, the last close, or until the page is wanted for something
+ * else. Opening a file asks the host for its size again and drops the
+ * cached pages if it changed (close-to-open consistency, with the
+ * size standing in for a modification time).
+ *
+ * The number of pages is set at mount time to 1/EMUFS_RAMSHARE of
+ * physical memory, within EMUFS_MINPAGES..EMUFS_MAXPAGES. Buffers are
+ * only allocated as pages get used.
+ */
+#define EMUFS_PAGESIZE  4096
+#define EMUFS_RAMSHARE  32
+#define EMUFS_MINPAGES  16
+#define EMUFS_MAXPAGES  1024
+
+struct emufs_page {
+	struct emufs_vnode *ep_ev;	/* file, or NULL if free */
+	uint32_t ep_pageno;		/* page number within the file */
+	uint32_t ep_len;		/* valid bytes from start of page */
+	bool ep_dirty;			/* needs writing back */
+	unsigned ep_lastuse;		/* ef_clock at last use */
+	char *ep_data;			/* EMUFS_PAGESIZE bytes, or NULL */
+	bool ep_busy;			/* being read in or written back */
 };
 
 struct emufs_fs {
@@ -52,7 +84,23 @@ struct emufs_fs {
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
 	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+	struct lock *ef_vnlock;		/* protects ef_vnodes */
+	struct lock *ef_cachelock;	/* protects all below, and ev_size */
+	bool ef_cacheon;		/* caching enabled */
+	struct cv *ef_cachecv;		/* a page stopped being busy */
+	unsigned ef_clock;		/* ticks on every page use */
+	unsigned ef_npages;		/* size of ef_pages[] */
+	struct emufs_page *ef_pages;
+	unsigned ef_hits, ef_misses;	/* page lookups */
+	unsigned ef_ahits, ef_amisses;	/* file size lookups */
+	unsigned ef_writebacks;		/* dirty pages written */
 };
 
+/*
+ * Turn caching on (ENABLE 1) or off (0) for the emufs named DEVNAME,
+ * or just report (-1); prints the cache statistics either way.
+ */
+int emufs_cachectl(const char *devname, int enable);
+
 
 #endif /* _EMUFS_H_ */
@@ -16,6 +16,7 @@ struct File{
 	unsigned int fd;
 	volatile off_t offset;
     struct lock* rw_lock;
+    unsigned int refcount; // file tables sharing this File (fork)
 };
 
 struct FileTable{
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_IORING_H_
+#define _KERN_IORING_H_
+
+/*
+ * Submission/completion rings for batched system calls.
+ *
+ * A process sets up, in its own memory, a control block (struct
+ * ioring), an array of submission entries and an array of completion
+ * entries, each a power of two long. It fills in submission entries,
+ * advances ir_sqtail, and calls ioring_enter() to have the kernel run
+ * them all in one trap. The kernel runs them in order, posts one
+ * completion per entry at ir_cqtail, and advances ir_sqhead and
+ * ir_cqtail. The process consumes completions and advances ir_cqhead.
+ *
+ * Indexes run freely and are masked with the array's mask on use,
+ * so tail - head is the number of entries queued.
+ */
+
+/* Operations (sqe_op). */
+#define IORING_OP_NOP	0	/* does nothing, result 0 */
+#define IORING_OP_READ	1	/* read(fd, addr, len) */
+#define IORING_OP_WRITE	2	/* write(fd, addr, len) */
+#define IORING_OP_OPEN	3	/* open(addr, len as open flags) */
+#define IORING_OP_CLOSE	4	/* close(fd) */
+
+/* Submission flags (sqe_flags). */
+#define IORING_SQE_POS	1	/* read/write at sqe_off, as pread/pwrite */
+
+/* Largest ring the kernel will accept. */
+#define IORING_MAX_ENTRIES	4096
+
+struct ioring_sqe {
+	__u32 sqe_op;		/* IORING_OP_* */
+	__i32 sqe_fd;		/* file to operate on */
+	__u32 sqe_flags;	/* IORING_SQE_* */
+	__u32 sqe_len;		/* byte count (open: open flags) */
+#ifdef _KERNEL
+	userptr_t sqe_addr;	/* buffer (open: path) */
+#else
+	void *sqe_addr;		/* buffer (open: path) */
+#endif
+	__u32 sqe_pad;
+	__off_t sqe_off;	/* file position, with IORING_SQE_POS */
+	__u64 sqe_data;		/* passed back untouched in cqe_data */
+};
+
+struct ioring_cqe {
+	__u64 cqe_data;		/* sqe_data of the entry this completes */
+	__i32 cqe_res;		/* what the syscall returned, or -errno */
+	__u32 cqe_pad;
+};
+
+struct ioring {
+	__u32 ir_sqhead;	/* next entry to run; written by the kernel */
+	__u32 ir_sqtail;	/* next free entry; written by the process */
+	__u32 ir_sqmask;	/* submission entries - 1 */
+	__u32 ir_cqhead;	/* next completion to consume; process */
+	__u32 ir_cqtail;	/* next completion slot; written by the kernel */
+	__u32 ir_cqmask;	/* completion entries - 1 */
+#ifdef _KERNEL
+	userptr_t ir_sqes;	/* submission entries */
+	userptr_t ir_cqes;	/* completion entries */
+#else
+	struct ioring_sqe *ir_sqes;
+	struct ioring_cqe *ir_cqes;
+#endif
+};
+
+#endif /* _KERN_IORING_H_ */
@@ -41,6 +41,7 @@
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
+#define SFS_NINDLEVELS    3             /* max depth of indirect blocks */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SB_LOCATION    0            /* block the superblock lives in */
 #define SFS_ROOT_LOCATION  1            /* loc'n of the root dir inode */
@@ -71,28 +72,89 @@ struct sfs_super {
 	uint32_t sp_magic;		/* Magic number, should be SFS_MAGIC */
 	uint32_t sp_nblocks;			/* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];
+	uint32_t sp_jstart;			/* First block of journal */
+	uint32_t sp_jblocks;			/* Journal size, 0 if none */
+	uint32_t reserved[116];
 };
 
 /*
  * On-disk inode
+ *
+ * The double and triple indirect pointers live in what used to be the
+ * start of sfi_waste. Older volumes always have zeros there, which
+ * reads as "no such blocks", so they mount and work unchanged; they
+ * just can't have held a file bigger than the single indirect block
+ * could map.
+ *
+ * A small file or directory with SFS_IF_INLINE set keeps its contents
+ * in sfi_inline rather than in data blocks, and has no blocks at all.
+ * The bytes there past sfi_size are always zero.
  */
+#define SFS_INLINESIZE    (4*(128-6-SFS_NDIRECT))  /* bytes of sfi_inline */
+
 struct sfs_inode {
 	uint32_t sfi_size;			/* Size of this file (bytes) */
 	uint16_t sfi_type;			/* One of SFS_TYPE_* above */
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	uint32_t sfi_flags;			/* SFS_IF_* flags below */
+	char sfi_inline[SFS_INLINESIZE];	/* Inline data, or 0 */
 };
 
+/* Flags for sfi_flags */
+#define SFS_IF_HASHDIR    0x1     /* directory blocks are hash buckets */
+#define SFS_IF_INLINE     0x2     /* contents are in sfi_inline */
+
 /*
  * On-disk directory entry
+ *
+ * A free slot has sfd_ino == SFS_NOINO. In hashed directories a slot
+ * that used to hold an entry has SFS_DIR_TOMBSTONE as the first byte
+ * of the name, to tell it apart from one that was never used.
  */
+#define SFS_DIR_TOMBSTONE '/'
+
 struct sfs_dir {
 	uint32_t sfd_ino;			/* Inode number */
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * On-disk metadata journal
+ *
+ * If sp_jblocks is nonzero, that many blocks starting at sp_jstart
+ * (marked in use in the freemap) hold a journal. The first is a
+ * struct sfs_jheader; the rest is a log, always written from its
+ * start after a checkpoint. The log holds transactions, each one or
+ * more descriptor blocks, each followed by the blocks whose home
+ * locations its tags list, and then a commit block, which is a
+ * descriptor with the commit magic and the transaction's total block
+ * count in jd_ntags. Recovery replays complete transactions with
+ * consecutive sequence numbers, starting at jh_seq.
+ *
+ * Older volumes have zeros in the superblock fields, meaning no
+ * journal.
+ */
+#define SFS_JMAGIC_HEADER 0x6a686472    /* "jhdr" */
+#define SFS_JMAGIC_DESC   0x6a646573    /* "jdes" */
+#define SFS_JMAGIC_COMMIT 0x6a636d74    /* "jcmt" */
+#define SFS_JTAGS         125           /* tags per descriptor block */
+
+struct sfs_jheader {
+	uint32_t jh_magic;			/* SFS_JMAGIC_HEADER */
+	uint32_t jh_seq;			/* First transaction to replay */
+	uint32_t jh_waste[126];			/* unused space, set to 0 */
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;			/* SFS_JMAGIC_DESC or _COMMIT */
+	uint32_t jd_seq;			/* Transaction sequence number */
+	uint32_t jd_ntags;			/* # of tags used */
+	uint32_t jd_tags[SFS_JTAGS];		/* Home blocks of what follows */
+};
+
 
 #endif /* _KERN_SFS_H_ */
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics ("lockstat").
+ *
+ * When the kernel is configured with "options lockstat", every named
+ * spinlock and every sleep lock (struct lock, struct rwlock) keeps
+ * counters in a struct lockstat shared by all locks with the same
+ * name and kind. For each we record:
+ *
+ *    ls_acquires   - number of times the lock was taken
+ *    ls_contended  - number of those where we had to wait
+ *    ls_waitns     - total time spent waiting, in nanoseconds
+ *    ls_maxwaitns  - longest single wait
+ *    ls_holdns     - total time the lock was held
+ *
+ * Times come from gettime(), whose LAMEbus timer counts processor
+ * cycles, so this is as close to a cycle counter as we have.
+ *
+ * Spinlocks have no name unless given one, with
+ * SPINLOCK_NAMED_INITIALIZER or spinlock_setname() (see spinlock.h);
+ * unnamed spinlocks are not tracked. Sleep locks use their lk_name.
+ *
+ * Without the option, none of this is compiled in.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+#include <spinlock.h>
+
+#define LOCKSTAT_NAMELEN  24	/* names longer than this are truncated */
+#define LOCKSTAT_MAX      128	/* number of distinct lock names tracked */
+
+/* Lock kinds, also used to tell otherwise same-named records apart. */
+#define LOCKSTAT_SPIN     0
+#define LOCKSTAT_SLEEP    1
+#define LOCKSTAT_RW       2
+
+struct lockstat {
+	char ls_name[LOCKSTAT_NAMELEN];
+	int ls_kind;
+	struct spinlock ls_lock;	/* protects the counters; unnamed */
+	uint64_t ls_acquires;
+	uint64_t ls_contended;
+	uint64_t ls_waitns;
+	uint64_t ls_maxwaitns;
+	uint64_t ls_holdns;
+};
+
+/*
+ * Functions:
+ *    lockstat_bootstrap - start recording. Must be called after the
+ *                         clock device is attached, since gettime
+ *                         doesn't work until then.
+ *    lockstat_get       - find or make the record for NAME/KIND.
+ *                         Returns NULL if recording is off or the
+ *                         table is full.
+ *    lockstat_now       - current time in nanoseconds.
+ *    lockstat_acquired  - note an acquisition. WAITSTART is the time
+ *                         we started waiting, or 0 if the lock was
+ *                         free; NOW is the time we got the lock.
+ *    lockstat_released  - note a release of a lock taken at ACQTIME.
+ *    lockstat_print     - print the N most contended locks.
+ *    lockstat_reset     - zero all the counters.
+ */
+void lockstat_bootstrap(void);
+struct lockstat *lockstat_get(const char *name, int kind);
+uint64_t lockstat_now(void);
+void lockstat_acquired(struct lockstat *ls, uint64_t waitstart, uint64_t now);
+void lockstat_released(struct lockstat *ls, uint64_t acqtime);
+void lockstat_print(unsigned n);
+void lockstat_reset(void);
+
+/* true once lockstat_bootstrap has run */
+extern volatile bool lockstat_enabled;
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -41,9 +41,11 @@
 #include <thread.h> /* required for struct threadarray */
 #include <filetable.h>
 #include "opt-A2.h"
+#include "opt-systrace.h"
 #include <synch.h>
 struct addrspace;
 struct vnode;
+struct systrace_ring;
 
 /*
  * Process structure.
@@ -59,18 +61,39 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
+	/* Resource usage (see usage.h); protected by p_lock */
+	struct usage p_usage;		/* from threads that have left */
+	struct usage p_cusage;		/* from reaped children */
+
 	/* add more material here as needed */
 #if OPT_A2
     pid_t p_pid;
     pid_t p_parentpid;
-    int child_exitcode; // exitcode of my child
-    int child_is_exit;  //does my child exit?
-    int is_waiting; //am i is waiting for my child ?
+    /*
+     * Parent/child bookkeeping, all protected by the global wait lock
+     * in proc.c. A process that exits while it still has a parent
+     * moves from the parent's p_children list to its p_zombies list
+     * and keeps its pid until the parent reaps it; one without a
+     * parent is freed as soon as it exits.
+     */
+    struct proc *p_parent;      // NULL if orphaned or not forked
+    struct proc *p_children;    // live children
+    struct proc *p_zombies;     // exited children not yet reaped
+    struct proc *p_sibling;     // link on the parent's list
+    struct proc **p_psibling;   // pointer to us on that list
+    struct cv *p_waitcv;        // we wait here for a child to exit
+    int p_exitcode;             // wait status, set by _exit
+    bool p_exited;
+    // vfork child still running on its parent's address space; the
+    // parent sleeps on its p_waitcv until this goes false
+    bool p_asborrowed;
     struct FileTable *p_ft;
-    struct semaphore *p_sem;
     bool stdio_reserve;
     //struct vnode * elf_file;
 #endif
+#if OPT_SYSTRACE
+    struct systrace_ring *p_systrace;  // recent syscalls, or NULL; p_lock
+#endif
     
 };
 
@@ -89,9 +112,50 @@ int proc_duplicate(struct proc * src, struct proc * dest);
 
 struct proc * maybe_proc_create(const char *name);
 
+/*
+ * Set up DEST as a vfork child of SRC: it runs on SRC's address space
+ * rather than a copy, and shares SRC's cwd and open files.
+ */
+int proc_share(struct proc * src, struct proc * dest);
+
+/*
+ * Give a borrowed address space back to the vfork parent; called by
+ * execv once the child is running on its own, fully loaded address
+ * space. _exit does this implicitly.
+ */
+void proc_releaseas(struct proc *p);
+
+/* Sleep until vfork child CHILD stops using our address space. */
+void proc_vforkwait(struct proc *child);
+
+/* Make CHILD a child of PARENT, to be reaped with proc_waitchild. */
+void proc_addchild(struct proc *parent, struct proc *child);
+
+/*
+ * Called by the last thread of P as it exits, after it has detached
+ * and dropped the address space and file table. Orphans P's live
+ * children, frees its unreaped ones, and either hands P to its
+ * parent as a zombie or frees it.
+ */
+void proc_exit(struct proc *p);
+
+/*
+ * Reap an exited child of the current process: PID, or any child if
+ * PID is -1. If NOHANG and no such child has exited yet, sets
+ * *CHILDPID to 0 instead of waiting. Returns an errno value.
+ */
+int proc_waitchild(pid_t pid, bool nohang, pid_t *childpid, int *exitcode);
+
 /* Remove all threads from current process. */
 // void proc_remall(void);
 
+/* Print the N processes using the most of METRIC (PROC_TOP_*). */
+#define PROC_TOP_CPU	0	/* user + system ticks */
+#define PROC_TOP_FAULTS	1	/* minor + major faults */
+#define PROC_TOP_SWAP	2	/* swap-ins + swap-outs */
+#define PROC_TOP_IO	3	/* bytes read + written */
+void proc_printtop(int metric, unsigned n);
+
 #endif
 
 /* Destroy a process. */
@@ -103,6 +167,13 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/*
+ * Resource usage of P itself, including its live threads, and of its
+ * reaped children.
+ */
+void proc_getusage(struct proc *p, struct usage *u);
+void proc_getchildusage(struct proc *p, struct usage *u);
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
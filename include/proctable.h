@@ -9,17 +9,34 @@
 
 #if OPT_A2
 
+// initial number of pid slots; the table doubles from here up to PID_MAX+1
+#define PT_INITSIZE 32
+
 struct ProcTable {
-	struct proc * processes[OPEN_MAX];
+	// indexed by pid; pt_size entries, grown on demand
+	struct proc ** processes;
+	unsigned pt_size;
+	// free pids form a FIFO threaded through pt_freelink[], so a freed
+	// pid goes to the back of the line and is not handed out again
+	// until every other free pid has been. pid 0 is never free and
+	// doubles as the end-of-list marker.
+	pid_t * pt_freelink;
+	pid_t pt_freehead;
+	pid_t pt_freetail;
+	unsigned pt_nfree;
 	int num_running;
 	struct cv * pt_cv;
 	struct lock * pt_lock;
 	struct lock * pt_lock2;
+	// guards everything above: lookups share it, add/remove/grow take it exclusively
+	struct rwlock * pt_rwlock;
 };
 
+// create the table and its locks, and give kernproc (kproc) the first pid
+void proctable_bootstrap(struct proc * kernproc);
 struct ProcTable * get_proctable(void);
 struct proc * get_proc_by_pid(pid_t pid);
-void add_proc_to_table(struct proc * p);
+int add_proc_to_table(struct proc * p);
 void remove_proc_from_table(struct proc * p);
 bool can_add_to_proctable(void);
 
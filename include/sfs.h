@@ -41,6 +41,7 @@
  */
 #include <fs.h>
 #include <vnode.h>
+#include <spinlock.h>
 
 /*
  * Get on-disk structures and constants that are made available to 
@@ -48,23 +49,99 @@
  */
 #include <kern/sfs.h>
 
+struct sfs_journal;     /* metadata journal; private to sfs_journal.c */
+
+/*
+ * Copy of the most recently used indirect block at each depth of a
+ * file's block tree (slot 0 holds blocks that point at data, slot 1
+ * blocks that point at those, and so on). Sequential access walks the
+ * same indirect blocks over and over, so keeping them here saves most
+ * of the metadata reads. Contents are written through to disk; a
+ * block number of 0 marks an empty slot.
+ */
+struct sfs_idcache {
+	uint32_t ic_block;              /* disk block cached, or 0 */
+	uint32_t ic_data[SFS_DBPERIDB]; /* contents of that block */
+};
+
+/*
+ * Locking: sv_lock covers everything in a sfs_vnode below sv_v,
+ * including the file's data and indirect blocks. sfs_vnlock covers the
+ * table of loaded vnodes, and sfs_freemaplock the free block map, the
+ * reservation map, the held map, and the superblock. Take them in that
+ * order; when two vnodes are needed, lock the directory before the
+ * file in it. The dirty inode list (sv_dnext/sv_dpprev) is under
+ * sfs_dirtylock. The journal's own lock comes after all of these, but
+ * an operation that changes anything must open its journal handle
+ * (sfs_jbegin) before taking any of them.
+ */
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
+	struct lock *sv_lock;           /* protects the rest of this */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct sfs_idcache *sv_idcache; /* SFS_NINDLEVELS slots, or NULL */
+	uint32_t sv_lastalloc;          /* last block allocated, or 0 */
+	uint32_t sv_resvnext;           /* next block in reservation window */
+	uint32_t sv_resvend;            /* end of reservation window */
+	struct sfs_vnode *sv_dnext;     /* next on dirty inode list */
+	struct sfs_vnode **sv_dpprev;   /* pointer to us there, or NULL */
+	char *sv_wbuf;                  /* delayed writes, or NULL */
+	uint32_t sv_wstart;             /* file block of first one there */
+	uint32_t sv_wcount;             /* number of blocks there */
+	uint32_t sv_wresv;              /* blocks promised for them */
 };
 
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
+	struct lock *sfs_freemaplock;   /* protects the maps and super */
 	struct sfs_super sfs_super;	/* on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct rwlock *sfs_vnlock;      /* protects sfs_vnodes */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_mapdirty;    /* freemap blocks modified */
+	struct bitmap *sfs_resvmap;     /* blocks in reservation windows */
+	struct spinlock sfs_dirtylock;  /* protects sfs_dirtyinodes */
+	struct sfs_vnode *sfs_dirtyinodes; /* dirty or delayed-write vnodes */
+	struct sfs_journal *sfs_journal; /* metadata journal, or NULL */
+	struct bitmap *sfs_heldmap;     /* freed blocks not reusable yet */
+	unsigned sfs_nheld;             /* number of bits set there */
+	uint32_t sfs_nfree;             /* blocks not marked in sfs_freemap */
+	uint32_t sfs_nresv;             /* number of bits set in sfs_resvmap */
+	uint32_t sfs_ndelayed;          /* blocks promised to delayed writes */
+	bool sfs_frozen;                /* writes dropped; see sfs_freeze */
 };
 
+/*
+ * Size of the reservation window handed to a growing file; see
+ * sfs_balloc_file().
+ */
+#define SFS_RESVBLOCKS  32
+
+/*
+ * Most blocks of newly written file data held back to be allocated
+ * and written together; see sfs_wbuf_write().
+ */
+#define SFS_CLUSTERBLOCKS 16
+
+/*
+ * Extra blocks promised along with each run of held-back blocks, for
+ * the indirect blocks flushing it may need: a new chain where the run
+ * starts and another where it crosses into the next indirect block.
+ */
+#define SFS_WRESVMETA   (2*SFS_NINDLEVELS)
+
+/*
+ * Size of the journal put on a volume that doesn't have one when it
+ * is first mounted, and the smallest volume that gets one.
+ */
+#define SFS_JBLOCKS     512
+#define SFS_JMINVOLUME  (8*SFS_JBLOCKS)
+
 /*
  * Function for mounting a sfs (calls vfs_mount)
  */
@@ -84,8 +161,45 @@ int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block);
 
+/* Metadata journal */
+int sfs_jrecover(struct sfs_fs *sfs);
+int sfs_jstart(struct sfs_fs *sfs);
+int sfs_jflush(struct sfs_fs *sfs);
+void sfs_jstop(struct sfs_fs *sfs);
+void sfs_jbegin(struct sfs_fs *sfs);
+void sfs_jend(struct sfs_fs *sfs);
+int sfs_jwrite(struct sfs_fs *sfs, void *data, uint32_t block);
+int sfs_jwriteuio(struct sfs_fs *sfs, struct uio *uio);
+int sfs_jread(struct sfs_fs *sfs, struct uio *uio, bool *found);
+int sfs_jcommit(struct sfs_fs *sfs);
+int sfs_jsync(struct sfs_fs *sfs);
+void sfs_jcounts(struct sfs_fs *sfs, uint32_t *ncommits, uint32_t *nlogged);
+void sfs_jfreezeroom(struct sfs_fs *sfs);
+
+/* Write out the changed parts of the freemap, if there's no journal */
+int sfs_mapsync(struct sfs_fs *sfs);
+
+/* Put a file's held-back data and inode in the journal, uncommitted */
+int sfs_flushvnode(struct sfs_vnode *sv);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
+/* Count the extents of the files in the root directory */
+int sfs_filefrag(struct sfs_fs *sfs, uint32_t *nfiles, uint32_t *nblocks,
+		 uint32_t *nextents, uint32_t *nfragfiles);
+
+/* Print a fragmentation report for the sfs mounted on DEVNAME */
+int sfs_fragreport(const char *devname);
+
+/* For testing journal replay; see sfs_fs.c */
+int sfs_logstat(const char *devname, uint32_t *ncommits, uint32_t *nlogged,
+		bool *frozen);
+int sfs_freeze(const char *devname);
+int sfs_freezeroom(const char *devname);
+
+/* Make an unlinked directory for fstest to use; see sfs_vnode.c */
+int sfs_scratchdir(struct vnode *dir, struct vnode **ret);
+
 
 #endif /* _SFS_H_ */
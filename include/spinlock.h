@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -50,19 +51,44 @@
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * Spinlocks are ticket locks: each CPU that wants the lock takes the
+ * next number from lk_next and waits until lk_serving reaches it.
+ * This hands the lock out in FIFO order, so no CPU can be starved,
+ * and waiters back off in proportion to how far back in line they
+ * are, which keeps the traffic on lk_serving down.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
+	volatile spinlock_data_t lk_next;    /* Next ticket to hand out. */
+	volatile spinlock_data_t lk_serving; /* Ticket now holding the lock. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	const char *lk_name;		/* Name for lockstat, or NULL. */
+	struct lockstat *lk_stat;	/* Looked up on first use. */
+	uint64_t lk_acqtime;		/* When the holder got it. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
+ * The named version gives the lock a name for lockstat (lockstat.h);
+ * without lockstat the name is ignored.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, \
+	  NULL, NULL, 0 }
+#define SPINLOCK_NAMED_INITIALIZER(name) \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, \
+	  name, NULL, 0 }
+#else
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_NAMED_INITIALIZER(name) SPINLOCK_INITIALIZER
+#endif
 
 /*
  * Spinlock functions.
@@ -74,6 +100,9 @@ struct spinlock {
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ *
+ * setname	Name the lock for lockstat. The string is not copied and
+ *		must outlive the lock. Does nothing without lockstat.
  */
 
 void spinlock_init(struct spinlock *lk);
@@ -83,5 +112,11 @@ void spinlock_acquire(struct spinlock *lk);
 void spinlock_release(struct spinlock *lk);
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+#if OPT_LOCKSTAT
+void spinlock_setname(struct spinlock *lk, const char *name);
+#else
+#define spinlock_setname(lk, name) ((void)(lk), (void)(name))
+#endif
+
 
 #endif /* _SPINLOCK_H_ */
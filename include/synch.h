@@ -37,6 +37,7 @@
 
 #include <spinlock.h>
 #include "opt-A1.h"
+#include "opt-lockstat.h"
 /*
  * Dijkstra-style semaphore.
  *
@@ -71,15 +72,29 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held by a thread
+ * that is currently running on another CPU spins for a while (up to
+ * LOCK_SPIN_MAX polls) in the hope that the holder lets go soon,
+ * and only goes to sleep on lk_wchan if that doesn't happen or the
+ * holder is not running. lk_nwaiters counts the sleepers so that an
+ * uncontended release never has to touch the wait channel.
  */
+#define LOCK_SPIN_MAX 2000
+
 struct lock {
         char *lk_name;
         // add what you need here
 #if OPT_A1
     struct wchan *lk_wchan;
 	struct spinlock lk_lock;
-    bool be_held;
+    volatile bool be_held;
     struct thread* who_hold;
+    volatile unsigned lk_nwaiters;
+#endif
+#if OPT_LOCKSTAT
+	struct lockstat *lk_stat;       /* lockstat record, set on first use */
+	uint64_t lk_acqtime;            /* when the holder got the lock */
 #endif
         // (don't forget to mark things volatile as needed)
 };
@@ -148,4 +163,54 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once; a writer holds it
+ * alone. The lock prefers writers: once a writer is waiting, newly
+ * arriving readers block behind it, so a steady stream of readers
+ * cannot starve updates. Readers wait on rw_rwchan and writers on
+ * rw_wwchan.
+ *
+ * Read acquisitions are not recursive: a thread that already holds
+ * the lock for reading must not try to get it for reading again,
+ * since a writer may have queued up in between.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rw_name;
+	struct spinlock rw_lock;
+	struct wchan *rw_rwchan;
+	struct wchan *rw_wwchan;
+	volatile unsigned rw_readers;      /* threads holding for read */
+	volatile unsigned rw_waitwriters;  /* writers asleep on rw_wwchan */
+	struct thread *rw_writer;          /* thread holding for write */
+#if OPT_LOCKSTAT
+	struct lockstat *rw_stat;          /* lockstat record */
+	uint64_t rw_acqtime;               /* when the writer got it */
+#endif
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Blocks while a
+ *                           writer holds the lock or is waiting for it.
+ *    rwlock_release_read  - Drop a read hold.
+ *    rwlock_acquire_write - Get the lock exclusively.
+ *    rwlock_release_write - Drop the exclusive hold.
+ *    rwlock_do_i_hold     - Return true if the current thread holds
+ *                           the lock for writing. (Read holds are not
+ *                           tracked per thread.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold(struct rwlock *);
+
 #endif /* _SYNCH_H_ */
@@ -60,6 +60,7 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
 #if OPT_A2
 int read(unsigned int fd, void *buf, size_t buflen, int32_t *ret);
 int write(unsigned int fd, const void *buffer, size_t len, int32_t *ret);
@@ -69,6 +70,35 @@ int close(int fd, int32_t *ret);
 pid_t waitpid(pid_t pid, int *status, int options,int32_t *ret);
 int execv(const char* program, char ** args, int32_t* retval);
 int fork(struct trapframe * parent_trapframe, int32_t *ret);
+int vfork(struct trapframe * parent_trapframe, int32_t *ret);
+
+/*
+ * execv argument marshalling. KBUF must be ARG_MAX bytes.
+ * execv_copyinargs packs the user's argv strings into KBUF, failing
+ * with E2BIG if they would not fit on the new user stack;
+ * execv_copyoutargs turns KBUF into argv plus strings, copies that out
+ * below *STACKPTR in one go and updates *STACKPTR.
+ */
+int execv_copyinargs(userptr_t uargv, char *kbuf, int *argc, size_t *len);
+int execv_copyoutargs(char *kbuf, int argc, size_t len, vaddr_t *stackptr, userptr_t *uargv);
 int getpid(int32_t *ret);
+struct rusage;
+int getrusage(int who, struct rusage *usage, int32_t *ret);
+struct iovec;
+int readv(int fd, const struct iovec *iov, int iovcnt, int32_t *ret);
+int writev(int fd, const struct iovec *iov, int iovcnt, int32_t *ret);
+int pread(int fd, void *buf, size_t len, off_t pos, int32_t *ret);
+int pwrite(int fd, const void *buf, size_t len, off_t pos, int32_t *ret);
+int copy_file_range(int infd, off_t *inpos, int outfd, off_t *outpos,
+                    size_t len, int32_t *ret);
+int pipe(int *fds, int32_t *ret);
+struct ioring;
+int ioring_enter(struct ioring *ring, unsigned to_submit, int32_t *ret);
+
+/* Look up an fd of the current process for reading or writing. */
+struct File;
+int syscall_getfile(int fd, bool writing, struct File **ret);
+/* Open the console on fds 0-2 if this process hasn't yet. Returns an errno. */
+int syscall_reservestdio(void);
 #endif
 #endif /* _SYSCALL_H_ */
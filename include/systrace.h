@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYSTRACE_H_
+#define _SYSTRACE_H_
+
+/*
+ * System call accounting ("systrace").
+ *
+ * When the kernel is configured with "options systrace", syscall()
+ * times every call from dispatch to return and records, per call
+ * number:
+ *
+ *    sc_calls    - number of calls
+ *    sc_errors   - number of those that failed
+ *    sc_ns       - total time spent, in nanoseconds
+ *    sc_maxns    - longest single call
+ *    sc_hist     - latency histogram; bucket i counts calls taking
+ *                  less than 2^i microseconds (and at least half
+ *                  that), the last bucket everything slower
+ *
+ * Each cpu has its own counters, updated with interrupts off and no
+ * locks, so calls on different cpus never touch the same cache lines;
+ * the report adds them up. Times include any time spent asleep.
+ *
+ * A process can also be given a trace ring, which keeps the last
+ * SYSTRACE_RINGSIZE calls it made with their arguments, result and
+ * duration.
+ *
+ * The counters are printed by the "st" menu command and can be read
+ * as text from the device "systrace:"; writing anything to the device
+ * resets them.
+ *
+ * Without the option, none of this is compiled in.
+ */
+
+#include "opt-systrace.h"
+
+#if OPT_SYSTRACE
+
+#define SYSTRACE_NCALLS    128	/* call numbers tracked: 0 .. NCALLS-1 */
+#define SYSTRACE_NBUCKETS  16	/* histogram buckets, powers of 2 us */
+#define SYSTRACE_MAXCPUS   32	/* cpus with counters */
+#define SYSTRACE_RINGSIZE  64	/* per-process trace entries; power of 2 */
+
+struct trapframe;
+struct cpu;
+struct proc;
+
+/* Per-cpu counters. */
+struct systrace_cpu {
+	uint64_t sc_calls[SYSTRACE_NCALLS];
+	uint64_t sc_errors[SYSTRACE_NCALLS];
+	uint64_t sc_ns[SYSTRACE_NCALLS];
+	uint32_t sc_maxns[SYSTRACE_NCALLS];
+	uint32_t sc_hist[SYSTRACE_NCALLS][SYSTRACE_NBUCKETS];
+};
+
+/* One traced call. */
+struct systrace_rec {
+	int sr_callno;
+	uint32_t sr_args[4];		/* a0-a3 as passed */
+	int32_t sr_retval;		/* return value, if sr_err is 0 */
+	int sr_err;			/* errno, or 0 */
+	uint32_t sr_ns;			/* how long it took */
+};
+
+/* Per-process trace ring; protected by the process's p_lock. */
+struct systrace_ring {
+	unsigned sr_next;		/* total calls recorded */
+	struct systrace_rec sr_recs[SYSTRACE_RINGSIZE];
+};
+
+/*
+ * Functions:
+ *    systrace_bootstrap - start recording and attach "systrace:".
+ *                         Must be called after the clock device is
+ *                         attached and after vfs_bootstrap.
+ *    systrace_cpuinit   - allocate counters for a new cpu.
+ *    systrace_enter     - call at dispatch; returns the start time,
+ *                         or 0 if recording is off.
+ *    systrace_exit      - call after the handler returns, before
+ *                         the trapframe is updated.
+ *    systrace_print     - print the counters.
+ *    systrace_reset     - zero the counters.
+ *    systrace_settrace  - give process P a trace ring, or take it
+ *                         away. Returns an errno.
+ *    systrace_printring - print process P's trace ring.
+ *    systrace_procexit  - free P's trace ring, when P is destroyed.
+ */
+void systrace_bootstrap(void);
+void systrace_cpuinit(struct cpu *c);
+uint64_t systrace_enter(void);
+void systrace_exit(int callno, const struct trapframe *tf, int err,
+		   int32_t retval, uint64_t start);
+void systrace_print(void);
+void systrace_reset(void);
+int systrace_settrace(struct proc *p, bool on);
+void systrace_printring(struct proc *p);
+void systrace_procexit(struct proc *p);
+
+/* true once systrace_bootstrap has run */
+extern volatile bool systrace_enabled;
+
+#endif /* OPT_SYSTRACE */
+
+#endif /* _SYSTRACE_H_ */
@@ -59,18 +59,39 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int lockbench(int, char **);
+int rwtest(int, char **);
+int rwbench(int, char **);
+int spinbench(int, char **);
+int timertest(int, char **);
 
 #ifdef UW
 /* More thread and synchronization tests */
 int uwlocktest1(int, char **);
 #endif
 
+/* process tests */
+#if OPT_A2
+int proctabletest(int, char **);
+int reaptest(int, char **);
+int spawnbench(int, char **);
+int execargbench(int, char **);
+int ioringbench(int, char **);
+#endif
+
 /* filesystem tests */
 int fstest(int, char **);
 int readstress(int, char **);
 int writestress(int, char **);
 int writestress2(int, char **);
 int createstress(int, char **);
+int agedbench(int, char **);
+int parallelbench(int, char **);
+int journaltest(int, char **);
+int dirgrowtest(int, char **);
+int inlinetest(int, char **);
+int roomtest(int, char **);
+int pipetest(int, char **);
 int printfile(int, char **);
 
 /* other tests */
@@ -39,8 +39,10 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <usage.h>
 
 struct cpu;
+struct wchan;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -83,6 +85,7 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	struct wchan *t_sleepchan;	/* Private channel for clocksleep */
 
 	/*
 	 * Interrupt state fields.
@@ -101,6 +104,14 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Resource usage, counted by this thread (see usage.h).
+	 * t_intruser says whether the interrupt being handled came
+	 * from user mode, so hardclock knows where to charge the tick.
+	 */
+	struct usage t_usage;
+	bool t_intruser;
+
 	/*
 	 * Public fields
 	 */
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TIMEOUT_H_
+#define _TIMEOUT_H_
+
+/*
+ * Timeouts: callbacks scheduled to run a given number of hardclock
+ * ticks in the future.
+ *
+ * Each CPU keeps its own hierarchical timer wheel (struct timerwheel,
+ * embedded in struct cpu), so arming a timeout only touches the
+ * current CPU's wheel and the per-tick work in hardclock() is
+ * proportional to the number of timeouts that actually expire, not
+ * the number that are pending.
+ *
+ * The wheel has TW_LEVELS levels. Level 0 has TW_L0_SLOTS slots of
+ * one tick each; each further level has TW_LN_SLOTS slots, each
+ * covering a whole revolution of the level below. When the level
+ * below wraps around, one slot of the level above is "cascaded":
+ * its entries are redistributed into finer slots. Timeouts further
+ * out than the wheel can represent park in the coarsest level and
+ * are redistributed until they come into range.
+ *
+ * Functions:
+ *     timeout_init   - set up a timeout to call FUNC(ARG). Does not
+ *                      allocate; struct timeout may live on the stack.
+ *     timeout_arm    - schedule the timeout to fire TICKS hardclocks
+ *                      from now (at least one) on the current CPU.
+ *                      The timeout must not already be pending.
+ *     timeout_cancel - remove a pending timeout. Returns true if it
+ *                      was pending and now will not fire; false if it
+ *                      already fired (or is firing right now).
+ *     timeout_pending - true if the timeout is armed and has not
+ *                      fired yet.
+ *
+ * Callbacks run from hardclock(), i.e. in interrupt context with no
+ * locks held. They must not sleep; waking a thread is fine.
+ */
+
+#include <spinlock.h>
+
+struct cpu;	/* from <cpu.h> */
+
+#define TW_LEVELS	3
+#define TW_L0_BITS	8
+#define TW_LN_BITS	6
+#define TW_L0_SLOTS	(1 << TW_L0_BITS)
+#define TW_LN_SLOTS	(1 << TW_LN_BITS)
+
+struct timeout {
+	struct timeout *to_next;	/* Next in slot */
+	struct timeout **to_pprev;	/* Pointer to us in slot list */
+	uint64_t to_expire;		/* Absolute tick to fire at */
+	void (*to_func)(void *);	/* Callback */
+	void *to_arg;			/* Argument to callback */
+	struct cpu *to_cpu;		/* Wheel we're on; NULL if idle */
+};
+
+struct timerwheel {
+	struct spinlock tw_lock;
+	uint64_t tw_now;		/* Last tick processed */
+	unsigned tw_count;		/* Pending timeouts */
+	struct timeout *tw_l0[TW_L0_SLOTS];
+	struct timeout *tw_ln[TW_LEVELS - 1][TW_LN_SLOTS];
+};
+
+void timeout_init(struct timeout *to, void (*func)(void *), void *arg);
+void timeout_arm(struct timeout *to, unsigned ticks);
+bool timeout_cancel(struct timeout *to);
+bool timeout_pending(struct timeout *to);
+
+/*
+ * Wheel management, for the cpu and clock code.
+ *
+ * timerwheel_init    - initialize a wheel (called from cpu_create).
+ * timerwheel_tick    - advance the current CPU's wheel by one tick
+ *                      and run whatever expires (called from
+ *                      hardclock).
+ */
+void timerwheel_init(struct timerwheel *tw);
+void timerwheel_tick(void);
+
+
+#endif /* _TIMEOUT_H_ */
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _USAGE_H_
+#define _USAGE_H_
+
+/*
+ * Resource usage counters, kept per thread and per process.
+ *
+ * Each thread counts into its own t_usage without locking, since only
+ * the thread itself (or the timer interrupt on its cpu) updates it.
+ * When a thread leaves its process, its counts are folded into the
+ * process's p_usage. A process's usage is p_usage plus that of its
+ * live threads; p_cusage holds what its reaped children (and their
+ * reaped children) used, added in by waitpid.
+ *
+ * What is counted where:
+ *    u_uticks, u_sticks - hardclock ticks spent in user mode and in
+ *                         the kernel (hardclock)
+ *    u_minflt           - faults served without I/O: TLB reloads and
+ *                         zero-filled stack pages (vm_fault)
+ *    u_majflt           - faults that read the page in, from the
+ *                         executable or from swap (page_fault)
+ *    u_swapin/out       - pages read from / written to swap, charged
+ *                         to the thread that caused it, not to the
+ *                         owner of the page
+ *    u_rbytes/wbytes    - bytes moved by the read and write calls
+ *    u_nvcsw/nivcsw     - times the thread went to sleep / was
+ *                         preempted
+ */
+
+struct usage {
+	uint64_t u_uticks;
+	uint64_t u_sticks;
+	uint64_t u_minflt;
+	uint64_t u_majflt;
+	uint64_t u_swapin;
+	uint64_t u_swapout;
+	uint64_t u_rbytes;
+	uint64_t u_wbytes;
+	uint64_t u_nvcsw;
+	uint64_t u_nivcsw;
+};
+
+/* Add FROM into TO. */
+void usage_add(struct usage *to, const struct usage *from);
+
+#endif /* _USAGE_H_ */
@@ -114,12 +114,36 @@ int vfs_rename(char *oldpath, char *newpath);
 int vfs_chdir(char *path);
 int vfs_getcwd(struct uio *buf);
 
+/*
+ * Name cache (vfscache.c)
+ *
+ *    vfs_dcache_lookup     - Like VOP_LOOKUP on DIR, but goes through
+ *                            the cache a path component at a time.
+ *                            May destroy the path passed in.
+ *    vfs_dcache_invalidate - Forget NAME in DIR. Must be called after
+ *                            anything that creates, removes or renames
+ *                            a name.
+ *    vfs_dcache_purgefs    - Forget everything on a filesystem, so it
+ *                            can be unmounted.
+ *    vfs_dcache_printstats - Print hit/miss counts.
+ */
+
+int vfs_dcache_lookup(struct vnode *dir, char *path, struct vnode **ret);
+void vfs_dcache_invalidate(struct vnode *dir, const char *name);
+void vfs_dcache_purgefs(struct fs *fs);
+void vfs_dcache_printstats(void);
+
 /*
  * Misc
  *
  *    vfs_bootstrap - Call during system initialization to allocate 
  *                    structures.
  *
+ *    vfs_syncer_start - Start the thread that calls vfs_sync every
+ *                    VFS_SYNCINTERVAL seconds, so filesystems can
+ *                    leave metadata writeback to it. Call once
+ *                    threads can be forked.
+ *
  *    vfs_setbootfs - Set the filesystem that paths beginning with a
  *                    slash are sent to. If not set, these paths fail
  *                    with ENOENT. The argument should be the device
@@ -160,6 +184,10 @@ int vfs_getcwd(struct uio *buf);
  */
 
 void vfs_bootstrap(void);
+void vfs_dcache_bootstrap(void);
+void vfs_syncer_start(void);
+
+#define VFS_SYNCINTERVAL 5	/* seconds */
 
 int vfs_setbootfs(const char *fsname);
 void vfs_clearbootfs(void);
@@ -30,6 +30,7 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
+#include <spinlock.h>
 
 struct uio;
 struct stat;
@@ -50,10 +51,14 @@ struct stat;
  * vn_opencount is managed using VOP_INCOPEN and VOP_DECOPEN by
  * vfs_open() and vfs_close(). Code above the VFS layer should not
  * need to worry about it.
+ *
+ * vn_countlock protects vn_refcount and vn_opencount. Everything else
+ * about the file is the filesystem's business to lock.
  */
 struct vnode {
 	int vn_refcount;                /* Reference count */
 	int vn_opencount;
+	struct spinlock vn_countlock;   /* Protects the counts */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -283,6 +288,15 @@ void vnode_decref(struct vnode *);
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
 
+/*
+ * For use by a filesystem's vop_reclaim, while holding whatever lock
+ * keeps new references from being handed out. VOP_DECREF passes its
+ * reference along to vop_reclaim without dropping it; if somebody has
+ * picked the vnode up again since, this consumes that reference and
+ * returns false, and reclaim should return EBUSY.
+ */
+bool vnode_reclaimable(struct vnode *);
+
 /*
  * Open count manipulation (handled above filesystem level)
  *
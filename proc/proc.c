@@ -55,12 +55,20 @@
 #include <kern/fcntl.h>
 #include <kern/errno.h>
 #include <thread.h>
+#include <clock.h>
+#include <systrace.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+#if OPT_A2
+/*
+ * Protects the parent/child links and exit state of every process.
+ */
+static struct lock *proc_waitlock;
+#endif
 
 
 /*
@@ -90,11 +98,12 @@ proc_create(const char *name)
             kfree(proc);
             return NULL;
         }
-        add_proc_to_table(proc);
-        // kprintf("PROC PID: %d", proc->p_pid);
+        // the pid is assigned by proc_create_pid (or, for kproc, by
+        // proctable_bootstrap)
+        proc->p_pid = 0;
         
-        proc->p_sem = sem_create("procsem", 0);
-        if (proc->p_sem == NULL) {
+        proc->p_waitcv = cv_create("proc wait");
+        if (proc->p_waitcv == NULL) {
 	        destroy_filetable(proc->p_ft);
 	        kfree(proc->p_name);
 	        kfree(proc);
@@ -102,18 +111,32 @@ proc_create(const char *name)
         }
                
         proc->stdio_reserve = false;
-        proc->child_is_exit = 0;
-        proc->is_waiting = 0;
+        proc->p_parent = NULL;
+        proc->p_children = NULL;
+        proc->p_zombies = NULL;
+        proc->p_sibling = NULL;
+        proc->p_psibling = NULL;
+        proc->p_exitcode = 0;
+        proc->p_exited = false;
+        proc->p_asborrowed = false;
 #endif
     
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
+	spinlock_setname(&proc->p_lock, "proc");
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+	bzero(&proc->p_cusage, sizeof(proc->p_cusage));
+
+#if OPT_SYSTRACE
+	proc->p_systrace = NULL;
+#endif
 	
 	// set no owner to root processes
 	proc->p_parentpid = 0;
@@ -123,10 +146,32 @@ proc_create(const char *name)
 	return proc;
 }
 
+#if OPT_A2
+/*
+ * Create a proc structure and enter it in the process table.
+ */
+static
+struct proc *
+proc_create_pid(const char *name)
+{
+	struct proc *proc;
+
+	proc = proc_create(name);
+	if (proc == NULL) {
+		return NULL;
+	}
+	if (add_proc_to_table(proc)) {
+		proc_destroy(proc);
+		return NULL;
+	}
+	return proc;
+}
+
 struct proc * maybe_proc_create(const char *name) {
-	struct proc * p = proc_create(name);
+	struct proc * p = proc_create_pid(name);
 	return p;
 }
+#endif
 
 
 /*
@@ -149,6 +194,14 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
+#if OPT_A2
+	/*
+	 * Unpublish it first, so nothing that finds processes through
+	 * the table (see startup/menu.c) can see it half torn down.
+	 */
+	remove_proc_from_table(proc);
+#endif
+
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
@@ -161,6 +214,14 @@ proc_destroy(struct proc *proc)
 		proc->p_cwd = NULL;
 	}
 
+#if OPT_A2
+	/* A borrowed address space belongs to the vfork parent. */
+	if (proc->p_asborrowed) {
+		proc->p_addrspace = NULL;
+		proc->p_asborrowed = false;
+	}
+#endif
+
 	/* VM fields */
 	if (proc->p_addrspace) {
 		/*
@@ -183,7 +244,12 @@ proc_destroy(struct proc *proc)
 	if(proc->p_ft != NULL) {
 		destroy_filetable(proc->p_ft);	
 	}
-	remove_proc_from_table(proc);
+	KASSERT(proc->p_psibling == NULL);
+	KASSERT(proc->p_children == NULL && proc->p_zombies == NULL);
+	cv_destroy(proc->p_waitcv);
+#endif
+#if OPT_SYSTRACE
+	systrace_procexit(proc);
 #endif
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
@@ -202,6 +268,13 @@ proc_bootstrap(void)
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
 	}
+#if OPT_A2
+	proctable_bootstrap(kproc);
+	proc_waitlock = lock_create("proc wait");
+	if (proc_waitlock == NULL) {
+		panic("lock_create for proc_waitlock failed\n");
+	}
+#endif
 #if OPT_A1
 	kprintf("kproc = %p\n", kproc);
 #endif
@@ -226,15 +299,302 @@ int proc_duplicate(struct proc * src, struct proc * dest) {
 	 dest->p_parentpid = src->p_pid;
      VOP_INCREF(src->p_cwd);
      dest->p_cwd = src->p_cwd;
-	 dest->p_ft = kmalloc(sizeof(struct FileTable));
-	 if(dest->p_ft == NULL) {
-		 proc_destroy(dest);
-		 return ENOMEM;
-	 }
+	 // proc_create gave dest an empty table; fill it from src
 	 duplicate_filetable(src->p_ft, dest->p_ft);
 	 
 	 return 0;
  }
+
+int proc_share(struct proc * src, struct proc * dest) {
+
+	 KASSERT(dest != NULL);
+
+	 dest->p_addrspace = src->p_addrspace;
+	 dest->p_asborrowed = true;
+
+	 dest->p_parentpid = src->p_pid;
+	 if (src->p_cwd != NULL) {
+		 VOP_INCREF(src->p_cwd);
+		 dest->p_cwd = src->p_cwd;
+	 }
+	 // proc_create gave dest an empty table; fill it from src
+	 duplicate_filetable(src->p_ft, dest->p_ft);
+
+	 return 0;
+ }
+
+void
+proc_releaseas(struct proc *p)
+{
+	lock_acquire(proc_waitlock);
+	if (p->p_asborrowed) {
+		p->p_asborrowed = false;
+		if (p->p_parent != NULL) {
+			cv_broadcast(p->p_parent->p_waitcv, proc_waitlock);
+		}
+	}
+	lock_release(proc_waitlock);
+}
+
+void
+proc_vforkwait(struct proc *child)
+{
+	lock_acquire(proc_waitlock);
+	KASSERT(child->p_parent == curproc);
+	while (child->p_asborrowed) {
+		cv_wait(curproc->p_waitcv, proc_waitlock);
+	}
+	lock_release(proc_waitlock);
+}
+
+/*
+ * Push P onto the list at *HEAD.
+ */
+static
+void
+proc_link(struct proc **head, struct proc *p)
+{
+	p->p_sibling = *head;
+	if (*head != NULL) {
+		(*head)->p_psibling = &p->p_sibling;
+	}
+	p->p_psibling = head;
+	*head = p;
+}
+
+/*
+ * Take P off whichever sibling list it is on.
+ */
+static
+void
+proc_unlink(struct proc *p)
+{
+	*p->p_psibling = p->p_sibling;
+	if (p->p_sibling != NULL) {
+		p->p_sibling->p_psibling = p->p_psibling;
+	}
+	p->p_sibling = NULL;
+	p->p_psibling = NULL;
+}
+
+void
+proc_addchild(struct proc *parent, struct proc *child)
+{
+	KASSERT(child->p_parent == NULL);
+
+	lock_acquire(proc_waitlock);
+	child->p_parent = parent;
+	child->p_parentpid = parent->p_pid;
+	proc_link(&parent->p_children, child);
+	lock_release(proc_waitlock);
+}
+
+void
+proc_exit(struct proc *p)
+{
+	struct proc *parent, *c, *reap;
+
+	KASSERT(p != kproc);
+	KASSERT(threadarray_num(&p->p_threads) == 0);
+
+	lock_acquire(proc_waitlock);
+
+	/* Live children carry on without us and free themselves. */
+	while ((c = p->p_children) != NULL) {
+		proc_unlink(c);
+		c->p_parent = NULL;
+	}
+
+	/* Nobody is going to reap the ones that already exited. */
+	reap = p->p_zombies;
+	for (c = reap; c != NULL; c = c->p_sibling) {
+		c->p_psibling = NULL;
+	}
+	p->p_zombies = NULL;
+
+	/* A vfork parent waiting on us can have its address space back. */
+	if (p->p_asborrowed) {
+		p->p_addrspace = NULL;
+		p->p_asborrowed = false;
+	}
+
+	parent = p->p_parent;
+	if (parent != NULL) {
+		proc_unlink(p);
+		proc_link(&parent->p_zombies, p);
+		p->p_exited = true;
+		cv_broadcast(parent->p_waitcv, proc_waitlock);
+	}
+
+	lock_release(proc_waitlock);
+
+	while (reap != NULL) {
+		c = reap;
+		reap = c->p_sibling;
+		c->p_sibling = NULL;
+		proc_destroy(c);
+	}
+	if (parent == NULL) {
+		proc_destroy(p);
+	}
+}
+
+/*
+ * Find the child with pid PID on list HEAD.
+ */
+static
+struct proc *
+proc_findchild(struct proc *head, pid_t pid)
+{
+	struct proc *c;
+
+	for (c = head; c != NULL; c = c->p_sibling) {
+		if (c->p_pid == pid) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+int
+proc_waitchild(pid_t pid, bool nohang, pid_t *childpid, int *exitcode)
+{
+	struct proc *p = curproc;
+	struct proc *c;
+
+	lock_acquire(proc_waitlock);
+	while (1) {
+		if (pid == -1) {
+			c = p->p_zombies;
+			if (c == NULL && p->p_children == NULL) {
+				lock_release(proc_waitlock);
+				return ECHILD;
+			}
+		}
+		else {
+			c = proc_findchild(p->p_zombies, pid);
+			if (c == NULL &&
+			    proc_findchild(p->p_children, pid) == NULL) {
+				lock_release(proc_waitlock);
+				/* Don't touch it; it isn't ours to look at. */
+				return get_proc_by_pid(pid) == NULL ?
+					ESRCH : ECHILD;
+			}
+		}
+		if (c != NULL) {
+			break;
+		}
+		if (nohang) {
+			lock_release(proc_waitlock);
+			*childpid = 0;
+			return 0;
+		}
+		cv_wait(p->p_waitcv, proc_waitlock);
+	}
+
+	KASSERT(c->p_exited);
+	proc_unlink(c);
+	c->p_parent = NULL;
+	*childpid = c->p_pid;
+	*exitcode = c->p_exitcode;
+	lock_release(proc_waitlock);
+
+	/* c has no threads left, so its usage is final. */
+	spinlock_acquire(&p->p_lock);
+	usage_add(&p->p_cusage, &c->p_usage);
+	usage_add(&p->p_cusage, &c->p_cusage);
+	spinlock_release(&p->p_lock);
+
+	proc_destroy(c);
+	return 0;
+}
+
+struct proc_topent {
+	pid_t pt_pid;
+	char pt_name[16];
+	struct usage pt_usage;
+};
+
+static
+uint64_t
+proc_topkey(const struct usage *u, int metric)
+{
+	switch (metric) {
+	    case PROC_TOP_FAULTS:
+		return u->u_minflt + u->u_majflt;
+	    case PROC_TOP_SWAP:
+		return u->u_swapin + u->u_swapout;
+	    case PROC_TOP_IO:
+		return u->u_rbytes + u->u_wbytes;
+	    default:
+		return u->u_uticks + u->u_sticks;
+	}
+}
+
+void
+proc_printtop(int metric, unsigned n)
+{
+	struct ProcTable *pt = get_proctable();
+	struct proc_topent *ents, tmp;
+	struct proc *p;
+	unsigned i, j, best, num, max;
+
+	/* Snapshot first; kprintf can sleep. */
+	rwlock_acquire_read(pt->pt_rwlock);
+	max = pt->pt_size;
+	rwlock_release_read(pt->pt_rwlock);
+	ents = kmalloc(max * sizeof(*ents));
+	if (ents == NULL) {
+		kprintf("top: out of memory\n");
+		return;
+	}
+	num = 0;
+	rwlock_acquire_read(pt->pt_rwlock);
+	for (i=1; i<pt->pt_size && num < max; i++) {
+		p = pt->processes[i];
+		if (p == NULL) {
+			continue;
+		}
+		ents[num].pt_pid = p->p_pid;
+		snprintf(ents[num].pt_name, sizeof(ents[num].pt_name), "%s",
+			 p->p_name);
+		proc_getusage(p, &ents[num].pt_usage);
+		num++;
+	}
+	rwlock_release_read(pt->pt_rwlock);
+
+	/* Selection sort of the top N. */
+	if (n > num) {
+		n = num;
+	}
+	for (i=0; i<n; i++) {
+		best = i;
+		for (j=i+1; j<num; j++) {
+			if (proc_topkey(&ents[j].pt_usage, metric) >
+			    proc_topkey(&ents[best].pt_usage, metric)) {
+				best = j;
+			}
+		}
+		tmp = ents[i];
+		ents[i] = ents[best];
+		ents[best] = tmp;
+	}
+
+	kprintf("%5s %-15s %8s %8s %8s %8s %7s %7s %10s %10s\n",
+		"pid", "name", "user ms", "sys ms", "minflt", "majflt",
+		"swapin", "swapout", "read", "written");
+	for (i=0; i<n; i++) {
+		struct usage *u = &ents[i].pt_usage;
+
+		kprintf("%5d %-15s %8llu %8llu %8llu %8llu %7llu %7llu "
+			"%10llu %10llu\n",
+			ents[i].pt_pid, ents[i].pt_name,
+			u->u_uticks * 1000 / HZ, u->u_sticks * 1000 / HZ,
+			u->u_minflt, u->u_majflt, u->u_swapin, u->u_swapout,
+			u->u_rbytes, u->u_wbytes);
+	}
+	kfree(ents);
+}
  #endif
 
 /*
@@ -248,7 +608,11 @@ proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
 
+#if OPT_A2
+	proc = proc_create_pid(name);
+#else
 	proc = proc_create(name);
+#endif
 	if (proc == NULL) {
 		return NULL;
 	}
@@ -314,6 +678,8 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+			usage_add(&proc->p_usage, &t->t_usage);
+			bzero(&t->t_usage, sizeof(t->t_usage));
 			spinlock_release(&proc->p_lock);
 			t->t_proc = NULL;
 			return;
@@ -324,6 +690,47 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+void
+usage_add(struct usage *to, const struct usage *from)
+{
+	to->u_uticks += from->u_uticks;
+	to->u_sticks += from->u_sticks;
+	to->u_minflt += from->u_minflt;
+	to->u_majflt += from->u_majflt;
+	to->u_swapin += from->u_swapin;
+	to->u_swapout += from->u_swapout;
+	to->u_rbytes += from->u_rbytes;
+	to->u_wbytes += from->u_wbytes;
+	to->u_nvcsw += from->u_nvcsw;
+	to->u_nivcsw += from->u_nivcsw;
+}
+
+/*
+ * Live threads' counters are read without their cooperation, so a
+ * count in the middle of being bumped may be slightly off.
+ */
+void
+proc_getusage(struct proc *p, struct usage *u)
+{
+	unsigned i, num;
+
+	spinlock_acquire(&p->p_lock);
+	*u = p->p_usage;
+	num = threadarray_num(&p->p_threads);
+	for (i=0; i<num; i++) {
+		usage_add(u, &threadarray_get(&p->p_threads, i)->t_usage);
+	}
+	spinlock_release(&p->p_lock);
+}
+
+void
+proc_getchildusage(struct proc *p, struct usage *u)
+{
+	spinlock_acquire(&p->p_lock);
+	*u = p->p_cusage;
+	spinlock_release(&p->p_lock);
+}
+
 #if OPT_A2
 /*
  * Remove all threads from current process. 
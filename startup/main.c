@@ -48,6 +48,8 @@
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <lockstat.h>
+#include <systrace.h>
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -122,6 +124,13 @@ boot(void)
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
 	KASSERT(curthread->t_curspl == 0);
+#if OPT_LOCKSTAT
+	/* gettime works now that the clock is attached */
+	lockstat_bootstrap();
+#endif
+#if OPT_SYSTRACE
+	systrace_bootstrap();
+#endif
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
@@ -134,6 +143,7 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	vfs_syncer_start();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -39,14 +39,27 @@
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <emufs.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-A3.h"
+#include "opt-lockstat.h"
+#include "opt-systrace.h"
 #include <current.h>
 #include <proctable.h>
+#if OPT_A3
+#include <coremap.h>
+#endif
+#if OPT_LOCKSTAT
+#include <lockstat.h>
+#endif
+#if OPT_SYSTRACE
+#include <systrace.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -406,10 +419,309 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+#if OPT_A3
+	if (coremap_exists()) {
+		unsigned used, total;
+
+		coremap_getstats(&used, &total);
+		kprintf("coremap: %u of %u frames in use\n", used, total);
+	}
+#endif
 	
 	return 0;
 }
 
+/*
+ * Command for printing name cache statistics.
+ */
+static
+int
+cmd_dcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vfs_dcache_printstats();
+	return 0;
+}
+
+/*
+ * Command for printing emufs cache statistics, and optionally
+ * turning the cache on or off.
+ */
+static
+int
+cmd_emucache(int nargs, char **args)
+{
+	char *device;
+	int enable = -1;
+	int result;
+
+	if (nargs == 3 && !strcmp(args[2], "on")) {
+		enable = 1;
+	}
+	else if (nargs == 3 && !strcmp(args[2], "off")) {
+		enable = 0;
+	}
+	else if (nargs != 2) {
+		kprintf("Usage: ec device [on|off]\n");
+		return EINVAL;
+	}
+
+	device = args[1];
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	result = emufs_cachectl(device, enable);
+	if (result == EINVAL) {
+		kprintf("ec: %s is not an emufs\n", device);
+	}
+	return result;
+}
+
+#if OPT_SFS
+/*
+ * Command for printing an sfs fragmentation report.
+ */
+static
+int
+cmd_sfsfrag(int nargs, char **args)
+{
+	char *device;
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: frag device\n");
+		return EINVAL;
+	}
+
+	device = args[1];
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	result = sfs_fragreport(device);
+	if (result == EINVAL) {
+		kprintf("frag: %s is not an sfs volume\n", device);
+	}
+	return result;
+}
+#endif
+
+#if OPT_A2
+/*
+ * Command for listing the processes using the most of a resource.
+ */
+static
+int
+cmd_top(int nargs, char **args)
+{
+	static const char *const metrics[] = { "cpu", "flt", "swap", "io" };
+	int metric = PROC_TOP_CPU;
+	int n = 10;
+	int i;
+
+	if (nargs > 3) {
+		goto usage;
+	}
+	if (nargs >= 2) {
+		for (i=0; i<4; i++) {
+			if (!strcmp(args[1], metrics[i])) {
+				break;
+			}
+		}
+		if (i == 4) {
+			goto usage;
+		}
+		/* metrics[] is in PROC_TOP_* order */
+		metric = i;
+	}
+	if (nargs == 3) {
+		n = atoi(args[2]);
+		if (n <= 0) {
+			goto usage;
+		}
+	}
+
+	proc_printtop(metric, n);
+	return 0;
+
+ usage:
+	kprintf("Usage: top [cpu|flt|swap|io] [count]\n");
+	return EINVAL;
+}
+#endif
+
+#if OPT_LOCKSTAT
+/*
+ * Command for printing the most contended locks.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	int n = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: lk [count]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("Usage: lk [count]\n");
+			return EINVAL;
+		}
+	}
+
+	lockstat_print(n);
+	return 0;
+}
+
+/*
+ * Command for clearing the lock statistics.
+ */
+static
+int
+cmd_lockstatreset(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockstat_reset();
+	kprintf("lockstat: counters reset\n");
+	return 0;
+}
+#endif
+
+#if OPT_SYSTRACE
+/*
+ * Command for printing the per-syscall counters.
+ */
+static
+int
+cmd_systrace(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	systrace_print();
+	return 0;
+}
+
+/*
+ * Command for clearing the per-syscall counters.
+ */
+static
+int
+cmd_systracereset(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	systrace_reset();
+	kprintf("systrace: counters reset\n");
+	return 0;
+}
+
+#if OPT_A2
+/*
+ * Look up the process named by a command's pid argument. Once reaped
+ * a process is freed, so on success this returns with the process
+ * table locked (for reading) to keep it around; the caller releases
+ * it with cmd_putproc. Can't use get_proc_by_pid, which drops the
+ * lock before returning.
+ */
+static
+struct proc *
+cmd_getproc(const char *arg)
+{
+	struct ProcTable *pt = get_proctable();
+	struct proc *p;
+	pid_t pid;
+
+	pid = atoi(arg);
+	p = NULL;
+	rwlock_acquire_read(pt->pt_rwlock);
+	if (pid > 0 && (unsigned)pid < pt->pt_size) {
+		p = pt->processes[pid];
+	}
+	if (p == NULL) {
+		rwlock_release_read(pt->pt_rwlock);
+		kprintf("No process with pid %s\n", arg);
+	}
+	return p;
+}
+
+/*
+ * Done with a process from cmd_getproc.
+ */
+static
+void
+cmd_putproc(void)
+{
+	rwlock_release_read(get_proctable()->pt_rwlock);
+}
+
+/*
+ * Command for starting or stopping a process's syscall trace ring.
+ */
+static
+int
+cmd_systracepid(int nargs, char **args)
+{
+	struct proc *p;
+	bool on = true;
+	int result;
+
+	if (nargs == 3 && !strcmp(args[2], "off")) {
+		on = false;
+	}
+	else if (nargs != 2) {
+		kprintf("Usage: stt pid [off]\n");
+		return EINVAL;
+	}
+	p = cmd_getproc(args[1]);
+	if (p == NULL) {
+		return ESRCH;
+	}
+	result = systrace_settrace(p, on);
+	cmd_putproc();
+	if (result) {
+		kprintf("stt: %s\n", strerror(result));
+	}
+	return result;
+}
+
+/*
+ * Command for printing a process's syscall trace ring.
+ */
+static
+int
+cmd_systraceprint(int nargs, char **args)
+{
+	struct proc *p;
+
+	if (nargs != 2) {
+		kprintf("Usage: stp pid\n");
+		return EINVAL;
+	}
+	p = cmd_getproc(args[1]);
+	if (p == NULL) {
+		return ESRCH;
+	}
+	systrace_printring(p);
+	cmd_putproc();
+	return 0;
+}
+#endif /* OPT_A2 */
+#endif /* OPT_SYSTRACE */
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -479,11 +791,32 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Lock contention bench (1)     ",
+	"[sy5] Rwlock test                   ",
+	"[sy6] Rwlock throughput bench (1)   ",
+	"[sy7] Spinlock scaling bench        ",
+	"[tm1] Timer/clocksleep test         ",
+#if OPT_A2
+	"[pt1] Process table test            ",
+	"[pt2] Process reaping bench         ",
+	"[pt3] fork vs vfork spawn bench     ",
+	"[pt4] execv argument bench          ",
+	"[pt5] Batched syscall ring bench    ",
+#endif
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress        (4)     ",
 	"[fs3] FS write stress       (4)     ",
 	"[fs4] FS write stress 2     (4)     ",
 	"[fs5] FS create stress      (4)     ",
+	"[fs6] Aged FS sequential bench (4)  ",
+	"[fs7] Parallel file I/O bench  (4)  ",
+#if OPT_SFS
+	"[fs8] SFS journal replay test  (4)  ",
+	"[fs9] SFS directory growth test (4) ",
+	"[fs10] SFS inline data test    (4)  ",
+	"[fs11] SFS journal make-room test (4)",
+#endif
+	"[pi1] Pipe bandwidth/latency bench  ",
 	NULL
 };
 
@@ -514,6 +847,26 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[dc] Name cache stats               ",
+	"[ec] emufs cache stats/on/off       ",
+#if OPT_SFS
+	"[frag] SFS fragmentation report     ",
+#endif
+#if OPT_A2
+	"[top] Top processes by resource     ",
+#endif
+#if OPT_LOCKSTAT
+	"[lk] Lock contention stats          ",
+	"[lkr] Reset lock contention stats   ",
+#endif
+#if OPT_SYSTRACE
+	"[st] Syscall stats                  ",
+	"[str] Reset syscall stats           ",
+#if OPT_A2
+	"[stt] Trace a process's syscalls    ",
+	"[stp] Print a process's trace       ",
+#endif
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -569,6 +922,26 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "dc",		cmd_dcachestats },
+	{ "ec",		cmd_emucache },
+#if OPT_SFS
+	{ "frag",	cmd_sfsfrag },
+#endif
+#if OPT_A2
+	{ "top",	cmd_top },
+#endif
+#if OPT_LOCKSTAT
+	{ "lk",		cmd_lockstat },
+	{ "lkr",	cmd_lockstatreset },
+#endif
+#if OPT_SYSTRACE
+	{ "st",		cmd_systrace },
+	{ "str",	cmd_systracereset },
+#if OPT_A2
+	{ "stt",	cmd_systracepid },
+	{ "stp",	cmd_systraceprint },
+#endif
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -586,16 +959,39 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	lockbench },
+	{ "sy5",	rwtest },
+	{ "sy6",	rwbench },
+	{ "sy7",	spinbench },
+	{ "tm1",	timertest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 #endif
 
+	/* process tests */
+#if OPT_A2
+	{ "pt1",	proctabletest },
+	{ "pt2",	reaptest },
+	{ "pt3",	spawnbench },
+	{ "pt4",	execargbench },
+	{ "pt5",	ioringbench },
+#endif
+
 	/* file system assignment tests */
 	{ "fs1",	fstest },
 	{ "fs2",	readstress },
 	{ "fs3",	writestress },
 	{ "fs4",	writestress2 },
 	{ "fs5",	createstress },
+	{ "fs6",	agedbench },
+	{ "fs7",	parallelbench },
+#if OPT_SFS
+	{ "fs8",	journaltest },
+	{ "fs9",	dirgrowtest },
+	{ "fs10",	inlinetest },
+	{ "fs11",	roomtest },
+#endif
+	{ "pi1",	pipetest },
 
 	{ NULL, NULL }
 };
@@ -41,17 +41,9 @@
 #if OPT_A2
 void _exit(int exitcode){
 
-    struct proc * parent = get_proc_by_pid(curproc->p_parentpid);
-    if(parent != NULL){
-        exitcode = _MKWAIT_EXIT(exitcode);
-        parent->child_exitcode = exitcode;
-        parent->child_is_exit = 1;
-        //call V only when parent is waiting
-        if (parent->is_waiting) {
-            parent->is_waiting = 0;
-            V(parent->p_sem);
-        }
-    }
+    // picked up by the parent's waitpid once thread_exit has turned us
+    // into a zombie (see proc_exit)
+    curproc->p_exitcode = _MKWAIT_EXIT(exitcode);
     
 //    struct ProcTable * pt = get_proctable();
 //    lock_acquire(pt->pt_lock);
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "opt-A2.h"
+#include <types.h>
+#include <copyinout.h>
+#include <kern/errno.h>
+#include <syscall.h>
+#include <lib.h>
+#include <filetable.h>
+#include <current.h>
+#include <proc.h>
+#include <kern/iovec.h>
+#include <uio.h>
+#include <vnode.h>
+#include <synch.h>
+
+/*
+ * copy_file_range: copy bytes from one open file to another without
+ * a round trip through user memory.
+ *
+ * Data moves through a kernel buffer of COPYRANGE_CHUNK bytes, one
+ * VOP_READ and one VOP_WRITE per chunk, until LEN bytes are copied or
+ * the source runs dry. A source that can't seek (a pipe or a device)
+ * is done after its first short read, as for read(): another read
+ * would block until a writer shows up. For each side, a non-NULL position pointer
+ * means "start at *pos and update *pos, leave the file offset alone"
+ * (like pread/pwrite); NULL means "use and advance the file offset"
+ * (like read/write), in which case that file's rw_lock is held across
+ * the copy.
+ */
+
+#if OPT_A2
+
+#define COPYRANGE_CHUNK (16 * 1024)
+
+/*
+ * Copy up to LEN bytes from IN at *INPOS to OUT at *OUTPOS through
+ * BUF, advancing both positions. Stops early at end of file, on a
+ * short write, or on a short read from a source that can't seek.
+ * Returns the number of bytes copied in *COPIED.
+ */
+static int copyrange(struct File *in, off_t *inpos, struct File *out,
+                     off_t *outpos, size_t len, char *buf, size_t *copied) {
+    struct iovec iov;
+    struct uio u;
+    size_t chunk, got;
+    bool stream;
+    int result = 0;
+
+    stream = VOP_TRYSEEK(in->vn, 0) == ESPIPE;
+
+    *copied = 0;
+    while (len > 0) {
+        chunk = len < COPYRANGE_CHUNK ? len : COPYRANGE_CHUNK;
+
+        uio_kinit(&iov, &u, buf, chunk, *inpos, UIO_READ);
+        result = VOP_READ(in->vn, &u);
+        if (result) {
+            break;
+        }
+        got = chunk - u.uio_resid;
+        if (got == 0) {
+            break;
+        }
+        *inpos += got;
+
+        uio_kinit(&iov, &u, buf, got, *outpos, UIO_WRITE);
+        result = VOP_WRITE(out->vn, &u);
+        *outpos += got - u.uio_resid;
+        *copied += got - u.uio_resid;
+        if (result || u.uio_resid > 0) {
+            // don't report bytes read that never made it out
+            *inpos -= u.uio_resid;
+            break;
+        }
+        len -= got;
+        if (stream && got < chunk) {
+            break;
+        }
+    }
+
+    // partial success still counts as success
+    if (*copied > 0) {
+        result = 0;
+    }
+    return result;
+}
+
+int copy_file_range(int infd, off_t *uinpos, int outfd, off_t *uoutpos,
+                    size_t len, int32_t *ret) {
+    struct File *in, *out, *first, *second;
+    off_t inpos, outpos;
+    size_t copied;
+    char *buf;
+    int result;
+
+    result = syscall_getfile(infd, false, &in);
+    if (!result) {
+        result = syscall_getfile(outfd, true, &out);
+    }
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+    if (len > 0x7fffffff) {
+        len = 0x7fffffff;
+    }
+
+    if (uinpos != NULL) {
+        result = copyin((const_userptr_t)uinpos, &inpos, sizeof(off_t));
+        if (!result && inpos < 0) {
+            result = EINVAL;
+        }
+        if (!result) {
+            result = VOP_TRYSEEK(in->vn, inpos);
+        }
+    }
+    if (!result && uoutpos != NULL) {
+        result = copyin((const_userptr_t)uoutpos, &outpos, sizeof(off_t));
+        if (!result && outpos < 0) {
+            result = EINVAL;
+        }
+        if (!result) {
+            result = VOP_TRYSEEK(out->vn, outpos);
+        }
+    }
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+
+    buf = kmalloc(COPYRANGE_CHUNK);
+    if (buf == NULL) {
+        *ret = ENOMEM;
+        return -1;
+    }
+
+    // lock the files whose offsets we use, in address order so two
+    // copies in opposite directions can't deadlock
+    first = uinpos == NULL ? in : NULL;
+    second = uoutpos == NULL ? out : NULL;
+    if (first == second) {
+        second = NULL;
+    } else if (first != NULL && second != NULL && second < first) {
+        first = out;
+        second = in;
+    }
+    if (first != NULL) {
+        lock_acquire(first->rw_lock);
+    }
+    if (second != NULL) {
+        lock_acquire(second->rw_lock);
+    }
+
+    if (uinpos == NULL) {
+        inpos = in->offset;
+    }
+    if (uoutpos == NULL) {
+        outpos = out->offset;
+    }
+    result = copyrange(in, &inpos, out, &outpos, len, buf, &copied);
+    if (uinpos == NULL) {
+        in->offset = inpos;
+    }
+    if (uoutpos == NULL) {
+        out->offset = outpos;
+    }
+
+    if (second != NULL) {
+        lock_release(second->rw_lock);
+    }
+    if (first != NULL) {
+        lock_release(first->rw_lock);
+    }
+    kfree(buf);
+
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+    if (uinpos != NULL) {
+        result = copyout(&inpos, (userptr_t)uinpos, sizeof(off_t));
+    }
+    if (!result && uoutpos != NULL) {
+        result = copyout(&outpos, (userptr_t)uoutpos, sizeof(off_t));
+    }
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+    *ret = copied;
+    curthread->t_usage.u_rbytes += copied;
+    curthread->t_usage.u_wbytes += copied;
+    return 0;
+}
+
+#endif /* OPT_A2 */
@@ -39,102 +39,195 @@
 #include <vm.h>
 #include <vfs.h>
 #include <test.h>
+#include <limits.h>
 #include "opt-A3.h"
 
 #if OPT_A2
-int execv(const char* progname, char ** argv, int32_t* retval){
+
+/*
+ * Argument marshalling.
+ *
+ * The argument strings are gathered into one ARG_MAX-sized kernel
+ * buffer, packed end to end, and later turned in place into the exact
+ * image that goes on the new user stack: the argv pointer array
+ * followed by the strings. That image then goes out with a single
+ * copyout. ARGV_MAX bounds the whole image, pointers included.
+ *
+ * The image has to fit on the new user stack, which is only
+ * DUMBVM_STACKPAGES long, with room left over for the program to run
+ * in. ARG_MAX is bigger than that, so the stack size is what limits
+ * us. The check happens at copyin, while the old address space is
+ * still there to return E2BIG to.
+ */
+
+/* Stack pages kept free for the program itself. */
+#define ARGV_STACKSLACK 4
+
+#define ARGV_MAX ((DUMBVM_STACKPAGES - ARGV_STACKSLACK) * PAGE_SIZE < ARG_MAX ? \
+                  (DUMBVM_STACKPAGES - ARGV_STACKSLACK) * PAGE_SIZE : ARG_MAX)
+
+/* Bytes the pointer array takes up for ARGC arguments (plus NULL). */
+#define ARGV_PTRBYTES(argc) (((argc) + 1) * sizeof(userptr_t))
+
+int execv_copyinargs(userptr_t uargv, char *kbuf, int *argc_ret, size_t *len_ret) {
+    userptr_t uarg;
+    size_t len = 0, got;
+    int argc = 0;
+    int result;
+
+    while (1) {
+        result = copyin((const_userptr_t)((userptr_t *)uargv + argc), &uarg, sizeof(uarg));
+        if (result) {
+            return result;
+        }
+        if (uarg == NULL) {
+            break;
+        }
+        // room for this string, and for one more pointer than we have now
+        if (len + ARGV_PTRBYTES(argc + 1) >= ARGV_MAX) {
+            return E2BIG;
+        }
+        result = copyinstr((const_userptr_t)uarg, kbuf + len,
+                           ARGV_MAX - len - ARGV_PTRBYTES(argc + 1), &got);
+        if (result == ENAMETOOLONG) {
+            return E2BIG;
+        }
+        if (result) {
+            return result;
+        }
+        len += got;
+        argc++;
+    }
+
+    *argc_ret = argc;
+    *len_ret = len;
+    return 0;
+}
+
+int execv_copyoutargs(char *kbuf, int argc, size_t len, vaddr_t *stackptr, userptr_t *uargv) {
+    size_t ptrbytes = ARGV_PTRBYTES(argc);
+    size_t total = ptrbytes + len;
+    vaddr_t base;
+    userptr_t *argv;
+    size_t off;
+    int i;
+
+    KASSERT(total <= ARGV_MAX);
+
+    // argv at the (8-aligned) bottom, strings right above it
+    base = (*stackptr - total) & ~(vaddr_t)7;
+
+    memmove(kbuf + ptrbytes, kbuf, len);
+    argv = (userptr_t *)kbuf;
+    off = ptrbytes;
+    for (i = 0; i < argc; i++) {
+        argv[i] = (userptr_t)(base + off);
+        off += strlen(kbuf + off) + 1;
+    }
+    argv[argc] = NULL;
+
+    int result = copyout(kbuf, (userptr_t)base, total);
+    if (result) {
+        return result;
+    }
+    *stackptr = base;
+    *uargv = (userptr_t)base;
+    return 0;
+}
+
+/*
+ * Put back the address space execv started with and throw away the
+ * half-built new one.
+ */
+static void execv_restoreas(struct addrspace *oldas) {
     struct addrspace *as;
+
+    as_deactivate();
+    as = curproc_setas(oldas);
+    as_activate();
+    as_destroy(as);
+}
+
+int execv(const char* progname, char ** argv, int32_t* retval){
+    struct addrspace *as, *oldas;
 	struct vnode *v;
 	vaddr_t entrypoint, stackptr;
 	int result;
-    
-    if(vm_invalidaddress((vaddr_t)progname) || vm_invalidaddress((vaddr_t)argv)){
-        *retval = EFAULT;
+    char *prog, *args;
+    size_t actual_len, arglen;
+    int argc;
+    userptr_t uargv;
+
+    prog = kmalloc(PATH_MAX);
+    if (prog == NULL) {
+        *retval = ENOMEM;
         return -1;
     }
-    if(strlen(progname) == 0){
-        *retval = EINVAL;
+    result = copyinstr((const_userptr_t)progname, prog, PATH_MAX, &actual_len);
+    if (result) {
+        kfree(prog);
+        *retval = result;
         return -1;
     }
-    if(!strcmp(progname,"con:")){
-        *retval = ENODEV;
+    if(actual_len <= 1){
+        kfree(prog);
+        *retval = EINVAL;
         return -1;
     }
-    int l = strlen(progname) + 1; 
-    int prog_len = (sizeof(char))*l;
-    size_t actual_len;
-    char prog[l];
-    *retval = copyinstr((const_userptr_t)progname,prog,prog_len,&actual_len);
-    if(*retval){
+    if(!strcmp(prog,"con:")){
+        kfree(prog);
+        *retval = ENODEV;
         return -1;
     }
 
-    unsigned int argc = 0;
-    //calculate the number of args
-    while(argv[argc] !=  NULL){
-        argc++;
-    }
-    
-    //check if the addresses of args are valid
-        if(vm_invalidaddress((vaddr_t)argv[0]) || vm_invalidaddress((vaddr_t)argv)){
-            *retval = EFAULT;
-            return -1;
-        }
-    unsigned int z;
-        for(z=1;argv[z] != NULL;z++){
-            if(vm_invalidaddress((vaddr_t)argv[z])){
-                *retval = EFAULT;
-                return -1;
-            }
-        }
-    
-    
-    char* temp_argv[argc+1];
-    int argv_len;
-    for(z = 0; z < argc; z++){
-        argv_len = (strlen(argv[z])+1)*(sizeof(char));
-        temp_argv[z] = kmalloc(argv_len);
-        if(temp_argv[z] == NULL){
-            *retval = ENOMEM;
-            return -1;
-        }
-        *retval = copyinstr((const_userptr_t)argv[z],temp_argv[z],argv_len,&actual_len);
-        if(*retval){
-            return -1;
-        }
+    args = kmalloc(ARG_MAX);
+    if (args == NULL) {
+        kfree(prog);
+        *retval = ENOMEM;
+        return -1;
     }
-    
-    if(curproc_getas() != NULL){
-		as_deactivate();
-		as = curproc_setas(NULL);
-		as_destroy(as);
+    result = execv_copyinargs((userptr_t)argv, args, &argc, &arglen);
+    if (result) {
+        kfree(args);
+        kfree(prog);
+        *retval = result;
+        return -1;
     }
-    
-	/* Open the file. */
-	result = vfs_open((char *)prog, O_RDONLY, 0, &v);
+
+	/* Open the file while we still have somewhere to return to. */
+	result = vfs_open(prog, O_RDONLY, 0, &v);
 	if (result) {
+        kfree(args);
+        kfree(prog);
         *retval = result;
 		return -1;
 	}
 
+	/*
+	 * Keep the old address space until the new image is fully
+	 * loaded, so that a failure can still return to the caller. For
+	 * a vfork child the old one is the parent's, and the parent
+	 * stays asleep until we hand it back.
+	 */
+	oldas = curproc_getas();
 
-	/* We should be a new process. */
-	KASSERT(curproc_getas() == NULL);
-    
 	/* Create a new address space. */
 	#if OPT_A3
-	as = as_create((char *)progname);
+	as = as_create(prog);
 	#else
 	as = as_create();
 	#endif
 	if (as ==NULL) {
 		vfs_close(v);
+        kfree(args);
+        kfree(prog);
         *retval = ENOMEM;
 		return -1;
 	}
     
     
 	/* Switch to it and activate it. */
+	as_deactivate();
 	curproc_setas(as);
 	as_activate();
     
@@ -142,8 +235,10 @@ int execv(const char* progname, char ** argv, int32_t* retval){
 	/* Load the executable. */
 	result = load_elf(v, &entrypoint);
 	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
 		vfs_close(v);
+		execv_restoreas(oldas);
+        kfree(args);
+        kfree(prog);
         *retval = result;
 		return -1;
 	}
@@ -153,48 +248,33 @@ int execv(const char* progname, char ** argv, int32_t* retval){
 	/* Define the user stack in the address space */
 	result = as_define_stack(as, &stackptr);
 	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
+		execv_restoreas(oldas);
+        kfree(args);
+        kfree(prog);
         *retval = result;
 		return -1;
 	}
-    
-    
-    
 
-
-    //add stuff
-    stackptr = stackptr - (argc + 1)*sizeof(vaddr_t);
-    
-    
-    char **buf = (char **)stackptr;
-    unsigned long i;
-    unsigned int len;
-    for(i=0; i<argc; i++){
-        //kprintf("%lu argv: %s\n",i,temp_argv[i]);
-        len = (strlen(temp_argv[i])+1)*(sizeof(char));
-        //kprintf("string length is: %u\n",len);
-        stackptr = stackptr - len;
-        
-        buf[i] = (char*)stackptr;
-        result = copyout((void *)temp_argv[i],(userptr_t)buf[i],len);
-        if(result){
-            *retval = result;
-            return -1;
-        }
+    result = execv_copyoutargs(args, argc, arglen, &stackptr, &uargv);
+    kfree(args);
+    kfree(prog);
+    if (result) {
+        execv_restoreas(oldas);
+        *retval = result;
+        return -1;
     }
-    unsigned int remainder = stackptr % 8;
-	if(remainder != 0){
-		stackptr = stackptr - remainder;
+
+	/* The new image is complete; let go of the old one. */
+	if (oldas != NULL) {
+		if (curproc->p_asborrowed) {
+			proc_releaseas(curproc);
+		} else {
+			as_destroy(oldas);
+		}
 	}
     
-    for(z=0;z<argc;z++){
-        if(temp_argv[z] != NULL){
-            kfree(temp_argv[z]);
-        }
-    }
-    
 	/* Warp to user mode. */
-	enter_new_process(argc, (userptr_t)buf /*userspace addr of argv*/,
+	enter_new_process(argc, uargv /*userspace addr of argv*/,
                       stackptr, entrypoint);
 	
     
@@ -204,4 +284,3 @@ int execv(const char* progname, char ** argv, int32_t* retval){
 	return -1;
 }
 #endif
-
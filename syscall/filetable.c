@@ -8,9 +8,32 @@
 #include <kern/fcntl.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <spinlock.h>
 
 #if OPT_A2
 
+/* protects File refcounts, which are shared across processes after fork */
+static struct spinlock file_refspin = SPINLOCK_NAMED_INITIALIZER("file refs");
+
+/*
+ * Drop one reference to F; the last one closes the vnode and frees F.
+ */
+static void file_decref(struct File * f) {
+    unsigned int refs;
+
+    spinlock_acquire(&file_refspin);
+    KASSERT(f->refcount > 0);
+    refs = --f->refcount;
+    spinlock_release(&file_refspin);
+
+    if (refs == 0) {
+        vfs_close(f->vn); /* close vnode; wouldn't fail */
+        f->vn = NULL;
+        lock_destroy(f->rw_lock);
+        kfree(f);
+    }
+}
+
 //operations for FileTable
 
 struct FileTable * create_filetable(void) {
@@ -35,19 +58,17 @@ struct FileTable * create_filetable(void) {
 }
 
 int duplicate_filetable(struct FileTable * src, struct FileTable * dest) {
-	KASSERT(dest != NULL);
+	KASSERT(dest != NULL && dest->bm != NULL);
 	dest->num_files = src->num_files;
-	dest->bm = bitmap_create(OPEN_MAX);
-	if (dest->bm == NULL) {
-		kfree(dest);
-		return -1;
-	}
 	
 	for(int i = 0; i < OPEN_MAX; i++) {
 		if(bitmap_isset(src->bm, i)) {
 			bitmap_mark(dest->bm, i);
 			dest->files[i] = src->files[i];
-            VOP_INCOPEN(dest->files[i]->vn);//increase the num of open file
+			// both tables now hold the same File (and its offset)
+			spinlock_acquire(&file_refspin);
+			dest->files[i]->refcount++;
+			spinlock_release(&file_refspin);
 		} else {
 			dest->files[i] = NULL;
 		}
@@ -57,28 +78,18 @@ int duplicate_filetable(struct FileTable * src, struct FileTable * dest) {
 }
 
 int destroy_filetable(struct FileTable * ft) {
-	//check if there is any other files open besides stdin/out/err
-    //KASSERT(ft->num_files == 3);
-    
-    //remove stdin/out/err from file table
-    for (int i = 0; i < 3; i ++) {
+    // drop every open file, so e.g. a pipe sees its last writer go away
+    for (int i = 0; i < OPEN_MAX; i ++) {
         if(bitmap_isset(ft->bm, i)) {
+            file_decref(ft->files[i]);
             ft->files[i] = NULL;
             ft->num_files --;
             bitmap_unmark(ft->bm, i);	
 		}
     }
 	
-//	for(int i = 3; i < OPEN_MAX; i++) {
-//		if(bitmap_isset(ft->bm, i)) {
-//			kfree(ft->files[i]);	
-//		}
-//	}
-	
-	//bitmap_destroy(ft->bm);
-    //ft->bm = NULL;
-    ft = NULL;
-	//kfree(ft);
+	bitmap_destroy(ft->bm);
+	kfree(ft);
 	return 0;
 }
 
@@ -91,6 +102,7 @@ int create_file_and_add_to_table(struct FileTable * ft, struct vnode *vn, int fl
     f->vn = vn;
     f->flags = flags;
     f->offset = 0;
+    f->refcount = 1;
     f->rw_lock = lock_create("rw_lock");
     if(f->rw_lock == NULL){
         kfree(f);
@@ -107,6 +119,8 @@ int create_file_and_add_to_table(struct FileTable * ft, struct vnode *vn, int fl
         }
     }
     
+    lock_destroy(f->rw_lock);
+    kfree(f);
     return EMFILE;  /* process's file table is full */
 }
 
@@ -125,11 +139,7 @@ int close_file_and_remove_from_table(struct FileTable * ft, unsigned int fd) {
     if (!bitmap_isset(ft->bm, fd)) {
         return -1; /* the file is not open */
     }
-    struct File *f = ft->files[fd];
-    vfs_close(f->vn); /* close vnode; wouldn't fail */
-    f->vn = NULL;
-    lock_destroy(f->rw_lock);
-    kfree(f);
+    file_decref(ft->files[fd]);
     
     bitmap_unmark(ft->bm, fd);
 	ft->files[fd] = NULL;
@@ -77,6 +77,7 @@ int fork(struct trapframe * parent_trapframe, int32_t *ret) {
         *ret = result;
         return -1;
     }
+    proc_addchild(parent_proc, child_proc);
     void * child_trapframe = trapframe_duplicate(parent_trapframe);
     get_proctable()->num_running++;
     result = thread_fork(curthread->t_name, child_proc, enter_forked_process, child_trapframe, (unsigned int) parent_proc->p_addrspace);
@@ -88,5 +89,60 @@ int fork(struct trapframe * parent_trapframe, int32_t *ret) {
     return 0;
 }
 
+/*
+ * vfork: like fork, but the child runs on our address space instead of
+ * a copy, and we sleep until it calls execv or _exit. The cost no
+ * longer depends on how big we are. As usual with vfork the child must
+ * not return from the function that called vfork or touch much of
+ * anything else before it execs.
+ */
+int vfork(struct trapframe * parent_trapframe, int32_t *ret) {
+    struct proc *parent_proc = curproc;
+    
+    if(!can_add_to_proctable()) {
+        *ret = ENPROC;
+        return -1;
+    }
+        
+    struct proc * child_proc = maybe_proc_create(parent_proc->p_name);
+    
+    if(child_proc == NULL) {
+        *ret = ENOMEM;
+        return -1;
+    }
+
+    int result = proc_share(parent_proc, child_proc);
+    if(result != 0) {
+        *ret = result;
+        return -1;
+    }
+    void * child_trapframe = trapframe_duplicate(parent_trapframe);
+    if(child_trapframe == NULL) {
+        proc_destroy(child_proc);
+        *ret = ENOMEM;
+        return -1;
+    }
+    proc_addchild(parent_proc, child_proc);
+    pid_t child_pid = child_proc->p_pid;
+    get_proctable()->num_running++;
+    result = thread_fork(curthread->t_name, child_proc, enter_forked_process, child_trapframe, 0);
+    if(result) {
+        // never ran: turn it into a zombie and reap it straight away
+        int status;
+        get_proctable()->num_running--;
+        kfree(child_trapframe);
+        proc_exit(child_proc);
+        proc_waitchild(child_pid, false, &child_pid, &status);
+        *ret = result;
+        return -1;
+    }
+
+    proc_vforkwait(child_proc);
+    
+    *ret = child_pid;
+    
+    return 0;
+}
+
 #endif
 
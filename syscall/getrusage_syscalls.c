@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "opt-A2.h"
+#include <types.h>
+#include <copyinout.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <syscall.h>
+#include <lib.h>
+#include <clock.h>
+#include <current.h>
+#include <proc.h>
+
+/*
+ * getrusage: report the resource usage of the calling process
+ * (RUSAGE_SELF) or of its reaped children (RUSAGE_CHILDREN).
+ *
+ * struct rusage has no byte counters, so bytes read and written are
+ * reported in ru_inblock/ru_oublock as 512-byte blocks, rounded up;
+ * ru_nswap is swap-ins plus swap-outs. Fields we don't track are 0.
+ */
+
+#if OPT_A2
+
+#define RUSAGE_BLOCKSIZE 512
+
+static void rusage_ticks(uint64_t ticks, struct timeval *tv) {
+    tv->tv_sec = ticks / HZ;
+    tv->tv_usec = (ticks % HZ) * (1000000 / HZ);
+}
+
+int getrusage(int who, struct rusage *usage, int32_t *ret) {
+    struct usage u;
+    struct rusage ru;
+    int result;
+
+    if (who == RUSAGE_SELF) {
+        proc_getusage(curproc, &u);
+    } else if (who == RUSAGE_CHILDREN) {
+        proc_getchildusage(curproc, &u);
+    } else {
+        *ret = EINVAL;
+        return -1;
+    }
+
+    bzero(&ru, sizeof(ru));
+    rusage_ticks(u.u_uticks, &ru.ru_utime);
+    rusage_ticks(u.u_sticks, &ru.ru_stime);
+    ru.ru_minflt = u.u_minflt;
+    ru.ru_majflt = u.u_majflt;
+    ru.ru_nswap = u.u_swapin + u.u_swapout;
+    ru.ru_inblock = (u.u_rbytes + RUSAGE_BLOCKSIZE - 1) / RUSAGE_BLOCKSIZE;
+    ru.ru_oublock = (u.u_wbytes + RUSAGE_BLOCKSIZE - 1) / RUSAGE_BLOCKSIZE;
+    ru.ru_nvcsw = u.u_nvcsw;
+    ru.ru_nivcsw = u.u_nivcsw;
+
+    result = copyout(&ru, (userptr_t)usage, sizeof(ru));
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+    *ret = 0;
+    return 0;
+}
+#endif
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "opt-A2.h"
+#include <types.h>
+#include <copyinout.h>
+#include <kern/errno.h>
+#include <kern/ioring.h>
+#include <syscall.h>
+#include <lib.h>
+
+/*
+ * ioring_enter: run a batch of queued operations in one trap. See
+ * kern/ioring.h for the ring layout.
+ *
+ * Entries are run by the calling thread, in order, each through the
+ * same in-kernel function its own syscall would use, so the results
+ * are exactly what the individual calls would have returned. They
+ * are copied in and completions copied out IORING_BATCH at a time,
+ * with at most two copies per batch (one on each side of the wrap).
+ * Submission stops early if the completion ring fills up; the entries
+ * not run stay queued. Returns the number of entries consumed.
+ * An entry counts as consumed once it has run: if its completion then
+ * can't be copied out, sqhead still moves past it and the completion
+ * is lost, rather than leaving it queued to run a second time.
+ */
+
+#if OPT_A2
+
+#define IORING_BATCH 32
+
+/*
+ * Copy N entries of size ESIZE between KBUF and the user ring at
+ * BASE, starting at free-running index IDX.
+ */
+static int ioring_copy(userptr_t base, size_t esize, unsigned mask,
+                       unsigned idx, unsigned n, void *kbuf, bool out) {
+    unsigned first, chunk;
+    char *k = kbuf;
+    int result;
+
+    while (n > 0) {
+        first = idx & mask;
+        chunk = mask + 1 - first;
+        if (chunk > n) {
+            chunk = n;
+        }
+        if (out) {
+            result = copyout(k, base + first * esize, chunk * esize);
+        } else {
+            result = copyin(base + first * esize, k, chunk * esize);
+        }
+        if (result) {
+            return result;
+        }
+        k += chunk * esize;
+        idx += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * Run one submission entry. Returns the syscall's result, or -errno.
+ */
+static int32_t ioring_run(const struct ioring_sqe *sqe) {
+    int32_t ret = 0;
+    int err;
+    bool positional = (sqe->sqe_flags & IORING_SQE_POS) != 0;
+
+    switch (sqe->sqe_op) {
+        case IORING_OP_NOP:
+            err = 0;
+            break;
+        case IORING_OP_READ:
+            if (positional) {
+                err = pread(sqe->sqe_fd, (void *)sqe->sqe_addr,
+                            sqe->sqe_len, sqe->sqe_off, &ret);
+            } else {
+                err = read(sqe->sqe_fd, (void *)sqe->sqe_addr,
+                           sqe->sqe_len, &ret);
+            }
+            break;
+        case IORING_OP_WRITE:
+            if (positional) {
+                err = pwrite(sqe->sqe_fd, (const void *)sqe->sqe_addr,
+                             sqe->sqe_len, sqe->sqe_off, &ret);
+            } else {
+                err = write(sqe->sqe_fd, (const void *)sqe->sqe_addr,
+                            sqe->sqe_len, &ret);
+            }
+            break;
+        case IORING_OP_OPEN:
+            err = open((const char *)sqe->sqe_addr, sqe->sqe_len, &ret);
+            break;
+        case IORING_OP_CLOSE:
+            err = close(sqe->sqe_fd, &ret);
+            break;
+        default:
+            err = -1;
+            ret = EINVAL;
+            break;
+    }
+    return err ? -ret : ret;
+}
+
+int ioring_enter(struct ioring *uring, unsigned to_submit, int32_t *ret) {
+    struct ioring ring;
+    struct ioring_sqe *sqes;
+    struct ioring_cqe *cqes;
+    unsigned queued, space, n, i, done;
+    int result;
+
+    result = copyin((const_userptr_t)uring, &ring, sizeof(ring));
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+    if (ring.ir_sqmask >= IORING_MAX_ENTRIES ||
+        ring.ir_cqmask >= IORING_MAX_ENTRIES ||
+        (ring.ir_sqmask & (ring.ir_sqmask + 1)) != 0 ||
+        (ring.ir_cqmask & (ring.ir_cqmask + 1)) != 0) {
+        *ret = EINVAL;
+        return -1;
+    }
+    queued = ring.ir_sqtail - ring.ir_sqhead;
+    if (queued > ring.ir_sqmask + 1) {
+        *ret = EINVAL;
+        return -1;
+    }
+    if (to_submit > queued) {
+        to_submit = queued;
+    }
+
+    sqes = kmalloc(IORING_BATCH * sizeof(*sqes));
+    cqes = kmalloc(IORING_BATCH * sizeof(*cqes));
+    if (sqes == NULL || cqes == NULL) {
+        kfree(sqes);
+        kfree(cqes);
+        *ret = ENOMEM;
+        return -1;
+    }
+
+    done = 0;
+    result = 0;
+    while (done < to_submit) {
+        space = ring.ir_cqmask + 1 - (ring.ir_cqtail - ring.ir_cqhead);
+        n = to_submit - done;
+        if (n > space) {
+            n = space;
+        }
+        if (n > IORING_BATCH) {
+            n = IORING_BATCH;
+        }
+        if (n == 0) {
+            break;  /* completion ring full */
+        }
+
+        result = ioring_copy(ring.ir_sqes, sizeof(*sqes), ring.ir_sqmask,
+                             ring.ir_sqhead, n, sqes, false);
+        if (result) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            cqes[i].cqe_data = sqes[i].sqe_data;
+            cqes[i].cqe_res = ioring_run(&sqes[i]);
+            cqes[i].cqe_pad = 0;
+        }
+        /* They have run; a retry must not run them again. */
+        ring.ir_sqhead += n;
+        done += n;
+        result = ioring_copy(ring.ir_cqes, sizeof(*cqes), ring.ir_cqmask,
+                             ring.ir_cqtail, n, cqes, true);
+        if (result) {
+            break;
+        }
+        ring.ir_cqtail += n;
+    }
+    kfree(sqes);
+    kfree(cqes);
+
+    /* Publish how far we got, even if we stopped on a fault. */
+    if (done > 0) {
+        int err;
+
+        err = copyout(&ring.ir_sqhead, (userptr_t)&uring->ir_sqhead,
+                      sizeof(ring.ir_sqhead));
+        if (err == 0) {
+            err = copyout(&ring.ir_cqtail, (userptr_t)&uring->ir_cqtail,
+                          sizeof(ring.ir_cqtail));
+        }
+        if (err) {
+            result = err;
+        }
+    }
+    if (done == 0 && result) {
+        *ret = result;
+        return -1;
+    }
+
+    *ret = done;
+    return 0;
+}
+#endif
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "opt-A2.h"
+#include <types.h>
+#include <copyinout.h>
+#include <kern/errno.h>
+#include <syscall.h>
+#include <lib.h>
+#include <filetable.h>
+#include <current.h>
+#include <limits.h>
+#include <proc.h>
+#include <kern/fcntl.h>
+#include <kern/iovec.h>
+#include <uio.h>
+#include <vnode.h>
+#include <synch.h>
+#include <addrspace.h>
+
+/*
+ * Vectored (readv/writev) and positional (pread/pwrite) I/O.
+ *
+ * All four build a single uio over the caller's buffers and make one
+ * VOP_READ/VOP_WRITE call. readv and writev use and advance the
+ * shared file offset under the file's rw_lock, like read and write.
+ * pread and pwrite take the offset as an argument and never touch
+ * the shared one, so they don't take rw_lock at all and can run in
+ * parallel on the same open file.
+ */
+
+#if OPT_A2
+
+/*
+ * Look up FD in the current process and check that it was opened for
+ * writing (WRITING) or reading (!WRITING). Returns an errno value.
+ */
+int syscall_getfile(int fd, bool writing, struct File **ret) {
+    struct File *f;
+    int result;
+
+    if(fd < 0 || fd >= OPEN_MAX){
+        return EBADF;
+    }
+    result = syscall_reservestdio();
+    if (result) {
+        return result;
+    }
+    f = curproc->p_ft->files[fd];
+    if(f == NULL){
+        return EBADF;
+    }
+    if((!writing && (f->flags & O_ACCMODE) == O_WRONLY) ||
+       (writing && (f->flags & O_ACCMODE) == O_RDONLY)){
+        return EBADF;
+    }
+    *ret = f;
+    return 0;
+}
+
+/*
+ * Do the transfer. With POSITIONAL, read or write at POS and leave the
+ * file's offset alone; otherwise use and update the offset under the
+ * file's lock. Returns the number of bytes moved in *RET.
+ */
+static int iov_transfer(struct File *f, struct iovec *iov, int iovcnt,
+                        size_t total, bool positional, off_t pos,
+                        enum uio_rw rw, int32_t *ret) {
+    struct uio u;
+    int result;
+
+    if (positional) {
+        if (pos < 0) {
+            return EINVAL;
+        }
+        result = VOP_TRYSEEK(f->vn, pos);
+        if (result) {
+            return result;
+        }
+    } else {
+        lock_acquire(f->rw_lock);
+        pos = f->offset;
+    }
+
+    u.uio_iov = iov;
+    u.uio_iovcnt = iovcnt;
+    u.uio_offset = pos;
+    u.uio_resid = total;
+    u.uio_segflg = UIO_USERSPACE;
+    u.uio_rw = rw;
+    u.uio_space = curproc_getas();
+
+    if (rw == UIO_READ) {
+        result = VOP_READ(f->vn, &u);
+    } else {
+        result = VOP_WRITE(f->vn, &u);
+    }
+
+    if (!positional) {
+        if (!result) {
+            f->offset = u.uio_offset;
+        }
+        lock_release(f->rw_lock);
+    }
+    if (result) {
+        return result;
+    }
+    *ret = total - u.uio_resid;
+    if (rw == UIO_READ) {
+        curthread->t_usage.u_rbytes += *ret;
+    } else {
+        curthread->t_usage.u_wbytes += *ret;
+    }
+    return 0;
+}
+
+/*
+ * Shared body of readv and writev.
+ */
+static int iov_rw(int fd, const struct iovec *uiov, int iovcnt,
+                  enum uio_rw rw, int32_t *ret) {
+    struct File *f;
+    struct iovec *iov;
+    size_t total = 0;
+    int i, result;
+
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        *ret = EINVAL;
+        return -1;
+    }
+    result = syscall_getfile(fd, rw == UIO_WRITE, &f);
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+
+    iov = kmalloc(iovcnt * sizeof(struct iovec));
+    if (iov == NULL) {
+        *ret = ENOMEM;
+        return -1;
+    }
+    result = copyin((const_userptr_t)uiov, iov, iovcnt * sizeof(struct iovec));
+    if (result) {
+        kfree(iov);
+        *ret = result;
+        return -1;
+    }
+    // the total has to fit in the (signed) return value
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > (size_t)0x7fffffff - total) {
+            kfree(iov);
+            *ret = EINVAL;
+            return -1;
+        }
+        total += iov[i].iov_len;
+    }
+
+    result = iov_transfer(f, iov, iovcnt, total, false, 0, rw, ret);
+    kfree(iov);
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+    return 0;
+}
+
+int readv(int fd, const struct iovec *iov, int iovcnt, int32_t *ret) {
+    return iov_rw(fd, iov, iovcnt, UIO_READ, ret);
+}
+
+int writev(int fd, const struct iovec *iov, int iovcnt, int32_t *ret) {
+    return iov_rw(fd, iov, iovcnt, UIO_WRITE, ret);
+}
+
+/*
+ * Shared body of pread and pwrite.
+ */
+static int iov_prw(int fd, void *buf, size_t len, off_t pos,
+                   enum uio_rw rw, int32_t *ret) {
+    struct File *f;
+    struct iovec iov;
+    int result;
+
+    result = syscall_getfile(fd, rw == UIO_WRITE, &f);
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+    if (len > 0x7fffffff) {
+        *ret = EINVAL;
+        return -1;
+    }
+    iov.iov_ubase = (userptr_t)buf;
+    iov.iov_len = len;
+    result = iov_transfer(f, &iov, 1, len, true, pos, rw, ret);
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+    return 0;
+}
+
+int pread(int fd, void *buf, size_t len, off_t pos, int32_t *ret) {
+    return iov_prw(fd, buf, len, pos, UIO_READ, ret);
+}
+
+int pwrite(int fd, const void *buf, size_t len, off_t pos, int32_t *ret) {
+    return iov_prw(fd, (void *)buf, len, pos, UIO_WRITE, ret);
+}
+
+#endif /* OPT_A2 */
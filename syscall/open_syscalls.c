@@ -41,6 +41,28 @@
 #include <vm.h>
 
 #if OPT_A2
+/*
+ * Open the console on fds 0-2 the first time a process does I/O.
+ * Every call that hands out or uses an fd goes through here first.
+ * Returns an errno value.
+ */
+int syscall_reservestdio(void) {
+    static const int modes[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+    int32_t result;
+    int i;
+
+    if(!curproc->stdio_reserve){
+        curproc->stdio_reserve = true;
+        for(i = 0; i < 3; i++){
+            // open() fails with -1 and leaves the errno in RESULT
+            if(open("con:", modes[i], &result)){
+                return result;
+            }
+        }
+    }
+    return 0;
+}
+
 int open(const char *filename, int flags, int32_t *ret){
     int result;
     int err;
@@ -82,20 +104,10 @@ int open(const char *filename, int flags, int32_t *ret){
         }
     }
     //reserve 0,1,2 for stdio
-    if(!curproc->stdio_reserve){
-        curproc->stdio_reserve = true;
-        err = open("con:", O_RDONLY,ret);
-        if(err){
-            return -1;
-        }
-        err = open("con:", O_WRONLY,ret);
-        if(err){
-            return -1;
-        }
-        err = open("con:", O_WRONLY,ret);
-        if(err){
-            return -1;
-        }
+    err = syscall_reservestdio();
+    if(err){
+        *ret = err;
+        return -1;
     }
     struct vnode *retvnode; /*  */ 
     char* tempFilename;
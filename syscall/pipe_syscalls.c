@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "opt-A2.h"
+#include <types.h>
+#include <copyinout.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <syscall.h>
+#include <lib.h>
+#include <filetable.h>
+#include <current.h>
+#include <proc.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <pipe.h>
+
+/*
+ * pipe: create a pipe and put its read end in fds[0] and its write
+ * end in fds[1]. The ends are ordinary entries in the file table, so
+ * they are inherited across fork and closed with close.
+ */
+
+#if OPT_A2
+int pipe(int *fds, int32_t *ret) {
+    struct FileTable *ft = curproc->p_ft;
+    struct vnode *rvn, *wvn;
+    int kfds[2];
+    int result;
+
+    // take 0-2 for the console first so the pipe doesn't land there
+    result = syscall_reservestdio();
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+
+    result = pipe_create(&rvn, &wvn);
+    if (result) {
+        *ret = result;
+        return -1;
+    }
+
+    result = create_file_and_add_to_table(ft, rvn, O_RDONLY, &kfds[0]);
+    if (result) {
+        vfs_close(rvn);
+        vfs_close(wvn);
+        *ret = EMFILE;
+        return -1;
+    }
+    result = create_file_and_add_to_table(ft, wvn, O_WRONLY, &kfds[1]);
+    if (result) {
+        close_file_and_remove_from_table(ft, kfds[0]);
+        vfs_close(wvn);
+        *ret = EMFILE;
+        return -1;
+    }
+
+    result = copyout(kfds, (userptr_t)fds, sizeof(kfds));
+    if (result) {
+        close_file_and_remove_from_table(ft, kfds[0]);
+        close_file_and_remove_from_table(ft, kfds[1]);
+        *ret = result;
+        return -1;
+    }
+
+    *ret = 0;
+    return 0;
+}
+#endif
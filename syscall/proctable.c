@@ -6,68 +6,172 @@
 
 static struct ProcTable * GlobalProctable;
 
-struct ProcTable * get_proctable(void) {
-	if(!GlobalProctable) {
-		GlobalProctable = kmalloc(sizeof(struct ProcTable));
-		KASSERT(GlobalProctable != NULL);
-		for (int i = 0; i < OPEN_MAX; i++) {
-			GlobalProctable->processes[i] = NULL;
-		}		
-		GlobalProctable->num_running = 0;
-		GlobalProctable->pt_cv = cv_create("proctable cv");
-	    GlobalProctable->pt_lock = lock_create("proctable lock");
-		GlobalProctable->pt_lock2 = lock_create("proclock2");
+// append pid to the tail of the free queue
+static void free_pid(struct ProcTable * pt, pid_t pid) {
+	pt->pt_freelink[pid] = 0;
+	if (pt->pt_freetail == 0) {
+		pt->pt_freehead = pid;
+	} else {
+		pt->pt_freelink[pt->pt_freetail] = pid;
+	}
+	pt->pt_freetail = pid;
+	pt->pt_nfree++;
+}
+
+// take the pid at the head of the free queue; 0 if there is none
+static pid_t alloc_pid(struct ProcTable * pt) {
+	pid_t pid = pt->pt_freehead;
+	if (pid != 0) {
+		pt->pt_freehead = pt->pt_freelink[pid];
+		if (pt->pt_freehead == 0) {
+			pt->pt_freetail = 0;
+		}
+		pt->pt_nfree--;
+	}
+	return pid;
+}
+
+// double the table (capped at PID_MAX+1 slots) and queue the new pids
+static int grow_proctable(struct ProcTable * pt) {
+	unsigned newsize = pt->pt_size == 0 ? PT_INITSIZE : pt->pt_size * 2;
+	if (newsize > PID_MAX + 1) {
+		newsize = PID_MAX + 1;
+	}
+	if (newsize <= pt->pt_size) {
+		return ENPROC;
+	}
+
+	struct proc ** procs = kmalloc(newsize * sizeof(struct proc *));
+	if (procs == NULL) {
+		return ENOMEM;
+	}
+	pid_t * links = kmalloc(newsize * sizeof(pid_t));
+	if (links == NULL) {
+		kfree(procs);
+		return ENOMEM;
+	}
+
+	for (unsigned i = 0; i < pt->pt_size; i++) {
+		procs[i] = pt->processes[i];
+		links[i] = pt->pt_freelink[i];
+	}
+	for (unsigned i = pt->pt_size; i < newsize; i++) {
+		procs[i] = NULL;
+	}
+	kfree(pt->processes);
+	kfree(pt->pt_freelink);
+	pt->processes = procs;
+	pt->pt_freelink = links;
+
+	// reserve pid=0 for fork()
+	for (unsigned i = pt->pt_size == 0 ? 1 : pt->pt_size; i < newsize; i++) {
+		free_pid(pt, i);
+	}
+	pt->pt_size = newsize;
+	return 0;
+}
+
+void proctable_bootstrap(struct proc * kernproc) {
+	KASSERT(GlobalProctable == NULL);
+	GlobalProctable = kmalloc(sizeof(struct ProcTable));
+	if (GlobalProctable == NULL) {
+		panic("proctable_bootstrap: out of memory\n");
+	}
+	GlobalProctable->processes = NULL;
+	GlobalProctable->pt_size = 0;
+	GlobalProctable->pt_freelink = NULL;
+	GlobalProctable->pt_freehead = 0;
+	GlobalProctable->pt_freetail = 0;
+	GlobalProctable->pt_nfree = 0;
+	if (grow_proctable(GlobalProctable)) {
+		panic("proctable_bootstrap: out of memory\n");
 	}
+	GlobalProctable->num_running = 0;
+	GlobalProctable->pt_cv = cv_create("proctable cv");
+	GlobalProctable->pt_lock = lock_create("proctable lock");
+	GlobalProctable->pt_lock2 = lock_create("proclock2");
+	GlobalProctable->pt_rwlock = rwlock_create("proctable rwlock");
+	if (GlobalProctable->pt_cv == NULL || GlobalProctable->pt_lock == NULL ||
+	    GlobalProctable->pt_lock2 == NULL || GlobalProctable->pt_rwlock == NULL) {
+		panic("proctable_bootstrap: out of memory\n");
+	}
+
+	// kproc takes the first pid. There is no curthread yet to take
+	// pt_rwlock with, and no other thread to race with; every later
+	// process goes through add_proc_to_table.
+	pid_t pid = alloc_pid(GlobalProctable);
+	KASSERT(pid != 0);
+	GlobalProctable->processes[pid] = kernproc;
+	kernproc->p_pid = pid;
+}
 
+struct ProcTable * get_proctable(void) {
+	KASSERT(GlobalProctable != NULL);
 	return GlobalProctable;
 }
 
 struct proc * get_proc_by_pid(pid_t pid) {
+	struct proc * p = NULL;
 	struct ProcTable * proctable = get_proctable();
 	KASSERT(proctable != NULL);
-	if (pid == 0 || pid > OPEN_MAX) {
+	if (pid <= 0) {
 		return NULL;
 	}
-	return proctable->processes[pid];
+	rwlock_acquire_read(proctable->pt_rwlock);
+	if ((unsigned)pid < proctable->pt_size) {
+		p = proctable->processes[pid];
+	}
+	rwlock_release_read(proctable->pt_rwlock);
+	return p;
 }
 
-void add_proc_to_table(struct proc * p) {
+int add_proc_to_table(struct proc * p) {
 	struct ProcTable * proctable = get_proctable();
+	int result = 0;
 	KASSERT(proctable != NULL);
 	KASSERT(p != NULL);
-	// reserve pid=0 for fork()
-	for (int i = 1; i < OPEN_MAX; i++) {
-		if(proctable->processes[i] == NULL) {
-			proctable->processes[i] = p;
-			p->p_pid = i;
-			// kprintf("Set pid: %d\n", i);
-			// lock_acquire(proctable->pt_lock);
-			 //  proctable->num_running++;
-			// lock_release(proctable->pt_lock);
-			return;
+	rwlock_acquire_write(proctable->pt_rwlock);
+	// grow before the queue runs short so freed pids sit out for a
+	// while before being reused; if growing fails we can still use
+	// whatever is left
+	if (proctable->pt_nfree < proctable->pt_size / 4) {
+		result = grow_proctable(proctable);
+	}
+	pid_t pid = alloc_pid(proctable);
+	if (pid == 0) {
+		if (result == 0) {
+			result = ENPROC;
 		}
+	} else {
+		KASSERT(proctable->processes[pid] == NULL);
+		proctable->processes[pid] = p;
+		p->p_pid = pid;
+		result = 0;
 	}
+	rwlock_release_write(proctable->pt_rwlock);
+	return result;
 }
 
 void remove_proc_from_table(struct proc * p) {
 	struct ProcTable * proctable = get_proctable();
 	KASSERT(proctable != NULL);
-	if(p->p_pid < OPEN_MAX) {
+	rwlock_acquire_write(proctable->pt_rwlock);
+	if(p->p_pid > 0 && (unsigned)p->p_pid < proctable->pt_size) {
 		if(proctable->processes[p->p_pid] == p) {
 			proctable->processes[p->p_pid] = NULL;
-			//proctable->num_running--;
-			return;
+			free_pid(proctable, p->p_pid);
 		}
 	}
+	rwlock_release_write(proctable->pt_rwlock);
 }
 
 bool can_add_to_proctable(void) {
-	for (int i = 0; i < OPEN_MAX; i++) {
-		if(GlobalProctable->processes[i] != NULL) {
-			return true;
-		}
-	}
-	return false;
+	bool ret;
+	struct ProcTable * proctable = get_proctable();
+	rwlock_acquire_read(proctable->pt_rwlock);
+	ret = proctable->pt_nfree > 0 || proctable->pt_size < PID_MAX + 1;
+	rwlock_release_read(proctable->pt_rwlock);
+	return ret;
 }
 
 #endif /* OPT_A2 */
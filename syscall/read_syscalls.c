@@ -59,20 +59,10 @@ read(unsigned int fd, void *buf, size_t buflen, int32_t *ret){
         *ret = EBADF;
         return -1;
     }
-    if(!curproc->stdio_reserve){
-        curproc->stdio_reserve = true;
-        err = open("con:", O_RDONLY,ret);
-        if(err){
-            return -1;
-        }
-        err = open("con:", O_WRONLY,ret);
-        if(err){
-            return -1;
-        }
-        err = open("con:", O_WRONLY,ret);
-        if(err){
-            return -1;
-        }
+    err = syscall_reservestdio();
+    if(err){
+        *ret = err;
+        return -1;
     }
     
     tempfile = curproc->p_ft->files[fd];
@@ -90,6 +80,7 @@ read(unsigned int fd, void *buf, size_t buflen, int32_t *ret){
     data = buflen - u.uio_resid;
     tempfile->offset = u.uio_offset;
     *ret = data;
+    curthread->t_usage.u_rbytes += data;
     lock_release(tempfile->rw_lock);
     return 0;
 }
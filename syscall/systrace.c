@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * System call accounting. See systrace.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/syscall.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <proc.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <mips/trapframe.h>
+#include <systrace.h>
+
+/* Largest report we generate; calls that don't fit are left off. */
+#define SYSTRACE_TEXTMAX  16384
+
+volatile bool systrace_enabled = false;
+
+/*
+ * Every cpu's counters, by cpu number, for the report. Entries are
+ * set once in systrace_cpuinit and never freed.
+ */
+static struct systrace_cpu *systrace_cpus[SYSTRACE_MAXCPUS];
+
+static const char *const systrace_names[SYSTRACE_NCALLS] = {
+	[SYS_fork] = "fork",
+	[SYS_vfork] = "vfork",
+	[SYS_execv] = "execv",
+	[SYS__exit] = "_exit",
+	[SYS_waitpid] = "waitpid",
+	[SYS_getpid] = "getpid",
+	[SYS_getrusage] = "getrusage",
+	[SYS_open] = "open",
+	[SYS_pipe] = "pipe",
+	[SYS_close] = "close",
+	[SYS_read] = "read",
+	[SYS_pread] = "pread",
+	[SYS_readv] = "readv",
+	[SYS_write] = "write",
+	[SYS_pwrite] = "pwrite",
+	[SYS_writev] = "writev",
+	[SYS___time] = "__time",
+	[SYS_nanosleep] = "nanosleep",
+	[SYS_reboot] = "reboot",
+	[SYS_copy_file_range] = "copy_file_range",
+	[SYS_ioring_enter] = "ioring_enter",
+};
+
+static
+uint64_t
+systrace_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+void
+systrace_cpuinit(struct cpu *c)
+{
+	struct systrace_cpu *sc;
+
+	c->c_systrace = NULL;
+	if (c->c_number >= SYSTRACE_MAXCPUS) {
+		return;
+	}
+	sc = kmalloc(sizeof(*sc));
+	if (sc == NULL) {
+		panic("systrace_cpuinit: Out of memory\n");
+	}
+	bzero(sc, sizeof(*sc));
+	c->c_systrace = sc;
+	systrace_cpus[c->c_number] = sc;
+}
+
+uint64_t
+systrace_enter(void)
+{
+	if (!systrace_enabled) {
+		return 0;
+	}
+	return systrace_now();
+}
+
+void
+systrace_exit(int callno, const struct trapframe *tf, int err,
+	      int32_t retval, uint64_t start)
+{
+	struct systrace_cpu *sc;
+	struct systrace_ring *ring;
+	struct systrace_rec *rec;
+	uint64_t ns, us;
+	unsigned b;
+	int spl;
+
+	if (start == 0) {
+		return;
+	}
+	ns = systrace_now() - start;
+	if (ns > 0xffffffff) {
+		ns = 0xffffffff;
+	}
+
+	if (callno >= 0 && callno < SYSTRACE_NCALLS) {
+		us = ns / 1000;
+		for (b = 0; b < SYSTRACE_NBUCKETS - 1 && us >= (1ULL << b); b++) {
+			/* nothing */
+		}
+
+		/* Interrupts off: no one else can be on this cpu's counters. */
+		spl = splhigh();
+		sc = curcpu->c_systrace;
+		if (sc != NULL) {
+			sc->sc_calls[callno]++;
+			if (err) {
+				sc->sc_errors[callno]++;
+			}
+			sc->sc_ns[callno] += ns;
+			if (ns > sc->sc_maxns[callno]) {
+				sc->sc_maxns[callno] = ns;
+			}
+			sc->sc_hist[callno][b]++;
+		}
+		splx(spl);
+	}
+
+	if (curproc->p_systrace != NULL) {
+		spinlock_acquire(&curproc->p_lock);
+		ring = curproc->p_systrace;
+		if (ring != NULL) {
+			rec = &ring->sr_recs[ring->sr_next++ &
+					     (SYSTRACE_RINGSIZE - 1)];
+			rec->sr_callno = callno;
+			rec->sr_args[0] = tf->tf_a0;
+			rec->sr_args[1] = tf->tf_a1;
+			rec->sr_args[2] = tf->tf_a2;
+			rec->sr_args[3] = tf->tf_a3;
+			rec->sr_retval = retval;
+			rec->sr_err = err;
+			rec->sr_ns = ns;
+		}
+		spinlock_release(&curproc->p_lock);
+	}
+}
+
+void
+systrace_reset(void)
+{
+	unsigned i;
+	int spl;
+
+	/*
+	 * Other cpus may be mid-update; at worst one of their counts
+	 * survives the reset.
+	 */
+	for (i=0; i<SYSTRACE_MAXCPUS; i++) {
+		if (systrace_cpus[i] != NULL) {
+			spl = splhigh();
+			bzero(systrace_cpus[i], sizeof(struct systrace_cpu));
+			splx(spl);
+		}
+	}
+}
+
+static
+const char *
+systrace_name(int callno, char *buf, size_t len)
+{
+	if (callno >= 0 && callno < SYSTRACE_NCALLS &&
+	    systrace_names[callno] != NULL) {
+		return systrace_names[callno];
+	}
+	snprintf(buf, len, "#%d", callno);
+	return buf;
+}
+
+/*
+ * Write the report into BUF, which is LEN bytes. Returns the length
+ * of the text.
+ */
+static
+size_t
+systrace_format(char *buf, size_t len)
+{
+	struct systrace_cpu *tot;
+	struct systrace_cpu *sc;
+	char namebuf[16], line[320];
+	size_t pos, n;
+	unsigned i, c, b;
+
+	KASSERT(len > 0);
+	buf[0] = 0;
+
+	tot = kmalloc(sizeof(*tot));
+	if (tot == NULL) {
+		snprintf(buf, len, "systrace: out of memory\n");
+		return strlen(buf);
+	}
+	bzero(tot, sizeof(*tot));
+	for (c=0; c<SYSTRACE_MAXCPUS; c++) {
+		sc = systrace_cpus[c];
+		if (sc == NULL) {
+			continue;
+		}
+		for (i=0; i<SYSTRACE_NCALLS; i++) {
+			tot->sc_calls[i] += sc->sc_calls[i];
+			tot->sc_errors[i] += sc->sc_errors[i];
+			tot->sc_ns[i] += sc->sc_ns[i];
+			if (sc->sc_maxns[i] > tot->sc_maxns[i]) {
+				tot->sc_maxns[i] = sc->sc_maxns[i];
+			}
+			for (b=0; b<SYSTRACE_NBUCKETS; b++) {
+				tot->sc_hist[i][b] += sc->sc_hist[i][b];
+			}
+		}
+	}
+
+	pos = snprintf(buf, len, "%-16s %10s %8s %10s %10s\n",
+		       "syscall", "calls", "errors", "avg us", "max us");
+	for (i=0; i<SYSTRACE_NCALLS && pos < len; i++) {
+		if (tot->sc_calls[i] == 0) {
+			continue;
+		}
+		n = snprintf(line, sizeof(line), "%-16s %10llu %8llu %10llu %10u\n",
+			     systrace_name(i, namebuf, sizeof(namebuf)),
+			     tot->sc_calls[i], tot->sc_errors[i],
+			     tot->sc_ns[i] / tot->sc_calls[i] / 1000,
+			     tot->sc_maxns[i] / 1000);
+		for (b=0; b<SYSTRACE_NBUCKETS && n < sizeof(line); b++) {
+			if (tot->sc_hist[i][b] == 0) {
+				continue;
+			}
+			if (b == SYSTRACE_NBUCKETS - 1) {
+				n += snprintf(line + n, sizeof(line) - n,
+					      " >=%u:%u", 1U << (b - 1),
+					      tot->sc_hist[i][b]);
+			}
+			else {
+				n += snprintf(line + n, sizeof(line) - n,
+					      " <%u:%u", 1U << b,
+					      tot->sc_hist[i][b]);
+			}
+		}
+		if (n < sizeof(line)) {
+			snprintf(line + n, sizeof(line) - n, "\n");
+		}
+		n = strlen(line);
+		if (n >= len - pos) {
+			/* doesn't fit; stop here */
+			break;
+		}
+		strcpy(buf + pos, line);
+		pos += n;
+	}
+
+	kfree(tot);
+	return pos;
+}
+
+void
+systrace_print(void)
+{
+	char *buf;
+
+	if (!systrace_enabled) {
+		kprintf("systrace: not running\n");
+		return;
+	}
+	buf = kmalloc(SYSTRACE_TEXTMAX);
+	if (buf == NULL) {
+		kprintf("systrace: out of memory\n");
+		return;
+	}
+	systrace_format(buf, SYSTRACE_TEXTMAX);
+	kprintf("%s", buf);
+	kprintf("(histogram buckets: calls taking under N us)\n");
+	kfree(buf);
+}
+
+int
+systrace_settrace(struct proc *p, bool on)
+{
+	struct systrace_ring *ring, *old;
+
+	ring = NULL;
+	if (on) {
+		ring = kmalloc(sizeof(*ring));
+		if (ring == NULL) {
+			return ENOMEM;
+		}
+		bzero(ring, sizeof(*ring));
+	}
+
+	spinlock_acquire(&p->p_lock);
+	old = p->p_systrace;
+	if (on && old != NULL) {
+		/* already tracing; keep what's there */
+		spinlock_release(&p->p_lock);
+		kfree(ring);
+		return 0;
+	}
+	p->p_systrace = ring;
+	spinlock_release(&p->p_lock);
+
+	kfree(old);
+	return 0;
+}
+
+void
+systrace_printring(struct proc *p)
+{
+	struct systrace_ring *snap;
+	struct systrace_rec *rec;
+	char namebuf[16];
+	unsigned i, first;
+
+	snap = kmalloc(sizeof(*snap));
+	if (snap == NULL) {
+		kprintf("systrace: out of memory\n");
+		return;
+	}
+
+	/* Copy it out; kprintf can sleep. */
+	spinlock_acquire(&p->p_lock);
+	if (p->p_systrace == NULL) {
+		spinlock_release(&p->p_lock);
+		kfree(snap);
+		kprintf("systrace: pid %d is not being traced\n", p->p_pid);
+		return;
+	}
+	memcpy(snap, p->p_systrace, sizeof(*snap));
+	spinlock_release(&p->p_lock);
+
+	first = snap->sr_next > SYSTRACE_RINGSIZE ?
+		snap->sr_next - SYSTRACE_RINGSIZE : 0;
+	for (i=first; i<snap->sr_next; i++) {
+		rec = &snap->sr_recs[i & (SYSTRACE_RINGSIZE - 1)];
+		kprintf("%6u %-16s(0x%x, 0x%x, 0x%x, 0x%x) = ", i,
+			systrace_name(rec->sr_callno, namebuf, sizeof(namebuf)),
+			rec->sr_args[0], rec->sr_args[1],
+			rec->sr_args[2], rec->sr_args[3]);
+		if (rec->sr_err) {
+			kprintf("%s", strerror(rec->sr_err));
+		}
+		else {
+			kprintf("%d", rec->sr_retval);
+		}
+		kprintf(" [%u us]\n", rec->sr_ns / 1000);
+	}
+	kfree(snap);
+}
+
+void
+systrace_procexit(struct proc *p)
+{
+	kfree(p->p_systrace);
+	p->p_systrace = NULL;
+}
+
+/*
+ * The "systrace:" device. Reads return the report, regenerated on
+ * each read and indexed by the file offset; writes reset the
+ * counters.
+ */
+
+static
+int
+systrace_devopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+	return 0;
+}
+
+static
+int
+systrace_devclose(struct device *dev)
+{
+	(void)dev;
+	return 0;
+}
+
+static
+int
+systrace_devio(struct device *dev, struct uio *uio)
+{
+	char *buf;
+	size_t len;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw == UIO_WRITE) {
+		systrace_reset();
+		uio->uio_resid = 0;
+		return 0;
+	}
+
+	buf = kmalloc(SYSTRACE_TEXTMAX);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	len = systrace_format(buf, SYSTRACE_TEXTMAX);
+	result = 0;
+	if (uio->uio_offset >= 0 && uio->uio_offset < (off_t)len) {
+		len -= uio->uio_offset;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(buf + uio->uio_offset, len, uio);
+	}
+	kfree(buf);
+	return result;
+}
+
+static
+int
+systrace_devioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+void
+systrace_bootstrap(void)
+{
+	struct device *dev;
+	int result;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev == NULL) {
+		panic("Could not add systrace device: out of memory\n");
+	}
+	dev->d_open = systrace_devopen;
+	dev->d_close = systrace_devclose;
+	dev->d_io = systrace_devio;
+	dev->d_ioctl = systrace_devioctl;
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+	dev->d_data = NULL;
+
+	result = vfs_adddev("systrace", dev, 0);
+	if (result) {
+		panic("Could not add systrace device: %s\n", strerror(result));
+	}
+
+	systrace_enabled = true;
+}
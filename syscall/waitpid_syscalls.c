@@ -36,17 +36,20 @@
 #include <synch.h>
 #include <proc.h>
 #include <proctable.h>
+#include <limits.h>
+#include <kern/wait.h>
 
 //int exitcode; 
 //int is_exit; 
 #if OPT_A2
 pid_t waitpid(pid_t pid, int *status, int options, int32_t *ret) {
 
-    if(pid <=0 || pid >= OPEN_MAX){
+    // -1 means any child; process groups are not supported
+    if(pid == 0 || pid < -1 || pid > PID_MAX){
         *ret = ESRCH;
         return -1;
     }
-    if(options != 0){//check for options
+    if(options & ~WNOHANG){//check for options
         *ret = EINVAL;
         return -1;
     }
@@ -54,32 +57,23 @@ pid_t waitpid(pid_t pid, int *status, int options, int32_t *ret) {
         *ret = EFAULT;
         return -1;
     }
-    curproc->is_waiting = 1;
-    if (curproc->child_is_exit) {
-        *status = curproc->child_exitcode;
-        *ret = pid;
-        curproc->is_waiting = 0;
-        return 0;
-    }
-    pid_t parent_pid = (pid_t)curproc->p_pid;
-    struct proc * child = get_proc_by_pid(pid);
-    if (child == NULL) {
-        *ret = ESRCH;
+
+    pid_t childpid;
+    int exitcode;
+    int result = proc_waitchild(pid, (options & WNOHANG) != 0, &childpid, &exitcode);
+    if (result) {
+        *ret = result;
         return -1;
     }
-    
-    //make the currentproc only interested in waiting for its child.
-    if (parent_pid != (pid_t)child->p_parentpid) {
-        *ret = ECHILD;
-        return  -1;
+    if (childpid != 0) {
+        result = copyout(&exitcode, (userptr_t)status, sizeof(int));
+        if (result) {
+            *ret = result;
+            return -1;
+        }
     }
-    //child->exitcode_retrieved = 1;
-    P(curproc->p_sem);
-    KASSERT(curproc->child_is_exit);
-    *status = curproc->child_exitcode;
-    *ret = pid;
+    *ret = childpid;
     return 0;
       
 }
 #endif
-
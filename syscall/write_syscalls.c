@@ -60,20 +60,10 @@ int write(unsigned int fd, const void *buffer, size_t len, int32_t *ret)
         return -1;
     }
     
-    if(!curproc->stdio_reserve){
-        curproc->stdio_reserve = true;
-        err = open("con:", O_RDONLY,ret);
-        if(err){
-            return -1;
-        }
-        err = open("con:", O_WRONLY,ret);
-        if(err){
-            return -1;
-        }
-        err = open("con:", O_WRONLY,ret);
-        if(err){
-            return -1;
-        }
+    err = syscall_reservestdio();
+    if(err){
+        *ret = err;
+        return -1;
     }
     
     
@@ -102,6 +92,7 @@ int write(unsigned int fd, const void *buffer, size_t len, int32_t *ret)
     data = len - u.uio_resid;
     tempfile->offset = u.uio_offset;
     *ret = data;
+    curthread->t_usage.u_wbytes += data;
     
     lock_release(tempfile->rw_lock);
 	return 0;
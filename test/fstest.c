@@ -41,6 +41,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <stat.h>
 #include <lib.h>
 #include <uio.h>
 #include <thread.h>
@@ -48,7 +49,10 @@
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <clock.h>
+#include <sfs.h>
 #include <test.h>
+#include "opt-sfs.h"
 
 #define SLOGAN   "HODIE MIHI - CRAS TIBI\n"
 #define FILENAME "fstest.tmp"
@@ -347,6 +351,27 @@ doreadstress(const char *filesys)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Print the time since S1/N1 taken to move BYTES bytes, and the
+ * resulting rate; WHAT says what was done with them.
+ */
+static
+void
+fstest_report(const char *what, uint64_t bytes, time_t s1, uint32_t n1)
+{
+	time_t s2, rs;
+	uint32_t n2, rn;
+	uint64_t ns;
+
+	gettime(&s2, &n2);
+	getinterval(s1, n1, s2, n2, &rs, &rn);
+
+	ns = (uint64_t)rs * 1000000000 + rn;
+	kprintf("  %s %llu bytes: %llu.%03llu s, %llu KB/s\n", what,
+		bytes, (uint64_t)rs, (uint64_t)rn / 1000000,
+		ns ? bytes * 1000000 / ns : 0);
+}
+
 static
 void
 writestress_thread(void *fs, unsigned long num)
@@ -380,12 +405,15 @@ static
 void
 dowritestress(const char *filesys)
 {
+	time_t s1;
+	uint32_t n1;
 	int i, err;
 
 	init_threadsem();
 
 	kprintf("*** Starting fs write stress test on %s:\n", filesys);
 
+	gettime(&s1, &n1);
 	for (i=0; i<NTHREADS; i++) {
 		err = thread_fork("writestress", NULL,
 				  writestress_thread, (char *)filesys, i);
@@ -398,6 +426,10 @@ dowritestress(const char *filesys)
 		P(threadsem);
 	}
 
+	/* Each thread writes and reads back a whole file */
+	fstest_report("wrote and read",
+		      (uint64_t)NTHREADS * NCHUNKS * strlen(SLOGAN) * 2, s1, n1);
+
 	kprintf("*** fs write stress test done\n");
 }
 
@@ -422,6 +454,8 @@ static
 void
 dowritestress2(const char *filesys)
 {
+	time_t s1;
+	uint32_t n1;
 	int i, err;
 	char name[32];
 	struct vnode *vn;
@@ -440,6 +474,7 @@ dowritestress2(const char *filesys)
 	}
 	vfs_close(vn);
 
+	gettime(&s1, &n1);
 	for (i=0; i<NTHREADS; i++) {
 		err = thread_fork("writestress2", NULL,
 				  writestress2_thread, (char *)filesys, i);
@@ -458,6 +493,10 @@ dowritestress2(const char *filesys)
 		return;
 	}
 
+	/* The threads write one file between them; it's read once */
+	fstest_report("wrote and read", (uint64_t)NCHUNKS * strlen(SLOGAN) * 2,
+		      s1, n1);
+
 	if (fstest_remove(filesys, "")) {
 		kprintf("*** Test failed\n");
 	}
@@ -537,6 +576,1010 @@ docreatestress(const char *filesys)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Sequential throughput on an aged filesystem. First scar the free
+ * space: grow AGE_NFILES small files in lockstep, so their blocks
+ * interleave, and then delete every other one. Then time writing and
+ * reading back one big file in BENCH_CHUNK pieces. BENCH_BYTES is
+ * large enough to need the double indirect block.
+ */
+#define AGE_NFILES   48
+#define AGE_MAXBLKS  7
+#define AGE_CHUNK    512
+#define BENCH_CHUNK  4096
+#define BENCH_BYTES  (192*1024)
+
+static
+int
+agedbench_rw(struct vnode *vn, char *buf, size_t len, off_t pos,
+	     enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int err;
+
+	uio_kinit(&iov, &ku, buf, len, pos, rw);
+	err = (rw == UIO_READ) ? VOP_READ(vn, &ku) : VOP_WRITE(vn, &ku);
+	if (err == 0 && ku.uio_resid > 0) {
+		err = EIO;
+	}
+	return err;
+}
+
+static
+void
+agedbench_fill(char *buf, size_t len, off_t pos)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		buf[i] = (char)((pos + i) * 7 + ((pos + i) >> 9));
+	}
+}
+
+static
+void
+doagedbench(const char *filesys)
+{
+	struct vnode *age[AGE_NFILES];
+	struct vnode *vn;
+	char name[32];
+	char *buf, *check;
+	time_t s1;
+	uint32_t n1;
+	off_t pos;
+	int i, blk, err;
+
+	kprintf("*** Starting aged fs sequential bench on %s:\n", filesys);
+
+	buf = kmalloc(BENCH_CHUNK);
+	check = kmalloc(BENCH_CHUNK);
+	if (buf == NULL || check == NULL) {
+		panic("agedbench: Out of memory\n");
+	}
+
+	/* Age the free space */
+	for (i=0; i<AGE_NFILES; i++) {
+		snprintf(name, sizeof(name), "%s:%sage%d", filesys,
+			 FILENAME, i);
+		err = vfs_open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664, &age[i]);
+		if (err) {
+			panic("agedbench: create: %s\n", strerror(err));
+		}
+	}
+	agedbench_fill(buf, AGE_CHUNK, 0);
+	for (blk=0; blk<AGE_MAXBLKS; blk++) {
+		for (i=0; i<AGE_NFILES; i++) {
+			if (blk > i % AGE_MAXBLKS) {
+				continue;
+			}
+			err = agedbench_rw(age[i], buf, AGE_CHUNK,
+					   blk * AGE_CHUNK, UIO_WRITE);
+			if (err) {
+				panic("agedbench: aging write: %s\n",
+				      strerror(err));
+			}
+		}
+	}
+	for (i=0; i<AGE_NFILES; i++) {
+		vfs_close(age[i]);
+		if (i % 2 == 0) {
+			snprintf(name, sizeof(name), "%s:%sage%d", filesys,
+				 FILENAME, i);
+			err = vfs_remove(name);
+			if (err) {
+				panic("agedbench: remove: %s\n",
+				      strerror(err));
+			}
+		}
+	}
+
+	/* Sequential write */
+	fstest_makename(name, sizeof(name), filesys, "");
+	err = vfs_open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	if (err) {
+		panic("agedbench: create: %s\n", strerror(err));
+	}
+	gettime(&s1, &n1);
+	for (pos=0; pos<BENCH_BYTES; pos+=BENCH_CHUNK) {
+		agedbench_fill(buf, BENCH_CHUNK, pos);
+		err = agedbench_rw(vn, buf, BENCH_CHUNK, pos, UIO_WRITE);
+		if (err) {
+			panic("agedbench: write: %s\n", strerror(err));
+		}
+	}
+	vfs_close(vn);
+	vfs_sync();
+	fstest_report("write", BENCH_BYTES, s1, n1);
+
+	/* Sequential read, checking the data as we go */
+	fstest_makename(name, sizeof(name), filesys, "");
+	err = vfs_open(name, O_RDONLY, 0664, &vn);
+	if (err) {
+		panic("agedbench: open: %s\n", strerror(err));
+	}
+	gettime(&s1, &n1);
+	for (pos=0; pos<BENCH_BYTES; pos+=BENCH_CHUNK) {
+		err = agedbench_rw(vn, buf, BENCH_CHUNK, pos, UIO_READ);
+		if (err) {
+			panic("agedbench: read: %s\n", strerror(err));
+		}
+		agedbench_fill(check, BENCH_CHUNK, pos);
+		for (i=0; i<BENCH_CHUNK; i++) {
+			if (buf[i] != check[i]) {
+				panic("agedbench: data mismatch at "
+				      "offset %llu\n",
+				      (unsigned long long)(pos + i));
+			}
+		}
+	}
+	fstest_report("read ", BENCH_BYTES, s1, n1);
+	vfs_close(vn);
+
+	/* Clean up */
+	fstest_remove(filesys, "");
+	for (i=1; i<AGE_NFILES; i+=2) {
+		snprintf(name, sizeof(name), "%s:%sage%d", filesys,
+			 FILENAME, i);
+		vfs_remove(name);
+	}
+
+	kfree(check);
+	kfree(buf);
+	kprintf("*** aged fs sequential bench done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Parallel I/O to independent files. Each thread writes PAR_BYTES to
+ * a file of its own, reads it back and checks it; the whole lot is
+ * timed for 1, 2, 4, ... PAR_MAXTHREADS threads. Files on the same
+ * filesystem don't share any locks on the data path, so aggregate
+ * throughput should go up with the thread count until the CPUs or
+ * the disk run out.
+ */
+#define PAR_MAXTHREADS 8
+#define PAR_BYTES      (32*1024)
+
+static
+void
+parallelbench_thread(void *fs, unsigned long num)
+{
+	const char *filesys = fs;
+	struct vnode *vn;
+	char name[32];
+	char *buf, *check;
+	off_t pos;
+	int i, err;
+
+	buf = kmalloc(BENCH_CHUNK);
+	check = kmalloc(BENCH_CHUNK);
+	if (buf == NULL || check == NULL) {
+		panic("parallelbench: Out of memory\n");
+	}
+
+	snprintf(name, sizeof(name), "%s:%spar%lu", filesys, FILENAME, num);
+	err = vfs_open(name, O_RDWR|O_CREAT|O_TRUNC, 0664, &vn);
+	if (err) {
+		panic("parallelbench: create: %s\n", strerror(err));
+	}
+
+	for (pos=0; pos<PAR_BYTES; pos+=BENCH_CHUNK) {
+		agedbench_fill(buf, BENCH_CHUNK, pos + num);
+		err = agedbench_rw(vn, buf, BENCH_CHUNK, pos, UIO_WRITE);
+		if (err) {
+			panic("parallelbench: write: %s\n", strerror(err));
+		}
+	}
+	for (pos=0; pos<PAR_BYTES; pos+=BENCH_CHUNK) {
+		err = agedbench_rw(vn, buf, BENCH_CHUNK, pos, UIO_READ);
+		if (err) {
+			panic("parallelbench: read: %s\n", strerror(err));
+		}
+		agedbench_fill(check, BENCH_CHUNK, pos + num);
+		for (i=0; i<BENCH_CHUNK; i++) {
+			if (buf[i] != check[i]) {
+				panic("parallelbench: thread %lu: data "
+				      "mismatch at offset %llu\n", num,
+				      (unsigned long long)(pos + i));
+			}
+		}
+	}
+	vfs_close(vn);
+
+	err = vfs_remove(name);
+	if (err) {
+		panic("parallelbench: remove: %s\n", strerror(err));
+	}
+
+	kfree(check);
+	kfree(buf);
+	V(threadsem);
+}
+
+static
+void
+doparallelbench(const char *filesys)
+{
+	time_t s1, s2, rs;
+	uint32_t n1, n2, rn;
+	uint64_t ns, bytes;
+	int nthreads, i, err;
+
+	init_threadsem();
+
+	kprintf("*** Starting parallel file I/O bench on %s:\n", filesys);
+
+	for (nthreads=1; nthreads<=PAR_MAXTHREADS; nthreads*=2) {
+		gettime(&s1, &n1);
+		for (i=0; i<nthreads; i++) {
+			err = thread_fork("parallelbench", NULL,
+					  parallelbench_thread,
+					  (char *)filesys, i);
+			if (err) {
+				panic("thread_fork failed %s\n",
+				      strerror(err));
+			}
+		}
+		for (i=0; i<nthreads; i++) {
+			P(threadsem);
+		}
+		gettime(&s2, &n2);
+		getinterval(s1, n1, s2, n2, &rs, &rn);
+
+		/* Each thread writes and reads its file once */
+		bytes = (uint64_t)nthreads * PAR_BYTES * 2;
+		ns = (uint64_t)rs * 1000000000 + rn;
+		kprintf("  %d thread%s: %llu bytes in %llu.%03llu s, "
+			"%llu KB/s\n", nthreads, nthreads == 1 ? " " : "s",
+			bytes, (uint64_t)rs, (uint64_t)rn / 1000000,
+			ns ? bytes * 1000000 / ns : 0);
+	}
+
+	kprintf("*** parallel file I/O bench done\n");
+}
+
+#if OPT_SFS
+////////////////////////////////////////////////////////////
+
+/*
+ * SFS journal replay. Create small files in rounds, removing most of
+ * the previous round's each time and syncing after each, until the
+ * log has been checkpointed and started over at least once and holds
+ * JR_MINLOGGED commits made since. Then freeze the volume, so none of
+ * those reach their home locations, and remount it, which has to
+ * replay them. Afterwards exactly the files that should be there must
+ * be, each holding its own name.
+ */
+#define JR_NFILES     8
+#define JR_MINLOGGED  3
+#define JR_MAXROUNDS  500
+
+/* What a file must look like after the remount */
+#define JR_GONE       0
+#define JR_KEPT       1
+#define JR_EITHER     2
+
+static
+void
+journaltest_name(char *buf, size_t buflen, const char *filesys,
+		 int round, int i)
+{
+	snprintf(buf, buflen, "%s:%sj%d.%d", filesys, FILENAME, round, i);
+	KASSERT(strlen(buf) < buflen);
+}
+
+/*
+ * Create a round's files, remove all but the first of the previous
+ * round's, and sync.
+ */
+static
+void
+journaltest_round(const char *filesys, int round)
+{
+	struct vnode *vn;
+	char name[48], path[48];
+	int i, err;
+
+	for (i=0; i<JR_NFILES; i++) {
+		journaltest_name(name, sizeof(name), filesys, round, i);
+		/* vfs_open destroys the string it's passed */
+		strcpy(path, name);
+		err = vfs_open(path, O_WRONLY|O_CREAT|O_EXCL, 0664, &vn);
+		if (err) {
+			panic("journaltest: create %s: %s\n", name,
+			      strerror(err));
+		}
+		err = agedbench_rw(vn, name, strlen(name), 0, UIO_WRITE);
+		if (err) {
+			panic("journaltest: write %s: %s\n", name,
+			      strerror(err));
+		}
+		vfs_close(vn);
+	}
+	for (i=1; round>0 && i<JR_NFILES; i++) {
+		journaltest_name(name, sizeof(name), filesys, round-1, i);
+		strcpy(path, name);
+		err = vfs_remove(path);
+		if (err) {
+			panic("journaltest: remove %s: %s\n", name,
+			      strerror(err));
+		}
+	}
+	vfs_sync();
+}
+
+/*
+ * Check one file after the remount, and remove it if it's there. A
+ * file whose creation was cut short (JR_EITHER) may be there without
+ * its contents yet, but not with anything else in it.
+ */
+static
+void
+journaltest_check(const char *filesys, int round, int i, int how)
+{
+	struct vnode *vn;
+	char name[48], path[48], buf[48];
+	int err;
+
+	journaltest_name(name, sizeof(name), filesys, round, i);
+	strcpy(path, name);
+	err = vfs_open(path, O_RDONLY, 0664, &vn);
+	if (err == ENOENT && how != JR_KEPT) {
+		return;
+	}
+	if (err) {
+		panic("journaltest: %s lost: %s\n", name, strerror(err));
+	}
+	if (how == JR_GONE) {
+		panic("journaltest: %s came back\n", name);
+	}
+	bzero(buf, sizeof(buf));
+	err = agedbench_rw(vn, buf, strlen(name), 0, UIO_READ);
+	vfs_close(vn);
+	if (err) {
+		panic("journaltest: read %s: %s\n", name, strerror(err));
+	}
+	if (strcmp(buf, name) && (how == JR_KEPT || buf[0] != 0)) {
+		panic("journaltest: %s has the wrong contents\n", name);
+	}
+	strcpy(path, name);
+	err = vfs_remove(path);
+	if (err) {
+		panic("journaltest: remove %s: %s\n", name, strerror(err));
+	}
+}
+
+/*
+ * Replay happens at mount, so the volume has to come and go. Returns
+ * nonzero, having said why, if FILESYS isn't an sfs with a journal
+ * or can't be unmounted.
+ */
+static
+int
+journaltest_remount(const char *filesys, const char *test)
+{
+	uint32_t ncommits, nlogged;
+	bool frozen;
+	int err;
+
+	err = sfs_logstat(filesys, &ncommits, &nlogged, &frozen);
+	if (err) {
+		kprintf("%s: %s: no sfs journal: %s\n", test, filesys,
+			strerror(err));
+		return err;
+	}
+	err = vfs_unmount(filesys);
+	if (err) {
+		kprintf("%s: can't unmount %s: %s\n", test, filesys,
+			strerror(err));
+		return err;
+	}
+	err = sfs_mount(filesys);
+	if (err) {
+		panic("%s: mount: %s\n", test, strerror(err));
+	}
+	return 0;
+}
+
+static
+void
+dojournaltest(const char *filesys)
+{
+	uint32_t ncommits, nlogged;
+	int round, last, i, err;
+	bool frozen;
+
+	kprintf("*** Starting sfs journal replay test on %s:\n", filesys);
+
+	if (journaltest_remount(filesys, "journaltest")) {
+		return;
+	}
+
+	last = -1;
+	for (round=0; round<JR_MAXROUNDS; round++) {
+		journaltest_round(filesys, round);
+		err = sfs_logstat(filesys, &ncommits, &nlogged, &frozen);
+		if (err) {
+			panic("journaltest: logstat: %s\n", strerror(err));
+		}
+		if (ncommits > nlogged && nlogged >= JR_MINLOGGED) {
+			last = round;
+			break;
+		}
+	}
+	if (last < 0) {
+		panic("journaltest: log never started over in %d rounds\n",
+		      JR_MAXROUNDS);
+	}
+	kprintf("journaltest: %d rounds, %u commits, %u left in the log\n",
+		last+1, ncommits, nlogged);
+
+	/* Crash, and come back */
+	err = sfs_freeze(filesys);
+	if (err) {
+		panic("journaltest: freeze: %s\n", strerror(err));
+	}
+	err = vfs_unmount(filesys);
+	if (err) {
+		panic("journaltest: unmount: %s\n", strerror(err));
+	}
+	err = sfs_mount(filesys);
+	if (err) {
+		panic("journaltest: remount: %s\n", strerror(err));
+	}
+
+	/* The first of each round's files is kept, and all of the last's */
+	for (round=0; round<=last; round++) {
+		for (i=0; i<JR_NFILES; i++) {
+			journaltest_check(filesys, round, i,
+				(i == 0 || round == last) ? JR_KEPT : JR_GONE);
+		}
+	}
+
+	kprintf("*** sfs journal replay test done\n");
+}
+
+/*
+ * SFS journal replay after making room. Same files as above, but with
+ * lazy checkpoints off, so the log fills up and a commit has to
+ * checkpoint to make room for itself; freeze the volume just after
+ * that checkpoint and remount. The checkpoint must have written home
+ * only what was committed, whatever the transaction waiting on it had
+ * done since. So everything synced before the round that froze must
+ * be there as it was, and that round's own changes may or may not be.
+ */
+static
+void
+doroomtest(const char *filesys)
+{
+	uint32_t ncommits, nlogged;
+	int round, last, i, err;
+	bool frozen;
+
+	kprintf("*** Starting sfs journal make-room test on %s:\n",
+		filesys);
+
+	if (journaltest_remount(filesys, "roomtest")) {
+		return;
+	}
+	err = sfs_freezeroom(filesys);
+	if (err) {
+		panic("roomtest: freezeroom: %s\n", strerror(err));
+	}
+
+	last = -1;
+	for (round=0; round<JR_MAXROUNDS; round++) {
+		journaltest_round(filesys, round);
+		err = sfs_logstat(filesys, &ncommits, &nlogged, &frozen);
+		if (err) {
+			panic("roomtest: logstat: %s\n", strerror(err));
+		}
+		if (frozen) {
+			last = round;
+			break;
+		}
+	}
+	if (last < 0) {
+		panic("roomtest: log never filled up in %d rounds\n",
+		      JR_MAXROUNDS);
+	}
+	kprintf("roomtest: frozen in round %d, after %u commits\n",
+		last, ncommits);
+
+	err = vfs_unmount(filesys);
+	if (err) {
+		panic("roomtest: unmount: %s\n", strerror(err));
+	}
+	err = sfs_mount(filesys);
+	if (err) {
+		panic("roomtest: remount: %s\n", strerror(err));
+	}
+
+	/*
+	 * Rounds before the previous one are settled. The previous
+	 * round's first file is kept; the rest were being removed.
+	 */
+	for (round=0; round<=last; round++) {
+		for (i=0; i<JR_NFILES; i++) {
+			if (round == last) {
+				journaltest_check(filesys, round, i,
+						  JR_EITHER);
+			}
+			else if (i == 0) {
+				journaltest_check(filesys, round, i, JR_KEPT);
+			}
+			else {
+				journaltest_check(filesys, round, i,
+					round == last-1 ? JR_EITHER : JR_GONE);
+			}
+		}
+	}
+
+	kprintf("*** sfs journal make-room test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * SFS directory growth. Create DG_NFILES files in the volume's root
+ * directory, which rehashes it into a bigger table several times on
+ * the way (seen as its size jumping to a new whole number of blocks),
+ * then check that each name can be looked up and that reading the
+ * directory turns up every one of them exactly once.
+ */
+#define DG_NFILES     400
+#define DG_MINREHASH  3
+#define DG_PREFIX     FILENAME "d"
+
+static
+void
+dodirgrowtest(const char *filesys)
+{
+	struct vnode *root, *vn;
+	struct stat st;
+	struct iovec iov;
+	struct uio ku;
+	char name[48], path[48], buf[SFS_NAMELEN];
+	char *seen;
+	off_t pos, lastsize;
+	size_t plen, len;
+	int i, nrehash, err;
+	char c;
+
+	kprintf("*** Starting sfs directory growth test on %s:\n", filesys);
+
+	seen = kmalloc(DG_NFILES);
+	if (seen == NULL) {
+		panic("dirgrowtest: Out of memory\n");
+	}
+	bzero(seen, DG_NFILES);
+
+	err = vfs_getroot(filesys, &root);
+	if (err) {
+		panic("dirgrowtest: getroot: %s\n", strerror(err));
+	}
+	err = VOP_STAT(root, &st);
+	if (err) {
+		panic("dirgrowtest: stat: %s\n", strerror(err));
+	}
+	lastsize = st.st_size;
+
+	/* Grow it */
+	nrehash = 0;
+	for (i=0; i<DG_NFILES; i++) {
+		snprintf(name, sizeof(name), "%s:%s%d", filesys, DG_PREFIX, i);
+		/* vfs_open destroys the string it's passed */
+		strcpy(path, name);
+		err = vfs_open(path, O_WRONLY|O_CREAT|O_EXCL, 0664, &vn);
+		if (err) {
+			panic("dirgrowtest: create %s: %s\n", name,
+			      strerror(err));
+		}
+		vfs_close(vn);
+
+		err = VOP_STAT(root, &st);
+		if (err) {
+			panic("dirgrowtest: stat: %s\n", strerror(err));
+		}
+		if (st.st_size > lastsize && st.st_size % SFS_BLOCKSIZE == 0) {
+			nrehash++;
+		}
+		lastsize = st.st_size;
+	}
+	if (nrehash < DG_MINREHASH) {
+		panic("dirgrowtest: only %d rehashes growing to %d files\n",
+		      nrehash, DG_NFILES);
+	}
+	kprintf("dirgrowtest: %d files, %d rehashes, directory %llu bytes\n",
+		DG_NFILES, nrehash, (unsigned long long)lastsize);
+
+	/* Look each one up */
+	for (i=0; i<DG_NFILES; i++) {
+		snprintf(name, sizeof(name), "%s:%s%d", filesys, DG_PREFIX, i);
+		strcpy(path, name);
+		err = vfs_open(path, O_RDONLY, 0664, &vn);
+		if (err) {
+			panic("dirgrowtest: lookup %s: %s\n", name,
+			      strerror(err));
+		}
+		vfs_close(vn);
+	}
+
+	/* Read the directory */
+	plen = strlen(DG_PREFIX);
+	pos = 0;
+	while (1) {
+		uio_kinit(&iov, &ku, buf, sizeof(buf)-1, pos, UIO_READ);
+		err = VOP_GETDIRENTRY(root, &ku);
+		if (err) {
+			panic("dirgrowtest: getdirentry: %s\n",
+			      strerror(err));
+		}
+		len = sizeof(buf)-1 - ku.uio_resid;
+		if (len == 0) {
+			break;
+		}
+		buf[len] = 0;
+		pos = ku.uio_offset;
+
+		/* Skip anything else that's in there */
+		if (len <= plen) {
+			continue;
+		}
+		c = buf[plen];
+		buf[plen] = 0;
+		if (strcmp(buf, DG_PREFIX)) {
+			continue;
+		}
+		buf[plen] = c;
+
+		i = atoi(buf+plen);
+		snprintf(name, sizeof(name), "%s%d", DG_PREFIX, i);
+		if (i < 0 || i >= DG_NFILES || strcmp(buf, name)) {
+			panic("dirgrowtest: stray name %s\n", buf);
+		}
+		if (seen[i]) {
+			panic("dirgrowtest: %s listed twice\n", buf);
+		}
+		seen[i] = 1;
+	}
+	for (i=0; i<DG_NFILES; i++) {
+		if (!seen[i]) {
+			panic("dirgrowtest: %s%d not listed\n", DG_PREFIX, i);
+		}
+	}
+
+	/* Clean up */
+	for (i=0; i<DG_NFILES; i++) {
+		snprintf(path, sizeof(path), "%s:%s%d", filesys, DG_PREFIX, i);
+		err = vfs_remove(path);
+		if (err) {
+			panic("dirgrowtest: remove: %s\n", strerror(err));
+		}
+	}
+	VOP_DECREF(root);
+	kfree(seen);
+
+	kprintf("*** sfs directory growth test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * SFS inline data. Small files and directories keep their contents in
+ * the inode, SFS_INLINESIZE bytes of it, and move out to a block when
+ * they outgrow that, and don't move back. Take files across the
+ * boundary with writes and truncates, and shrink them below it again,
+ * checking the size and every byte against a copy kept here after
+ * each step; then add names to a directory
+ * until it no longer fits inline and take them away again, checking
+ * lookup and getdirentry all the way.
+ */
+#define IL_MAXSIZE  (2*SFS_BLOCKSIZE)
+#define IL_NDIRS    (SFS_INLINESIZE / sizeof(struct sfs_dir) + 4)
+
+enum inlineop { IL_WRITE, IL_TRUNCATE, IL_NEWFILE };
+
+struct inlinestep {
+	enum inlineop op;
+	off_t pos;              /* where to write, or length to truncate to */
+	size_t len;             /* how much to write */
+};
+
+static const struct inlinestep inlinesteps[] = {
+	{ IL_WRITE,    0,                  100 },
+	{ IL_TRUNCATE, 50,                 0 },
+	{ IL_TRUNCATE, 300,                0 },
+	{ IL_WRITE,    300,                SFS_INLINESIZE-301 },
+	{ IL_WRITE,    SFS_INLINESIZE-1,   1 },
+	{ IL_WRITE,    SFS_INLINESIZE,     1 },          /* moves out */
+	{ IL_TRUNCATE, SFS_INLINESIZE-1,   0 },
+	{ IL_WRITE,    10,                 20 },
+	{ IL_TRUNCATE, SFS_INLINESIZE+200, 0 },
+	{ IL_WRITE,    SFS_INLINESIZE-5,   10 },
+	{ IL_NEWFILE,  0,                  0 },
+	{ IL_WRITE,    0,                  SFS_INLINESIZE+1 }, /* moves out */
+	{ IL_TRUNCATE, 5,                  0 },
+	{ IL_NEWFILE,  0,                  0 },
+	{ IL_WRITE,    0,                  200 },
+	{ IL_TRUNCATE, SFS_INLINESIZE+1,   0 },          /* moves out */
+	{ IL_WRITE,    SFS_BLOCKSIZE-3,    SFS_BLOCKSIZE },
+	{ IL_TRUNCATE, SFS_INLINESIZE,     0 },
+};
+
+static
+void
+inlinetest_checkfile(struct vnode *vn, const char *model, off_t size,
+		     char *buf, unsigned step)
+{
+	struct stat st;
+	off_t i;
+	int err;
+
+	err = VOP_STAT(vn, &st);
+	if (err) {
+		panic("inlinetest: stat: %s\n", strerror(err));
+	}
+	if (st.st_size != size) {
+		panic("inlinetest: step %u: size %llu, expected %llu\n",
+		      step, (unsigned long long)st.st_size,
+		      (unsigned long long)size);
+	}
+
+	/* One byte more than there is, to see it stop at EOF */
+	bzero(buf, IL_MAXSIZE+1);
+	if (size > 0) {
+		err = agedbench_rw(vn, buf, size, 0, UIO_READ);
+		if (err) {
+			panic("inlinetest: step %u: read: %s\n", step,
+			      strerror(err));
+		}
+	}
+	err = agedbench_rw(vn, buf + size, 1, size, UIO_READ);
+	if (err != EIO) {
+		panic("inlinetest: step %u: read past EOF got data\n", step);
+	}
+	for (i=0; i<size; i++) {
+		if (buf[i] != model[i]) {
+			panic("inlinetest: step %u: wrong data at offset "
+			      "%llu\n", step, (unsigned long long)i);
+		}
+	}
+}
+
+static
+void
+inlinetest_checkdir(struct vnode *dir, const bool *present)
+{
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char name[SFS_NAMELEN], check[SFS_NAMELEN];
+	bool seen[IL_NDIRS];
+	unsigned i, want, got;
+	off_t pos;
+	size_t len;
+	int err;
+
+	want = 0;
+	for (i=0; i<IL_NDIRS; i++) {
+		snprintf(name, sizeof(name), "d%u", i);
+		err = VOP_LOOKUP(dir, name, &vn);
+		if (present[i]) {
+			if (err) {
+				panic("inlinetest: lookup d%u: %s\n", i,
+				      strerror(err));
+			}
+			VOP_DECREF(vn);
+			want++;
+		}
+		else if (err == 0) {
+			panic("inlinetest: removed name d%u still there\n",
+			      i);
+		}
+		seen[i] = false;
+	}
+
+	got = 0;
+	pos = 0;
+	while (1) {
+		uio_kinit(&iov, &ku, name, sizeof(name)-1, pos, UIO_READ);
+		err = VOP_GETDIRENTRY(dir, &ku);
+		if (err) {
+			panic("inlinetest: getdirentry: %s\n", strerror(err));
+		}
+		len = sizeof(name)-1 - ku.uio_resid;
+		if (len == 0) {
+			break;
+		}
+		name[len] = 0;
+		pos = ku.uio_offset;
+
+		i = atoi(name+1);
+		snprintf(check, sizeof(check), "d%u", i);
+		if (i >= IL_NDIRS || strcmp(name, check) || !present[i]) {
+			panic("inlinetest: stray name %s\n", name);
+		}
+		if (seen[i]) {
+			panic("inlinetest: %s listed twice\n", name);
+		}
+		seen[i] = true;
+		got++;
+	}
+	if (got != want) {
+		panic("inlinetest: %u names listed, expected %u\n", got, want);
+	}
+}
+
+static
+void
+doinlinetest(const char *filesys)
+{
+	const struct inlinestep *is;
+	struct vnode *root, *dir, *vn;
+	struct stat st;
+	char name[48], path[48];
+	char *model, *buf;
+	bool present[IL_NDIRS];
+	off_t size;
+	unsigned step, i;
+	size_t k;
+	int err;
+
+	kprintf("*** Starting sfs inline data test on %s:\n", filesys);
+
+	model = kmalloc(IL_MAXSIZE);
+	buf = kmalloc(IL_MAXSIZE+1);
+	if (model == NULL || buf == NULL) {
+		panic("inlinetest: Out of memory\n");
+	}
+
+	/* A file */
+	fstest_makename(name, sizeof(name), filesys, "i");
+	strcpy(path, name);
+	err = vfs_open(path, O_RDWR|O_CREAT|O_TRUNC, 0664, &vn);
+	if (err) {
+		panic("inlinetest: create %s: %s\n", name, strerror(err));
+	}
+	size = 0;
+	for (step=0; step<sizeof(inlinesteps)/sizeof(inlinesteps[0]);
+	     step++) {
+		is = &inlinesteps[step];
+		KASSERT(is->pos + is->len <= IL_MAXSIZE);
+		if (is->op == IL_NEWFILE) {
+			vfs_close(vn);
+			fstest_remove(filesys, "i");
+			strcpy(path, name);
+			err = vfs_open(path, O_RDWR|O_CREAT|O_EXCL, 0664,
+				       &vn);
+			if (err) {
+				panic("inlinetest: step %u: create: %s\n",
+				      step, strerror(err));
+			}
+			size = 0;
+		}
+		else if (is->op == IL_WRITE) {
+			for (k=0; k<is->len; k++) {
+				buf[k] = (char)(step * 31 + k + 1);
+			}
+			err = agedbench_rw(vn, buf, is->len, is->pos,
+					   UIO_WRITE);
+			if (err) {
+				panic("inlinetest: step %u: write: %s\n",
+				      step, strerror(err));
+			}
+			if (is->pos > size) {
+				/* The hole reads as zeros */
+				bzero(model + size, is->pos - size);
+			}
+			memcpy(model + is->pos, buf, is->len);
+			if (is->pos + (off_t)is->len > size) {
+				size = is->pos + is->len;
+			}
+		}
+		else {
+			err = VOP_TRUNCATE(vn, is->pos);
+			if (err) {
+				panic("inlinetest: step %u: truncate: %s\n",
+				      step, strerror(err));
+			}
+			if (is->pos > size) {
+				bzero(model + size, is->pos - size);
+			}
+			size = is->pos;
+		}
+		inlinetest_checkfile(vn, model, size, buf, step);
+	}
+	vfs_close(vn);
+
+	/* Again from disk, after a sync */
+	vfs_sync();
+	strcpy(path, name);
+	err = vfs_open(path, O_RDONLY, 0664, &vn);
+	if (err) {
+		panic("inlinetest: reopen %s: %s\n", name, strerror(err));
+	}
+	inlinetest_checkfile(vn, model, size, buf, step);
+	vfs_close(vn);
+	fstest_remove(filesys, "i");
+
+	/* A directory */
+	err = vfs_getroot(filesys, &root);
+	if (err) {
+		panic("inlinetest: getroot: %s\n", strerror(err));
+	}
+	err = sfs_scratchdir(root, &dir);
+	VOP_DECREF(root);
+	if (err) {
+		panic("inlinetest: scratchdir: %s\n", strerror(err));
+	}
+	for (i=0; i<IL_NDIRS; i++) {
+		present[i] = false;
+	}
+	inlinetest_checkdir(dir, present);
+
+	/* Grow it past inline, then shrink it, then grow it again */
+	for (i=0; i<IL_NDIRS; i++) {
+		snprintf(name, sizeof(name), "d%u", i);
+		err = VOP_CREAT(dir, name, true, 0664, &vn);
+		if (err) {
+			panic("inlinetest: create %s: %s\n", name,
+			      strerror(err));
+		}
+		VOP_DECREF(vn);
+		present[i] = true;
+		inlinetest_checkdir(dir, present);
+	}
+	err = VOP_STAT(dir, &st);
+	if (err) {
+		panic("inlinetest: stat: %s\n", strerror(err));
+	}
+	if (st.st_size <= SFS_INLINESIZE) {
+		panic("inlinetest: %u names still fit inline?\n", IL_NDIRS);
+	}
+	for (i=0; i<IL_NDIRS; i++) {
+		snprintf(name, sizeof(name), "d%u", i);
+		err = VOP_REMOVE(dir, name);
+		if (err) {
+			panic("inlinetest: remove %s: %s\n", name,
+			      strerror(err));
+		}
+		present[i] = false;
+		inlinetest_checkdir(dir, present);
+	}
+	for (i=0; i<IL_NDIRS; i+=2) {
+		snprintf(name, sizeof(name), "d%u", i);
+		err = VOP_CREAT(dir, name, true, 0664, &vn);
+		if (err) {
+			panic("inlinetest: create %s: %s\n", name,
+			      strerror(err));
+		}
+		VOP_DECREF(vn);
+		present[i] = true;
+		inlinetest_checkdir(dir, present);
+	}
+
+	/* Empty it; the directory itself goes when we let go */
+	for (i=0; i<IL_NDIRS; i+=2) {
+		snprintf(name, sizeof(name), "d%u", i);
+		err = VOP_REMOVE(dir, name);
+		if (err) {
+			panic("inlinetest: remove %s: %s\n", name,
+			      strerror(err));
+		}
+	}
+	VOP_DECREF(dir);
+
+	kfree(buf);
+	kfree(model);
+	kprintf("*** sfs inline data test done\n");
+}
+#endif /* OPT_SFS */
+
+////////////////////////////////////////////////////////////
+
 static
 int
 checkfilesystem(int nargs, char **args)
@@ -544,7 +1587,7 @@ checkfilesystem(int nargs, char **args)
 	char *device;
 
 	if (nargs != 2) {
-		kprintf("Usage: fs[12345] filesystem:\n");
+		kprintf("Usage: fs[1-11] filesystem:\n");
 		return EINVAL;
 	}
 
@@ -576,6 +1619,14 @@ DEFTEST(readstress);
 DEFTEST(writestress);
 DEFTEST(writestress2);
 DEFTEST(createstress);
+DEFTEST(agedbench);
+DEFTEST(parallelbench);
+#if OPT_SFS
+DEFTEST(journaltest);
+DEFTEST(dirgrowtest);
+DEFTEST(inlinetest);
+DEFTEST(roomtest);
+#endif
 
 ////////////////////////////////////////////////////////////
 
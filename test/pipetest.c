@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipe test and benchmark.
+ *
+ * Bandwidth: a writer thread streams a patterned byte sequence
+ * through a pipe to a reader thread, which checks every byte and
+ * then expects end of file once the writer closes its end. This is
+ * repeated for several transfer sizes, small ones stressing the
+ * wakeup path and large ones the bulk copy.
+ *
+ * Latency: two threads bounce a single byte back and forth over a
+ * pair of pipes and the average round trip is reported.
+ *
+ * Finally, writing to a pipe with no reader must fail with EPIPE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <pipe.h>
+#include <test.h>
+
+#define PIPEBENCH_BYTES		(2 * 1024 * 1024)
+#define PIPEBENCH_MAXCHUNK	16384
+#define PIPEBENCH_PINGS		2000
+
+static const size_t pipebench_chunks[] = { 64, 512, 4096, 16384 };
+#define PIPEBENCH_NCHUNKS \
+	(sizeof(pipebench_chunks) / sizeof(pipebench_chunks[0]))
+
+static struct semaphore *pipedone;
+
+/*
+ * Read or write LEN bytes of BUF on V in one call; returns the number
+ * of bytes transferred.
+ */
+static
+size_t
+pipe_io(struct vnode *v, char *buf, size_t len, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, 0, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(v, &ku);
+	}
+	else {
+		result = VOP_WRITE(v, &ku);
+	}
+	if (result) {
+		panic("pipetest: VOP_%s: %s\n",
+		      rw == UIO_READ ? "READ" : "WRITE", strerror(result));
+	}
+	return len - ku.uio_resid;
+}
+
+static
+void
+pipewriter(void *vp, unsigned long chunk)
+{
+	struct vnode *v = vp;
+	char *buf;
+	size_t done, len, i;
+
+	buf = kmalloc(PIPEBENCH_MAXCHUNK);
+	if (buf == NULL) {
+		panic("pipetest: out of memory\n");
+	}
+
+	for (done = 0; done < PIPEBENCH_BYTES; done += len) {
+		len = chunk;
+		if (len > PIPEBENCH_BYTES - done) {
+			len = PIPEBENCH_BYTES - done;
+		}
+		for (i=0; i<len; i++) {
+			buf[i] = (char)((done + i) * 7);
+		}
+		if (pipe_io(v, buf, len, UIO_WRITE) != len) {
+			panic("pipetest: short write\n");
+		}
+	}
+
+	/* The reader should now see end of file. */
+	vfs_close(v);
+	kfree(buf);
+	V(pipedone);
+}
+
+static
+void
+pipereader(void *vp, unsigned long chunk)
+{
+	struct vnode *v = vp;
+	char *buf;
+	size_t done, len, i;
+
+	buf = kmalloc(PIPEBENCH_MAXCHUNK);
+	if (buf == NULL) {
+		panic("pipetest: out of memory\n");
+	}
+
+	done = 0;
+	while ((len = pipe_io(v, buf, chunk, UIO_READ)) > 0) {
+		for (i=0; i<len; i++) {
+			if (buf[i] != (char)((done + i) * 7)) {
+				panic("pipetest: bad byte at offset %u\n",
+				      (unsigned)(done + i));
+			}
+		}
+		done += len;
+	}
+	if (done != PIPEBENCH_BYTES) {
+		panic("pipetest: read %u bytes, expected %u\n",
+		      (unsigned)done, PIPEBENCH_BYTES);
+	}
+
+	vfs_close(v);
+	kfree(buf);
+	V(pipedone);
+}
+
+/*
+ * Ping-pong over two pipes. The pinger (PINGER != 0) sends and then
+ * waits for the echo; the ponger echoes each byte it receives.
+ */
+static
+void
+pipeponger(void *vp, unsigned long pinger)
+{
+	struct vnode **v = vp;	/* [0] reads from us, [1] writes to us */
+	char c = 'x';
+	unsigned i;
+
+	for (i=0; i<PIPEBENCH_PINGS; i++) {
+		if (pinger) {
+			pipe_io(v[1], &c, 1, UIO_WRITE);
+			if (pipe_io(v[0], &c, 1, UIO_READ) != 1) {
+				panic("pipetest: lost ping\n");
+			}
+		}
+		else {
+			if (pipe_io(v[0], &c, 1, UIO_READ) != 1) {
+				panic("pipetest: lost ping\n");
+			}
+			pipe_io(v[1], &c, 1, UIO_WRITE);
+		}
+	}
+	V(pipedone);
+}
+
+static
+void
+pipe_mustcreate(struct vnode **rd, struct vnode **wr)
+{
+	int result;
+
+	result = pipe_create(rd, wr);
+	if (result) {
+		panic("pipetest: pipe_create: %s\n", strerror(result));
+	}
+}
+
+static
+void
+pipe_mustfork(void (*func)(void *, unsigned long), void *data1,
+	      unsigned long data2)
+{
+	int result;
+
+	result = thread_fork("pipetest", NULL, func, data1, data2);
+	if (result) {
+		panic("pipetest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+static
+void
+pipebandwidth(size_t chunk)
+{
+	struct vnode *rd, *wr;
+	time_t s1, s2, rs;
+	uint32_t n1, n2, rn;
+	uint64_t ns;
+
+	pipe_mustcreate(&rd, &wr);
+
+	gettime(&s1, &n1);
+	pipe_mustfork(pipereader, rd, chunk);
+	pipe_mustfork(pipewriter, wr, chunk);
+	P(pipedone);
+	P(pipedone);
+	gettime(&s2, &n2);
+	getinterval(s1, n1, s2, n2, &rs, &rn);
+
+	ns = (uint64_t)rs * 1000000000 + rn;
+	kprintf("  %5u-byte transfers: %llu.%03llu s, %llu KB/s\n",
+		(unsigned)chunk, (uint64_t)rs, (uint64_t)rn / 1000000,
+		ns ? (uint64_t)PIPEBENCH_BYTES * 1000000 / ns : 0);
+}
+
+static
+void
+pipelatency(void)
+{
+	struct vnode *ping[2], *pong[2];
+	struct vnode *pingerv[2], *pongerv[2];
+	time_t s1, s2, rs;
+	uint32_t n1, n2, rn;
+	uint64_t ns;
+
+	pipe_mustcreate(&ping[0], &ping[1]);
+	pipe_mustcreate(&pong[0], &pong[1]);
+
+	/* The pinger writes ping and reads pong; the ponger the reverse. */
+	pingerv[0] = pong[0];
+	pingerv[1] = ping[1];
+	pongerv[0] = ping[0];
+	pongerv[1] = pong[1];
+
+	gettime(&s1, &n1);
+	pipe_mustfork(pipeponger, pongerv, 0);
+	pipe_mustfork(pipeponger, pingerv, 1);
+	P(pipedone);
+	P(pipedone);
+	gettime(&s2, &n2);
+	getinterval(s1, n1, s2, n2, &rs, &rn);
+
+	ns = (uint64_t)rs * 1000000000 + rn;
+	kprintf("  1-byte round trip: %llu us average over %u\n",
+		ns / PIPEBENCH_PINGS / 1000, PIPEBENCH_PINGS);
+
+	vfs_close(ping[0]);
+	vfs_close(ping[1]);
+	vfs_close(pong[0]);
+	vfs_close(pong[1]);
+}
+
+static
+void
+pipebroken(void)
+{
+	struct vnode *rd, *wr;
+	struct iovec iov;
+	struct uio ku;
+	char c = 'x';
+	int result;
+
+	pipe_mustcreate(&rd, &wr);
+	vfs_close(rd);
+
+	uio_kinit(&iov, &ku, &c, 1, 0, UIO_WRITE);
+	result = VOP_WRITE(wr, &ku);
+	if (result != EPIPE) {
+		panic("pipetest: write with no reader returned %d, "
+		      "expected EPIPE\n", result);
+	}
+	vfs_close(wr);
+}
+
+int
+pipetest(int nargs, char **args)
+{
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	pipedone = sem_create("pipedone", 0);
+	if (pipedone == NULL) {
+		panic("pipetest: sem_create failed\n");
+	}
+
+	kprintf("Starting pipe test (%u bytes per run)...\n",
+		PIPEBENCH_BYTES);
+	for (i=0; i<PIPEBENCH_NCHUNKS; i++) {
+		pipebandwidth(pipebench_chunks[i]);
+	}
+	pipelatency();
+	pipebroken();
+
+	sem_destroy(pipedone);
+	pipedone = NULL;
+	kprintf("Pipe test done.\n");
+
+	return 0;
+}
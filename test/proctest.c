@@ -0,0 +1,781 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Process table and reaping tests.
+ *
+ * pt1 creates a few thousand process structures (without threads),
+ * checks that each got a distinct pid that looks up back to it, then
+ * frees them all and checks that a fresh process doesn't immediately
+ * get back a pid that was just released. Also times the lookups.
+ *
+ * pt2 is a worker-pool supervisor: a process that starts a batch of
+ * child processes, each of which exits right away with a known code,
+ * and then reaps them all with waitpid(-1)-style waits.
+ *
+ * pt3 compares what fork and vfork spend creating a child of a process
+ * running a real program: fork copies the address space, vfork just
+ * borrows it. The exec that follows costs the same either way, so it
+ * is left out.
+ *
+ * pt4 times execv's argument marshalling (collect argv from user
+ * memory, lay it out on the new stack) for growing argument counts.
+ *
+ * pt5 pushes small writes and reads through a pipe, first one system
+ * call each and then in batches through ioring_enter, and compares the
+ * cost per operation. Both go through the syscall dispatcher with a
+ * trapframe, as from user mode, but skip the exception entry itself,
+ * so the real saving per batched call is a little larger than shown.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <proc.h>
+#include <proctable.h>
+#include <addrspace.h>
+#include <vfs.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <limits.h>
+#include <kern/syscall.h>
+#include <kern/ioring.h>
+#include <mips/trapframe.h>
+#include <test.h>
+#include "opt-A2.h"
+#include "opt-A3.h"
+
+#if OPT_A2
+
+#define NPROCTESTPROCS	2000
+
+int
+proctabletest(int nargs, char **args)
+{
+	struct proc **procs;
+	struct proc *p;
+	int i, j, n;
+	pid_t lastpid;
+	time_t s1, s2, rs;
+	uint32_t n1, n2, rn;
+
+	n = NPROCTESTPROCS;
+	if (nargs > 1) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("Usage: pt1 [nprocs]\n");
+			return EINVAL;
+		}
+	}
+
+	procs = kmalloc(n * sizeof(struct proc *));
+	if (procs == NULL) {
+		return ENOMEM;
+	}
+
+	kprintf("Starting process table test with %d processes...\n", n);
+
+	for (i=0; i<n; i++) {
+		procs[i] = maybe_proc_create("proctest");
+		if (procs[i] == NULL) {
+			kprintf("proctest: ran out after %d processes\n", i);
+			n = i;
+			break;
+		}
+	}
+
+	for (i=0; i<n; i++) {
+		if (get_proc_by_pid(procs[i]->p_pid) != procs[i]) {
+			panic("proctest: pid %d does not map back to its proc\n",
+			      procs[i]->p_pid);
+		}
+	}
+
+	gettime(&s1, &n1);
+	for (j=0; j<10; j++) {
+		for (i=0; i<n; i++) {
+			(void)get_proc_by_pid(procs[i]->p_pid);
+		}
+	}
+	gettime(&s2, &n2);
+	getinterval(s1, n1, s2, n2, &rs, &rn);
+	kprintf("%d lookups in %lu.%09lu seconds\n", 10 * n,
+		(unsigned long)rs, (unsigned long)rn);
+
+	lastpid = n > 0 ? procs[n-1]->p_pid : 0;
+	for (i=0; i<n; i++) {
+		proc_destroy(procs[i]);
+	}
+	kfree(procs);
+
+	p = maybe_proc_create("proctest");
+	if (p == NULL) {
+		panic("proctest: could not create a process after cleanup\n");
+	}
+	if (p->p_pid == lastpid) {
+		panic("proctest: pid %d reused immediately\n", lastpid);
+	}
+	proc_destroy(p);
+
+	kprintf("Process table test done.\n");
+	return 0;
+}
+
+#define NREAPTESTPROCS	500
+
+static struct semaphore *reapdone;
+
+/* Count a new process the way fork does; thread_exit uncounts it. */
+static
+void
+reaptest_count(void)
+{
+	struct ProcTable *pt = get_proctable();
+
+	lock_acquire(pt->pt_lock);
+	pt->num_running++;
+	lock_release(pt->pt_lock);
+}
+
+static
+void
+reapworker(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	curproc->p_exitcode = _MKWAIT_EXIT((int)(num % 256));
+	thread_exit();
+}
+
+static
+void
+reapsupervisor(void *junk, unsigned long n)
+{
+	struct proc *c;
+	pid_t firstpid, pid;
+	int status, result;
+	unsigned long i, reaped, sum, expected, nohang;
+	time_t s1, s2, rs;
+	uint32_t n1, n2, rn;
+
+	(void)junk;
+
+	gettime(&s1, &n1);
+
+	firstpid = 0;
+	expected = 0;
+	for (i=0; i<n; i++) {
+		c = maybe_proc_create("reapworker");
+		if (c == NULL) {
+			panic("reaptest: maybe_proc_create failed\n");
+		}
+		if (i == 0) {
+			firstpid = c->p_pid;
+		}
+		proc_addchild(curproc, c);
+		reaptest_count();
+		result = thread_fork("reapworker", c, reapworker, NULL, i);
+		if (result) {
+			panic("reaptest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		expected += i % 256;
+	}
+
+	/* Reap the first one by pid, then everything else in bulk. */
+	result = proc_waitchild(firstpid, false, &pid, &status);
+	if (result || pid != firstpid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		panic("reaptest: waiting for pid %d failed\n", firstpid);
+	}
+
+	reaped = 1;
+	sum = 0;
+	nohang = 0;
+	while (reaped < n) {
+		/* Take whatever has finished, then block for the rest. */
+		result = proc_waitchild(-1, true, &pid, &status);
+		if (result == 0 && pid == 0) {
+			nohang++;
+			result = proc_waitchild(-1, false, &pid, &status);
+		}
+		if (result) {
+			panic("reaptest: wait failed after %lu: %s\n",
+			      reaped, strerror(result));
+		}
+		sum += WEXITSTATUS(status);
+		reaped++;
+	}
+
+	gettime(&s2, &n2);
+
+	if (sum != expected) {
+		panic("reaptest: exit codes add up to %lu, not %lu\n",
+		      sum, expected);
+	}
+	if (proc_waitchild(-1, true, &pid, &status) != ECHILD) {
+		panic("reaptest: children left over\n");
+	}
+
+	getinterval(s1, n1, s2, n2, &rs, &rn);
+	kprintf("Started and reaped %lu processes in %lu.%09lu seconds "
+		"(%lu waits found nothing ready)\n", n,
+		(unsigned long)rs, (unsigned long)rn, nohang);
+
+	V(reapdone);
+	thread_exit();
+}
+
+int
+reaptest(int nargs, char **args)
+{
+	struct proc *sup;
+	int n, result;
+
+	n = NREAPTESTPROCS;
+	if (nargs > 1) {
+		n = atoi(args[1]);
+		if (n <= 0) {
+			kprintf("Usage: pt2 [nprocs]\n");
+			return EINVAL;
+		}
+	}
+
+	reapdone = sem_create("reapdone", 0);
+	if (reapdone == NULL) {
+		return ENOMEM;
+	}
+
+	sup = maybe_proc_create("reapsupervisor");
+	if (sup == NULL) {
+		sem_destroy(reapdone);
+		return ENOMEM;
+	}
+	reaptest_count();
+
+	kprintf("Starting reaping test with %d processes...\n", n);
+	result = thread_fork("reapsupervisor", sup, reapsupervisor, NULL, n);
+	if (result) {
+		panic("reaptest: thread_fork failed: %s\n", strerror(result));
+	}
+	P(reapdone);
+	sem_destroy(reapdone);
+	reapdone = NULL;
+
+	kprintf("Reaping test done.\n");
+	return 0;
+}
+
+#define NSPAWNBENCHLOOPS	100
+
+static
+void
+spawnbench_report(const char *what, int n,
+		  time_t s1, uint32_t n1, time_t s2, uint32_t n2)
+{
+	time_t rs;
+	uint32_t rn;
+	uint64_t ns;
+
+	getinterval(s1, n1, s2, n2, &rs, &rn);
+	ns = (uint64_t)rs * 1000000000 + rn;
+	kprintf("  %-6s %d children in %lu.%09lu seconds, %llu us each\n",
+		what, n, (unsigned long)rs, (unsigned long)rn,
+		ns / n / 1000);
+}
+
+/*
+ * Turn the current (kernel-created) process into one running PROGNAME,
+ * up to the point of entry: address space loaded and stack defined.
+ */
+static
+void
+benchproc_load(char *progname, vaddr_t *stackptr)
+{
+	struct addrspace *as;
+	struct vnode *v;
+	vaddr_t entrypoint;
+	int result;
+
+	result = vfs_open(progname, O_RDONLY, 0, &v);
+	if (result) {
+		panic("benchproc: %s: %s\n", progname, strerror(result));
+	}
+#if OPT_A3
+	as = as_create(progname);
+#else
+	as = as_create();
+#endif
+	if (as == NULL) {
+		panic("benchproc: as_create failed\n");
+	}
+	curproc_setas(as);
+	as_activate();
+	result = load_elf(v, &entrypoint);
+	vfs_close(v);
+	if (result) {
+		panic("benchproc: load_elf: %s\n", strerror(result));
+	}
+	result = as_define_stack(as, stackptr);
+	if (result) {
+		panic("benchproc: as_define_stack: %s\n", strerror(result));
+	}
+}
+
+/*
+ * Run FUNC(PROGNAME, N) in a new process and wait for it, for
+ * benchmarks that need a user address space. FUNC must V(reapdone)
+ * and exit.
+ */
+static
+int
+benchproc_run(const char *what, char *progname, unsigned long n,
+	      void (*func)(void *, unsigned long))
+{
+	struct proc *p;
+	int result;
+
+	/* vfs_open eats its argument, so give it a copy. */
+	progname = kstrdup(progname);
+	if (progname == NULL) {
+		return ENOMEM;
+	}
+	reapdone = sem_create(what, 0);
+	if (reapdone == NULL) {
+		kfree(progname);
+		return ENOMEM;
+	}
+	p = proc_create_runprogram(what);
+	if (p == NULL) {
+		sem_destroy(reapdone);
+		kfree(progname);
+		return ENOMEM;
+	}
+	reaptest_count();
+
+	result = thread_fork(what, p, func, progname, n);
+	if (result) {
+		panic("%s: thread_fork failed: %s\n", what, strerror(result));
+	}
+	P(reapdone);
+	sem_destroy(reapdone);
+	reapdone = NULL;
+	return 0;
+}
+
+static
+void
+spawnbenchthread(void *progname, unsigned long n)
+{
+	struct proc *c;
+	vaddr_t stackptr;
+	time_t s1, s2;
+	uint32_t n1, n2;
+	unsigned long i;
+	int result;
+
+	benchproc_load(progname, &stackptr);
+
+	/* fork: each child gets its own copy of the address space. */
+	gettime(&s1, &n1);
+	for (i=0; i<n; i++) {
+		c = maybe_proc_create("spawnchild");
+		if (c == NULL) {
+			panic("spawnbench: maybe_proc_create failed\n");
+		}
+		result = proc_duplicate(curproc, c);
+		if (result) {
+			panic("spawnbench: proc_duplicate: %s\n",
+			      strerror(result));
+		}
+		as_destroy(c->p_addrspace);
+		c->p_addrspace = NULL;
+		proc_destroy(c);
+	}
+	gettime(&s2, &n2);
+	spawnbench_report("fork", n, s1, n1, s2, n2);
+
+	/* vfork: each child borrows ours. */
+	gettime(&s1, &n1);
+	for (i=0; i<n; i++) {
+		c = maybe_proc_create("spawnchild");
+		if (c == NULL) {
+			panic("spawnbench: maybe_proc_create failed\n");
+		}
+		result = proc_share(curproc, c);
+		if (result) {
+			panic("spawnbench: proc_share: %s\n",
+			      strerror(result));
+		}
+		proc_destroy(c);
+	}
+	gettime(&s2, &n2);
+	spawnbench_report("vfork", n, s1, n1, s2, n2);
+
+	kfree(progname);
+	V(reapdone);
+	thread_exit();
+}
+
+int
+spawnbench(int nargs, char **args)
+{
+	int n, result;
+
+	if (nargs < 2 || nargs > 3) {
+		kprintf("Usage: pt3 program [count]\n");
+		return EINVAL;
+	}
+	n = NSPAWNBENCHLOOPS;
+	if (nargs > 2) {
+		n = atoi(args[2]);
+		if (n <= 0) {
+			kprintf("Usage: pt3 program [count]\n");
+			return EINVAL;
+		}
+	}
+
+	kprintf("Starting spawn benchmark with %s...\n", args[1]);
+	result = benchproc_run("spawnbench", args[1], n, spawnbenchthread);
+	if (result) {
+		return result;
+	}
+
+	kprintf("Spawn benchmark done.\n");
+	return 0;
+}
+
+#define NEXECARGLOOPS	50
+#define EXECARGMAX	1024
+
+/*
+ * Build a user-level argv of N short strings just below *STACKPTR, as
+ * a program about to call execv would have, and move *STACKPTR below
+ * it. Returns the user address of the argv array.
+ */
+static
+userptr_t
+execargbench_setup(unsigned long n, vaddr_t *stackptr)
+{
+	char str[16];
+	userptr_t *argv;
+	unsigned long i;
+	size_t len;
+	int result;
+
+	argv = kmalloc((n + 1) * sizeof(userptr_t));
+	if (argv == NULL) {
+		panic("execargbench: out of memory\n");
+	}
+	for (i=0; i<n; i++) {
+		snprintf(str, sizeof(str), "arg%lu", i);
+		len = strlen(str) + 1;
+		*stackptr -= len;
+		result = copyout(str, (userptr_t)*stackptr, len);
+		if (result) {
+			panic("execargbench: copyout: %s\n", strerror(result));
+		}
+		argv[i] = (userptr_t)*stackptr;
+	}
+	argv[n] = NULL;
+	*stackptr = (*stackptr - (n + 1) * sizeof(userptr_t)) & ~(vaddr_t)7;
+	result = copyout(argv, (userptr_t)*stackptr,
+			 (n + 1) * sizeof(userptr_t));
+	if (result) {
+		panic("execargbench: copyout: %s\n", strerror(result));
+	}
+	kfree(argv);
+	return (userptr_t)*stackptr;
+}
+
+static
+void
+execargbenchthread(void *progname, unsigned long junk)
+{
+	static const unsigned long counts[] = { 1, 16, 64, 256, EXECARGMAX };
+	char *kbuf;
+	vaddr_t stacktop, sp, newsp;
+	userptr_t uargv, newargv;
+	unsigned long c, i;
+	int argc, result;
+	size_t len;
+	time_t s1, s2, rs;
+	uint32_t n1, n2, rn;
+	uint64_t ns;
+
+	(void)junk;
+
+	benchproc_load(progname, &stacktop);
+	kbuf = kmalloc(ARG_MAX);
+	if (kbuf == NULL) {
+		panic("execargbench: out of memory\n");
+	}
+
+	for (c=0; c<sizeof(counts)/sizeof(counts[0]); c++) {
+		sp = stacktop;
+		uargv = execargbench_setup(counts[c], &sp);
+
+		gettime(&s1, &n1);
+		for (i=0; i<NEXECARGLOOPS; i++) {
+			result = execv_copyinargs(uargv, kbuf, &argc, &len);
+			if (result) {
+				panic("execargbench: copyin: %s\n",
+				      strerror(result));
+			}
+			newsp = sp;
+			result = execv_copyoutargs(kbuf, argc, len, &newsp,
+						   &newargv);
+			if (result) {
+				panic("execargbench: copyout: %s\n",
+				      strerror(result));
+			}
+		}
+		gettime(&s2, &n2);
+
+		if ((unsigned long)argc != counts[c]) {
+			panic("execargbench: got %d args, not %lu\n",
+			      argc, counts[c]);
+		}
+		getinterval(s1, n1, s2, n2, &rs, &rn);
+		ns = (uint64_t)rs * 1000000000 + rn;
+		kprintf("  %4lu args (%5u bytes): %llu us per exec\n",
+			counts[c], (unsigned)len, ns / NEXECARGLOOPS / 1000);
+	}
+
+	kfree(kbuf);
+	kfree(progname);
+	V(reapdone);
+	thread_exit();
+}
+
+int
+execargbench(int nargs, char **args)
+{
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: pt4 program\n");
+		return EINVAL;
+	}
+
+	kprintf("Starting execv argument benchmark...\n");
+	result = benchproc_run("execargbench", args[1], 0,
+			       execargbenchthread);
+	if (result) {
+		return result;
+	}
+	kprintf("Execv argument benchmark done.\n");
+	return 0;
+}
+
+#define IORINGBENCH_OPS		8192
+#define IORINGBENCH_ENTRIES	64
+#define IORINGBENCH_MSG		64
+
+/*
+ * Make system call CALLNO with the given arguments through the
+ * dispatcher and return its result; any error is fatal.
+ */
+static
+int32_t
+ioringbench_call(struct trapframe *tf, int callno, uint32_t a0, uint32_t a1,
+		 uint32_t a2)
+{
+	tf->tf_v0 = callno;
+	tf->tf_a0 = a0;
+	tf->tf_a1 = a1;
+	tf->tf_a2 = a2;
+	syscall(tf);
+	if (tf->tf_a3 != 0) {
+		panic("ioringbench: syscall %d: %s\n", callno,
+		      strerror(tf->tf_v0));
+	}
+	return tf->tf_v0;
+}
+
+static
+void
+ioringbench_report(const char *what, time_t s1, uint32_t n1,
+		   time_t s2, uint32_t n2)
+{
+	time_t rs;
+	uint32_t rn;
+	uint64_t ns;
+
+	getinterval(s1, n1, s2, n2, &rs, &rn);
+	ns = (uint64_t)rs * 1000000000 + rn;
+	kprintf("  %-12s %llu ns per operation\n", what,
+		ns / IORINGBENCH_OPS);
+}
+
+static
+void
+ioringbenchthread(void *progname, unsigned long junk)
+{
+	struct trapframe tf;
+	struct ioring ring;
+	struct ioring_sqe *sqes;
+	struct ioring_cqe *cqes;
+	vaddr_t sp;
+	userptr_t ufds, ubuf, usqes, ucqes, uring;
+	int fds[2];
+	unsigned i, j;
+	int result;
+	time_t s1, s2;
+	uint32_t n1, n2;
+
+	(void)junk;
+
+	benchproc_load(progname, &sp);
+	bzero(&tf, sizeof(tf));
+
+	/* Carve what a user program would have out of its stack. */
+	sp -= sizeof(fds);
+	ufds = (userptr_t)sp;
+	sp -= IORINGBENCH_MSG;
+	ubuf = (userptr_t)sp;
+	sp = (sp - IORINGBENCH_ENTRIES * sizeof(*sqes)) & ~(vaddr_t)7;
+	usqes = (userptr_t)sp;
+	sp = (sp - IORINGBENCH_ENTRIES * sizeof(*cqes)) & ~(vaddr_t)7;
+	ucqes = (userptr_t)sp;
+	sp = (sp - sizeof(ring)) & ~(vaddr_t)7;
+	uring = (userptr_t)sp;
+
+	ioringbench_call(&tf, SYS_pipe, (uint32_t)ufds, 0, 0);
+	result = copyin((const_userptr_t)ufds, fds, sizeof(fds));
+	if (result) {
+		panic("ioringbench: copyin: %s\n", strerror(result));
+	}
+
+	/* One system call per write and per read. */
+	gettime(&s1, &n1);
+	for (i=0; i<IORINGBENCH_OPS; i+=2) {
+		if (ioringbench_call(&tf, SYS_write, fds[1], (uint32_t)ubuf,
+				     IORINGBENCH_MSG) != IORINGBENCH_MSG ||
+		    ioringbench_call(&tf, SYS_read, fds[0], (uint32_t)ubuf,
+				     IORINGBENCH_MSG) != IORINGBENCH_MSG) {
+			panic("ioringbench: short transfer\n");
+		}
+	}
+	gettime(&s2, &n2);
+	ioringbench_report("syscalls:", s1, n1, s2, n2);
+
+	/* The same write/read pairs, a ringful per ioring_enter. */
+	sqes = kmalloc(IORINGBENCH_ENTRIES * sizeof(*sqes));
+	cqes = kmalloc(IORINGBENCH_ENTRIES * sizeof(*cqes));
+	if (sqes == NULL || cqes == NULL) {
+		panic("ioringbench: out of memory\n");
+	}
+	bzero(sqes, IORINGBENCH_ENTRIES * sizeof(*sqes));
+	for (i=0; i<IORINGBENCH_ENTRIES; i++) {
+		sqes[i].sqe_op = (i % 2) ? IORING_OP_READ : IORING_OP_WRITE;
+		sqes[i].sqe_fd = fds[(i % 2) ? 0 : 1];
+		sqes[i].sqe_len = IORINGBENCH_MSG;
+		sqes[i].sqe_addr = ubuf;
+		sqes[i].sqe_data = i;
+	}
+	result = copyout(sqes, usqes, IORINGBENCH_ENTRIES * sizeof(*sqes));
+	if (result) {
+		panic("ioringbench: copyout: %s\n", strerror(result));
+	}
+	bzero(&ring, sizeof(ring));
+	ring.ir_sqmask = ring.ir_cqmask = IORINGBENCH_ENTRIES - 1;
+	ring.ir_sqes = usqes;
+	ring.ir_cqes = ucqes;
+
+	gettime(&s1, &n1);
+	for (i=0; i<IORINGBENCH_OPS; i+=IORINGBENCH_ENTRIES) {
+		/* Queue a ringful; the previous one has been consumed. */
+		ring.ir_sqtail += IORINGBENCH_ENTRIES;
+		ring.ir_cqhead = ring.ir_cqtail;
+		result = copyout(&ring, uring, sizeof(ring));
+		if (result) {
+			panic("ioringbench: copyout: %s\n", strerror(result));
+		}
+		if (ioringbench_call(&tf, SYS_ioring_enter, (uint32_t)uring,
+				     IORINGBENCH_ENTRIES, 0)
+		    != IORINGBENCH_ENTRIES) {
+			panic("ioringbench: short submission\n");
+		}
+		result = copyin((const_userptr_t)uring, &ring, sizeof(ring));
+		if (result == 0) {
+			result = copyin((const_userptr_t)ucqes, cqes,
+					IORINGBENCH_ENTRIES * sizeof(*cqes));
+		}
+		if (result) {
+			panic("ioringbench: copyin: %s\n", strerror(result));
+		}
+		for (j=0; j<IORINGBENCH_ENTRIES; j++) {
+			if (cqes[j].cqe_data != j ||
+			    cqes[j].cqe_res != IORINGBENCH_MSG) {
+				panic("ioringbench: completion %u: %d\n",
+				      j, cqes[j].cqe_res);
+			}
+		}
+	}
+	gettime(&s2, &n2);
+	ioringbench_report("ioring:", s1, n1, s2, n2);
+
+	ioringbench_call(&tf, SYS_close, fds[0], 0, 0);
+	ioringbench_call(&tf, SYS_close, fds[1], 0, 0);
+
+	kfree(sqes);
+	kfree(cqes);
+	kfree(progname);
+	V(reapdone);
+	thread_exit();
+}
+
+int
+ioringbench(int nargs, char **args)
+{
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: pt5 program\n");
+		return EINVAL;
+	}
+
+	kprintf("Starting batched syscall benchmark (%u x %u-byte "
+		"pipe ops)...\n", IORINGBENCH_OPS, IORINGBENCH_MSG);
+	result = benchproc_run("ioringbench", args[1], 0, ioringbenchthread);
+	if (result) {
+		return result;
+	}
+	kprintf("Batched syscall benchmark done.\n");
+	return 0;
+}
+
+#endif /* OPT_A2 */
@@ -32,9 +32,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
+#include <cpu.h>
+#include <current.h>
 #include <synch.h>
 #include <test.h>
 
@@ -343,3 +346,445 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Lock contention microbenchmark.
+ *
+ * A handful of threads hammer a single lock with a very short
+ * critical section, which is the case the adaptive (spin-then-block)
+ * lock is meant for. Reports the elapsed time and the average cost
+ * of an acquire/release pair, and checks that no increments were lost.
+ */
+
+#define NLOCKBENCHTHREADS  8
+#define NLOCKBENCHLOOPS    5000
+
+static volatile unsigned long benchcount;
+
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	int i;
+	volatile int j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NLOCKBENCHLOOPS; i++) {
+		lock_acquire(testlock);
+		benchcount++;
+		lock_release(testlock);
+
+		/* a little work outside the lock */
+		for (j=0; j<20; j++);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	int i, result, nthreads;
+	time_t secs1, secs2, secs;
+	uint32_t nsecs1, nsecs2, nsecs;
+	uint64_t totalns, ops;
+
+	nthreads = NLOCKBENCHTHREADS;
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+		if (nthreads <= 0) {
+			kprintf("Usage: sy4 [nthreads]\n");
+			return EINVAL;
+		}
+	}
+
+	inititems();
+	kprintf("Starting lock benchmark: %d threads, %d loops each...\n",
+		nthreads, NLOCKBENCHLOOPS);
+
+	benchcount = 0;
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("lockbench", NULL, lockbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(donesem);
+	}
+	gettime(&secs2, &nsecs2);
+
+	ops = (uint64_t)nthreads * NLOCKBENCHLOOPS;
+	if (benchcount != ops) {
+		panic("lockbench: lost updates: count %lu, expected %llu\n",
+		      benchcount, (unsigned long long)ops);
+	}
+
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs, &nsecs);
+	totalns = (uint64_t)secs * 1000000000 + nsecs;
+	kprintf("%llu lock/unlock pairs in %lu.%09lu seconds "
+		"(%llu ns each)\n", (unsigned long long)ops,
+		(unsigned long)secs, (unsigned long)nsecs,
+		(unsigned long long)(totalns / ops));
+
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("Lock benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Reader-writer lock tests.
+ *
+ * rwtest: a mix of reader and writer threads. Writers update a pair
+ * of values that must always agree and check that no reader and no
+ * other writer is inside with them; readers check that the pair is
+ * consistent and that no writer is inside.
+ *
+ * rwbench: the same lock used read-mostly (one write in RWBENCHWRITEPCT
+ * percent of operations) compared against a plain lock doing the
+ * same work, to show what concurrent readers buy us.
+ */
+
+#define NRWTHREADS      16
+#define NRWLOOPS        200
+#define NRWBENCHLOOPS   2000
+#define RWBENCHWRITEPCT 5
+
+static struct rwlock *testrwlock;
+static volatile unsigned long rwval1, rwval2;
+static volatile unsigned rwreaders, rwwriters;
+static struct spinlock rwcountlock = SPINLOCK_INITIALIZER;
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	volatile int j;
+	bool writer = (num % 4 == 0);
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (writer) {
+			rwlock_acquire_write(testrwlock);
+			spinlock_acquire(&rwcountlock);
+			rwwriters++;
+			if (rwwriters != 1 || rwreaders != 0) {
+				panic("rwtest: writer %lu shares the lock "
+				      "(%u writers, %u readers)\n",
+				      num, rwwriters, rwreaders);
+			}
+			spinlock_release(&rwcountlock);
+
+			rwval1 = num * i;
+			for (j=0; j<50; j++);
+			rwval2 = num * i;
+
+			spinlock_acquire(&rwcountlock);
+			rwwriters--;
+			spinlock_release(&rwcountlock);
+			rwlock_release_write(testrwlock);
+		}
+		else {
+			rwlock_acquire_read(testrwlock);
+			spinlock_acquire(&rwcountlock);
+			rwreaders++;
+			if (rwwriters != 0) {
+				panic("rwtest: reader %lu inside with a "
+				      "writer\n", num);
+			}
+			spinlock_release(&rwcountlock);
+
+			if (rwval1 != rwval2) {
+				panic("rwtest: reader %lu saw a torn "
+				      "update\n", num);
+			}
+			for (j=0; j<50; j++);
+			if (rwval1 != rwval2) {
+				panic("rwtest: reader %lu saw a torn "
+				      "update\n", num);
+			}
+
+			spinlock_acquire(&rwcountlock);
+			rwreaders--;
+			spinlock_release(&rwcountlock);
+			rwlock_release_read(testrwlock);
+		}
+		if (i % 16 == 0) {
+			thread_yield();
+		}
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrwlock = rwlock_create("testrwlock");
+	if (testrwlock == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	rwval1 = rwval2 = 0;
+	rwreaders = rwwriters = 0;
+
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NRWTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NRWTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+static
+void
+rwbenchthread(void *junk, unsigned long num)
+{
+	bool userw = (junk != NULL);
+	int i;
+	volatile int j;
+	unsigned long v;
+
+	for (i=0; i<NRWBENCHLOOPS; i++) {
+		bool write = ((num + i) % 100) < RWBENCHWRITEPCT;
+
+		if (userw) {
+			if (write) {
+				rwlock_acquire_write(testrwlock);
+				rwval1++;
+				rwlock_release_write(testrwlock);
+			}
+			else {
+				rwlock_acquire_read(testrwlock);
+				v = rwval1;
+				for (j=0; j<20; j++);
+				(void)v;
+				rwlock_release_read(testrwlock);
+			}
+		}
+		else {
+			lock_acquire(testlock);
+			if (write) {
+				rwval1++;
+			}
+			else {
+				v = rwval1;
+				for (j=0; j<20; j++);
+				(void)v;
+			}
+			lock_release(testlock);
+		}
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+void
+rwbench_run(const char *what, bool userw)
+{
+	int i, result;
+	time_t secs1, secs2, secs;
+	uint32_t nsecs1, nsecs2, nsecs;
+
+	rwval1 = 0;
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<NRWTHREADS; i++) {
+		result = thread_fork("rwbench", NULL, rwbenchthread,
+				     userw ? (void *)testrwlock : NULL, i);
+		if (result) {
+			panic("rwbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NRWTHREADS; i++) {
+		P(donesem);
+	}
+	gettime(&secs2, &nsecs2);
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs, &nsecs);
+
+	kprintf("%-8s %d threads x %d ops: %lu.%09lu seconds\n", what,
+		NRWTHREADS, NRWBENCHLOOPS,
+		(unsigned long)secs, (unsigned long)nsecs);
+}
+
+int
+rwbench(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrwlock = rwlock_create("testrwlock");
+	if (testrwlock == NULL) {
+		panic("rwbench: rwlock_create failed\n");
+	}
+
+	kprintf("Starting rwlock benchmark (%d%% writes)...\n",
+		RWBENCHWRITEPCT);
+	rwbench_run("lock", false);
+	rwbench_run("rwlock", true);
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("Rwlock benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Spinlock throughput and fairness benchmark.
+ *
+ * Threads take and drop one shared spinlock as fast as they can for
+ * about a second, keeping count of how many times each thread and
+ * each CPU got it. Total acquisitions give throughput; the spread
+ * between the luckiest and unluckiest thread shows fairness. Run it
+ * with different numbers of CPUs in sys161.conf to see how both
+ * behave as CPUs are added.
+ */
+
+#define NSPINBENCHTHREADS  8
+#define SPINBENCHMAXCPUS   32
+
+static struct spinlock benchspin = SPINLOCK_INITIALIZER;
+static volatile bool spinbench_stop;
+static volatile unsigned long spinbench_cpucount[SPINBENCHMAXCPUS];
+
+static
+void
+spinbenchthread(void *countp, unsigned long num)
+{
+	volatile unsigned long *count = countp;
+	unsigned cpunum;
+	volatile int j;
+
+	while (!spinbench_stop) {
+		spinlock_acquire(&benchspin);
+		count[num]++;
+		cpunum = curcpu->c_number;
+		if (cpunum < SPINBENCHMAXCPUS) {
+			spinbench_cpucount[cpunum]++;
+		}
+		for (j=0; j<10; j++);
+		spinlock_release(&benchspin);
+
+		for (j=0; j<10; j++);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+spinbench(int nargs, char **args)
+{
+	int i, result, nthreads;
+	unsigned long *count;
+	unsigned long total, min, max;
+
+	nthreads = NSPINBENCHTHREADS;
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+		if (nthreads <= 0) {
+			kprintf("Usage: sy7 [nthreads]\n");
+			return EINVAL;
+		}
+	}
+
+	count = kmalloc(nthreads * sizeof(unsigned long));
+	if (count == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<nthreads; i++) {
+		count[i] = 0;
+	}
+	for (i=0; i<SPINBENCHMAXCPUS; i++) {
+		spinbench_cpucount[i] = 0;
+	}
+
+	inititems();
+	kprintf("Starting spinlock benchmark: %d threads for 1 second...\n",
+		nthreads);
+
+	spinbench_stop = false;
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinbench", NULL, spinbenchthread,
+				     count, i);
+		if (result) {
+			panic("spinbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	clocksleep(1);
+	spinbench_stop = true;
+	for (i=0; i<nthreads; i++) {
+		P(donesem);
+	}
+
+	total = 0;
+	min = max = count[0];
+	for (i=0; i<nthreads; i++) {
+		total += count[i];
+		if (count[i] < min) {
+			min = count[i];
+		}
+		if (count[i] > max) {
+			max = count[i];
+		}
+	}
+	kprintf("%lu acquisitions/sec; per thread min %lu max %lu\n",
+		total, min, max);
+	for (i=0; i<SPINBENCHMAXCPUS; i++) {
+		if (spinbench_cpucount[i] > 0) {
+			kprintf("  cpu%d: %lu\n", i, spinbench_cpucount[i]);
+		}
+	}
+
+	kfree(count);
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("Spinlock benchmark done.\n");
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timer wheel and clocksleep test.
+ *
+ * A bunch of threads each sleep for a different sub-second interval a
+ * few times and measure how long they actually slept. Nobody may wake
+ * up more than a tick early; the report shows how late they were.
+ * Then a few timeouts are armed and some cancelled, to check that
+ * cancelled ones never fire and the others fire exactly once.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <timeout.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define NTIMERTHREADS	8
+#define NTIMERLOOPS	5
+#define NTIMEOUTS	16
+
+static struct semaphore *timerdone;
+static volatile unsigned timer_fired[NTIMEOUTS];
+
+/* Worst oversleep seen by each thread, in nanoseconds. */
+static uint64_t timer_late[NTIMERTHREADS];
+
+static
+uint64_t
+timer_ns(time_t secs, uint32_t nsecs)
+{
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+static
+void
+timerthread(void *junk, unsigned long num)
+{
+	time_t s1, s2, rs;
+	uint32_t n1, n2, rn;
+	uint32_t want;
+	uint64_t got;
+	int i;
+
+	(void)junk;
+
+	/* Thread n sleeps (n+1) * 15ms: a mix of whole and partial ticks. */
+	want = (num + 1) * 15000000;
+	timer_late[num] = 0;
+
+	for (i=0; i<NTIMERLOOPS; i++) {
+		gettime(&s1, &n1);
+		clocksleep_nsecs(0, want);
+		gettime(&s2, &n2);
+		getinterval(s1, n1, s2, n2, &rs, &rn);
+
+		got = timer_ns(rs, rn);
+		if (got + 1000000000 / HZ < want) {
+			panic("timertest: thread %lu slept %llu ns, "
+			      "wanted %u\n", num, got, want);
+		}
+		if (got > want && got - want > timer_late[num]) {
+			timer_late[num] = got - want;
+		}
+	}
+
+	V(timerdone);
+}
+
+static
+void
+timerfire(void *data)
+{
+	unsigned num = (uintptr_t)data;
+
+	timer_fired[num]++;
+}
+
+int
+timertest(int nargs, char **args)
+{
+	struct timeout to[NTIMEOUTS];
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	timerdone = sem_create("timerdone", 0);
+	if (timerdone == NULL) {
+		panic("timertest: sem_create failed\n");
+	}
+
+	kprintf("Starting timer test...\n");
+
+	for (i=0; i<NTIMERTHREADS; i++) {
+		result = thread_fork("timertest", NULL, timerthread,
+				     NULL, i);
+		if (result) {
+			panic("timertest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTIMERTHREADS; i++) {
+		P(timerdone);
+	}
+	for (i=0; i<NTIMERTHREADS; i++) {
+		kprintf("  sleep %3u ms: worst oversleep %llu us\n",
+			(i + 1) * 15, timer_late[i] / 1000);
+	}
+
+	/* Odd-numbered timeouts get cancelled before they can fire. */
+	for (i=0; i<NTIMEOUTS; i++) {
+		timer_fired[i] = 0;
+		timeout_init(&to[i], timerfire, (void *)(uintptr_t)i);
+		timeout_arm(&to[i], (i % 2) ? HZ : i + 1);
+	}
+	for (i=1; i<NTIMEOUTS; i+=2) {
+		if (!timeout_cancel(&to[i])) {
+			panic("timertest: timeout %u fired early\n", i);
+		}
+	}
+	clocksleep(2);
+	for (i=0; i<NTIMEOUTS; i++) {
+		if (timeout_pending(&to[i])) {
+			panic("timertest: timeout %u still pending\n", i);
+		}
+		if (timer_fired[i] != ((i % 2) ? 0 : 1)) {
+			panic("timertest: timeout %u fired %u times\n",
+			      i, timer_fired[i]);
+		}
+	}
+
+	sem_destroy(timerdone);
+	timerdone = NULL;
+	kprintf("Timer test done.\n");
+
+	return 0;
+}
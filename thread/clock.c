@@ -32,15 +32,15 @@
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
+#include <timeout.h>
 #include <thread.h>
 #include <current.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Callbacks scheduled at specific points in the future are handled
+ * by the per-cpu timer wheels in timeout.c, which hardclock() drives.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -54,20 +54,17 @@
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Largest number of ticks handed to a single timeout_arm.
  */
-static struct wchan *lbolt;
+#define CLOCKSLEEP_MAXTICKS	0x7fffffff
 
 /*
- * Setup.
+ * Setup. The timer wheels themselves are set up with each cpu in
+ * cpu_create, so there is nothing left to do here.
  */
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
-	}
 }
 
 /*
@@ -77,8 +74,7 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	wchan_wakeall(lbolt);
+	/* Nothing to do; sleepers use timeouts now. */
 }
 
 /*
@@ -93,6 +89,18 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+
+	/* Charge the tick to whoever it interrupted, unless we were idle. */
+	if (!curcpu->c_isidle) {
+		if (curthread->t_intruser) {
+			curthread->t_usage.u_uticks++;
+		}
+		else {
+			curthread->t_usage.u_sticks++;
+		}
+	}
+
+	timerwheel_tick();
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
@@ -102,15 +110,69 @@ hardclock(void)
 	thread_yield();
 }
 
+/*
+ * Timeout callback for clocksleep: wake the sleeping thread.
+ */
+static
+void
+clocksleep_wakeup(void *data)
+{
+	struct thread *t = data;
+
+	wchan_wakeone(t->t_sleepchan);
+}
+
+/*
+ * Suspend execution for the given number of hardclock ticks.
+ *
+ * The channel is locked before the timeout is armed, so the wakeup
+ * cannot happen until we are actually asleep on it. The timeout
+ * lives on our stack; that's safe because the wheel is done with it
+ * before the callback wakes us.
+ */
+void
+clocksleep_ticks(uint64_t ticks)
+{
+	struct timeout to;
+	unsigned chunk;
+
+	KASSERT(!curthread->t_in_interrupt);
+
+	timeout_init(&to, clocksleep_wakeup, curthread);
+	while (ticks > 0) {
+		chunk = ticks > CLOCKSLEEP_MAXTICKS ?
+			CLOCKSLEEP_MAXTICKS : (unsigned)ticks;
+		wchan_lock(curthread->t_sleepchan);
+		timeout_arm(&to, chunk);
+		wchan_sleep(curthread->t_sleepchan);
+		ticks -= chunk;
+	}
+}
+
+/*
+ * Suspend execution for n seconds plus m nanoseconds, rounded up to
+ * whole ticks.
+ */
+void
+clocksleep_nsecs(time_t secs, uint32_t nsecs)
+{
+	uint64_t ticks;
+
+	KASSERT(secs >= 0);
+	KASSERT(nsecs < 1000000000);
+
+	ticks = (uint64_t)secs * HZ;
+	ticks += ((uint64_t)nsecs * HZ + 999999999) / 1000000000;
+	clocksleep_ticks(ticks);
+}
+
 /*
  * Suspend execution for n seconds.
  */
 void
 clocksleep(int num_secs)
 {
-	while (num_secs > 0) {
-		wchan_lock(lbolt);
-		wchan_sleep(lbolt);
-		num_secs--;
+	if (num_secs > 0) {
+		clocksleep_ticks((uint64_t)num_secs * HZ);
 	}
 }
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+volatile bool lockstat_enabled = false;
+
+/*
+ * The table of records. Entries are handed out in order and never
+ * freed, so a record pointer stays valid forever; lockstat_count is
+ * the number in use. None of the spinlocks here are named, so none
+ * of them are themselves instrumented.
+ */
+static struct lockstat lockstat_table[LOCKSTAT_MAX];
+static unsigned lockstat_count;
+static struct spinlock lockstat_tablelock = SPINLOCK_INITIALIZER;
+
+void
+lockstat_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_MAX; i++) {
+		spinlock_init(&lockstat_table[i].ls_lock);
+	}
+	lockstat_count = 0;
+	lockstat_enabled = true;
+}
+
+uint64_t
+lockstat_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+struct lockstat *
+lockstat_get(const char *name, int kind)
+{
+	struct lockstat *ls = NULL;
+	char key[LOCKSTAT_NAMELEN];
+	unsigned i;
+
+	if (!lockstat_enabled || name == NULL) {
+		return NULL;
+	}
+
+	/* Records are matched on the (possibly truncated) stored name. */
+	for (i=0; i<LOCKSTAT_NAMELEN-1 && name[i] != 0; i++) {
+		key[i] = name[i];
+	}
+	key[i] = 0;
+
+	spinlock_acquire(&lockstat_tablelock);
+	for (i=0; i<lockstat_count; i++) {
+		if (lockstat_table[i].ls_kind == kind &&
+		    !strcmp(lockstat_table[i].ls_name, key)) {
+			ls = &lockstat_table[i];
+			break;
+		}
+	}
+	if (ls == NULL && lockstat_count < LOCKSTAT_MAX) {
+		ls = &lockstat_table[lockstat_count++];
+		strcpy(ls->ls_name, key);
+		ls->ls_kind = kind;
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_waitns = 0;
+		ls->ls_maxwaitns = 0;
+		ls->ls_holdns = 0;
+	}
+	spinlock_release(&lockstat_tablelock);
+
+	return ls;
+}
+
+void
+lockstat_acquired(struct lockstat *ls, uint64_t waitstart, uint64_t now)
+{
+	uint64_t wait;
+
+	spinlock_acquire(&ls->ls_lock);
+	ls->ls_acquires++;
+	if (waitstart != 0) {
+		wait = now - waitstart;
+		ls->ls_contended++;
+		ls->ls_waitns += wait;
+		if (wait > ls->ls_maxwaitns) {
+			ls->ls_maxwaitns = wait;
+		}
+	}
+	spinlock_release(&ls->ls_lock);
+}
+
+void
+lockstat_released(struct lockstat *ls, uint64_t acqtime)
+{
+	uint64_t now;
+
+	now = lockstat_now();
+	spinlock_acquire(&ls->ls_lock);
+	ls->ls_holdns += now - acqtime;
+	spinlock_release(&ls->ls_lock);
+}
+
+void
+lockstat_reset(void)
+{
+	unsigned i;
+	struct lockstat *ls;
+
+	spinlock_acquire(&lockstat_tablelock);
+	for (i=0; i<lockstat_count; i++) {
+		ls = &lockstat_table[i];
+		spinlock_acquire(&ls->ls_lock);
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_waitns = 0;
+		ls->ls_maxwaitns = 0;
+		ls->ls_holdns = 0;
+		spinlock_release(&ls->ls_lock);
+	}
+	spinlock_release(&lockstat_tablelock);
+}
+
+/*
+ * Sort order for the report: most contended first, then most time
+ * spent waiting.
+ */
+static
+bool
+lockstat_worse(const struct lockstat *a, const struct lockstat *b)
+{
+	if (a->ls_contended != b->ls_contended) {
+		return a->ls_contended > b->ls_contended;
+	}
+	return a->ls_waitns > b->ls_waitns;
+}
+
+void
+lockstat_print(unsigned n)
+{
+	static const char *const kinds[] = { "spin", "sleep", "rw" };
+	struct lockstat *snap, tmp;
+	unsigned i, j, best, num;
+
+	if (!lockstat_enabled) {
+		kprintf("lockstat: not running\n");
+		return;
+	}
+
+	/*
+	 * Copy the table out first; kprintf takes locks, and those
+	 * may want to update their own records while we print.
+	 */
+	snap = kmalloc(LOCKSTAT_MAX * sizeof(struct lockstat));
+	if (snap == NULL) {
+		kprintf("lockstat: out of memory\n");
+		return;
+	}
+	spinlock_acquire(&lockstat_tablelock);
+	num = lockstat_count;
+	for (i=0; i<num; i++) {
+		spinlock_acquire(&lockstat_table[i].ls_lock);
+		snap[i] = lockstat_table[i];
+		spinlock_release(&lockstat_table[i].ls_lock);
+	}
+	spinlock_release(&lockstat_tablelock);
+
+	/* Selection sort of the first N; the table is small. */
+	if (n > num) {
+		n = num;
+	}
+	for (i=0; i<n; i++) {
+		best = i;
+		for (j=i+1; j<num; j++) {
+			if (lockstat_worse(&snap[j], &snap[best])) {
+				best = j;
+			}
+		}
+		if (best != i) {
+			tmp = snap[i];
+			snap[i] = snap[best];
+			snap[best] = tmp;
+		}
+	}
+
+	kprintf("%-24s %-5s %10s %10s %12s %10s %12s\n", "lock", "kind",
+		"acquires", "contended", "wait(us)", "max(us)", "hold(us)");
+	for (i=0; i<n; i++) {
+		kprintf("%-24s %-5s %10llu %10llu %12llu %10llu %12llu\n",
+			snap[i].ls_name, kinds[snap[i].ls_kind],
+			(unsigned long long)snap[i].ls_acquires,
+			(unsigned long long)snap[i].ls_contended,
+			(unsigned long long)(snap[i].ls_waitns / 1000),
+			(unsigned long long)(snap[i].ls_maxwaitns / 1000),
+			(unsigned long long)(snap[i].ls_holdns / 1000));
+	}
+	kprintf("%u of %u lock names tracked\n", num, LOCKSTAT_MAX);
+
+	kfree(snap);
+}
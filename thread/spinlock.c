@@ -35,12 +35,20 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <lockstat.h>
 #include <current.h>	/* for curcpu */
 
 /*
  * Spinlocks.
  */
 
+/*
+ * Backoff, in trips around an empty loop, per waiter ahead of us in
+ * line. A CPU that is k tickets back waits about k*SPINLOCK_BACKOFF
+ * iterations between looks at lk_serving.
+ */
+#define SPINLOCK_BACKOFF  16
+
 
 /*
  * Initialize spinlock.
@@ -48,9 +56,27 @@
 void
 spinlock_init(struct spinlock *lk)
 {
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lk->lk_name = NULL;
+	lk->lk_stat = NULL;
+	lk->lk_acqtime = 0;
+#endif
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Give the lock a name, so lockstat will track it.
+ */
+void
+spinlock_setname(struct spinlock *lk, const char *name)
+{
+	lk->lk_name = name;
+	lk->lk_stat = NULL;
 }
+#endif
 
 /*
  * Clean up spinlock.
@@ -59,7 +85,8 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_serving));
 }
 
 /*
@@ -67,12 +94,18 @@ spinlock_cleanup(struct spinlock *lk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket, and wait for our turn.
  */
 void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket, ahead;
+	volatile unsigned i;
+#if OPT_LOCKSTAT
+	struct lockstat *ls = NULL;
+	uint64_t waitstart = 0;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +120,49 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+#if OPT_LOCKSTAT
+	if (lk->lk_name != NULL && lockstat_enabled) {
+		if (lk->lk_stat == NULL) {
+			lk->lk_stat = lockstat_get(lk->lk_name,
+						   LOCKSTAT_SPIN);
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+		ls = lk->lk_stat;
+	}
+#endif
+
+	/*
+	 * Take a ticket. Fetch-and-add is a machine-level atomic
+	 * operation, so every CPU gets a different number and they
+	 * are served in the order they arrived.
+	 */
+	ticket = spinlock_data_fetchadd(&lk->lk_next, 1);
+
+	/*
+	 * Wait for our number to come up. The subtraction is done
+	 * unsigned so it keeps working when the counters wrap.
+	 * Rather than hammer lk_serving, wait longer the further back
+	 * in line we are; the holder must finish, and everyone ahead
+	 * of us take their turn, before we can get in anyway.
+	 */
+	while ((ahead = ticket - spinlock_data_get(&lk->lk_serving)) != 0) {
+#if OPT_LOCKSTAT
+		if (ls != NULL && waitstart == 0) {
+			waitstart = lockstat_now();
+		}
+#endif
+		for (i=0; i < ahead * SPINLOCK_BACKOFF; i++) {
+			/* nothing */
 		}
-		break;
 	}
 
 	lk->lk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	if (ls != NULL) {
+		lk->lk_acqtime = lockstat_now();
+		lockstat_acquired(ls, waitstart, lk->lk_acqtime);
+	}
+#endif
 }
 
 /*
@@ -121,8 +176,20 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	if (lk->lk_stat != NULL && lk->lk_acqtime != 0) {
+		lockstat_released(lk->lk_stat, lk->lk_acqtime);
+		lk->lk_acqtime = 0;
+	}
+#endif
+
+	/*
+	 * Only the holder writes lk_serving, so a plain store is
+	 * enough to pass the lock to the next ticket.
+	 */
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -37,10 +37,32 @@
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <synch.h>
+#include <lockstat.h>
 #include "opt-A1.h"
 
+#if OPT_LOCKSTAT
+/*
+ * Find the lockstat record for a sleep lock, looking it up by name
+ * the first time through (lockstat may not have been running when
+ * the lock was created). Returns NULL if we aren't recording.
+ */
+static
+struct lockstat *
+synch_getstat(struct lockstat **lsp, const char *name, int kind)
+{
+	if (!lockstat_enabled) {
+		return NULL;
+	}
+	if (*lsp == NULL) {
+		*lsp = lockstat_get(name, kind);
+	}
+	return *lsp;
+}
+#endif
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -71,6 +93,7 @@ sem_create(const char *name, int initial_count)
 	}
 
 	spinlock_init(&sem->sem_lock);
+	spinlock_setname(&sem->sem_lock, "semaphore");
         sem->sem_count = initial_count;
 
         return sem;
@@ -166,6 +189,11 @@ lock_create(const char *name)
 #if OPT_A1
     lock->who_hold = NULL;
     lock->be_held = false;
+    lock->lk_nwaiters = 0;
+#if OPT_LOCKSTAT
+    lock->lk_stat = NULL;
+    lock->lk_acqtime = 0;
+#endif
     lock->lk_wchan = wchan_create(lock->lk_name);
     if (lock->lk_wchan == NULL) {
 		kfree(lock->lk_name);
@@ -193,25 +221,106 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+#if OPT_A1
+/*
+ * Decide whether it is worth spinning for a held lock rather than
+ * going to sleep: only if the holder is actually on a processor right
+ * now, and that processor isn't ours (if it were, the holder cannot
+ * run until we give up the cpu, so spinning is pure waste).
+ *
+ * Must be called with lk_lock held, which keeps who_hold stable.
+ */
+static
+bool
+lock_should_spin(struct lock *lock)
+{
+    struct thread *holder;
+
+    KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+    holder = lock->who_hold;
+    if (holder == NULL) {
+        return false;
+    }
+    return holder->t_state == S_RUN && holder->t_cpu != curcpu->c_self;
+}
+#endif
+
 void
 lock_acquire(struct lock *lock)
 {
         // Write this
 #if OPT_A1
+    unsigned spins;
+#if OPT_LOCKSTAT
+    struct lockstat *ls;
+    uint64_t waitstart;
+#endif
+
     KASSERT(lock != NULL);
     KASSERT(curthread->t_in_interrupt == false);
+
+#if OPT_LOCKSTAT
+    ls = synch_getstat(&lock->lk_stat, lock->lk_name, LOCKSTAT_SLEEP);
+#endif
+
+    /*
+     * Fast path: lock is free, take it without going near the wchan.
+     */
     spinlock_acquire(&lock->lk_lock);
+    if (!lock->be_held) {
+        lock->who_hold = curthread;
+        lock->be_held = true;
+        spinlock_release(&lock->lk_lock);
+#if OPT_LOCKSTAT
+        if (ls != NULL) {
+            lock->lk_acqtime = lockstat_now();
+            lockstat_acquired(ls, 0, lock->lk_acqtime);
+        }
+#endif
+        return;
+    }
+
+#if OPT_LOCKSTAT
+    waitstart = (ls != NULL) ? lockstat_now() : 0;
+#endif
+
+    /*
+     * Adaptive phase: poll the lock word (without holding lk_lock,
+     * so the holder can get in to release it) while the holder is
+     * running elsewhere.
+     */
+    spins = 0;
+    while (lock->be_held && lock_should_spin(lock) && spins < LOCK_SPIN_MAX) {
+        spinlock_release(&lock->lk_lock);
+        while (lock->be_held && spins < LOCK_SPIN_MAX) {
+            spins++;
+        }
+        spinlock_acquire(&lock->lk_lock);
+    }
+
+    /*
+     * Slow path: sleep until the holder hands the lock back.
+     */
     while(lock->be_held){
+        lock->lk_nwaiters++;
         wchan_lock(lock->lk_wchan);
         spinlock_release(&lock->lk_lock);
         wchan_sleep(lock->lk_wchan);
         spinlock_acquire(&lock->lk_lock);
+        KASSERT(lock->lk_nwaiters > 0);
+        lock->lk_nwaiters--;
     }
     KASSERT(!lock->be_held);
     lock->who_hold = curthread;
     lock->be_held = true;
     //kprintf("%s acquire sucessfully\n",lock->lk_name);
     spinlock_release(&lock->lk_lock);
+#if OPT_LOCKSTAT
+    if (ls != NULL) {
+        lock->lk_acqtime = lockstat_now();
+        lockstat_acquired(ls, waitstart, lock->lk_acqtime);
+    }
+#endif
 #else
         (void)lock;  // suppress warning until code gets written
 #endif
@@ -225,10 +334,19 @@ lock_release(struct lock *lock)
     KASSERT(lock != NULL);
     KASSERT(curthread->t_in_interrupt == false);
     KASSERT(lock->who_hold == curthread);
+#if OPT_LOCKSTAT
+    if (lock->lk_stat != NULL && lock->lk_acqtime != 0) {
+        lockstat_released(lock->lk_stat, lock->lk_acqtime);
+        lock->lk_acqtime = 0;
+    }
+#endif
     spinlock_acquire(&lock->lk_lock);
     lock->be_held = false;
     lock->who_hold = NULL;
-    wchan_wakeone(lock->lk_wchan);
+    /* Nobody asleep means nobody to wake; skip the wchan entirely. */
+    if (lock->lk_nwaiters > 0) {
+        wchan_wakeone(lock->lk_wchan);
+    }
     spinlock_release(&lock->lk_lock);
 #else
         (void)lock;  // suppress warning until code gets written
@@ -353,3 +471,197 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	(void)lock;  // suppress warning until code gets written
 #endif
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+	rw->rw_rwchan = wchan_create(rw->rw_name);
+	if (rw->rw_rwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_wwchan = wchan_create(rw->rw_name);
+	if (rw->rw_wwchan == NULL) {
+		wchan_destroy(rw->rw_rwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_waitwriters = 0;
+	rw->rw_writer = NULL;
+#if OPT_LOCKSTAT
+	rw->rw_stat = NULL;
+	rw->rw_acqtime = 0;
+#endif
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+
+	/* wchan_destroy will assert if anyone's waiting on it */
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_wwchan);
+	wchan_destroy(rw->rw_rwchan);
+        kfree(rw->rw_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+#if OPT_LOCKSTAT
+	struct lockstat *ls;
+	uint64_t waitstart = 0;
+#endif
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+#if OPT_LOCKSTAT
+	ls = synch_getstat(&rw->rw_stat, rw->rw_name, LOCKSTAT_RW);
+#endif
+
+	spinlock_acquire(&rw->rw_lock);
+	/* Stand aside for a writer that holds the lock or is queued. */
+	while (rw->rw_writer != NULL || rw->rw_waitwriters > 0) {
+#if OPT_LOCKSTAT
+		if (ls != NULL && waitstart == 0) {
+			waitstart = lockstat_now();
+		}
+#endif
+		wchan_lock(rw->rw_rwchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(rw->rw_rwchan);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	rw->rw_readers++;
+	spinlock_release(&rw->rw_lock);
+
+#if OPT_LOCKSTAT
+	/* Read holds are shared, so only writers count toward hold time. */
+	if (ls != NULL) {
+		lockstat_acquired(ls, waitstart, lockstat_now());
+	}
+#endif
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_waitwriters > 0) {
+		wchan_wakeone(rw->rw_wwchan);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+#if OPT_LOCKSTAT
+	struct lockstat *ls;
+	uint64_t waitstart = 0;
+#endif
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+#if OPT_LOCKSTAT
+	ls = synch_getstat(&rw->rw_stat, rw->rw_name, LOCKSTAT_RW);
+#endif
+
+	spinlock_acquire(&rw->rw_lock);
+	while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+#if OPT_LOCKSTAT
+		if (ls != NULL && waitstart == 0) {
+			waitstart = lockstat_now();
+		}
+#endif
+		rw->rw_waitwriters++;
+		wchan_lock(rw->rw_wwchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(rw->rw_wwchan);
+		spinlock_acquire(&rw->rw_lock);
+		KASSERT(rw->rw_waitwriters > 0);
+		rw->rw_waitwriters--;
+	}
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+
+#if OPT_LOCKSTAT
+	if (ls != NULL) {
+		rw->rw_acqtime = lockstat_now();
+		lockstat_acquired(ls, waitstart, rw->rw_acqtime);
+	}
+#endif
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == curthread);
+
+#if OPT_LOCKSTAT
+	if (rw->rw_stat != NULL && rw->rw_acqtime != 0) {
+		lockstat_released(rw->rw_stat, rw->rw_acqtime);
+		rw->rw_acqtime = 0;
+	}
+#endif
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	/*
+	 * Hand off to the next writer if there is one; otherwise let
+	 * every reader that queued up behind us in.
+	 */
+	if (rw->rw_waitwriters > 0) {
+		wchan_wakeone(rw->rw_wwchan);
+	}
+	else {
+		wchan_wakeall(rw->rw_rwchan);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	return rw->rw_writer == curthread;
+}
@@ -54,6 +54,7 @@
 #include "opt-A2.h"
 #include "opt-A3.h"
 #include "opt-synchprobs.h"
+#include <systrace.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -145,12 +146,22 @@ thread_create(const char *name)
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_sleepchan = wchan_create("clocksleep");
+	if (thread->t_sleepchan == NULL) {
+		kfree(thread->t_name);
+		kfree(thread);
+		return NULL;
+	}
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Resource usage */
+	bzero(&thread->t_usage, sizeof(thread->t_usage));
+	thread->t_intruser = false;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -186,15 +197,22 @@ cpu_create(unsigned hardware_number)
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	spinlock_setname(&c->c_runqueue_lock, "runqueue");
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
+	spinlock_setname(&c->c_ipi_lock, "ipi");
+
+	timerwheel_init(&c->c_timers);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+#if OPT_SYSTRACE
+	systrace_cpuinit(c);
+#endif
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -256,6 +274,7 @@ thread_destroy(struct thread *thread)
 		kfree(thread->t_stack);
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
+	wchan_destroy(thread->t_sleepchan);
 	//thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
@@ -585,8 +604,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
 		thread_make_runnable(cur, true /*have lock*/);
+		cur->t_usage.u_nivcsw++;
 		break;
 	    case S_SLEEP:
+		cur->t_usage.u_nvcsw++;
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -790,20 +811,28 @@ thread_exit(void)
     struct proc * p;
     p = curproc;
 	proc_remthread(cur);
-    as_deactivate();
-    as_destroy(p->p_addrspace);
-    if(p->p_ft != NULL) {
-		destroy_filetable(p->p_ft);
-	}
-    
-    struct ProcTable * pt = get_proctable();
-    lock_acquire(pt->pt_lock);
-    pt->num_running--;
-    cv_signal(pt->pt_cv, pt->pt_lock);
-    lock_release(pt->pt_lock);
-    
-
-	remove_proc_from_table(p);
+    // kernel-only threads share kproc, which never exits
+    if (p != kproc && threadarray_num(&p->p_threads) == 0) {
+        as_deactivate();
+        // a vfork child's address space is its parent's; proc_exit hands it back
+        if (!p->p_asborrowed) {
+            as_destroy(p->p_addrspace);
+            p->p_addrspace = NULL;
+        }
+        if(p->p_ft != NULL) {
+            destroy_filetable(p->p_ft);
+            p->p_ft = NULL;
+        }
+
+        struct ProcTable * pt = get_proctable();
+        lock_acquire(pt->pt_lock);
+        pt->num_running--;
+        cv_signal(pt->pt_cv, pt->pt_lock);
+        lock_release(pt->pt_lock);
+
+        // p becomes a zombie for its parent or is freed; don't touch it after this
+        proc_exit(p);
+    }
 #endif
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
@@ -990,6 +1019,7 @@ wchan_create(const char *name)
 		return NULL;
 	}
 	spinlock_init(&wc->wc_lock);
+	spinlock_setname(&wc->wc_lock, "wchan");
 	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
 	return wc;
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-CPU hierarchical timer wheel. See <timeout.h>.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <current.h>
+#include <timeout.h>
+
+/* Shift to get from an absolute tick to the slot index at LEVEL. */
+#define TW_SHIFT(level)	(TW_L0_BITS + ((level) - 1) * TW_LN_BITS)
+
+/* Furthest into the future the wheel can represent directly. */
+#define TW_RANGE	((uint64_t)1 << TW_SHIFT(TW_LEVELS))
+
+/*
+ * Link TO at the head of the slot list *HEAD.
+ */
+static
+void
+timeout_link(struct timeout **head, struct timeout *to)
+{
+	to->to_next = *head;
+	if (*head != NULL) {
+		(*head)->to_pprev = &to->to_next;
+	}
+	to->to_pprev = head;
+	*head = to;
+}
+
+/*
+ * Unlink TO from whatever slot list it's on.
+ */
+static
+void
+timeout_unlink(struct timeout *to)
+{
+	*to->to_pprev = to->to_next;
+	if (to->to_next != NULL) {
+		to->to_next->to_pprev = to->to_pprev;
+	}
+	to->to_next = NULL;
+	to->to_pprev = NULL;
+}
+
+/*
+ * Choose a slot for TO based on how far away its expiry is, and put
+ * it there. Must hold the wheel lock. Anything already due goes in
+ * the slot for the current tick, which timerwheel_tick is about to
+ * run.
+ */
+static
+void
+timerwheel_place(struct timerwheel *tw, struct timeout *to)
+{
+	uint64_t expire, delta;
+	unsigned level, idx;
+
+	expire = to->to_expire;
+	if (expire < tw->tw_now) {
+		expire = tw->tw_now;
+	}
+	delta = expire - tw->tw_now;
+
+	if (delta < TW_L0_SLOTS) {
+		idx = expire & (TW_L0_SLOTS - 1);
+		timeout_link(&tw->tw_l0[idx], to);
+		return;
+	}
+
+	if (delta >= TW_RANGE) {
+		/* Too far out; park it at the edge and look again later. */
+		expire = tw->tw_now + TW_RANGE - 1;
+	}
+
+	for (level = 1; level < TW_LEVELS; level++) {
+		if (delta < ((uint64_t)1 << TW_SHIFT(level + 1)) ||
+		    level == TW_LEVELS - 1) {
+			break;
+		}
+	}
+	idx = (expire >> TW_SHIFT(level)) & (TW_LN_SLOTS - 1);
+	timeout_link(&tw->tw_ln[level - 1][idx], to);
+}
+
+/*
+ * Redistribute everything in slot IDX of LEVEL into finer slots.
+ */
+static
+void
+timerwheel_cascade(struct timerwheel *tw, unsigned level, unsigned idx)
+{
+	struct timeout *list, *to;
+
+	list = tw->tw_ln[level - 1][idx];
+	tw->tw_ln[level - 1][idx] = NULL;
+
+	while (list != NULL) {
+		to = list;
+		list = to->to_next;
+		to->to_next = NULL;
+		to->to_pprev = NULL;
+		timerwheel_place(tw, to);
+	}
+}
+
+void
+timerwheel_init(struct timerwheel *tw)
+{
+	unsigned i, j;
+
+	spinlock_init(&tw->tw_lock);
+	spinlock_setname(&tw->tw_lock, "timerwheel");
+	tw->tw_now = 0;
+	tw->tw_count = 0;
+	for (i = 0; i < TW_L0_SLOTS; i++) {
+		tw->tw_l0[i] = NULL;
+	}
+	for (i = 0; i < TW_LEVELS - 1; i++) {
+		for (j = 0; j < TW_LN_SLOTS; j++) {
+			tw->tw_ln[i][j] = NULL;
+		}
+	}
+}
+
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *arg)
+{
+	to->to_next = NULL;
+	to->to_pprev = NULL;
+	to->to_expire = 0;
+	to->to_func = func;
+	to->to_arg = arg;
+	to->to_cpu = NULL;
+}
+
+void
+timeout_arm(struct timeout *to, unsigned ticks)
+{
+	struct timerwheel *tw;
+
+	KASSERT(to->to_func != NULL);
+	KASSERT(to->to_cpu == NULL);
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+
+	tw = &curcpu->c_timers;
+	spinlock_acquire(&tw->tw_lock);
+	to->to_cpu = curcpu->c_self;
+	to->to_expire = tw->tw_now + ticks;
+	timerwheel_place(tw, to);
+	tw->tw_count++;
+	spinlock_release(&tw->tw_lock);
+}
+
+bool
+timeout_cancel(struct timeout *to)
+{
+	struct cpu *c;
+	bool pending = false;
+
+	c = to->to_cpu;
+	if (c == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&c->c_timers.tw_lock);
+	/* It may have fired while we were getting the lock. */
+	if (to->to_cpu == c) {
+		timeout_unlink(to);
+		to->to_cpu = NULL;
+		KASSERT(c->c_timers.tw_count > 0);
+		c->c_timers.tw_count--;
+		pending = true;
+	}
+	spinlock_release(&c->c_timers.tw_lock);
+
+	return pending;
+}
+
+bool
+timeout_pending(struct timeout *to)
+{
+	return to->to_cpu != NULL;
+}
+
+/*
+ * Advance this CPU's wheel one tick: cascade any coarse slots whose
+ * turn has come, then fire everything in the current level-0 slot.
+ *
+ * Callbacks are run one at a time with the wheel unlocked, and the
+ * timeout structure is not touched again once its callback has been
+ * fetched, so a callback may free or re-arm its own timeout.
+ */
+void
+timerwheel_tick(void)
+{
+	struct timerwheel *tw;
+	struct timeout *to;
+	void (*func)(void *);
+	void *arg;
+	unsigned level, idx;
+
+	tw = &curcpu->c_timers;
+
+	spinlock_acquire(&tw->tw_lock);
+	tw->tw_now++;
+	for (level = 1; level < TW_LEVELS; level++) {
+		if ((tw->tw_now & (((uint64_t)1 << TW_SHIFT(level)) - 1)) != 0) {
+			break;
+		}
+		idx = (tw->tw_now >> TW_SHIFT(level)) & (TW_LN_SLOTS - 1);
+		timerwheel_cascade(tw, level, idx);
+	}
+	idx = tw->tw_now & (TW_L0_SLOTS - 1);
+
+	while ((to = tw->tw_l0[idx]) != NULL) {
+		KASSERT(to->to_expire <= tw->tw_now);
+		timeout_unlink(to);
+		to->to_cpu = NULL;
+		tw->tw_count--;
+		func = to->to_func;
+		arg = to->to_arg;
+
+		spinlock_release(&tw->tw_lock);
+		func(arg);
+		spinlock_acquire(&tw->tw_lock);
+	}
+	spinlock_release(&tw->tw_lock);
+}
@@ -0,0 +1,549 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Anonymous pipes. See pipe.h.
+ *
+ * The buffer indexes p_head (next byte to write) and p_tail (next
+ * byte to read) run freely and are masked with PIPE_SIZE-1 on use, so
+ * head - tail is always the number of bytes buffered and a full pipe
+ * is distinguishable from an empty one. Data moves between the ring
+ * and the caller's buffer with at most two uiomove calls per pass,
+ * one on each side of the wrap point.
+ *
+ * Sleepers are counted, and the other side only signals when someone
+ * is actually asleep. A writer of a message that fits in the buffer
+ * copies it in one pass and then wakes at most one reader.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <pipe.h>
+
+#define PIPE_MASK	(PIPE_SIZE - 1)
+
+#if (PIPE_SIZE & PIPE_MASK) != 0 || PIPE_SIZE < PIPE_BUF
+#error "PIPE_SIZE must be a power of two no smaller than PIPE_BUF"
+#endif
+
+struct pipe {
+	struct lock *p_lock;		/* protects everything below */
+	struct cv *p_readcv;		/* readers wait here for data */
+	struct cv *p_writecv;		/* writers wait here for space */
+	unsigned p_head;		/* total bytes ever written */
+	unsigned p_tail;		/* total bytes ever read */
+	unsigned p_nreadwait;		/* readers asleep on p_readcv */
+	unsigned p_nwritewait;		/* writers asleep on p_writecv */
+	bool p_readopen;		/* read end still open */
+	bool p_writeopen;		/* write end still open */
+	unsigned p_nvnodes;		/* ends not yet reclaimed */
+	struct vnode p_readvn;
+	struct vnode p_writevn;
+	char p_buf[PIPE_SIZE];
+};
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	cv_destroy(p->p_writecv);
+	cv_destroy(p->p_readcv);
+	lock_destroy(p->p_lock);
+	kfree(p);
+}
+
+/*
+ * Move up to LEN bytes between the ring buffer at index POS and UIO,
+ * in at most two pieces. Returns the number of bytes moved in *DONE.
+ */
+static
+int
+pipe_uiomove(struct pipe *p, unsigned pos, size_t len, struct uio *uio,
+	     size_t *done)
+{
+	size_t resid, chunk;
+	unsigned off;
+	int result;
+
+	resid = uio->uio_resid;
+	while (len > 0) {
+		off = pos & PIPE_MASK;
+		chunk = PIPE_SIZE - off;
+		if (chunk > len) {
+			chunk = len;
+		}
+		result = uiomove(p->p_buf + off, chunk, uio);
+		if (result) {
+			*done = resid - uio->uio_resid;
+			return result;
+		}
+		pos += chunk;
+		len -= chunk;
+	}
+	*done = resid - uio->uio_resid;
+	return 0;
+}
+
+/*
+ * Called when the last holder of one end closes it. Wake the other
+ * side so blocked readers see end of file and blocked writers see
+ * EPIPE.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+
+	lock_acquire(p->p_lock);
+	if (v == &p->p_readvn) {
+		p->p_readopen = false;
+		cv_broadcast(p->p_writecv, p->p_lock);
+	}
+	else {
+		p->p_writeopen = false;
+		cv_broadcast(p->p_readcv, p->p_lock);
+	}
+	lock_release(p->p_lock);
+	return 0;
+}
+
+/*
+ * Called when the last reference to one end goes away. The pipe
+ * itself goes once both ends have been reclaimed.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool last;
+
+	lock_acquire(p->p_lock);
+	KASSERT(p->p_nvnodes > 0);
+	p->p_nvnodes--;
+	last = (p->p_nvnodes == 0);
+	lock_release(p->p_lock);
+
+	VOP_CLEANUP(v);
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t avail, done;
+	int result;
+
+	if (v != &p->p_readvn) {
+		return EBADF;
+	}
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	lock_acquire(p->p_lock);
+	while (p->p_head == p->p_tail) {
+		if (!p->p_writeopen) {
+			/* empty and no writers: end of file */
+			lock_release(p->p_lock);
+			return 0;
+		}
+		p->p_nreadwait++;
+		cv_wait(p->p_readcv, p->p_lock);
+		p->p_nreadwait--;
+	}
+
+	/* Take whatever is there; don't wait around for the rest. */
+	avail = p->p_head - p->p_tail;
+	if (avail > uio->uio_resid) {
+		avail = uio->uio_resid;
+	}
+	result = pipe_uiomove(p, p->p_tail, avail, uio, &done);
+	p->p_tail += done;
+
+	if (done > 0 && p->p_nwritewait > 0) {
+		cv_signal(p->p_writecv, p->p_lock);
+	}
+	lock_release(p->p_lock);
+	return result;
+}
+
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t need, space, len, done;
+	bool moved = false;
+	int result = 0;
+
+	if (v != &p->p_writevn) {
+		return EBADF;
+	}
+
+	lock_acquire(p->p_lock);
+	while (uio->uio_resid > 0) {
+		/*
+		 * A write of PIPE_BUF bytes or less waits until it fits
+		 * in one go, so it is never interleaved with another
+		 * writer's data. Larger writes take what room there is.
+		 */
+		need = uio->uio_resid <= PIPE_BUF ? uio->uio_resid : 1;
+		for (;;) {
+			if (!p->p_readopen) {
+				/* Report what got through, if anything. */
+				result = moved ? 0 : EPIPE;
+				goto out;
+			}
+			space = PIPE_SIZE - (p->p_head - p->p_tail);
+			if (space >= need) {
+				break;
+			}
+			/* Full: let a reader at what we've written so far. */
+			if (p->p_nreadwait > 0) {
+				cv_signal(p->p_readcv, p->p_lock);
+			}
+			p->p_nwritewait++;
+			cv_wait(p->p_writecv, p->p_lock);
+			p->p_nwritewait--;
+		}
+
+		len = uio->uio_resid < space ? uio->uio_resid : space;
+		result = pipe_uiomove(p, p->p_head, len, uio, &done);
+		p->p_head += done;
+		if (done > 0) {
+			moved = true;
+		}
+		if (result) {
+			break;
+		}
+	}
+
+ out:
+	if (moved && p->p_nreadwait > 0) {
+		cv_signal(p->p_readcv, p->p_lock);
+	}
+	lock_release(p->p_lock);
+	return result;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+	int result;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	result = VOP_GETTYPE(v, &statbuf->st_mode);
+	if (result) {
+		return result;
+	}
+	statbuf->st_mode |= 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_SIZE;
+
+	/* Bytes currently buffered; racy, but that's inherent. */
+	statbuf->st_size = p->p_head - p->p_tail;
+
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+/*
+ * Pipes are only ever created by pipe_create, never opened by name.
+ */
+static
+int
+pipe_open(struct vnode *v, int openflags)
+{
+	(void)v;
+	(void)openflags;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return EUNIMP;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * Operations that are meaningless on pipes.
+ */
+
+static
+int
+pipe_notfile(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_notdir(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *dir, char *pathname, struct vnode **result)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *dir, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+/*
+ * Function table for pipe vnodes. Both ends use the same table; the
+ * operations tell them apart by address.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_notfile, /* readlink */
+	pipe_notdir,  /* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_notfile, /* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,  /* remove */
+	pipe_nameop,  /* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+int
+pipe_create(struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(struct pipe));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_lock = lock_create("pipe");
+	if (p->p_lock == NULL) {
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_readcv = cv_create("pipe read");
+	if (p->p_readcv == NULL) {
+		lock_destroy(p->p_lock);
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_writecv = cv_create("pipe write");
+	if (p->p_writecv == NULL) {
+		cv_destroy(p->p_readcv);
+		lock_destroy(p->p_lock);
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_head = p->p_tail = 0;
+	p->p_nreadwait = p->p_nwritewait = 0;
+	p->p_readopen = p->p_writeopen = true;
+	p->p_nvnodes = 2;
+
+	result = VOP_INIT(&p->p_readvn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		pipe_destroy(p);
+		return result;
+	}
+	result = VOP_INIT(&p->p_writevn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		VOP_CLEANUP(&p->p_readvn);
+		pipe_destroy(p);
+		return result;
+	}
+
+	/* Open each end once, as vfs_open would. */
+	VOP_INCOPEN(&p->p_readvn);
+	VOP_INCOPEN(&p->p_writevn);
+
+	*readend = &p->p_readvn;
+	*writeend = &p->p_writevn;
+	return 0;
+}
@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VFS name cache.
+ *
+ * Maps (directory vnode, name) to the vnode that name refers to, or
+ * to "no such file" for a negative entry, so repeated lookups of the
+ * same paths don't have to go back to the filesystem and re-read its
+ * directories. Each entry holds a reference to its directory and, if
+ * positive, to its target; that keeps the vnode pointers used as keys
+ * from being recycled underneath us.
+ *
+ * Entries are hashed by directory and name, and kept on an LRU list
+ * that is trimmed to DCACHE_MAX entries. Anything that creates,
+ * removes, or renames a name must call vfs_dcache_invalidate after
+ * the filesystem operation; a lookup that raced with it notices the
+ * generation count moved and doesn't cache its (possibly stale)
+ * result.
+ *
+ * The table, LRU list, counters and statistics are protected by
+ * dc_lock, a spinlock held only while probing or changing them. It is
+ * never held across a call into a filesystem or a VOP_DECREF (which
+ * may reclaim the vnode), or across kmalloc/kfree: entries are
+ * allocated before taking it, and entries taken out of the cache are
+ * gathered on a list and freed after dropping it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vfs.h>
+#include <fs.h>
+#include <vnode.h>
+#include <spinlock.h>
+
+#define DCACHE_NAMELEN   32     /* longer names are not cached */
+#define DCACHE_NBUCKETS  128    /* must be a power of 2 */
+#define DCACHE_MAX       512
+
+struct dcentry {
+	struct dcentry *dc_hnext;       /* next in hash chain */
+	struct dcentry *dc_lprev;       /* LRU list, most recent first */
+	struct dcentry *dc_lnext;
+	struct vnode *dc_dir;           /* directory the name is in */
+	struct vnode *dc_vn;            /* what it names; NULL if nothing */
+	char dc_name[DCACHE_NAMELEN];
+};
+
+static struct spinlock dc_lock = SPINLOCK_NAMED_INITIALIZER("dcache");
+static struct dcentry *dc_hash[DCACHE_NBUCKETS];
+static struct dcentry dc_lru;           /* list head (sentinel) */
+static unsigned dc_count;               /* entries in the cache */
+static unsigned dc_gen;                 /* bumped on each invalidation */
+
+struct dcstats {
+	unsigned hits;
+	unsigned neghits;
+	unsigned misses;
+	unsigned uncached;
+	unsigned evictions;
+	unsigned invalidations;
+};
+static struct dcstats dc_stats;
+
+/*
+ * Setup function
+ */
+void
+vfs_dcache_bootstrap(void)
+{
+	dc_lru.dc_lprev = dc_lru.dc_lnext = &dc_lru;
+	dc_count = 0;
+	dc_gen = 0;
+}
+
+static
+unsigned
+dc_hashfn(struct vnode *dir, const char *name)
+{
+	uint32_t h = (uint32_t)(uintptr_t)dir >> 4;
+
+	while (*name) {
+		h = h*31 + (unsigned char)*name++;
+	}
+	return h & (DCACHE_NBUCKETS-1);
+}
+
+static
+void
+dc_lru_unlink(struct dcentry *dc)
+{
+	dc->dc_lprev->dc_lnext = dc->dc_lnext;
+	dc->dc_lnext->dc_lprev = dc->dc_lprev;
+}
+
+static
+void
+dc_lru_addhead(struct dcentry *dc)
+{
+	dc->dc_lnext = dc_lru.dc_lnext;
+	dc->dc_lprev = &dc_lru;
+	dc_lru.dc_lnext->dc_lprev = dc;
+	dc_lru.dc_lnext = dc;
+}
+
+/*
+ * Find the entry for NAME in DIR, and mark it most recently used.
+ */
+static
+struct dcentry *
+dc_find(struct vnode *dir, const char *name)
+{
+	struct dcentry *dc;
+
+	for (dc = dc_hash[dc_hashfn(dir, name)]; dc; dc = dc->dc_hnext) {
+		if (dc->dc_dir == dir && !strcmp(dc->dc_name, name)) {
+			dc_lru_unlink(dc);
+			dc_lru_addhead(dc);
+			return dc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take an entry out of the cache and put it on *FREELIST, to be
+ * passed to dc_freelist once dc_lock is released.
+ */
+static
+void
+dc_remove(struct dcentry *dc, struct dcentry **freelist)
+{
+	struct dcentry **pp;
+
+	KASSERT(spinlock_do_i_hold(&dc_lock));
+
+	pp = &dc_hash[dc_hashfn(dc->dc_dir, dc->dc_name)];
+	while (*pp != dc) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->dc_hnext;
+	}
+	*pp = dc->dc_hnext;
+	dc_lru_unlink(dc);
+	dc_count--;
+
+	dc->dc_hnext = *freelist;
+	*freelist = dc;
+}
+
+/*
+ * Drop the references held by entries removed with dc_remove, and
+ * free them. Dropping the last reference runs VOP_RECLAIM, so this
+ * must not be called with dc_lock held.
+ */
+static
+void
+dc_freelist(struct dcentry *dc)
+{
+	struct dcentry *next;
+
+	KASSERT(!spinlock_do_i_hold(&dc_lock));
+
+	for (; dc != NULL; dc = next) {
+		next = dc->dc_hnext;
+		if (dc->dc_vn != NULL) {
+			VOP_DECREF(dc->dc_vn);
+		}
+		VOP_DECREF(dc->dc_dir);
+		kfree(dc);
+	}
+}
+
+/*
+ * Add DC, already allocated and named, as an entry mapping its name
+ * in DIR to VN (which may be NULL). Entries evicted to make room go
+ * on *FREELIST.
+ */
+static
+void
+dc_insert(struct dcentry *dc, struct vnode *dir, struct vnode *vn,
+	  struct dcentry **freelist)
+{
+	unsigned h;
+
+	KASSERT(spinlock_do_i_hold(&dc_lock));
+
+	while (dc_count >= DCACHE_MAX) {
+		dc_remove(dc_lru.dc_lprev, freelist);
+		dc_stats.evictions++;
+	}
+
+	dc->dc_dir = dir;
+	VOP_INCREF(dir);
+	dc->dc_vn = vn;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+
+	h = dc_hashfn(dir, dc->dc_name);
+	dc->dc_hnext = dc_hash[h];
+	dc_hash[h] = dc;
+	dc_lru_addhead(dc);
+	dc_count++;
+}
+
+/*
+ * Look up a single name in DIR, through the cache.
+ */
+static
+int
+dc_lookupname(struct vnode *dir, char *name, struct vnode **ret)
+{
+	struct dcentry *dc, *freelist;
+	unsigned gen;
+	int result;
+
+	if (strlen(name) >= DCACHE_NAMELEN ||
+	    !strcmp(name, ".") || !strcmp(name, "..")) {
+		spinlock_acquire(&dc_lock);
+		dc_stats.uncached++;
+		spinlock_release(&dc_lock);
+		return VOP_LOOKUP(dir, name, ret);
+	}
+
+	spinlock_acquire(&dc_lock);
+	dc = dc_find(dir, name);
+	if (dc != NULL) {
+		if (dc->dc_vn == NULL) {
+			dc_stats.neghits++;
+			spinlock_release(&dc_lock);
+			return ENOENT;
+		}
+		dc_stats.hits++;
+		VOP_INCREF(dc->dc_vn);
+		*ret = dc->dc_vn;
+		spinlock_release(&dc_lock);
+		return 0;
+	}
+	dc_stats.misses++;
+	gen = dc_gen;
+	spinlock_release(&dc_lock);
+
+	result = VOP_LOOKUP(dir, name, ret);
+	if (result != 0 && result != ENOENT) {
+		return result;
+	}
+
+	dc = kmalloc(sizeof(*dc));
+	if (dc == NULL) {
+		/* Not caching is always allowed */
+		return result;
+	}
+	strcpy(dc->dc_name, name);
+
+	freelist = NULL;
+	spinlock_acquire(&dc_lock);
+	if (gen == dc_gen && dc_find(dir, name) == NULL) {
+		dc_insert(dc, dir, result == 0 ? *ret : NULL, &freelist);
+		dc = NULL;
+	}
+	spinlock_release(&dc_lock);
+
+	dc_freelist(freelist);
+	/* Lost a race with an invalidation or another lookup */
+	kfree(dc);
+	return result;
+}
+
+/*
+ * Like VOP_LOOKUP, but walks PATH (relative to DIR) a component at a
+ * time using the cache. May destroy PATH.
+ */
+int
+vfs_dcache_lookup(struct vnode *dir, char *path, struct vnode **ret)
+{
+	struct vnode *vn, *next;
+	char *name, *rest;
+	int result;
+
+	VOP_INCREF(dir);
+	vn = dir;
+	name = path;
+	while (1) {
+		while (*name == '/') {
+			name++;
+		}
+		if (*name == 0) {
+			break;
+		}
+
+		rest = strchr(name, '/');
+		if (rest != NULL) {
+			*rest++ = 0;
+		}
+		else {
+			rest = name + strlen(name);
+		}
+
+		result = dc_lookupname(vn, name, &next);
+		VOP_DECREF(vn);
+		if (result) {
+			return result;
+		}
+		vn = next;
+		name = rest;
+	}
+
+	*ret = vn;
+	return 0;
+}
+
+/*
+ * Forget whatever is cached for NAME in DIR.
+ */
+void
+vfs_dcache_invalidate(struct vnode *dir, const char *name)
+{
+	struct dcentry *dc, *freelist;
+
+	freelist = NULL;
+	spinlock_acquire(&dc_lock);
+
+	dc_gen++;
+	dc_stats.invalidations++;
+	if (strlen(name) < DCACHE_NAMELEN) {
+		dc = dc_find(dir, name);
+		if (dc != NULL) {
+			dc_remove(dc, &freelist);
+		}
+	}
+
+	spinlock_release(&dc_lock);
+	dc_freelist(freelist);
+}
+
+/*
+ * Forget everything cached about filesystem FS. Must be done before
+ * unmounting it, or our references would keep it busy.
+ */
+void
+vfs_dcache_purgefs(struct fs *fs)
+{
+	struct dcentry *dc, *next, *freelist;
+
+	freelist = NULL;
+	spinlock_acquire(&dc_lock);
+
+	dc_gen++;
+	for (dc = dc_lru.dc_lnext; dc != &dc_lru; dc = next) {
+		next = dc->dc_lnext;
+		if (dc->dc_dir->vn_fs == fs) {
+			dc_remove(dc, &freelist);
+		}
+	}
+
+	spinlock_release(&dc_lock);
+	dc_freelist(freelist);
+}
+
+/*
+ * Print cache statistics.
+ */
+void
+vfs_dcache_printstats(void)
+{
+	unsigned count, lookups;
+	struct dcstats st;
+
+	spinlock_acquire(&dc_lock);
+	count = dc_count;
+	st = dc_stats;
+	spinlock_release(&dc_lock);
+
+	lookups = st.hits + st.neghits + st.misses;
+	kprintf("dcache: %u/%u entries, %u lookups: %u hits, "
+		"%u negative hits, %u misses (%u%% hit)\n",
+		count, DCACHE_MAX, lookups, st.hits,
+		st.neghits, st.misses,
+		lookups ? (st.hits + st.neghits) * 100 / lookups
+		: 0);
+	kprintf("dcache: %u uncached, %u evictions, %u invalidations\n",
+		st.uncached, st.evictions,
+		st.invalidations);
+}
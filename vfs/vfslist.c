@@ -38,7 +38,9 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <array.h>
+#include <clock.h>
 #include <synch.h>
+#include <thread.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
@@ -87,6 +89,21 @@ DEFARRAY(knowndev, /*no inline*/);
 
 static struct knowndevarray *knowndevs;
 
+/*
+ * Lock for the knowndevs list. Name lookups (vfs_getroot and friends)
+ * happen on every path translation and only need to read the list,
+ * so they share it; adding devices and mounting/unmounting take it
+ * exclusively.
+ */
+static struct rwlock *knowndevs_lock;
+
+/*
+ * Held across the FSOP_SYNC calls made by vfs_sync, which runs them
+ * without the big lock or knowndevs_lock; unmounting takes it first
+ * so a filesystem can't go away while it is being synced.
+ */
+static struct lock *vfs_synclock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -103,12 +120,24 @@ vfs_bootstrap(void)
 		panic("vfs: Could not create knowndevs array\n");
 	}
 
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
+
+	vfs_synclock = lock_create("vfs_sync");
+	if (vfs_synclock==NULL) {
+		panic("vfs: Could not create sync lock\n");
+	}
+
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
 		panic("vfs: Could not create vfs big lock\n");
 	}
 	vfs_biglock_depth = 0;
 
+	vfs_dcache_bootstrap();
+
 	devnull_create();
 }
 
@@ -147,34 +176,83 @@ vfs_biglock_do_i_hold(void)
 
 /*
  * Global sync function - call FSOP_SYNC on all devices.
+ *
+ * The big lock and knowndevs_lock are only held long enough to read
+ * each entry's filesystem, not across the sync itself, so the syncer
+ * doesn't hold up every path lookup while the disks are written.
+ * Devices are never removed from knowndevs, and vfs_synclock keeps
+ * the filesystems we find there mounted until we're done.
  */
 int
 vfs_sync(void)
 {
 	struct knowndev *dev;
+	struct fs *fs;
 	unsigned i, num;
 
-	vfs_biglock_acquire();
+	lock_acquire(vfs_synclock);
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
-		if (dev->kd_fs != NULL) {
-			/*result =*/ FSOP_SYNC(dev->kd_fs);
+	for (i=0; ; i++) {
+		vfs_biglock_acquire();
+		rwlock_acquire_read(knowndevs_lock);
+		num = knowndevarray_num(knowndevs);
+		fs = NULL;
+		if (i < num) {
+			dev = knowndevarray_get(knowndevs, i);
+			fs = dev->kd_fs;
+		}
+		rwlock_release_read(knowndevs_lock);
+		vfs_biglock_release();
+
+		if (i >= num) {
+			break;
+		}
+		if (fs != NULL) {
+			/*result =*/ FSOP_SYNC(fs);
 		}
 	}
 
-	vfs_biglock_release();
+	lock_release(vfs_synclock);
 
 	return 0;
 }
 
+/*
+ * The syncer: write back whatever the filesystems have been holding
+ * dirty, every VFS_SYNCINTERVAL seconds, forever.
+ */
+static
+void
+vfs_syncer(void *unused1, unsigned long unused2)
+{
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(VFS_SYNCINTERVAL);
+		vfs_sync();
+	}
+}
+
+void
+vfs_syncer_start(void)
+{
+	int result;
+
+	result = thread_fork("syncer", NULL, vfs_syncer, NULL, 0);
+	if (result) {
+		panic("vfs: Cannot start syncer thread: %s\n",
+		      strerror(result));
+	}
+}
+
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
- * back an appropriate vnode.
+ * back an appropriate vnode. Call with knowndevs_lock held.
  */
+static
 int
-vfs_getroot(const char *devname, struct vnode **result)
+vfs_dogetroot(const char *devname, struct vnode **result)
 {
 	struct knowndev *kd;
 	unsigned i, num;
@@ -250,6 +328,18 @@ vfs_getroot(const char *devname, struct vnode **result)
 	return ENODEV;
 }
 
+int
+vfs_getroot(const char *devname, struct vnode **result)
+{
+	int ret;
+
+	rwlock_acquire_read(knowndevs_lock);
+	ret = vfs_dogetroot(devname, result);
+	rwlock_release_read(knowndevs_lock);
+
+	return ret;
+}
+
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
  */
@@ -257,12 +347,14 @@ const char *
 vfs_getdevname(struct fs *fs)
 {
 	struct knowndev *kd;
+	const char *name = NULL;
 	unsigned i, num;
 
 	KASSERT(fs != NULL);
 
 	KASSERT(vfs_biglock_do_i_hold());
 
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -274,11 +366,13 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rwlock_release_read(knowndevs_lock);
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -339,6 +433,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	struct knowndev *kd;
 
 	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold(knowndevs_lock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -411,7 +506,10 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
+	rwlock_acquire_write(knowndevs_lock);
+
 	if (badnames(name, rawname, volname)) {
+		rwlock_release_write(knowndevs_lock);
 		vfs_biglock_release();
 		return EEXIST;
 	}
@@ -423,6 +521,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		dev->d_devnumber = index+1;
 	}
 
+	rwlock_release_write(knowndevs_lock);
 	vfs_biglock_release();
 	return result;
 
@@ -470,7 +569,7 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold knowndevs_lock (for writing).
  */
 static
 int
@@ -481,6 +580,7 @@ findmount(const char *devname, struct knowndev **result)
 	bool found = false;
 
 	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold(knowndevs_lock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; !found && i<num; i++) {
@@ -515,14 +615,17 @@ vfs_mount(const char *devname, void *data,
 	int result;
 
 	vfs_biglock_acquire();
+	rwlock_acquire_write(knowndevs_lock);
 
 	result = findmount(devname, &kd);
 	if (result) {
+		rwlock_release_write(knowndevs_lock);
 		vfs_biglock_release();
 		return result;
 	}
 
 	if (kd->kd_fs != NULL) {
+		rwlock_release_write(knowndevs_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
@@ -531,6 +634,7 @@ vfs_mount(const char *devname, void *data,
 
 	result = mountfunc(data, kd->kd_device, &fs);
 	if (result) {
+		rwlock_release_write(knowndevs_lock);
 		vfs_biglock_release();
 		return result;
 	}
@@ -543,6 +647,7 @@ vfs_mount(const char *devname, void *data,
 	kprintf("vfs: Mounted %s: on %s\n",
 		volname ? volname : kd->kd_name, kd->kd_name);
 
+	rwlock_release_write(knowndevs_lock);
 	vfs_biglock_release();
 	return 0;
 }
@@ -557,7 +662,9 @@ vfs_unmount(const char *devname)
 	struct knowndev *kd;
 	int result;
 
+	lock_acquire(vfs_synclock);
 	vfs_biglock_acquire();
+	rwlock_acquire_write(knowndevs_lock);
 
 	result = findmount(devname, &kd);
 	if (result) {
@@ -571,6 +678,9 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* Drop the name cache's references into this fs */
+	vfs_dcache_purgefs(kd->kd_fs);
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto fail;
@@ -589,7 +699,9 @@ vfs_unmount(const char *devname)
 	KASSERT(result==0);
 
  fail:
+	rwlock_release_write(knowndevs_lock);
 	vfs_biglock_release();
+	lock_release(vfs_synclock);
 	return result;
 }
 
@@ -603,7 +715,9 @@ vfs_unmountall(void)
 	unsigned i, num;
 	int result;
 
+	lock_acquire(vfs_synclock);
 	vfs_biglock_acquire();
+	rwlock_acquire_write(knowndevs_lock);
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -619,6 +733,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		vfs_dcache_purgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -650,7 +766,9 @@ vfs_unmountall(void)
 		dev->kd_fs = NULL;
 	}
 
+	rwlock_release_write(knowndevs_lock);
 	vfs_biglock_release();
+	lock_release(vfs_synclock);
 
 	return 0;
 }
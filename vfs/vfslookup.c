@@ -275,15 +275,16 @@ vfs_lookup(char *path, struct vnode **retval)
 		return result;
 	}
 
+	vfs_biglock_release();
+
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	/* The name cache does its own locking. */
+	result = vfs_dcache_lookup(startvn, path, retval);
 
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
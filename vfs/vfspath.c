@@ -74,6 +74,7 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		}
 
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		vfs_dcache_invalidate(dir, name);
 
 		VOP_DECREF(dir);
 	}
@@ -148,6 +149,7 @@ vfs_remove(char *path)
 	}
 
 	result = VOP_REMOVE(dir, name);
+	vfs_dcache_invalidate(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
@@ -181,6 +183,8 @@ vfs_rename(char *oldpath, char *newpath)
 	}
 
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	vfs_dcache_invalidate(olddir, oldname);
+	vfs_dcache_invalidate(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -215,6 +219,7 @@ vfs_link(char *oldpath, char *newpath)
 	}
 
 	result = VOP_LINK(newdir, newname, oldfile);
+	vfs_dcache_invalidate(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -242,6 +247,7 @@ vfs_symlink(const char *contents, char *path)
 	}
 
 	result = VOP_SYMLINK(newdir, newname, contents);
+	vfs_dcache_invalidate(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -288,6 +294,7 @@ vfs_mkdir(char *path, mode_t mode)
 	}
 
 	result = VOP_MKDIR(parent, name, mode);
+	vfs_dcache_invalidate(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -310,6 +317,7 @@ vfs_rmdir(char *path)
 	}
 
 	result = VOP_RMDIR(parent, name);
+	vfs_dcache_invalidate(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -55,7 +55,6 @@
 
 
 #if OPT_A3
-#define DUMBVM_STACKPAGES    12
 
 
 //static
@@ -188,11 +187,7 @@ as_destroy(struct addrspace *as)
 			if(coremap[pte->cm_index] == NULL) {
 				continue;
 			}
-            coremap[pte->cm_index]->cm_occupied = false;
-            coremap[pte->cm_index]->cm_proc = NULL;
-            coremap[pte->cm_index]->cm_length = 0;
-            coremap[pte->cm_index]->seg_type = 0;
-            as_zero_region(coremap[pte->cm_index]->cm_paddr, 1);
+            coremap_release(pte->cm_index, 1);
         }
 	}
     
@@ -208,11 +203,7 @@ as_destroy(struct addrspace *as)
 			if(coremap[pte->cm_index] == NULL) {
 				continue;
 			}
-            coremap[pte->cm_index]->cm_occupied = false;
-            coremap[pte->cm_index]->cm_proc = NULL;
-            coremap[pte->cm_index]->cm_length = 0;
-            coremap[pte->cm_index]->seg_type = 0;
-            as_zero_region(coremap[pte->cm_index]->cm_paddr, 1);
+            coremap_release(pte->cm_index, 1);
         }
 	}
     
@@ -228,11 +219,7 @@ as_destroy(struct addrspace *as)
 			if(coremap[pte->cm_index] == NULL) {
 				continue;
 			}
-            coremap[pte->cm_index]->cm_occupied = false;
-            coremap[pte->cm_index]->cm_proc = NULL;
-            coremap[pte->cm_index]->cm_length = 0;
-            coremap[pte->cm_index]->seg_type = 0;
-            as_zero_region(coremap[pte->cm_index]->cm_paddr, 1);
+            coremap_release(pte->cm_index, 1);
         }
 	}
     for(index = DUMBVM_STACKPAGES-1; index >= 0;index--){
@@ -20,14 +20,16 @@ paddr_t lo_paddr, hi_paddr;
 // keep track of max_pages to iterate through coremap
 uint32_t max_pages;
 
-struct lock * coremap_lk;
+// frame allocation and release take this for writing; pure lookups
+// share it for reading
+struct rwlock * coremap_lk;
 
 struct coremap_entry ** get_global_coremap(void) {
 	if(global_coremap) {
 		return global_coremap;
 	}
 	
-	coremap_lk = lock_create("coremap lock");
+	coremap_lk = rwlock_create("coremap lock");
 
 	// get max number of pages (overestimation)
 	max_pages = mainbus_ramsize() / PAGE_SIZE;
@@ -73,12 +75,59 @@ void printCoremap(void) {
 void set_coremap_proc(unsigned int index, int seg_type){
     struct coremap_entry** coremap = get_global_coremap();
     if(index >= max_pages) return;
+    rwlock_acquire_write(coremap_lk);
     // give a process a coremap entry
     coremap[index]->cm_proc = curproc;
     // set it to be occupied
     global_coremap[index]->cm_occupied = true;
     // set the segment type
     global_coremap[index]->seg_type = seg_type;
+    rwlock_release_write(coremap_lk);
+}
+
+// physical address of a frame, for the fault path; faults on
+// different cpus look frames up without blocking each other
+paddr_t coremap_paddr(unsigned int index) {
+	struct coremap_entry ** coremap = get_global_coremap();
+	paddr_t paddr;
+
+	KASSERT(index < max_pages);
+	rwlock_acquire_read(coremap_lk);
+	paddr = coremap[index]->cm_paddr;
+	rwlock_release_read(coremap_lk);
+	return paddr;
+}
+
+// give npages frames starting at index back, zeroed
+void coremap_release(unsigned int index, unsigned int npages) {
+	struct coremap_entry ** coremap = get_global_coremap();
+
+	rwlock_acquire_write(coremap_lk);
+	for(unsigned int i = index; i < index + npages && i < max_pages; i++) {
+		coremap[i]->cm_occupied = false;
+		coremap[i]->cm_proc = NULL;
+		coremap[i]->cm_length = 0;
+		coremap[i]->seg_type = 0;
+		as_zero_region(coremap[i]->cm_paddr, 1);
+	}
+	rwlock_release_write(coremap_lk);
+}
+
+// count the frames in use; readers don't block each other
+void coremap_getstats(unsigned *used, unsigned *total) {
+	struct coremap_entry ** coremap = get_global_coremap();
+	unsigned n = 0;
+
+	rwlock_acquire_read(coremap_lk);
+	for(unsigned int i = 0; i < max_pages; i++) {
+		if(coremap[i]->cm_occupied) {
+			n++;
+		}
+	}
+	rwlock_release_read(coremap_lk);
+
+	*used = n;
+	*total = max_pages;
 }
 
 bool coremap_exists(void) {
@@ -98,7 +147,7 @@ paddr_t coremap_getFrames(unsigned long n, bool swappable, int seg_type) {
 	struct coremap_entry ** coremap = get_global_coremap();
 	
 	// grab lock for synchronization
-	lock_acquire(coremap_lk);
+	rwlock_acquire_write(coremap_lk);
 
 	for(unsigned int i = 0; i < max_pages; i++) {
 		if(!coremap[i]->cm_occupied) {
@@ -123,7 +172,7 @@ paddr_t coremap_getFrames(unsigned long n, bool swappable, int seg_type) {
 					coremap[j]->cm_swappable = swappable;
                     coremap[j]->seg_type = seg_type;
 				}
-				lock_release(coremap_lk);
+				rwlock_release_write(coremap_lk);
                 return paddr;
 			}
 		}
@@ -148,7 +197,7 @@ paddr_t coremap_getFrames(unsigned long n, bool swappable, int seg_type) {
         coremap[pte->cm_index]->cm_swappable = swappable;
         
         paddr = coremap[pte->cm_index]->cm_paddr;
-        lock_release(coremap_lk);
+        rwlock_release_write(coremap_lk);
         // write it to the swapfile
         write_to_swap(pte);
     }
@@ -9,6 +9,7 @@
 #include <pt.h>
 #include <swapfile.h>
 #include <current.h>
+#include <thread.h>
 #include <addrspace.h>
 #include <coremap.h>
 #include <uio.h>
@@ -171,6 +172,7 @@ int page_fault(int faulttype, vaddr_t faultaddress) {
 		{
             vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
             vmstats_inc(VMSTAT_ELF_FILE_READ);
+            curthread->t_usage.u_majflt++;
             ret = On_Demand_Loading(curproc_getas()->elf_vnode, faultaddress);
             break;
 		}
@@ -179,6 +181,7 @@ int page_fault(int faulttype, vaddr_t faultaddress) {
 		{
             vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
             vmstats_inc(VMSTAT_SWAP_FILE_READ);
+            curthread->t_usage.u_majflt++;
             // ADD THIS FUNCTION
             // ret = write_to_swap(faultaddress);
             struct pt_entry* pte;
@@ -190,6 +193,7 @@ int page_fault(int faulttype, vaddr_t faultaddress) {
 		case COPY_TO_STACK:
 		{
 			vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+            curthread->t_usage.u_minflt++;
             //vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
             ret = stack_loading(faultaddress);
             vmstats_inc(VMSTAT_TLB_FAULT);
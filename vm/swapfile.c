@@ -75,6 +75,7 @@ int write_to_swap(struct pt_entry * pte) {
 	//lock_acquire(swapfile->rw_lock);
 	if (pte->flag & MODIFIED) {
 		vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+		curthread->t_usage.u_swapout++;
 		// if it was in swapfile, find the previous slot and replace that slot
 		if (pte->flag & IN_SWAP) { 
 			off_t offset = pte->swapfile_index * PAGE_SIZE; 
@@ -127,10 +128,8 @@ int write_to_swap(struct pt_entry * pte) {
 		}
 		
 		//flush the corresponding TLB entry and free the page in memory
-		struct coremap_entry ** coremap = get_global_coremap();
-		
 		vaddr_t vaddr = pte->page_number;
-		paddr_t paddr = coremap[pte->cm_index]->cm_paddr;
+		paddr_t paddr = coremap_paddr(pte->cm_index);
 		int i = tlb_probe(vaddr, paddr);
         if(i >= 0){
             tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
@@ -160,6 +159,7 @@ int read_from_swap(struct pt_entry * pte){
     paddr_t paddr;
     int seg_type;
 	lock_acquire(swapfile->rw_lock);
+    curthread->t_usage.u_swapin++;
     
     //get a victim frame to load the page in pte
     coremap = get_global_coremap();
@@ -167,7 +167,6 @@ int read_from_swap(struct pt_entry * pte){
     seg_type = segment_type(pte->page_number);//get the segment type
     paddr = getppages(1, true,seg_type);
     frame_index = (paddr - coremap[0]->cm_paddr)/PAGE_SIZE;
-    coremap[frame_index]->cm_occupied = true;
     set_coremap_proc(frame_index,seg_type);
     pte->cm_index = frame_index;
     //******** UPDATE TLB ************
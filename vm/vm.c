@@ -25,10 +25,9 @@
 
 
 #if OPT_A3
-#define DUMBVM_STACKPAGES    12
 #define BASE_KADDR			0x80000000
 
-struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+struct spinlock stealmem_lock = SPINLOCK_NAMED_INITIALIZER("stealmem");
 
 unsigned int next_victim = 0;
 static int tlb_get_rr_victim(void);
@@ -108,13 +107,7 @@ free_kpages(vaddr_t addr)
 	unsigned int length = coremap[index]->cm_length;
 	
 	// free the coremap frames
-	for(unsigned int i = index; i < index + length; i++) {
-		coremap[i]->cm_occupied = false;
-		coremap[i]->cm_proc = NULL;
-		coremap[i]->cm_length = 0;
-        coremap[i]->seg_type = 0;
-        as_zero_region(coremap[i]->cm_paddr, 1);
-	}
+	coremap_release(index, length);
 	
 	
 #else
@@ -145,8 +138,6 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	paddr_t paddr;
 	struct addrspace *as;
     int result;
-    struct coremap_entry ** coremap;
-    coremap  = get_global_coremap();
     struct pt_entry* pte;
     int p_fault;
 	faultaddress &= PAGE_FRAME;
@@ -170,7 +161,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
                 if(result){
                     return result;
                 }
-                paddr = coremap[pte->cm_index]->cm_paddr;
+                paddr = coremap_paddr(pte->cm_index);
             }
             else if(p_fault==-1){
                 //no such a segment in address space
@@ -178,7 +169,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
             }
             else{
 	            vmstats_inc(VMSTAT_TLB_RELOAD);
-                paddr = coremap[pte->cm_index]->cm_paddr; // get the frame from pt
+	            curthread->t_usage.u_minflt++;
+                paddr = coremap_paddr(pte->cm_index); // get the frame from pt
             }
             vmstats_inc(VMSTAT_TLB_FAULT);
             vmstats_inc(VMSTAT_TLB_FAULT_FREE);
@@ -245,7 +237,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
         if(result){
             return result;
         }
-        paddr = coremap[pte->cm_index]->cm_paddr;
+        paddr = coremap_paddr(pte->cm_index);
     }
     else if(p_fault == 2){
         //stack page fault should to call load stack
@@ -258,7 +250,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
         if(result){
             return result;
         }
-        paddr = coremap[pte->cm_index]->cm_paddr;
+        paddr = coremap_paddr(pte->cm_index);
     }
     else if(p_fault==-1){
         //no such a segment in address space
@@ -269,7 +261,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
             kprintf("cm_index: %u\n",pte->cm_index);
         }
         vmstats_inc(VMSTAT_TLB_RELOAD);
-        paddr = coremap[pte->cm_index]->cm_paddr; // get the frame from pt
+        curthread->t_usage.u_minflt++;
+        paddr = coremap_paddr(pte->cm_index); // get the frame from pt
     }
     
     